@@ -12,12 +12,39 @@
 #include <gst/rtp/gstrtpbuffer.h>
 #include <gst/rtp/gstrtcpbuffer.h>
 #include <time.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 //#define DEFAULT_STAT_TIME_NS 1000000000 /* get stats every second */
 #define DEFAULT_STAT_TIME_NS 500000000 /* get stats every half second */
 #define DEFAULT_RTP_MTU 1200
 #define DEFAULT_HOST "127.0.0.1"
 #define DEFAULT_PORT 5000
+#define DEFAULT_ENCODER_BITRATE 5000 /* kbit/s */
+
+/* encoder bitrate adaptation in transcode mode */
+#define RATE_ADAPT_HEADROOM 0.9 /* share of the capacity given to the encoder. Rest is rtp/quic overhead */
+#define RATE_ADAPT_SMOOTHING 0.3 /* weight of a new sample when the capacity increases */
+#define RATE_ADAPT_HYSTERESIS 0.1 /* ignore changes smaller than 10% */
+#define RATE_ADAPT_INCREASE_INTERVAL_US 1000000 /* min time between two increases */
+#define RATE_ADAPT_KEYUNIT_DROP 0.5 /* request a keyframe if the bitrate drops below half */
+#define RATE_ADAPT_MIN_BITRATE 100 /* kbit/s */
+#define RATE_ADAPT_PROBE_GAIN 1.25 /* capacity assumed above the encoder rate while nothing is lost */
+
+/* benchmark mode */
+#define DEFAULT_BENCH_DURATION 10 /* s */
+#define DEFAULT_BENCH_FPS 30
+#define DEFAULT_BENCH_UDPFW "./udpfw"
+#define BENCH_RTP_HEADER_SIZE 12
+#define BENCH_HEADER_SIZE 16 /* frame number, packet index, packets in frame, generation time (us) */
+#define BENCH_PAYLOAD_TYPE 96
+#define BENCH_SSRC 0x62656e63
+#define BENCH_CLOCK_RATE 90000
+#define BENCH_DRAIN_MS 2000 /* wait for the frames still in flight after the last one was sent */
+#define BENCH_UDPFW_PORT_OFFSET 10 /* udpfw listens on port + offset */
+#define BENCH_UDPFW_STARTUP_US 200000
+#define BENCH_APPSRC_MAX_BYTES (16 * 1024 * 1024)
 
 int rtp_packet_num = 0;
 gssize rtp_bytes = 0;
@@ -58,6 +85,7 @@ typedef struct {
     GstElement *session;
     GstElement *jitterbuf;
     GstElement *scream;
+    GstElement *encoder;
     GstElement *rtcpSink;
     GstElement *sink;
     GstElement *internal_sink;
@@ -83,6 +111,15 @@ typedef struct {
     uint32_t num_jit_spikes;
 } Stats;
 
+typedef struct {
+    guint current_kbps;
+    gdouble smoothed_kbps;
+    gint64 last_increase;
+    guint num_changes;
+    guint num_keyunits;
+    guint64 packets_lost;
+} RateAdaptation;
+
 typedef struct _AppData
 {
     gchar *file_path;
@@ -105,10 +142,19 @@ typedef struct _AppData
     gboolean camera;
     gboolean verbose;
     gboolean quicNoCC;
+    gboolean mediaCC;
     gint quic_drop_late;
     gboolean async_sink;
+    gboolean bench;
+    gint bench_duration;
+    gint bench_rate;
+    gint bench_fps;
+    gchar *bench_trace;
+    gchar *bench_udpfw;
+    gchar *bench_udpfw_args;
     Gst_elements elements;
     Stats stats;
+    RateAdaptation rate_adapt;
     GstClockTime refTime;
     gint64 stat_interval;
 } AppData;
@@ -386,6 +432,7 @@ void init_elements(AppData *data)
     data->elements.net = NULL;
     data->elements.session = NULL;
     data->elements.sink = NULL;
+    data->elements.encoder = NULL;
     /*
     GstElement *jitterbuf;
     GstElement *scream;
@@ -700,11 +747,116 @@ cb_on_feedback_report(GstElement *ele,
                       guint64 packets_sent, guint64 packets_lost, guint64 packets_acked,
                       guint64 bytes_sent, guint64 bytes_lost, guint64 bytes_acked,
                       guint64 latest_ack_send_time, guint64 latest_ack_recv_time,
-                      guint64 bytes_in_flight, guint32 cwnd, gpointer user_data)
+                      guint64 bytes_in_flight, guint32 cwnd, gint64 timestamp, gpointer user_data)
 {
     g_print("Diff: %lu\n", latest_ack_recv_time - latest_ack_send_time);
 }
 
+/*
+ * Set the encoder bitrate according to the capacity reported by the transport.
+ * Drops are followed immediately, increases are smoothed and applied at most
+ * once per RATE_ADAPT_INCREASE_INTERVAL_US. Small changes are ignored.
+ */
+static void adapt_encoder_bitrate(AppData *data, guint64 capacity_bps)
+{
+    RateAdaptation *ra = &data->rate_adapt;
+    gdouble target = capacity_bps * RATE_ADAPT_HEADROOM / 1000;
+    gint64 now = g_get_monotonic_time();
+    gboolean first = ra->smoothed_kbps == 0;
+    guint kbps;
+
+    if (target < RATE_ADAPT_MIN_BITRATE)
+        target = RATE_ADAPT_MIN_BITRATE;
+    if (first || target < ra->smoothed_kbps)
+        ra->smoothed_kbps = target;
+    else
+        ra->smoothed_kbps = RATE_ADAPT_SMOOTHING * target + (1 - RATE_ADAPT_SMOOTHING) * ra->smoothed_kbps;
+    kbps = (guint) ra->smoothed_kbps;
+
+    if (!first) {
+        if (kbps < ra->current_kbps) {
+            if (ra->current_kbps - kbps < ra->current_kbps * RATE_ADAPT_HYSTERESIS)
+                return;
+        } else {
+            if (kbps - ra->current_kbps < ra->current_kbps * RATE_ADAPT_HYSTERESIS ||
+                now - ra->last_increase < RATE_ADAPT_INCREASE_INTERVAL_US)
+                return;
+            ra->last_increase = now;
+        }
+    }
+
+    g_object_set(data->elements.encoder, "bitrate", kbps, NULL);
+    ra->num_changes++;
+
+    /* The rate control of the encoder needs some time to follow a large drop.
+     * Start a new gop, so the frames queued at the old rate can be dropped */
+    if (!first && kbps < ra->current_kbps * RATE_ADAPT_KEYUNIT_DROP) {
+        GstPad *pad = gst_element_get_static_pad(data->elements.encoder, "src");
+        GstEvent *event = gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM,
+                            gst_structure_new("GstForceKeyUnit", "all-headers", G_TYPE_BOOLEAN, TRUE, NULL));
+        if (!gst_pad_send_event(pad, event))
+            g_printerr("Failed to request a keyframe from the encoder\n");
+        gst_object_unref(pad);
+        ra->num_keyunits++;
+    }
+
+    if (data->verbose)
+        g_print("Encoder bitrate: %u -> %u kbit/s\n", ra->current_kbps, kbps);
+    ra->current_kbps = kbps;
+}
+
+/* Target bitrate of the media congestion controller in quicly */
+static void
+cb_on_target_bitrate(GstElement *ele, guint64 bitrate, gpointer user_data)
+{
+    adapt_encoder_bitrate((AppData *) user_data, bitrate);
+}
+
+/*
+ * Estimate the capacity from the window based congestion controllers.
+ * The delivery rate does not exceed what the encoder sends, and cwnd does
+ * not grow while the connection is application-limited. So as long as no
+ * packets are lost, the capacity is probed above the encoder bitrate
+ */
+static void 
+cb_adapt_on_feedback_report(GstElement *ele, 
+                      guint64 packets_sent, guint64 packets_lost, guint64 packets_acked,
+                      guint64 bytes_sent, guint64 bytes_lost, guint64 bytes_acked,
+                      guint64 latest_ack_send_time, guint64 latest_ack_recv_time,
+                      guint64 bytes_in_flight, guint32 cwnd, gint64 timestamp, gpointer user_data)
+{
+    AppData *data = (AppData *) user_data;
+    RateAdaptation *ra = &data->rate_adapt;
+    GstStructure *stats;
+    guint64 pacing_rate = 0, delivery_rate = 0, capacity;
+    guint srtt = 0;
+    gboolean lost = packets_lost > ra->packets_lost;
+
+    ra->packets_lost = packets_lost;
+    g_object_get(ele, "stats", &stats, NULL);
+    gst_structure_get_uint64(stats, "pacing-rate", &pacing_rate);
+    gst_structure_get_uint64(stats, "delivery-rate", &delivery_rate);
+    gst_structure_get_uint(stats, "rtt-smoothed", &srtt);
+    gst_structure_free(stats);
+
+    if (pacing_rate != 0) {
+        adapt_encoder_bitrate(data, pacing_rate * 8);
+        return;
+    }
+    if (delivery_rate != 0)
+        capacity = delivery_rate * 8;
+    else if (srtt != 0)
+        capacity = (guint64) cwnd * 8 * 1000 / srtt;
+    else
+        return;
+
+    /* the encoder is the bottleneck, not the network */
+    if (!lost && ra->current_kbps != 0 &&
+        capacity * RATE_ADAPT_HEADROOM >= ra->current_kbps * 1000 * (1 - RATE_ADAPT_HYSTERESIS))
+        capacity = MAX(capacity, ra->current_kbps * 1000 * RATE_ADAPT_PROBE_GAIN / RATE_ADAPT_HEADROOM);
+    adapt_encoder_bitrate(data, capacity);
+}
+
 static void on_pad_added(GstElement *ele, GstPad *pad, gpointer data)
 {
     GstPad *sinkpad;
@@ -890,19 +1042,19 @@ static void cb_on_send_rtcp(GObject *sess, GstBuffer *buffer, gboolean early, gp
   g_print("Sending RTCP\n");
 }
 
-static void add_server_stream(GstPipeline *pipe, GstElement *rtpBin, SessionData *session, AppData *sdata)
+/* The sink sending the rtp stream, to port with udp, bound to it with quic */
+static GstElement *make_server_net_sink(AppData *sdata, gint port)
 {
     GstElement *rtpSink;
-    gchar *padName;
 
     if (sdata->udp) {
         g_print("UDP transport for rtp stream\n");
         rtpSink = gst_element_factory_make("udpsink", "rtpsink");
-        g_object_set (rtpSink, "port", sdata->port, "host", sdata->host, "sync", !sdata->async_sink, NULL);
+        g_object_set (rtpSink, "port", port, "host", sdata->host, "sync", !sdata->async_sink, NULL);
     } else {
         g_print("QUIC transport for rtp stream\n");
         rtpSink = gst_element_factory_make("quiclysink", "rtpsink");
-        g_object_set(rtpSink, "bind-port", sdata->port, 
+        g_object_set(rtpSink, "bind-port", port, 
                           "cert", sdata->cert_file,
                           "key", sdata->key_file, 
                           "sync", !sdata->async_sink, NULL);
@@ -915,6 +1067,9 @@ static void add_server_stream(GstPipeline *pipe, GstElement *rtpBin, SessionData
         if (sdata->scream) 
             g_object_set(rtpSink, "app-cc", TRUE, "feedback", TRUE, NULL);
 
+        if (sdata->mediaCC)
+            g_object_set(rtpSink, "cc-algorithm", "media", NULL);
+
         if (sdata->stream_mode)
             g_object_set(rtpSink, "stream-mode", TRUE, NULL);
 
@@ -924,8 +1079,25 @@ static void add_server_stream(GstPipeline *pipe, GstElement *rtpBin, SessionData
 
         if (sdata->quic_drop_late != -1)
             g_object_set(rtpSink, "drop-late", TRUE, NULL);
+
+        /* closed loop encoder rate control */
+        if (sdata->elements.encoder != NULL && !sdata->quicNoCC) {
+            if (sdata->mediaCC) {
+                g_signal_connect(rtpSink, "on-target-bitrate", G_CALLBACK(cb_on_target_bitrate), sdata);
+            } else {
+                g_object_set(rtpSink, "feedback", TRUE, NULL);
+                g_signal_connect(rtpSink, "on-feedback-report", G_CALLBACK(cb_adapt_on_feedback_report), sdata);
+            }
+        }
     }
     sdata->elements.net = rtpSink;
+    return rtpSink;
+}
+
+static void add_server_stream(GstPipeline *pipe, GstElement *rtpBin, SessionData *session, AppData *sdata)
+{
+    GstElement *rtpSink = make_server_net_sink(sdata, sdata->port);
+    gchar *padName;
 
     if (sdata->rtcp) {
         GstElement *rtcpSink = gst_element_factory_make ("udpsink", NULL);
@@ -1011,7 +1183,6 @@ static SessionData *make_server_video_session(guint sessionNum, AppData *sdata)
         GstElement *decoder = gst_element_factory_make("avdec_h264", "decode");
         //GstElement *queue = gst_element_factory_make("queue", "decode_queue");
         GstElement *encoder = gst_element_factory_make("x264enc", "video");
-        /* TODO: add bitrate option */
         g_object_set(encoder,"tune", 4, NULL);
 
         if (sdata->scream) {
@@ -1028,8 +1199,10 @@ static SessionData *make_server_video_session(guint sessionNum, AppData *sdata)
             gst_element_link_many(decoder, identity, queue2_1, encoder, queue2_2, rtph264pay, scream, NULL);
             lastEle = scream;
         } else {
-            /* Transcode only */
-            g_object_set(encoder, "bitrate", 5000, NULL);
+            /* Transcode only. Bitrate follows the transport if quic is used */
+            g_object_set(encoder, "bitrate", DEFAULT_ENCODER_BITRATE, NULL);
+            sdata->rate_adapt.current_kbps = DEFAULT_ENCODER_BITRATE;
+            sdata->elements.encoder = encoder;
             gst_bin_add_many (videoBin, filesrc, demux, decoder, identity,
                               queue2_1, queue2_2, encoder, rtph264pay, NULL);
             gst_element_link_many(decoder, identity, queue2_1, encoder, queue2_2, rtph264pay, NULL);
@@ -1116,6 +1289,10 @@ void print_server_stats(AppData *sdata)
         gst_object_unref(qu);
     }
 
+    if (sdata->elements.encoder != NULL)
+        g_print("##### Encoder rate adaptation: bitrate %u kbit/s, %u changes, %u keyframe requests\n",
+                sdata->rate_adapt.current_kbps, sdata->rate_adapt.num_changes, sdata->rate_adapt.num_keyunits);
+
     if (sdata->debug)
         g_print("Num buffers at sink: %i. Num bytes: %u\n", num_buffers, num_bytes);
 }
@@ -1209,19 +1386,16 @@ int run_server(AppData *sdata)
     return 0;
 }
 
-static void
-add_client_stream(GstElement *pipe, GstElement *rtpBin, SessionData *session, AppData *adata)
+/* The source receiving the rtp stream, on port with udp, from it with quic */
+static GstElement *make_client_net_src(AppData *adata, GstCaps *caps, gint port)
 {
     GstElement *rtpSrc;
-    gchar *padName;
-
-    session->rtpbin = g_object_ref(rtpBin);
 
     if (adata->udp) {
         rtpSrc = gst_element_factory_make("udpsrc", "rtpsrc");
         // timeout: 1550000000
-        g_object_set(rtpSrc, "port", adata->port, "caps", 
-                        session->caps, "timeout", 1550000000, NULL);
+        g_object_set(rtpSrc, "port", port, "caps", 
+                        caps, "timeout", 1550000000, NULL);
 
         /* Use a probe pad to recognize when we first receive a packet.
          * After the first packet is received, the timeout activates
@@ -1231,11 +1405,23 @@ add_client_stream(GstElement *pipe, GstElement *rtpBin, SessionData *session, Ap
         gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, 
                          (GstPadProbeCallback) cb_udp_first_packet,
                          NULL, NULL);
+        gst_object_unref(pad);
     } else {
         rtpSrc = gst_element_factory_make("quiclysrc", "rtpsrc");
-        g_object_set(G_OBJECT(rtpSrc), "host", adata->host, "port", adata->port, NULL);
+        g_object_set(G_OBJECT(rtpSrc), "host", adata->host, "port", port, NULL);
     }
     adata->elements.net = rtpSrc;
+    return rtpSrc;
+}
+
+static void
+add_client_stream(GstElement *pipe, GstElement *rtpBin, SessionData *session, AppData *adata)
+{
+    GstElement *rtpSrc;
+    gchar *padName;
+
+    session->rtpbin = g_object_ref(rtpBin);
+    rtpSrc = make_client_net_src(adata, session->caps, adata->port);
 
     if (adata->rtcp) {
         GstElement *rtcpSrc = gst_element_factory_make("udpsrc", NULL);
@@ -1510,6 +1696,416 @@ int run_client(AppData *cdata)
     return 0;
 }
 
+/*
+ * Benchmark mode: server and client run in this process, connected over
+ * loopback through udpfw. Synthetic RTP is generated at a constant rate
+ * or following a trace of frame sizes. Every packet carries the number
+ * of its frame, the number of packets of the frame and the time the
+ * frame was generated, so that the client measures the latency of each
+ * frame once its last packet arrived.
+ */
+typedef struct {
+    AppData *app;
+    GstElement *appsrc;
+    GMainLoop *loop;
+    GArray *trace; /* frame sizes in bytes, NULL: constant bitrate */
+    gint stop;
+
+    /* generator thread */
+    guint64 frames_sent;
+    guint64 packets_sent;
+    guint64 bytes_sent;
+    gint64 send_duration; /* us */
+
+    /* streaming thread of the client */
+    GHashTable *frames; /* frame number -> packets received so far */
+    GArray *latencies; /* us, one per complete frame */
+    guint64 packets_received;
+    guint64 bytes_received;
+} BenchData;
+
+/* One frame size in bytes per line, # starts a comment */
+static GArray *bench_load_trace(const gchar *path)
+{
+    gchar *contents, **lines;
+    GError *err = NULL;
+    GArray *trace;
+
+    if (!g_file_get_contents(path, &contents, NULL, &err)) {
+        g_printerr("Could not read trace file: %s\n", err->message);
+        g_clear_error(&err);
+        return NULL;
+    }
+    trace = g_array_new(FALSE, FALSE, sizeof(guint));
+    lines = g_strsplit(contents, "\n", -1);
+    for (gint i = 0; lines[i] != NULL; i++) {
+        gchar *line = g_strstrip(lines[i]);
+        guint size;
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        size = (guint) g_ascii_strtoull(line, NULL, 10);
+        g_array_append_val(trace, size);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+
+    if (trace->len == 0) {
+        g_printerr("Trace file %s has no frames\n", path);
+        g_array_unref(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+static guint bench_frame_size(BenchData *bench, guint64 frame)
+{
+    AppData *data = bench->app;
+
+    if (bench->trace != NULL)
+        return g_array_index(bench->trace, guint, frame % bench->trace->len);
+    return (guint) ((guint64) data->bench_rate * 1000 / 8 / data->bench_fps);
+}
+
+static gboolean cb_bench_quit(gpointer user_data)
+{
+    g_main_loop_quit((GMainLoop *) user_data);
+    return G_SOURCE_REMOVE;
+}
+
+/* Push the frames into the server pipeline at their time, then end the stream */
+static gpointer bench_generate(gpointer user_data)
+{
+    BenchData *bench = (BenchData *) user_data;
+    AppData *data = bench->app;
+    guint mtu = data->rtp_mtu == 0 ? DEFAULT_RTP_MTU : data->rtp_mtu;
+    guint chunk = mtu - BENCH_RTP_HEADER_SIZE - BENCH_HEADER_SIZE;
+    gint64 start = g_get_monotonic_time(), end = start + (gint64) data->bench_duration * G_USEC_PER_SEC;
+    GstFlowReturn ret;
+    guint16 seq = 0;
+
+    for (guint64 frame = 0; !g_atomic_int_get(&bench->stop); frame++) {
+        gint64 at = start + (gint64) (frame * G_USEC_PER_SEC / data->bench_fps), now;
+        guint size = bench_frame_size(bench, frame);
+        guint count = size == 0 ? 1 : (size + chunk - 1) / chunk;
+        guint32 rtp_ts = (guint32) (frame * BENCH_CLOCK_RATE / data->bench_fps);
+        guint64 send_time;
+
+        if (at >= end)
+            break;
+        if ((now = g_get_monotonic_time()) < at)
+            g_usleep(at - now);
+        if (count > G_MAXUINT16) {
+            count = G_MAXUINT16;
+            size = count * chunk;
+        }
+
+        send_time = g_get_real_time();
+        for (guint i = 0; i < count; i++) {
+            guint len = MIN(chunk, size - MIN(size, i * chunk));
+            GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+            GstBuffer *buffer = gst_rtp_buffer_new_allocate(BENCH_HEADER_SIZE + len, 0, 0);
+            guint8 *payload;
+
+            gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp);
+            gst_rtp_buffer_set_payload_type(&rtp, BENCH_PAYLOAD_TYPE);
+            gst_rtp_buffer_set_seq(&rtp, seq++);
+            gst_rtp_buffer_set_timestamp(&rtp, rtp_ts);
+            gst_rtp_buffer_set_ssrc(&rtp, BENCH_SSRC);
+            gst_rtp_buffer_set_marker(&rtp, i == count - 1);
+            payload = gst_rtp_buffer_get_payload(&rtp);
+            GST_WRITE_UINT32_BE(payload, (guint32) frame);
+            GST_WRITE_UINT16_BE(payload + 4, i);
+            GST_WRITE_UINT16_BE(payload + 6, count);
+            GST_WRITE_UINT64_BE(payload + 8, send_time);
+            memset(payload + BENCH_HEADER_SIZE, 0, len);
+            gst_rtp_buffer_unmap(&rtp);
+
+            g_signal_emit_by_name(bench->appsrc, "push-buffer", buffer, &ret);
+            gst_buffer_unref(buffer);
+            bench->packets_sent++;
+            bench->bytes_sent += BENCH_HEADER_SIZE + len;
+        }
+        bench->frames_sent++;
+    }
+    bench->send_duration = g_get_monotonic_time() - start;
+
+    g_signal_emit_by_name(bench->appsrc, "end-of-stream", &ret);
+    /* the last frames are still on their way */
+    g_timeout_add_full(G_PRIORITY_DEFAULT, BENCH_DRAIN_MS, cb_bench_quit, g_main_loop_ref(bench->loop),
+                       (GDestroyNotify) g_main_loop_unref);
+    return NULL;
+}
+
+static void bench_receive(BenchData *bench, GstBuffer *buffer)
+{
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    guint8 *payload;
+    guint32 frame;
+    guint count, received;
+
+    if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+        return;
+    if (gst_rtp_buffer_get_payload_len(&rtp) < BENCH_HEADER_SIZE) {
+        gst_rtp_buffer_unmap(&rtp);
+        return;
+    }
+    payload = gst_rtp_buffer_get_payload(&rtp);
+    frame = GST_READ_UINT32_BE(payload);
+    count = GST_READ_UINT16_BE(payload + 6);
+    bench->packets_received++;
+    bench->bytes_received += gst_rtp_buffer_get_payload_len(&rtp);
+
+    received = GPOINTER_TO_UINT(g_hash_table_lookup(bench->frames, GUINT_TO_POINTER(frame))) + 1;
+    if (received >= count) {
+        gint64 latency = g_get_real_time() - (gint64) GST_READ_UINT64_BE(payload + 8);
+        g_hash_table_remove(bench->frames, GUINT_TO_POINTER(frame));
+        g_array_append_val(bench->latencies, latency);
+    } else {
+        g_hash_table_insert(bench->frames, GUINT_TO_POINTER(frame), GUINT_TO_POINTER(received));
+    }
+    gst_rtp_buffer_unmap(&rtp);
+}
+
+static GstPadProbeReturn cb_bench_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    BenchData *bench = (BenchData *) user_data;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        for (guint i = 0; i < gst_buffer_list_length(list); i++)
+            bench_receive(bench, gst_buffer_list_get(list, i));
+    } else {
+        bench_receive(bench, GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/* udpfw listening on listen_port, forwarding to dst_port */
+static GPid bench_start_udpfw(AppData *data, gint listen_port, gint dst_port)
+{
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    gchar **fw_args = NULL;
+    GError *err = NULL;
+    GPid pid = 0;
+
+    g_ptr_array_add(argv, g_strdup(data->bench_udpfw));
+    if (data->bench_udpfw_args != NULL && data->bench_udpfw_args[0] != '\0') {
+        if (!g_shell_parse_argv(data->bench_udpfw_args, NULL, &fw_args, &err)) {
+            g_printerr("Invalid udpfw arguments: %s\n", err->message);
+            g_clear_error(&err);
+            g_ptr_array_unref(argv);
+            return 0;
+        }
+        for (gint i = 0; fw_args[i] != NULL; i++)
+            g_ptr_array_add(argv, g_strdup(fw_args[i]));
+        g_strfreev(fw_args);
+    }
+    g_ptr_array_add(argv, g_strdup("-l"));
+    g_ptr_array_add(argv, g_strdup_printf("%i", listen_port));
+    g_ptr_array_add(argv, g_strdup(data->host));
+    g_ptr_array_add(argv, g_strdup_printf("%i", dst_port));
+    g_ptr_array_add(argv, NULL);
+
+    /* udpfw logs every packet on stderr */
+    if (!g_spawn_async(NULL, (gchar **) argv->pdata, NULL,
+                       G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &pid, &err)) {
+        g_printerr("Could not start %s: %s\n", data->bench_udpfw, err->message);
+        g_clear_error(&err);
+        pid = 0;
+    }
+    g_ptr_array_unref(argv);
+    if (pid != 0)
+        g_usleep(BENCH_UDPFW_STARTUP_US);
+    return pid;
+}
+
+static void bench_stop_udpfw(GPid pid)
+{
+    if (pid == 0)
+        return;
+    kill(pid, SIGINT);
+    waitpid(pid, NULL, 0);
+    g_spawn_close_pid(pid);
+}
+
+static gint cmp_latency(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+    return x < y ? -1 : x > y;
+}
+
+static gdouble bench_percentile(GArray *latencies, guint p)
+{
+    if (latencies->len == 0)
+        return 0;
+    return g_array_index(latencies, gint64, MIN(latencies->len - 1, latencies->len * p / 100)) / 1000.0;
+}
+
+static gint64 cpu_time_us(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/* The result as a single line of JSON on stdout */
+static void bench_print_result(BenchData *bench, gint64 cpu_us)
+{
+    AppData *data = bench->app;
+    gdouble duration = bench->send_duration / 1e6;
+    gdouble mbit = bench->bytes_received * 8 / 1e6;
+    guint64 frames_received = bench->latencies->len;
+
+    g_array_sort(bench->latencies, cmp_latency);
+    fprintf(stdout, "{\"transport\":\"%s\",\"cc\":\"%s\",\"source\":\"%s\",\"duration_s\":%.3f,"
+                    "\"rate_kbps\":%i,\"fps\":%i,\"impairment\":\"%s\","
+                    "\"frames_sent\":%" G_GUINT64_FORMAT ",\"frames_received\":%" G_GUINT64_FORMAT ",\"frame_drop_rate\":%.4f,"
+                    "\"packets_sent\":%" G_GUINT64_FORMAT ",\"packets_received\":%" G_GUINT64_FORMAT ",\"packet_drop_rate\":%.4f,"
+                    "\"goodput_kbps\":%.1f,"
+                    "\"latency_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f},"
+                    "\"cpu_ms_per_mbit\":%.3f}\n",
+            data->udp ? "udp" : (data->stream_mode ? "quic-stream" : "quic-dgram"),
+            data->udp ? "none" : (data->quicNoCC ? "none" : (data->mediaCC ? "quic-media" : "quic")),
+            data->bench_trace != NULL ? "trace" : "cbr",
+            duration, data->bench_rate, data->bench_fps,
+            data->bench_udpfw[0] == '\0' ? "none" : (data->bench_udpfw_args != NULL ? data->bench_udpfw_args : ""),
+            bench->frames_sent, frames_received,
+            bench->frames_sent == 0 ? 0.0 : 1.0 - (gdouble) frames_received / bench->frames_sent,
+            bench->packets_sent, bench->packets_received,
+            bench->packets_sent == 0 ? 0.0 : 1.0 - (gdouble) bench->packets_received / bench->packets_sent,
+            duration == 0 ? 0.0 : mbit * 1000 / duration,
+            bench_percentile(bench->latencies, 50), bench_percentile(bench->latencies, 90),
+            bench_percentile(bench->latencies, 95), bench_percentile(bench->latencies, 99),
+            bench_percentile(bench->latencies, 100),
+            mbit == 0 ? 0.0 : cpu_us / 1000.0 / mbit);
+    fflush(stdout);
+}
+
+int run_bench(AppData *data)
+{
+    g_print("Starting benchmark.\n");
+
+    if ((data->cert_file == NULL || data->key_file == NULL) && !data->udp) {
+        g_printerr("Missing key/cert files\n");
+        return -1;
+    }
+    if (data->scream || data->rtcp || data->aux) {
+        g_printerr("bench can not be combined with scream, rtcp or aux\n");
+        return -1;
+    }
+    if (data->bench_duration <= 0 || data->bench_fps <= 0 || data->bench_rate <= 0) {
+        g_printerr("bench-duration, bench-fps and bench-rate have to be positive\n");
+        return -1;
+    }
+    if ((data->rtp_mtu == 0 ? DEFAULT_RTP_MTU : data->rtp_mtu) <= BENCH_RTP_HEADER_SIZE + BENCH_HEADER_SIZE) {
+        g_printerr("rtp-mtu too small for the benchmark\n");
+        return -1;
+    }
+
+    BenchData bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.app = data;
+    if (data->bench_trace != NULL && (bench.trace = bench_load_trace(data->bench_trace)) == NULL)
+        return -1;
+    bench.frames = g_hash_table_new(NULL, NULL);
+    bench.latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+    bench.loop = g_main_loop_new(NULL, FALSE);
+
+    /* The forwarder sits in front of the receiving end: the client with
+     * udp, the server with quic */
+    gint server_port = data->port, client_port = data->port;
+    GPid udpfw = 0;
+    if (data->bench_udpfw[0] != '\0') {
+        gint fw_port = data->port + BENCH_UDPFW_PORT_OFFSET;
+        if (data->udp) {
+            server_port = fw_port;
+        } else {
+            client_port = fw_port;
+        }
+        if ((udpfw = bench_start_udpfw(data, fw_port, data->port)) == 0)
+            return -1;
+    }
+
+    GstCaps *caps = gst_caps_new_simple("application/x-rtp",
+      "media", G_TYPE_STRING, "video",
+      "clock-rate", G_TYPE_INT, BENCH_CLOCK_RATE,
+      "encoding-name", G_TYPE_STRING, "X-GST", NULL);
+
+    /* server: appsrc ! net sink, paced by the generator */
+    GstPipeline *serverPipe = GST_PIPELINE(gst_pipeline_new("benchServer"));
+    bench.appsrc = gst_element_factory_make("appsrc", "benchsrc");
+    g_object_set(bench.appsrc, "caps", caps, "is-live", TRUE, "format", GST_FORMAT_TIME,
+                 "do-timestamp", TRUE, "max-bytes", (guint64) BENCH_APPSRC_MAX_BYTES, NULL);
+    data->async_sink = TRUE;
+    GstElement *netSink = make_server_net_sink(data, server_port);
+    gst_bin_add_many(GST_BIN(serverPipe), bench.appsrc, netSink, NULL);
+    gst_element_link(bench.appsrc, netSink);
+
+    /* client: net src ! fakesink */
+    GstPipeline *clientPipe = GST_PIPELINE(gst_pipeline_new("benchClient"));
+    GstElement *netSrc = make_client_net_src(data, caps, client_port);
+    GstElement *fakeSink = gst_element_factory_make("fakesink", "benchsink");
+    g_object_set(fakeSink, "sync", FALSE, "async", FALSE, NULL);
+    gst_bin_add_many(GST_BIN(clientPipe), netSrc, fakeSink, NULL);
+    gst_element_link(netSrc, fakeSink);
+    GstPad *pad = gst_element_get_static_pad(fakeSink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+                      (GstPadProbeCallback) cb_bench_probe, &bench, NULL);
+    gst_object_unref(pad);
+    gst_caps_unref(caps);
+
+    GstBus *bus = gst_element_get_bus(GST_ELEMENT(serverPipe));
+    g_signal_connect(bus, "message::error", G_CALLBACK(cb_error), bench.loop);
+    gst_bus_add_signal_watch(bus);
+    gst_object_unref(bus);
+    bus = gst_element_get_bus(GST_ELEMENT(clientPipe));
+    g_signal_connect(bus, "message::eos", G_CALLBACK(cb_eos), bench.loop);
+    g_signal_connect(bus, "message::error", G_CALLBACK(cb_error), bench.loop);
+    gst_bus_add_signal_watch(bus);
+    gst_object_unref(bus);
+
+    /* the server accepts the client while running */
+    gst_element_set_state(GST_ELEMENT(serverPipe), GST_STATE_PLAYING);
+    gst_element_set_state(GST_ELEMENT(clientPipe), GST_STATE_PLAYING);
+
+    gint64 cpu_start = cpu_time_us();
+    GThread *generator = g_thread_new("bench-generator", bench_generate, &bench);
+    g_main_loop_run(bench.loop);
+    g_atomic_int_set(&bench.stop, TRUE);
+    g_thread_join(generator);
+    gint64 cpu_us = cpu_time_us() - cpu_start;
+
+    if (data->verbose && !data->udp) {
+        GstStructure *stats;
+        gchar *str;
+        g_object_get(netSink, "stats", &stats, NULL);
+        str = gst_structure_to_string(stats);
+        g_print("##### QuiclySink stats:\n%s\n", str);
+        gst_structure_free(stats);
+        g_free(str);
+        g_object_get(netSrc, "stats", &stats, NULL);
+        str = gst_structure_to_string(stats);
+        g_print("##### QuiclySrc stats:\n%s\n", str);
+        gst_structure_free(stats);
+        g_free(str);
+    }
+
+    gst_element_set_state(GST_ELEMENT(serverPipe), GST_STATE_NULL);
+    gst_element_set_state(GST_ELEMENT(clientPipe), GST_STATE_NULL);
+    bench_stop_udpfw(udpfw);
+    bench_print_result(&bench, cpu_us);
+
+    gst_object_unref(serverPipe);
+    gst_object_unref(clientPipe);
+    g_main_loop_unref(bench.loop);
+    g_hash_table_unref(bench.frames);
+    g_array_unref(bench.latencies);
+    if (bench.trace != NULL)
+        g_array_unref(bench.trace);
+    return 0;
+}
+
 int main (int argc, char *argv[])
 {
     /* Parse command line options */
@@ -1535,15 +2131,24 @@ int main (int argc, char *argv[])
     data.stat_file_path = NULL;
     data.verbose = FALSE;
     data.quicNoCC = FALSE;
+    data.mediaCC = FALSE;
     data.saveToFilePath = NULL;
     data.stat_interval = 0;
     data.async_sink = FALSE;
+    data.bench = FALSE;
+    data.bench_duration = DEFAULT_BENCH_DURATION;
+    data.bench_rate = DEFAULT_ENCODER_BITRATE;
+    data.bench_fps = DEFAULT_BENCH_FPS;
+    data.bench_trace = NULL;
+    data.bench_udpfw = DEFAULT_BENCH_UDPFW;
+    data.bench_udpfw_args = NULL;
     gchar *logfile = NULL;
     GOptionContext *ctx;
     GError *err = NULL;
     gchar **plugins = NULL;
     init_elements(&data);
     memset(&data.stats, 0, sizeof(Stats));
+    memset(&data.rate_adapt, 0, sizeof(RateAdaptation));
     pthread_mutex_init(&lock_fps, NULL);
     
     GOptionEntry entries[] = {
@@ -1578,6 +2183,8 @@ int main (int argc, char *argv[])
          "Time between stat collection (in ms). Default: 500", NULL},
         {"disableCC", 'D', 0, G_OPTION_ARG_NONE, &data.quicNoCC,
          "Disable quic CC. Default: False.", NULL},
+        {"media-cc", 'C', 0, G_OPTION_ARG_NONE, &data.mediaCC,
+         "Use the delay-based media cc built into quicly. Implies transcode. Default: False.", NULL},
         {"host", 'h', 0, G_OPTION_ARG_STRING, &data.host,
          "Host to connect to.", NULL},
         {"port", 'p', 0, G_OPTION_ARG_INT, &data.port,
@@ -1594,6 +2201,20 @@ int main (int argc, char *argv[])
          "Print additional information", NULL}, 
         {"async", 'y', 0, G_OPTION_ARG_NONE, &data.async_sink,
          "Server. Don't sync on the clock in the sink. Default: False", NULL},
+        {"bench", 'b', 0, G_OPTION_ARG_NONE, &data.bench,
+         "Run server and client over loopback with synthetic RTP and print the result as JSON", NULL},
+        {"bench-duration", 0, 0, G_OPTION_ARG_INT, &data.bench_duration,
+         "Bench. Seconds of media to send. Default: 10", NULL},
+        {"bench-rate", 0, 0, G_OPTION_ARG_INT, &data.bench_rate,
+         "Bench. Constant bitrate in kbit/s. Default: 5000", NULL},
+        {"bench-fps", 0, 0, G_OPTION_ARG_INT, &data.bench_fps,
+         "Bench. Frames per second, each one sent as a burst of rtp packets. Default: 30", NULL},
+        {"bench-trace", 0, 0, G_OPTION_ARG_STRING, &data.bench_trace,
+         "Bench. File with one frame size in bytes per line, replaces bench-rate", NULL},
+        {"bench-udpfw", 0, 0, G_OPTION_ARG_STRING, &data.bench_udpfw,
+         "Bench. Path of udpfw, empty to connect directly. Default: ./udpfw", NULL},
+        {"bench-udpfw-args", 0, 0, G_OPTION_ARG_STRING, &data.bench_udpfw_args,
+         "Bench. Impairment options passed to udpfw, e.g. \"-i 100 -p 20000\"", NULL},
         {NULL}
     };
 
@@ -1643,7 +2264,7 @@ int main (int argc, char *argv[])
             fprintf(data.stat_file_path, "#app:%s,transport:%s,cc:%s,rtp-mtu:%i,drop-late:%i,output-file:%s,video:%s\n", 
                                         data.file_path ? "server" : "client", 
                                         data.udp ? "udp" : (data.stream_mode ? "quic-stream" : "quic-dgram"),
-                                        data.scream ? "scream" : data.udp ? "none" : ((data.quicNoCC ? "none" : "quic")),
+                                        data.scream ? "scream" : data.udp ? "none" : ((data.quicNoCC ? "none" : (data.mediaCC ? "quic-media" : "quic"))),
                                         data.rtp_mtu == 0 ? DEFAULT_RTP_MTU : data.rtp_mtu, 
                                         data.quic_drop_late,
                                         data.saveToFilePath != NULL ? data.saveToFilePath : "none",
@@ -1691,9 +2312,18 @@ int main (int argc, char *argv[])
         data.aux = FALSE;
         data.transcode = TRUE;
     }
+    if (data.mediaCC) {
+        if (data.scream || data.quicNoCC || data.udp) {
+            g_printerr("media-cc can not be combined with scream, disableCC or udp\n");
+            return -1;
+        }
+        data.transcode = TRUE;
+    }
 
     int ret;
-    if (data.file_path) 
+    if (data.bench)
+        ret = run_bench(&data);
+    else if (data.file_path) 
         ret = run_server(&data);
     else  
         ret = run_client(&data);
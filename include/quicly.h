@@ -81,6 +81,10 @@ typedef union st_quicly_address_t {
 typedef struct st_quicly_datagram_t {
     ptls_iovec_t data;
     quicly_address_t dest, src;
+    /**
+     * ECN codepoint (QUICLY_ECN_*) that the datagram is to be sent with
+     */
+    uint8_t ecn;
 } quicly_datagram_t;
 
 typedef struct st_quicly_cid_t quicly_cid_t;
@@ -283,6 +287,10 @@ struct st_quicly_context_t {
      * loss detection parameters
      */
     quicly_loss_conf_t loss;
+    /**
+     * congestion control algorithm to be used by the connections (NewReno if NULL)
+     */
+    const quicly_cc_algorithm_t *cc_algorithm;
     /**
      * transport parameters
      */
@@ -295,6 +303,17 @@ struct st_quicly_context_t {
      * maximum number of bytes that can be transmitted on a CRYPTO stream (per each epoch)
      */
     uint64_t max_crypto_bytes;
+    /**
+     * maximum number of ACK ranges being tracked per packet number space; the oldest ranges are evicted first when the number
+     * is exceeded (values greater than QUICLY_ENCODE_ACK_MAX_BLOCKS - 1 are clamped)
+     */
+    size_t max_ack_ranges;
+    /**
+     * ECN codepoint to mark the outgoing packets with; QUICLY_ECN_NOT_ECT disables ECN, QUICLY_ECN_ECT0 selects the classic
+     * (RFC 3168) response to CE marks, QUICLY_ECN_ECT1 selects the scalable (L4S) response. The application is responsible for
+     * applying the codepoint set in `quicly_datagram_t::ecn` to the IP header.
+     */
+    uint8_t ecn;
     /**
      * client-only
      */
@@ -387,6 +406,7 @@ struct st_quicly_conn_streamgroup_state_t {
         uint64_t lost;                                                                                                             \
         uint64_t acked;                                                                                                            \
         uint64_t dropped_late;                                                                                                     \
+        uint64_t ecn_ce; /* packets reported as CE-marked by the peer */                                                           \
     } num_packets;                                                                                                                 \
     struct {                                                                                                                       \
         uint64_t received;                                                                                                         \
@@ -395,6 +415,7 @@ struct st_quicly_conn_streamgroup_state_t {
         uint64_t acked;                                                                                                            \
         uint64_t bytes_in_flight;                                                                                                  \
     } num_bytes;                                                                                                                   \
+    uint64_t num_migrations; /* changes of the peer address being followed */                                                      \
     struct {                                                                                                                       \
         uint64_t latest_ack_send_time;                                                                                             \
         uint64_t latest_ack_recv_time;                                                                                             \
@@ -414,6 +435,22 @@ typedef struct st_quicly_stats_t {
      * Congestion control (experimental; TODO cherry-pick what can be exposed as part of a stable API)
      */
     quicly_cc_t cc;
+    /**
+     * if the sender is application-limited; i.e., the application has not been providing enough data to fill the congestion window
+     */
+    int app_limited;
+    /**
+     * ECN codepoint being used for marking the packets; QUICLY_ECN_NOT_ECT if ECN is disabled or if validation has failed
+     */
+    uint8_t ecn;
+    /**
+     * latest delivery rate estimate (in bytes per second)
+     */
+    uint64_t delivery_rate;
+    /**
+     * send rate set by `quicly_set_send_rate` (in bits per second), or zero if cwnd is in control
+     */
+    uint64_t send_rate;
     /**
      * bytes_in_flight
      */
@@ -425,6 +462,10 @@ typedef struct st_quicly_feedback_t {
     uint32_t rtt_smoothed;
     uint32_t rtt_latest;
     uint32_t cwnd;
+    uint64_t pacing_rate;
+    uint64_t target_bitrate;
+    uint64_t delivery_rate;
+    uint64_t send_rate;
     size_t bytes_in_flight;
     uint64_t bytes_sent;
     uint64_t bytes_lost;
@@ -571,6 +612,11 @@ typedef struct st_quicly_dgram_callbacks_t {
     void (*on_send_shift)(quicly_dgram_t *dgram, size_t delta);
     int (*on_send_emit)(quicly_dgram_t *dgram, void *dst, size_t *len);
     int (*on_receive)(quicly_dgram_t *dgram, const void *src, size_t len);
+    /**
+     * optional; called when the datagram at `index` of the send buffer has to be dropped, returns the number of datagrams being
+     * dropped. If NULL, `on_send_shift` is called with a delta of one.
+     */
+    size_t (*on_send_drop)(quicly_dgram_t *dgram, size_t index);
 } quicly_dgram_callbacks_t;
 
 struct st_quicly_dgram_t {
@@ -708,6 +754,11 @@ typedef struct st_quicly_decoded_packet_t {
      * if not UINT64_MAX, indicates that the packet has been decrypted prior to being passed to `quicly_receive`.
      */
     uint64_t decrypted_pn;
+    /**
+     * ECN codepoint (QUICLY_ECN_*) of the IP packet that carried the datagram; set to QUICLY_ECN_NOT_ECT by
+     * `quicly_decode_packet`, the application overwrites it before calling `quicly_receive` if the information is available
+     */
+    uint8_t ecn;
     /**
      *
      */
@@ -798,6 +849,23 @@ static quicly_stream_id_t quicly_get_peer_next_stream_id(quicly_conn_t *conn, in
  * Report feedback to the application
  */
 int quicly_get_feedback(quicly_conn_t *conn, quicly_feedback_t *fb);
+/**
+ * Returns the media bitrate (in bits per second) recommended by the congestion controller, or zero if the controller does not
+ * calculate one (see quicly_cc_media).
+ */
+uint64_t quicly_get_target_bitrate(quicly_conn_t *conn);
+/**
+ * Sets the bounds of the target bitrate (in bits per second). Zero retains the current value.
+ */
+void quicly_set_target_bitrate_limits(quicly_conn_t *conn, uint64_t min_bitrate, uint64_t max_bitrate);
+/**
+ * Lets the application control the send rate. While |bitrate| (in bits per second) is non-zero, cwnd no longer limits the sender;
+ * instead, the packets carrying streams and datagrams are paced to the given rate, using a token bucket holding up to |burst| bytes
+ * (or QUICLY_DEFAULT_SEND_RATE_BURST packets if zero). The congestion controller continues to run, so that its estimates (cwnd,
+ * pacing rate, delivery rate) can be obtained using `quicly_get_stats` or `quicly_get_feedback`. Setting |bitrate| to zero
+ * returns control to the congestion controller.
+ */
+void quicly_set_send_rate(quicly_conn_t *conn, uint64_t bitrate, uint32_t burst);
 /**
  *
  */
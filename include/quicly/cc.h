@@ -34,31 +34,392 @@ extern "C" {
 #include <stdint.h>
 #include <string.h>
 #include "quicly/constants.h"
+#include "quicly/loss.h"
+
+#define QUICLY_INITIAL_WINDOW 10
+#define QUICLY_MIN_CWND 2
+
+typedef struct st_quicly_cc_algorithm_t quicly_cc_algorithm_t;
+
+/**
+ * A delivery rate sample (draft-cheng-iccrg-delivery-rate-estimation), taken when an ACK frame is processed. The sample is built
+ * from the state recorded in the sentmap at the moment the most recently sent packet among those being acknowledged was sent.
+ */
+typedef struct st_quicly_rate_sample_t {
+    /**
+     * number of bytes delivered when the packet being used for sampling was sent (UINT64_MAX if no sample has been taken)
+     */
+    uint64_t prior_delivered;
+    /**
+     * number of bytes delivered during the sampling interval
+     */
+    uint64_t delivered;
+    /**
+     * length of the sampling interval (in milliseconds)
+     */
+    int64_t interval;
+    /**
+     * RTT observed for the packet being used for sampling (in milliseconds)
+     */
+    uint32_t rtt;
+    /**
+     * if the packet being used for sampling was sent while the sender was application-limited; in such case, the sample does not
+     * reflect the capacity of the path, and the window should not be increased
+     */
+    int is_app_limited;
+    /**
+     * internal state used while sampling
+     */
+    int64_t _send_elapsed;
+    int64_t _ack_elapsed;
+} quicly_rate_sample_t;
+
+/**
+ * returns the delivery rate (in bytes per second) of the sample, or zero if the sample is invalid
+ */
+static uint64_t quicly_rate_sample_get_rate(const quicly_rate_sample_t *rs);
+
+/**
+ * default bounds and the initial value of the target bitrate (in bits per second) calculated by the media congestion controller
+ */
+#define QUICLY_MEDIA_CC_MIN_BITRATE 150000
+#define QUICLY_MEDIA_CC_START_BITRATE 1000000
+#define QUICLY_MEDIA_CC_MAX_BITRATE 50000000
+/**
+ * number of delay samples used by the trendline filter of the media congestion controller
+ */
+#define QUICLY_MEDIA_CC_TRENDLINE_WINDOW 20
+
+/**
+ * states of the BBR congestion controller
+ */
+enum {
+    QUICLY_BBR_STATE_STARTUP,
+    QUICLY_BBR_STATE_DRAIN,
+    QUICLY_BBR_STATE_PROBE_BW,
+    QUICLY_BBR_STATE_PROBE_RTT
+};
+
+/**
+ * output of the overuse detector and the states of the rate controller of the media congestion controller
+ */
+enum { QUICLY_MEDIA_CC_USAGE_NORMAL, QUICLY_MEDIA_CC_USAGE_OVERUSE, QUICLY_MEDIA_CC_USAGE_UNDERUSE };
+enum { QUICLY_MEDIA_CC_RATE_INCREASE, QUICLY_MEDIA_CC_RATE_HOLD, QUICLY_MEDIA_CC_RATE_DECREASE };
 
 typedef struct st_quicly_cc_t {
+    /**
+     * the congestion control algorithm being used
+     */
+    const quicly_cc_algorithm_t *algo;
     uint32_t cwnd;
     uint32_t ssthresh;
-    uint32_t stash;
     uint64_t recovery_end;
+    /**
+     * the rate (in bytes per second) at which the algorithm wants the packets to be paced, or zero if pacing is not used
+     */
+    uint64_t pacing_rate;
+    /**
+     * the media bitrate (in bits per second) that the sender should produce, or zero if the algorithm does not calculate one
+     */
+    uint64_t target_bitrate;
+    /**
+     * state of the scalable (L4S) response to ECN-CE marks, maintained by `quicly_cc_on_ecn`
+     */
+    struct {
+        /**
+         * moving average of the fraction of packets being CE-marked per round trip
+         */
+        double alpha;
+        /**
+         * the current round ends when a packet with a packet number at or above this value is acknowledged
+         */
+        uint64_t round_end;
+        uint32_t round_acked;
+        uint32_t round_marked;
+        /**
+         * cwnd is not reduced again until a packet with a packet number at or above this value is acknowledged
+         */
+        uint64_t cwr_end;
+    } l4s;
+    /**
+     * algorithm-specific state
+     */
+    union {
+        struct {
+            uint32_t stash;
+        } reno;
+        struct {
+            /**
+             * time when the current congestion avoidance epoch started (or INT64_MAX if not in congestion avoidance)
+             */
+            int64_t avoidance_start;
+            /**
+             * time when the last ACK was processed; used for excluding application-limited periods from the epoch
+             */
+            int64_t last_acked_at;
+            /**
+             * the time period (in seconds) that the cubic function takes to increase cwnd to w_max
+             */
+            double k;
+            /**
+             * cwnd (in bytes) just before the last reduction, and the one before that (used for fast convergence)
+             */
+            uint32_t w_max;
+            uint32_t w_last_max;
+            /**
+             * HyStart++ state
+             */
+            struct {
+                /**
+                 * the current round ends when a packet with a packet number at or above this value is acknowledged
+                 */
+                uint64_t window_end;
+                uint32_t last_round_min_rtt;
+                uint32_t current_round_min_rtt;
+                uint32_t rtt_sample_count;
+                /**
+                 * min RTT observed when entering Conservative Slow Start (or UINT32_MAX if not in CSS)
+                 */
+                uint32_t css_baseline_min_rtt;
+                uint32_t css_round_count;
+            } hystart;
+        } cubic;
+        struct {
+            /**
+             * one of QUICLY_BBR_STATE_*
+             */
+            uint8_t mode;
+            /**
+             * index within the gain cycle of PROBE_BW
+             */
+            uint8_t cycle_index;
+            /**
+             * if full bandwidth has been reached (i.e. if STARTUP has been exited)
+             */
+            uint8_t full_bw_reached : 1;
+            /**
+             * if the current ACK starts a new round trip
+             */
+            uint8_t round_start : 1;
+            /**
+             * if the round trip of PROBE_RTT has been completed
+             */
+            uint8_t probe_rtt_round_done : 1;
+            /**
+             * number of rounds without significant bandwidth growth during STARTUP
+             */
+            uint8_t full_bw_count;
+            /**
+             * max filter of the delivery rate (in bytes per second); each slot covers a fixed number of round trips
+             */
+            uint64_t bw_filter[2];
+            uint64_t bw_filter_round;
+            /**
+             * bandwidth observed when full_bw_count was last reset
+             */
+            uint64_t full_bw;
+            /**
+             * min RTT (in milliseconds) and the time when it was observed
+             */
+            uint32_t min_rtt;
+            int64_t min_rtt_stamp;
+            /**
+             * round trip counting
+             */
+            uint64_t round_count;
+            uint64_t next_round_delivered;
+            /**
+             * bytes delivered and lost during the current round trip, used for calculating the loss rate
+             */
+            uint64_t round_delivered_start;
+            uint64_t round_lost;
+            /**
+             * upper bound of inflight, lowered when the loss rate exceeds the threshold (BBRv2)
+             */
+            uint32_t inflight_hi;
+            /**
+             * the time when the current phase of PROBE_BW has started
+             */
+            int64_t cycle_stamp;
+            /**
+             * the time when PROBE_RTT can be exited
+             */
+            int64_t probe_rtt_done_stamp;
+            /**
+             * cwnd saved when entering PROBE_RTT
+             */
+            uint32_t prior_cwnd;
+        } bbr;
+        /**
+         * state of the delay-based media congestion controller
+         */
+        struct {
+            /**
+             * bounds of target_bitrate
+             */
+            uint64_t min_bitrate;
+            uint64_t max_bitrate;
+            /**
+             * smoothed delivery rate (in bits per second)
+             */
+            uint64_t acked_bitrate;
+            /**
+             * RTT of the previous sample (UINT32_MAX if none); the difference between two samples is the variation of the one-way
+             * delay
+             */
+            uint32_t prev_rtt;
+            /**
+             * trendline filter
+             */
+            int64_t first_sample_at;
+            double accumulated_delay;
+            double smoothed_delay;
+            double trend_x[QUICLY_MEDIA_CC_TRENDLINE_WINDOW];
+            double trend_y[QUICLY_MEDIA_CC_TRENDLINE_WINDOW];
+            uint8_t trend_num;
+            uint8_t trend_pos;
+            uint32_t num_deltas;
+            double prev_trend;
+            /**
+             * overuse detector with an adaptive threshold
+             */
+            double threshold;
+            int64_t threshold_updated_at;
+            int64_t overuse_since;
+            uint32_t overuse_count;
+            /**
+             * one of QUICLY_MEDIA_CC_USAGE_*
+             */
+            uint8_t usage;
+            /**
+             * one of QUICLY_MEDIA_CC_RATE_*
+             */
+            uint8_t rate_state;
+            int64_t rate_updated_at;
+            int64_t decreased_at;
+            /**
+             * loss accounting, evaluated once every round trip
+             */
+            uint64_t loss_round_end;
+            uint64_t round_acked;
+            uint64_t round_lost;
+        } media;
+    } state;
 } quicly_cc_t;
 
-void quicly_cc_init(quicly_cc_t *cc);
+struct st_quicly_cc_algorithm_t {
+    /**
+     * name of the algorithm
+     */
+    const char *name;
+    /**
+     * initializes the state
+     */
+    void (*init)(quicly_cc_t *cc, int64_t now);
+    /**
+     * Called when a packet is newly acknowledged. |next_pn| is the next unsent packet number. |rs| is the delivery rate sample
+     * taken for the ACK frame.
+     */
+    void (*on_acked)(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t largest_acked, uint32_t inflight,
+                     uint64_t next_pn, int64_t now, const quicly_rate_sample_t *rs);
+    /**
+     * Called when a packet is detected as lost. |next_pn| is the next unsent packet number, used for setting the recovery window.
+     */
+    void (*on_lost)(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t lost_pn, uint64_t next_pn, int64_t now);
+    /**
+     * Called when persistent congestion is observed.
+     */
+    void (*on_persistent_congestion)(quicly_cc_t *cc, const quicly_rtt_t *rtt, int64_t now);
+};
 
 /**
- * Called when a packet is newly acknowledged.
+ * NewReno (RFC 6582) as described in the QUIC recovery draft
  */
-void quicly_cc_on_acked(quicly_cc_t *cc, uint32_t bytes, uint64_t largest_acked, uint32_t inflight);
-
+extern const quicly_cc_algorithm_t quicly_cc_reno;
 /**
- * Called when a packet is detected as lost. |next_pn| is the next unsent packet number,
- * used for setting the recovery window.
+ * CUBIC (RFC 8312) with HyStart++ slow start
  */
-void quicly_cc_on_lost(quicly_cc_t *cc, uint32_t bytes, uint64_t lost_pn, uint64_t next_pn);
+extern const quicly_cc_algorithm_t quicly_cc_cubic;
+/**
+ * BBRv2-style model-based congestion control; sets `pacing_rate`
+ */
+extern const quicly_cc_algorithm_t quicly_cc_bbr;
+/**
+ * Delay-based congestion control for real-time media, modelled after Google Congestion Control (draft-ietf-rmcat-gcc). The
+ * variation of the one-way delay is derived from the send times recorded in the sentmap and the times at which the ACKs are
+ * received. Sets `target_bitrate` as well as `pacing_rate`, and sizes `cwnd` so that the window does not limit a sender that
+ * follows the target.
+ */
+extern const quicly_cc_algorithm_t quicly_cc_media;
 
+static void quicly_cc_init(quicly_cc_t *cc, const quicly_cc_algorithm_t *algo, int64_t now);
+static void quicly_cc_on_acked(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t largest_acked, uint32_t inflight,
+                               uint64_t next_pn, int64_t now, const quicly_rate_sample_t *rs);
+static void quicly_cc_on_lost(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t lost_pn, uint64_t next_pn,
+                              int64_t now);
+static void quicly_cc_on_persistent_congestion(quicly_cc_t *cc, const quicly_rtt_t *rtt, int64_t now);
+/**
+ * Called when an ACK_ECN frame newly acknowledges |num_acked| packets sent with an ECT codepoint, |num_ce| being the increase of
+ * the ECN-CE counter. If |scalable| is set (i.e. ECT(1) is used) and the algorithm is Reno, cwnd is reduced in proportion to the
+ * fraction of marked packets, at most once per round trip (TCP Prague). Otherwise, CE marks are handled as losses (RFC 3168).
+ */
+void quicly_cc_on_ecn(quicly_cc_t *cc, const quicly_rtt_t *rtt, int scalable, uint32_t num_acked, uint32_t num_ce,
+                      uint64_t largest_acked, uint64_t next_pn, int64_t now);
 /**
- * Called when persistent congestion is observed.
+ * Sets the bounds of the target bitrate (in bits per second). Zero retains the current value. Has no effect unless the algorithm is
+ * quicly_cc_media.
  */
-void quicly_cc_on_persistent_congestion(quicly_cc_t *cc);
+static void quicly_cc_set_bitrate_limits(quicly_cc_t *cc, uint64_t min_bitrate, uint64_t max_bitrate);
+
+/* inline definitions */
+
+inline uint64_t quicly_rate_sample_get_rate(const quicly_rate_sample_t *rs)
+{
+    if (rs->prior_delivered == UINT64_MAX || rs->interval <= 0)
+        return 0;
+    return rs->delivered * 1000 / rs->interval;
+}
+
+inline void quicly_cc_init(quicly_cc_t *cc, const quicly_cc_algorithm_t *algo, int64_t now)
+{
+    memset(cc, 0, sizeof(*cc));
+    cc->algo = algo;
+    cc->l4s.alpha = 1;
+    algo->init(cc, now);
+}
+
+inline void quicly_cc_on_acked(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t largest_acked, uint32_t inflight,
+                               uint64_t next_pn, int64_t now, const quicly_rate_sample_t *rs)
+{
+    cc->algo->on_acked(cc, rtt, bytes, largest_acked, inflight, next_pn, now, rs);
+}
+
+inline void quicly_cc_on_lost(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t lost_pn, uint64_t next_pn,
+                              int64_t now)
+{
+    cc->algo->on_lost(cc, rtt, bytes, lost_pn, next_pn, now);
+}
+
+inline void quicly_cc_on_persistent_congestion(quicly_cc_t *cc, const quicly_rtt_t *rtt, int64_t now)
+{
+    cc->algo->on_persistent_congestion(cc, rtt, now);
+}
+
+inline void quicly_cc_set_bitrate_limits(quicly_cc_t *cc, uint64_t min_bitrate, uint64_t max_bitrate)
+{
+    if (cc->algo != &quicly_cc_media)
+        return;
+    if (min_bitrate != 0)
+        cc->state.media.min_bitrate = min_bitrate;
+    if (max_bitrate != 0)
+        cc->state.media.max_bitrate = max_bitrate;
+    if (cc->state.media.max_bitrate < cc->state.media.min_bitrate)
+        cc->state.media.max_bitrate = cc->state.media.min_bitrate;
+    if (cc->target_bitrate < cc->state.media.min_bitrate)
+        cc->target_bitrate = cc->state.media.min_bitrate;
+    if (cc->target_bitrate > cc->state.media.max_bitrate)
+        cc->target_bitrate = cc->state.media.max_bitrate;
+}
 
 #ifdef __cplusplus
 }
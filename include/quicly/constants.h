@@ -38,10 +38,18 @@ extern "C" {
 #define QUICLY_DEFAULT_MIN_PTO 1 /* milliseconds */
 #define QUICLY_DEFAULT_INITIAL_RTT 100
 #define QUICLY_LOSS_DEFAULT_PACKET_THRESHOLD 3
+#define QUICLY_PERSISTENT_CONGESTION_THRESHOLD 3
+#define QUICLY_DEFAULT_SEND_RATE_BURST 10 /* packets */
 
 #define QUICLY_MAX_PACKET_SIZE 1280 /* must be >= 1200 bytes */
 #define QUICLY_AEAD_TAG_SIZE 16
 
+/* ECN codepoints (RFC 3168), as carried in the two least significant bits of the IP TOS / traffic class field */
+#define QUICLY_ECN_NOT_ECT 0
+#define QUICLY_ECN_ECT1 1
+#define QUICLY_ECN_ECT0 2
+#define QUICLY_ECN_CE 3
+
 /* coexists with picotls error codes, assuming that int is at least 32-bits */
 #define QUICLY_ERROR_IS_QUIC(e) (((e) & ~0x1ffff) == 0x20000)
 #define QUICLY_ERROR_IS_QUIC_TRANSPORT(e) (((e) & ~0xffff) == 0x20000)
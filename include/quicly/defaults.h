@@ -56,6 +56,10 @@ extern quicly_stream_scheduler_t quicly_default_stream_scheduler;
  *
  */
 extern quicly_now_t quicly_default_now;
+/**
+ * NULL-terminated list of the congestion control algorithms being provided by quicly
+ */
+extern const quicly_cc_algorithm_t *const quicly_cc_all_algorithms[];
 
 #ifdef __cplusplus
 }
@@ -212,7 +212,12 @@ typedef struct st_quicly_stop_sending_frame_t {
 static int quicly_decode_stop_sending_frame(const uint8_t **src, const uint8_t *end, quicly_stop_sending_frame_t *frame);
 
 #define QUICLY_ENCODE_ACK_MAX_BLOCKS 63 /* exclusive, see encode_ack_frame */
-uint8_t *quicly_encode_ack_frame(uint8_t *dst, uint8_t *dst_end, quicly_ranges_t *ranges, uint64_t ack_delay, uint64_t largest_ack_received_at);
+/**
+ * Encodes an ACK frame. When `ecn_counts` is non-NULL, an ACK_ECN frame carrying the ECT(0), ECT(1), ECN-CE counts (in that order)
+ * is emitted instead.
+ */
+uint8_t *quicly_encode_ack_frame(uint8_t *dst, uint8_t *dst_end, quicly_ranges_t *ranges, uint64_t ack_delay, uint64_t largest_ack_received_at,
+                                 const uint64_t *ecn_counts);
 
 typedef struct st_quicly_ack_frame_t {
     uint64_t largest_acknowledged;
@@ -222,6 +227,10 @@ typedef struct st_quicly_ack_frame_t {
     uint64_t num_gaps;
     uint64_t ack_block_lengths[QUICLY_ACK_MAX_GAPS + 1];
     uint64_t gaps[QUICLY_ACK_MAX_GAPS];
+    /**
+     * ECT(0), ECT(1), ECN-CE counts; only valid when the frame is of type ACK_ECN
+     */
+    uint64_t ecn_counts[3];
 } quicly_ack_frame_t;
 
 int quicly_decode_ack_frame(const uint8_t **src, const uint8_t *end, quicly_ack_frame_t *frame, int is_ack_ecn);
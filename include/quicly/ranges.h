@@ -45,6 +45,10 @@ static void quicly_ranges_init(quicly_ranges_t *ranges);
 int quicly_ranges_init_with_range(quicly_ranges_t *ranges, uint64_t start, uint64_t end);
 static void quicly_ranges_clear(quicly_ranges_t *ranges);
 int quicly_ranges_add(quicly_ranges_t *ranges, uint64_t start, uint64_t end);
+/**
+ * adds given range, then discards the oldest (i.e. lowest) ranges so that no more than `max_ranges` ranges are retained
+ */
+int quicly_ranges_add_bounded(quicly_ranges_t *ranges, uint64_t start, uint64_t end, size_t max_ranges);
 int quicly_ranges_subtract(quicly_ranges_t *ranges, uint64_t start, uint64_t end);
 void quicly_ranges_shrink(quicly_ranges_t *ranges, size_t start, size_t end);
 
@@ -28,6 +28,7 @@ extern "C" {
 
 #include <assert.h>
 #include <stdint.h>
+#include "quicly/cc.h"
 #include "quicly/constants.h"
 #include "quicly/maxsender.h"
 #include "quicly/sendstate.h"
@@ -56,6 +57,10 @@ typedef struct st_quicly_sent_packet_t {
      * number of bytes in-flight for the packet (becomes zero once deemed lost)
      */
     uint16_t bytes_in_flight;
+    /**
+     * if the packet was sent during an application-limited period
+     */
+    uint8_t is_app_limited : 1;
 } quicly_sent_packet_t;
 
 typedef enum en_quicly_sentmap_event_t {
@@ -80,6 +85,15 @@ struct st_quicly_sent_t {
     quicly_sent_acked_cb acked;
     union {
         quicly_sent_packet_t packet;
+        /**
+         * snapshot of the delivery rate estimator (quicly_sentmap_t::rate) taken when the packet was sent; stored in the entry
+         * following the packet header, so that the frame-level entries do not grow
+         */
+        struct {
+            uint64_t delivered;
+            int64_t delivered_at;
+            int64_t first_sent_at;
+        } rate;
         struct {
             quicly_range_t range;
         } ack;
@@ -137,7 +151,8 @@ struct st_quicly_sent_block_t {
 
 /**
  * quicly_sentmap_t is a structure that holds a list of sent objects being tracked.  The list is a list of packet header and
- * frame-level objects of that packet.  Packet header is identified by quicly_sent_t::acked being quicly_sent__type_header.
+ * frame-level objects of that packet.  Packet header is identified by quicly_sent_t::acked being quicly_sent__type_header. The
+ * header is immediately followed by the rate snapshot (quicly_sentmap__type_rate) within the same block.
  *
  * The transport writes to the sentmap in the following way:
  * 1. call quicly_sentmap_prepare
@@ -163,6 +178,28 @@ typedef struct st_quicly_sentmap_t {
      * bytes in-flight
      */
     size_t bytes_in_flight;
+    /**
+     * state of the delivery rate estimator
+     */
+    struct {
+        /**
+         * total number of bytes being delivered (i.e. acknowledged)
+         */
+        uint64_t delivered;
+        /**
+         * when `delivered` was last updated
+         */
+        int64_t delivered_at;
+        /**
+         * send time of the packet that was most recently used for taking a rate sample
+         */
+        int64_t first_sent_at;
+        /**
+         * Non-zero while the sender is application-limited, indicating the value of `delivered` that marks the end of the period.
+         * Packets sent while this value is non-zero are marked as `is_app_limited`.
+         */
+        uint64_t app_limited;
+    } rate;
     /**
      * is non-NULL between prepare and commit, pointing to the packet header that is being written to
      */
@@ -217,9 +254,31 @@ void quicly_sentmap_skip(quicly_sentmap_iter_t *iter);
 int quicly_sentmap_update(quicly_sentmap_t *map, quicly_sentmap_iter_t *iter, quicly_sentmap_event_t event,
                           struct st_quicly_conn_t *conn);
 
+/**
+ * initializes a delivery rate sample
+ */
+static void quicly_sentmap_init_rate_sample(quicly_rate_sample_t *rs);
+/**
+ * Updates the delivery rate estimator for the packet being pointed to by the iterator that is newly acknowledged, as well as the
+ * rate sample being taken. The function MUST be called before quicly_sentmap_update for each acknowledged packet that is in flight.
+ */
+void quicly_sentmap_on_delivered(quicly_sentmap_t *map, quicly_sentmap_iter_t *iter, int64_t now, quicly_rate_sample_t *rs);
+/**
+ * Marks the start of an application-limited period; i.e., the application had nothing to send while the congestion controller
+ * would have allowed sending more. The period ends when all the bytes being in flight are delivered.
+ */
+static void quicly_sentmap_on_app_limited(quicly_sentmap_t *map);
+/**
+ * completes the delivery rate sample after all the packets being acknowledged by an ACK frame have been passed to
+ * quicly_sentmap_on_delivered
+ */
+void quicly_sentmap_finalize_rate_sample(quicly_sentmap_t *map, quicly_rate_sample_t *rs);
+
 struct st_quicly_sent_block_t *quicly_sentmap__new_block(quicly_sentmap_t *map);
 int quicly_sentmap__type_packet(struct st_quicly_conn_t *conn, const quicly_sent_packet_t *packet, quicly_sent_t *sent,
                                 quicly_sentmap_event_t event);
+int quicly_sentmap__type_rate(struct st_quicly_conn_t *conn, const quicly_sent_packet_t *packet, quicly_sent_t *sent,
+                              quicly_sentmap_event_t event);
 
 /* inline definitions */
 
@@ -240,6 +299,18 @@ inline void quicly_sentmap_commit(quicly_sentmap_t *map, uint16_t bytes_in_fligh
     map->_pending_packet = NULL;
 }
 
+inline void quicly_sentmap_on_app_limited(quicly_sentmap_t *map)
+{
+    map->rate.app_limited = map->rate.delivered + map->bytes_in_flight;
+    if (map->rate.app_limited == 0)
+        map->rate.app_limited = 1;
+}
+
+inline void quicly_sentmap_init_rate_sample(quicly_rate_sample_t *rs)
+{
+    *rs = (quicly_rate_sample_t){UINT64_MAX};
+}
+
 inline quicly_sent_t *quicly_sentmap_allocate(quicly_sentmap_t *map, quicly_sent_acked_cb acked)
 {
     struct st_quicly_sent_block_t *block;
@@ -138,10 +138,32 @@ static int quicly_streambuf_egress_write_rtp_framing(quicly_stream_t *stream, co
 
 /* dgram buff  */
 /* TODO: Refactor ingress buffer handling -> BufferLists */
+
+/**
+ * priorities of the datagrams tagged with a frame id (see `quicly_dgrambuf_egress_drop`)
+ */
+#define QUICLY_DGRAM_PRIORITY_DISPOSABLE 0 /* no other frame depends on this one */
+#define QUICLY_DGRAM_PRIORITY_REFERENCE 1  /* delta frame that later frames depend on */
+#define QUICLY_DGRAM_PRIORITY_KEY 2        /* frame that can be decoded on its own (e.g. IDR, parameter sets) */
+
 typedef struct st_quicly_dgram_listbuf_vec_t {
     int64_t max_time;
     size_t len;
     void *data;
+    /**
+     * if non-NULL, called instead of free(data) when the entry is discarded; allows queueing payload that is shared with other
+     * connections without copying
+     */
+    void (*release)(struct st_quicly_dgram_listbuf_vec_t *vec);
+    void *cbdata;
+    /**
+     * frame the datagram belongs to, or 0 if the datagram is not tagged
+     */
+    uint64_t frame_id;
+    /**
+     * one of QUICLY_DGRAM_PRIORITY_*; the priority of a frame is the highest among its datagrams
+     */
+    uint8_t priority;
 } quicly_dgram_listbuf_vec_t;
 
 typedef struct st_quicly_dgram_listbuf_t {
@@ -154,6 +176,23 @@ typedef struct st_quicly_dgram_listbuf_t {
 typedef struct st_quicly_dgrambuf_t {
     quicly_dgram_listbuf_t egress;
     quicly_dgram_listbuf_t ingress;
+    /**
+     * tagged datagrams written after a frame has been dropped, that can no longer be decoded
+     */
+    struct {
+        /**
+         * the frame that has been dropped
+         */
+        uint64_t frame_id;
+        /**
+         * if set, all tagged datagrams are discarded until the next key frame
+         */
+        int until_key;
+        /**
+         * number of datagrams discarded upon write
+         */
+        uint64_t num_discarded;
+    } drop;
 } quicly_dgrambuf_t;
 
 int quicly_dgrambuf_create(quicly_dgram_t *dgram, size_t sz);
@@ -162,6 +201,18 @@ int quicly_dgrambuf_egress_emit(quicly_dgram_t *dgram, void *dst, size_t *len);
 int quicly_dgrambuf_egress_write(quicly_dgram_t *dgram, const void *src, size_t len, int64_t max_time);
 int quicly_dgrambuf_write(quicly_dgram_t *dgram, quicly_dgram_listbuf_t *buf, const void *src, size_t len, int64_t max_time);
 int quicly_dgrambuf_write_vec(quicly_dgram_t *dgram, quicly_dgram_listbuf_t *db, quicly_dgram_listbuf_vec_t *vec);
+/**
+ * queues the entry without copying the payload. The entry is released through `vec->release` once sent or dropped. When an error
+ * is returned, the ownership stays with the caller.
+ */
+int quicly_dgrambuf_egress_write_vec(quicly_dgram_t *dgram, quicly_dgram_listbuf_vec_t *vec);
+/**
+ * Drops the datagram at `index` of the egress queue. If the datagram is tagged, the other datagrams of the frame are dropped as
+ * well, and if the frame is referenced by others, so are the tagged datagrams queued after it up to the next key frame. Tagged
+ * datagrams being written later on are discarded the same way. Returns the number of datagrams being dropped. Can be used as
+ * `quicly_dgram_callbacks_t::on_send_drop`.
+ */
+size_t quicly_dgrambuf_egress_drop(quicly_dgram_t *dgram, size_t index);
 int quicly_dgrambuf_ingress_receive(quicly_dgram_t *dgram, const void *src, size_t len);
 void quicly_dgrambuf_ingress_shift(quicly_dgram_t *dgram, size_t delta);
 int quicly_dgrambuf_ingress_get(quicly_dgram_t *dgram, void *dst, size_t *len);
@@ -171,6 +222,10 @@ void quicly_dgrambuf_shift(quicly_dgram_listbuf_t *b, size_t delta);
 int quicly_dgrambuf_emit(quicly_dgram_listbuf_t *b, void *dst, size_t *len);
 static size_t quicly_dgram_can_get_data(quicly_dgram_t *dgram);
 static size_t quicly_dgram_can_send(quicly_dgram_t *dgram);
+/**
+ * returns the number of datagrams waiting to be sent
+ */
+static size_t quicly_dgram_num_pending(quicly_dgram_t *dgram);
 static size_t quicly_dgram_debug(quicly_dgram_t *dgram);
 static int64_t quicly_dgram_get_expire_time(quicly_dgram_t *dgram);
 
@@ -213,6 +268,15 @@ inline size_t quicly_dgram_can_send(quicly_dgram_t *dgram)
     }
 }
 
+inline size_t quicly_dgram_num_pending(quicly_dgram_t *dgram)
+{
+    if (dgram == NULL)
+        return 0;
+
+    quicly_dgrambuf_t *bf = (quicly_dgrambuf_t *)dgram->data;
+    return bf->egress.vecs.size;
+}
+
 /* TODO: REMOVE */
 inline size_t quicly_dgram_debug(quicly_dgram_t *dgram)
 {
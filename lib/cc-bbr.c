@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2019 Fastly, Janardhan Iyengar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* A BBRv2-style congestion controller. The model consists of the max delivery rate (measured using the rate samples taken from the
+ * sentmap) and the min RTT. The controller paces at a multiple of the estimated bottleneck bandwidth and limits inflight to a
+ * multiple of the estimated BDP. Following BBRv2, the loss rate of each round trip is tracked, and `inflight_hi` is lowered when
+ * the loss rate exceeds a threshold, so that shallow buffers do not suffer from persistent loss.
+ */
+
+#include "quicly/cc.h"
+
+#define QUICLY_BBR_HIGH_GAIN 2.885 /* 2 / ln(2) */
+#define QUICLY_BBR_CWND_GAIN 2.0
+#define QUICLY_BBR_BW_FILTER_ROUNDS 5
+#define QUICLY_BBR_FULL_BW_THRESH 1.25
+#define QUICLY_BBR_FULL_BW_COUNT 3
+#define QUICLY_BBR_MIN_RTT_WINDOW 10000 /* milliseconds */
+#define QUICLY_BBR_PROBE_RTT_INTERVAL 5000 /* milliseconds */
+#define QUICLY_BBR_PROBE_RTT_DURATION 200  /* milliseconds */
+#define QUICLY_BBR_LOSS_THRESH 0.02
+#define QUICLY_BBR_BETA 0.7
+#define QUICLY_BBR_MIN_PIPE_CWND (4 * QUICLY_MAX_PACKET_SIZE)
+#define QUICLY_BBR_PACING_MARGIN 0.99
+
+static const double pacing_gain_cycle[] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+#define QUICLY_BBR_GAIN_CYCLE_LEN (sizeof(pacing_gain_cycle) / sizeof(pacing_gain_cycle[0]))
+
+static uint64_t get_max_bw(quicly_cc_t *cc)
+{
+    return cc->state.bbr.bw_filter[0] > cc->state.bbr.bw_filter[1] ? cc->state.bbr.bw_filter[0] : cc->state.bbr.bw_filter[1];
+}
+
+static uint32_t get_bdp(quicly_cc_t *cc, double gain)
+{
+    uint64_t bw = get_max_bw(cc);
+
+    if (bw == 0 || cc->state.bbr.min_rtt == UINT32_MAX)
+        return QUICLY_INITIAL_WINDOW * QUICLY_MAX_PACKET_SIZE;
+    double bdp = (double)bw * cc->state.bbr.min_rtt / 1000 * gain;
+    return bdp > UINT32_MAX ? UINT32_MAX : (uint32_t)bdp;
+}
+
+static double get_pacing_gain(quicly_cc_t *cc)
+{
+    switch (cc->state.bbr.mode) {
+    case QUICLY_BBR_STATE_STARTUP:
+        return QUICLY_BBR_HIGH_GAIN;
+    case QUICLY_BBR_STATE_DRAIN:
+        return 1 / QUICLY_BBR_HIGH_GAIN;
+    case QUICLY_BBR_STATE_PROBE_BW:
+        return pacing_gain_cycle[cc->state.bbr.cycle_index];
+    default:
+        return 1;
+    }
+}
+
+static void update_pacing_rate(quicly_cc_t *cc, const quicly_rtt_t *rtt)
+{
+    uint64_t bw = get_max_bw(cc);
+
+    if (bw == 0) {
+        /* no sample yet; pace the initial window over the handshake RTT */
+        uint32_t srtt = rtt->smoothed != 0 ? rtt->smoothed : rtt->latest;
+        if (srtt == 0)
+            srtt = 1;
+        cc->pacing_rate = (uint64_t)(QUICLY_BBR_HIGH_GAIN * cc->cwnd * 1000 / srtt);
+        return;
+    }
+    uint64_t rate = (uint64_t)(get_pacing_gain(cc) * bw * QUICLY_BBR_PACING_MARGIN);
+    /* never lower the pacing rate before STARTUP ends */
+    if (cc->state.bbr.full_bw_reached || rate > cc->pacing_rate)
+        cc->pacing_rate = rate;
+}
+
+static void update_bw(quicly_cc_t *cc, const quicly_rate_sample_t *rs)
+{
+    uint64_t rate;
+
+    /* rotate the max filter */
+    if (cc->state.bbr.round_start && cc->state.bbr.round_count >= cc->state.bbr.bw_filter_round + QUICLY_BBR_BW_FILTER_ROUNDS) {
+        cc->state.bbr.bw_filter[1] = cc->state.bbr.bw_filter[0];
+        cc->state.bbr.bw_filter[0] = 0;
+        cc->state.bbr.bw_filter_round = cc->state.bbr.round_count;
+    }
+    /* samples taken while being application-limited are used only when they raise the estimate */
+    if ((rate = quicly_rate_sample_get_rate(rs)) > cc->state.bbr.bw_filter[0] &&
+        (!rs->is_app_limited || rate > get_max_bw(cc)))
+        cc->state.bbr.bw_filter[0] = rate;
+}
+
+static void update_round(quicly_cc_t *cc, const quicly_rate_sample_t *rs, uint32_t bytes)
+{
+    cc->state.bbr.round_start = 0;
+    if (rs->prior_delivered == UINT64_MAX || rs->prior_delivered < cc->state.bbr.next_round_delivered)
+        return;
+
+    uint64_t delivered = rs->prior_delivered + rs->delivered;
+    cc->state.bbr.next_round_delivered = delivered;
+    ++cc->state.bbr.round_count;
+    cc->state.bbr.round_start = 1;
+
+    /* react to the loss rate of the round that just ended (BBRv2) */
+    uint64_t round_delivered = delivered - cc->state.bbr.round_delivered_start;
+    if (cc->state.bbr.round_lost != 0 &&
+        cc->state.bbr.round_lost > (round_delivered + cc->state.bbr.round_lost) * QUICLY_BBR_LOSS_THRESH) {
+        uint32_t inflight_hi = (uint32_t)(cc->cwnd * QUICLY_BBR_BETA);
+        if (inflight_hi < QUICLY_BBR_MIN_PIPE_CWND)
+            inflight_hi = QUICLY_BBR_MIN_PIPE_CWND;
+        if (inflight_hi < cc->state.bbr.inflight_hi)
+            cc->state.bbr.inflight_hi = inflight_hi;
+        if (cc->state.bbr.mode == QUICLY_BBR_STATE_STARTUP) {
+            /* excessive loss in STARTUP means that the pipe is full */
+            cc->state.bbr.full_bw_reached = 1;
+        } else if (cc->state.bbr.mode == QUICLY_BBR_STATE_PROBE_BW && cc->state.bbr.cycle_index == 0) {
+            /* stop probing up */
+            cc->state.bbr.cycle_index = 1;
+        }
+    } else if (cc->state.bbr.mode == QUICLY_BBR_STATE_PROBE_BW && cc->state.bbr.cycle_index == 0 &&
+               cc->state.bbr.inflight_hi != UINT32_MAX) {
+        /* probing up without excessive loss; raise the upper bound */
+        uint64_t inflight_hi = (uint64_t)cc->state.bbr.inflight_hi * 5 / 4;
+        cc->state.bbr.inflight_hi = inflight_hi > UINT32_MAX ? UINT32_MAX : (uint32_t)inflight_hi;
+    }
+    cc->state.bbr.round_delivered_start = delivered;
+    cc->state.bbr.round_lost = 0;
+}
+
+static void check_full_bw_reached(quicly_cc_t *cc, const quicly_rate_sample_t *rs)
+{
+    if (cc->state.bbr.full_bw_reached || !cc->state.bbr.round_start || rs->is_app_limited)
+        return;
+
+    uint64_t bw = get_max_bw(cc);
+    if (bw >= cc->state.bbr.full_bw * QUICLY_BBR_FULL_BW_THRESH) {
+        cc->state.bbr.full_bw = bw;
+        cc->state.bbr.full_bw_count = 0;
+        return;
+    }
+    if (++cc->state.bbr.full_bw_count >= QUICLY_BBR_FULL_BW_COUNT)
+        cc->state.bbr.full_bw_reached = 1;
+}
+
+static void enter_probe_bw(quicly_cc_t *cc, int64_t now)
+{
+    cc->state.bbr.mode = QUICLY_BBR_STATE_PROBE_BW;
+    /* start from a phase other than the one probing down, spreading out the probes of concurrent flows */
+    cc->state.bbr.cycle_index = (uint8_t)(now % (QUICLY_BBR_GAIN_CYCLE_LEN - 1));
+    if (cc->state.bbr.cycle_index != 0)
+        ++cc->state.bbr.cycle_index;
+    cc->state.bbr.cycle_stamp = now;
+}
+
+static void update_state(quicly_cc_t *cc, uint32_t inflight, int64_t now)
+{
+    switch (cc->state.bbr.mode) {
+    case QUICLY_BBR_STATE_STARTUP:
+        if (cc->state.bbr.full_bw_reached)
+            cc->state.bbr.mode = QUICLY_BBR_STATE_DRAIN;
+        break;
+    case QUICLY_BBR_STATE_DRAIN:
+        if (inflight <= get_bdp(cc, 1))
+            enter_probe_bw(cc, now);
+        break;
+    case QUICLY_BBR_STATE_PROBE_BW:
+        /* each phase lasts for min_rtt; the phase probing up lasts until inflight reaches the gain, or until loss is observed */
+        if (now - cc->state.bbr.cycle_stamp > (int64_t)cc->state.bbr.min_rtt) {
+            if (cc->state.bbr.cycle_index != 0 || inflight >= get_bdp(cc, pacing_gain_cycle[0]) ||
+                inflight >= cc->state.bbr.inflight_hi) {
+                cc->state.bbr.cycle_index = (cc->state.bbr.cycle_index + 1) % QUICLY_BBR_GAIN_CYCLE_LEN;
+                cc->state.bbr.cycle_stamp = now;
+            }
+        } else if (cc->state.bbr.cycle_index == 1 && inflight <= get_bdp(cc, 1)) {
+            /* drained the queue built by probing up */
+            cc->state.bbr.cycle_index = 2;
+            cc->state.bbr.cycle_stamp = now;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void update_min_rtt(quicly_cc_t *cc, const quicly_rate_sample_t *rs, uint32_t inflight, int64_t now)
+{
+    int probe_rtt_expired = now > cc->state.bbr.min_rtt_stamp + QUICLY_BBR_PROBE_RTT_INTERVAL;
+
+    if (rs->prior_delivered != UINT64_MAX &&
+        (rs->rtt < cc->state.bbr.min_rtt || now > cc->state.bbr.min_rtt_stamp + QUICLY_BBR_MIN_RTT_WINDOW)) {
+        cc->state.bbr.min_rtt = rs->rtt != 0 ? rs->rtt : 1;
+        cc->state.bbr.min_rtt_stamp = now;
+    }
+
+    /* enter PROBE_RTT if the min RTT has not been refreshed for a while */
+    if (probe_rtt_expired && cc->state.bbr.mode != QUICLY_BBR_STATE_PROBE_RTT && cc->state.bbr.min_rtt != UINT32_MAX) {
+        cc->state.bbr.mode = QUICLY_BBR_STATE_PROBE_RTT;
+        cc->state.bbr.prior_cwnd = cc->cwnd;
+        cc->state.bbr.probe_rtt_done_stamp = INT64_MAX;
+    }
+
+    if (cc->state.bbr.mode == QUICLY_BBR_STATE_PROBE_RTT) {
+        if (cc->state.bbr.probe_rtt_done_stamp == INT64_MAX) {
+            if (inflight <= get_bdp(cc, 0.5) || inflight <= QUICLY_BBR_MIN_PIPE_CWND) {
+                cc->state.bbr.probe_rtt_done_stamp = now + QUICLY_BBR_PROBE_RTT_DURATION;
+                cc->state.bbr.probe_rtt_round_done = 0;
+                cc->state.bbr.next_round_delivered = rs->prior_delivered != UINT64_MAX ? rs->prior_delivered + rs->delivered : 0;
+            }
+        } else {
+            if (cc->state.bbr.round_start)
+                cc->state.bbr.probe_rtt_round_done = 1;
+            if (cc->state.bbr.probe_rtt_round_done && now >= cc->state.bbr.probe_rtt_done_stamp) {
+                cc->state.bbr.min_rtt_stamp = now;
+                if (cc->cwnd < cc->state.bbr.prior_cwnd)
+                    cc->cwnd = cc->state.bbr.prior_cwnd;
+                if (cc->state.bbr.full_bw_reached) {
+                    enter_probe_bw(cc, now);
+                } else {
+                    cc->state.bbr.mode = QUICLY_BBR_STATE_STARTUP;
+                }
+            }
+        }
+    }
+}
+
+static void update_cwnd(quicly_cc_t *cc, uint32_t bytes, const quicly_rate_sample_t *rs)
+{
+    if (cc->state.bbr.mode == QUICLY_BBR_STATE_PROBE_RTT) {
+        uint32_t probe_rtt_cwnd = get_bdp(cc, 0.5);
+        if (probe_rtt_cwnd < QUICLY_BBR_MIN_PIPE_CWND)
+            probe_rtt_cwnd = QUICLY_BBR_MIN_PIPE_CWND;
+        if (cc->cwnd > probe_rtt_cwnd)
+            cc->cwnd = probe_rtt_cwnd;
+        return;
+    }
+
+    uint32_t target = get_bdp(cc, cc->state.bbr.mode == QUICLY_BBR_STATE_STARTUP ? QUICLY_BBR_HIGH_GAIN : QUICLY_BBR_CWND_GAIN);
+    if (cc->state.bbr.full_bw_reached) {
+        cc->cwnd = cc->cwnd + bytes < target ? cc->cwnd + bytes : target;
+    } else if (cc->cwnd < target || (get_max_bw(cc) == 0 && !rs->is_app_limited)) {
+        cc->cwnd += bytes;
+    }
+    if (cc->cwnd > cc->state.bbr.inflight_hi)
+        cc->cwnd = cc->state.bbr.inflight_hi;
+    if (cc->cwnd < QUICLY_BBR_MIN_PIPE_CWND)
+        cc->cwnd = QUICLY_BBR_MIN_PIPE_CWND;
+}
+
+static void bbr_init(quicly_cc_t *cc, int64_t now)
+{
+    cc->cwnd = QUICLY_INITIAL_WINDOW * QUICLY_MAX_PACKET_SIZE;
+    cc->ssthresh = UINT32_MAX;
+    cc->state.bbr.mode = QUICLY_BBR_STATE_STARTUP;
+    cc->state.bbr.min_rtt = UINT32_MAX;
+    cc->state.bbr.min_rtt_stamp = now;
+    cc->state.bbr.inflight_hi = UINT32_MAX;
+    cc->state.bbr.probe_rtt_done_stamp = INT64_MAX;
+}
+
+static void bbr_on_acked(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t largest_acked, uint32_t inflight,
+                         uint64_t next_pn, int64_t now, const quicly_rate_sample_t *rs)
+{
+    assert(inflight >= bytes);
+
+    update_round(cc, rs, bytes);
+    update_bw(cc, rs);
+    check_full_bw_reached(cc, rs);
+    update_state(cc, inflight - bytes, now);
+    update_min_rtt(cc, rs, inflight - bytes, now);
+    update_pacing_rate(cc, rtt);
+    update_cwnd(cc, bytes, rs);
+}
+
+static void bbr_on_lost(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t lost_pn, uint64_t next_pn, int64_t now)
+{
+    /* the loss rate is evaluated at the end of each round (see update_round) */
+    cc->state.bbr.round_lost += bytes;
+}
+
+static void bbr_on_persistent_congestion(quicly_cc_t *cc, const quicly_rtt_t *rtt, int64_t now)
+{
+    /* the path model is likely to be stale; restart from a small window but keep the min_rtt estimate */
+    cc->state.bbr.prior_cwnd = cc->cwnd;
+    cc->cwnd = QUICLY_BBR_MIN_PIPE_CWND;
+    cc->state.bbr.bw_filter[0] = 0;
+    cc->state.bbr.bw_filter[1] = 0;
+    cc->state.bbr.full_bw = 0;
+    cc->state.bbr.full_bw_count = 0;
+    cc->state.bbr.full_bw_reached = 0;
+    cc->state.bbr.inflight_hi = UINT32_MAX;
+    cc->state.bbr.mode = QUICLY_BBR_STATE_STARTUP;
+    update_pacing_rate(cc, rtt);
+}
+
+const quicly_cc_algorithm_t quicly_cc_bbr = {"bbr", bbr_init, bbr_on_acked, bbr_on_lost, bbr_on_persistent_congestion};
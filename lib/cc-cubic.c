@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2019 Fastly, Janardhan Iyengar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include "quicly/cc.h"
+
+#define QUICLY_CUBIC_C 0.4
+#define QUICLY_CUBIC_BETA 0.7
+
+/* HyStart++ parameters (draft-ietf-tcpm-hystartplusplus) */
+#define QUICLY_HYSTART_MIN_RTT_THRESH 4  /* milliseconds */
+#define QUICLY_HYSTART_MAX_RTT_THRESH 16 /* milliseconds */
+#define QUICLY_HYSTART_N_RTT_SAMPLE 8
+#define QUICLY_HYSTART_CSS_GROWTH_DIVISOR 4
+#define QUICLY_HYSTART_CSS_ROUNDS 5
+
+/**
+ * W_cubic(t) = C * (t - K)^3 + W_max (RFC 8312, section 4.1), in bytes
+ */
+static double calc_w_cubic(quicly_cc_t *cc, double t_sec)
+{
+    double tk = t_sec - cc->state.cubic.k;
+    return QUICLY_CUBIC_C * tk * tk * tk * QUICLY_MAX_PACKET_SIZE + cc->state.cubic.w_max;
+}
+
+/**
+ * W_est(t) = W_max * beta + [3 * (1 - beta) / (1 + beta)] * (t / RTT) (RFC 8312, section 4.2), in bytes
+ */
+static double calc_w_est(quicly_cc_t *cc, double t_sec, double rtt_sec)
+{
+    return cc->state.cubic.w_max * QUICLY_CUBIC_BETA +
+           3 * (1 - QUICLY_CUBIC_BETA) / (1 + QUICLY_CUBIC_BETA) * (t_sec / rtt_sec) * QUICLY_MAX_PACKET_SIZE;
+}
+
+static void start_avoidance_epoch(quicly_cc_t *cc, int64_t now)
+{
+    cc->state.cubic.avoidance_start = now;
+    if (cc->state.cubic.w_max > cc->cwnd) {
+        cc->state.cubic.k = cbrt((double)(cc->state.cubic.w_max - cc->cwnd) / QUICLY_MAX_PACKET_SIZE / QUICLY_CUBIC_C);
+    } else {
+        /* entering congestion avoidance from slow start, or cwnd has already reached w_max */
+        cc->state.cubic.w_max = cc->cwnd;
+        cc->state.cubic.k = 0;
+    }
+}
+
+static void hystart_start_round(quicly_cc_t *cc, uint64_t next_pn)
+{
+    cc->state.cubic.hystart.window_end = next_pn;
+    cc->state.cubic.hystart.last_round_min_rtt = cc->state.cubic.hystart.current_round_min_rtt;
+    cc->state.cubic.hystart.current_round_min_rtt = UINT32_MAX;
+    cc->state.cubic.hystart.rtt_sample_count = 0;
+}
+
+static void cubic_slow_start(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t largest_acked, uint64_t next_pn,
+                             int64_t now)
+{
+    int in_css = cc->state.cubic.hystart.css_baseline_min_rtt != UINT32_MAX;
+
+    /* round tracking */
+    if (largest_acked >= cc->state.cubic.hystart.window_end) {
+        hystart_start_round(cc, next_pn);
+        if (in_css && ++cc->state.cubic.hystart.css_round_count >= QUICLY_HYSTART_CSS_ROUNDS) {
+            /* CSS has lasted long enough; the increase in delay was not spurious, move to congestion avoidance */
+            cc->ssthresh = cc->cwnd;
+            start_avoidance_epoch(cc, now);
+            return;
+        }
+    }
+
+    /* collect RTT samples */
+    if (rtt->latest < cc->state.cubic.hystart.current_round_min_rtt)
+        cc->state.cubic.hystart.current_round_min_rtt = rtt->latest;
+    ++cc->state.cubic.hystart.rtt_sample_count;
+
+    if (!in_css) {
+        cc->cwnd += bytes;
+        if (cc->state.cubic.hystart.rtt_sample_count >= QUICLY_HYSTART_N_RTT_SAMPLE &&
+            cc->state.cubic.hystart.current_round_min_rtt != UINT32_MAX &&
+            cc->state.cubic.hystart.last_round_min_rtt != UINT32_MAX) {
+            uint32_t thresh = cc->state.cubic.hystart.last_round_min_rtt / 8;
+            if (thresh < QUICLY_HYSTART_MIN_RTT_THRESH)
+                thresh = QUICLY_HYSTART_MIN_RTT_THRESH;
+            if (thresh > QUICLY_HYSTART_MAX_RTT_THRESH)
+                thresh = QUICLY_HYSTART_MAX_RTT_THRESH;
+            if (cc->state.cubic.hystart.current_round_min_rtt >= cc->state.cubic.hystart.last_round_min_rtt + thresh) {
+                /* delay increase detected; enter Conservative Slow Start */
+                cc->state.cubic.hystart.css_baseline_min_rtt = cc->state.cubic.hystart.current_round_min_rtt;
+                cc->state.cubic.hystart.css_round_count = 0;
+            }
+        }
+    } else {
+        cc->cwnd += bytes / QUICLY_HYSTART_CSS_GROWTH_DIVISOR;
+        if (cc->state.cubic.hystart.rtt_sample_count >= QUICLY_HYSTART_N_RTT_SAMPLE &&
+            cc->state.cubic.hystart.current_round_min_rtt < cc->state.cubic.hystart.css_baseline_min_rtt) {
+            /* the delay increase was spurious; resume slow start */
+            cc->state.cubic.hystart.css_baseline_min_rtt = UINT32_MAX;
+        }
+    }
+}
+
+static void cubic_init(quicly_cc_t *cc, int64_t now)
+{
+    cc->cwnd = QUICLY_INITIAL_WINDOW * QUICLY_MAX_PACKET_SIZE;
+    cc->ssthresh = UINT32_MAX;
+    cc->state.cubic.avoidance_start = INT64_MAX;
+    cc->state.cubic.last_acked_at = now;
+    cc->state.cubic.hystart.last_round_min_rtt = UINT32_MAX;
+    cc->state.cubic.hystart.current_round_min_rtt = UINT32_MAX;
+    cc->state.cubic.hystart.css_baseline_min_rtt = UINT32_MAX;
+}
+
+static void cubic_on_acked(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t largest_acked, uint32_t inflight,
+                           uint64_t next_pn, int64_t now, const quicly_rate_sample_t *rs)
+{
+    int64_t last_acked_at = cc->state.cubic.last_acked_at;
+
+    assert(inflight >= bytes);
+    cc->state.cubic.last_acked_at = now;
+    /* no increases while in recovery */
+    if (largest_acked < cc->recovery_end)
+        return;
+
+    /* no increases if the window was not being utilized; the cubic function does not advance either (RFC 8312bis, section 5.8) */
+    if (rs->is_app_limited) {
+        if (cc->state.cubic.avoidance_start != INT64_MAX && last_acked_at < now)
+            cc->state.cubic.avoidance_start += now - last_acked_at;
+        return;
+    }
+
+    /* slow start */
+    if (cc->cwnd < cc->ssthresh) {
+        cubic_slow_start(cc, rtt, bytes, largest_acked, next_pn, now);
+        return;
+    }
+
+    /* congestion avoidance */
+    if (cc->state.cubic.avoidance_start == INT64_MAX)
+        start_avoidance_epoch(cc, now);
+    double t_sec = (now - cc->state.cubic.avoidance_start) / 1000.0;
+    double rtt_sec = (rtt->smoothed != 0 ? rtt->smoothed : rtt->latest) / 1000.0;
+    if (rtt_sec <= 0)
+        rtt_sec = 0.001;
+
+    double w_est = calc_w_est(cc, t_sec, rtt_sec);
+    if (calc_w_cubic(cc, t_sec) < w_est) {
+        /* TCP-friendly region */
+        if (cc->cwnd < w_est)
+            cc->cwnd = (uint32_t)w_est;
+    } else {
+        /* concave and convex regions; increase cwnd by (target - cwnd) / cwnd for each byte being acked */
+        double target = calc_w_cubic(cc, t_sec + rtt_sec);
+        if (target > 1.5 * cc->cwnd)
+            target = 1.5 * cc->cwnd;
+        if (target > cc->cwnd)
+            cc->cwnd += (uint32_t)((target - cc->cwnd) / cc->cwnd * bytes);
+    }
+}
+
+static void cubic_on_lost(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t lost_pn, uint64_t next_pn, int64_t now)
+{
+    /* nothing to do if loss is in recovery window */
+    if (lost_pn < cc->recovery_end)
+        return;
+    cc->recovery_end = next_pn;
+
+    /* fast convergence (RFC 8312, section 4.6) */
+    if (cc->cwnd < cc->state.cubic.w_last_max) {
+        cc->state.cubic.w_last_max = cc->cwnd;
+        cc->state.cubic.w_max = (uint32_t)(cc->cwnd * (1 + QUICLY_CUBIC_BETA) / 2);
+    } else {
+        cc->state.cubic.w_last_max = cc->cwnd;
+        cc->state.cubic.w_max = cc->cwnd;
+    }
+
+    cc->cwnd *= QUICLY_CUBIC_BETA;
+    if (cc->cwnd < QUICLY_MIN_CWND * QUICLY_MAX_PACKET_SIZE)
+        cc->cwnd = QUICLY_MIN_CWND * QUICLY_MAX_PACKET_SIZE;
+    cc->ssthresh = cc->cwnd;
+    cc->state.cubic.hystart.css_baseline_min_rtt = UINT32_MAX;
+    start_avoidance_epoch(cc, now);
+}
+
+static void cubic_on_persistent_congestion(quicly_cc_t *cc, const quicly_rtt_t *rtt, int64_t now)
+{
+    /* collapse cwnd and slow start towards ssthresh (which has been set by the loss episode); a new cubic epoch begins once
+     * congestion avoidance is entered */
+    cc->cwnd = QUICLY_MIN_CWND * QUICLY_MAX_PACKET_SIZE;
+    cc->state.cubic.avoidance_start = INT64_MAX;
+    cc->state.cubic.w_last_max = 0;
+    cc->state.cubic.hystart.window_end = 0;
+    cc->state.cubic.hystart.last_round_min_rtt = UINT32_MAX;
+    cc->state.cubic.hystart.current_round_min_rtt = UINT32_MAX;
+    cc->state.cubic.hystart.css_baseline_min_rtt = UINT32_MAX;
+}
+
+const quicly_cc_algorithm_t quicly_cc_cubic = {"cubic", cubic_init, cubic_on_acked, cubic_on_lost, cubic_on_persistent_congestion};
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2019 Fastly, Janardhan Iyengar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "quicly/cc.h"
+
+/**
+ * gain of the EWMA that tracks the fraction of CE-marked packets (DCTCP / TCP Prague use 1/16)
+ */
+#define QUICLY_L4S_ALPHA_GAIN (1. / 16)
+
+static void on_ce_scalable(quicly_cc_t *cc, uint32_t num_acked, uint32_t num_ce, uint64_t largest_acked, uint64_t next_pn)
+{
+    cc->l4s.round_acked += num_acked;
+    cc->l4s.round_marked += num_ce;
+
+    /* reduce cwnd in proportion to the extent of congestion, at most once per round trip */
+    if (num_ce != 0 && largest_acked >= cc->l4s.cwr_end && largest_acked >= cc->recovery_end) {
+        cc->cwnd -= (uint32_t)(cc->cwnd * cc->l4s.alpha / 2);
+        if (cc->cwnd < QUICLY_MIN_CWND * QUICLY_MAX_PACKET_SIZE)
+            cc->cwnd = QUICLY_MIN_CWND * QUICLY_MAX_PACKET_SIZE;
+        cc->ssthresh = cc->cwnd;
+        cc->state.reno.stash = 0;
+        cc->l4s.cwr_end = next_pn;
+    }
+
+    /* update alpha once every round trip */
+    if (largest_acked >= cc->l4s.round_end) {
+        if (cc->l4s.round_acked != 0) {
+            double frac = (double)cc->l4s.round_marked / cc->l4s.round_acked;
+            if (frac > 1)
+                frac = 1;
+            cc->l4s.alpha += QUICLY_L4S_ALPHA_GAIN * (frac - cc->l4s.alpha);
+        }
+        cc->l4s.round_end = next_pn;
+        cc->l4s.round_acked = 0;
+        cc->l4s.round_marked = 0;
+    }
+}
+
+void quicly_cc_on_ecn(quicly_cc_t *cc, const quicly_rtt_t *rtt, int scalable, uint32_t num_acked, uint32_t num_ce,
+                      uint64_t largest_acked, uint64_t next_pn, int64_t now)
+{
+    if (scalable && cc->algo == &quicly_cc_reno) {
+        on_ce_scalable(cc, num_acked, num_ce, largest_acked, next_pn);
+    } else if (num_ce != 0) {
+        /* classic ECN (RFC 3168); a CE mark is a loss without the retransmission */
+        cc->algo->on_lost(cc, rtt, num_ce * QUICLY_MAX_PACKET_SIZE, largest_acked, next_pn, now);
+    }
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2019 Fastly, Janardhan Iyengar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* A delay-based congestion controller for real-time media, following the design of Google Congestion Control
+ * (draft-ietf-rmcat-gcc-02). The controller consists of three parts:
+ *
+ * - a trendline filter that estimates the gradient of the one-way delay. Because each RTT sample is the difference between the time
+ *   the ACK was received and the send time recorded in the sentmap, the difference between two consecutive samples equals the
+ *   variation of the one-way delay (the clock offset and the constant part of the path delay cancel out).
+ * - an overuse detector comparing the gradient against an adaptive threshold.
+ * - an AIMD rate controller that adjusts the target bitrate, complemented by a loss-based controller evaluated once per round trip.
+ *
+ * The result is exposed as `target_bitrate`, to be used for configuring the media encoder. The congestion window is sized to twice
+ * the BDP of the target bitrate, so that it only limits senders that do not follow the target.
+ */
+
+#include <math.h>
+#include "quicly/cc.h"
+
+#define QUICLY_MEDIA_CC_SMOOTHING_COEF 0.9
+#define QUICLY_MEDIA_CC_THRESHOLD_GAIN 4
+#define QUICLY_MEDIA_CC_MAX_DELTAS 60
+#define QUICLY_MEDIA_CC_INITIAL_THRESHOLD 12.5 /* milliseconds */
+#define QUICLY_MEDIA_CC_MIN_THRESHOLD 6
+#define QUICLY_MEDIA_CC_MAX_THRESHOLD 600
+#define QUICLY_MEDIA_CC_K_UP 0.0087
+#define QUICLY_MEDIA_CC_K_DOWN 0.039
+#define QUICLY_MEDIA_CC_OVERUSE_TIME 10 /* milliseconds */
+#define QUICLY_MEDIA_CC_INCREASE_FACTOR 1.08 /* per second */
+#define QUICLY_MEDIA_CC_DECREASE_FACTOR 0.85
+#define QUICLY_MEDIA_CC_HIGH_LOSS 0.1
+#define QUICLY_MEDIA_CC_MIN_CWND (4 * QUICLY_MAX_PACKET_SIZE)
+
+static uint32_t get_rtt(const quicly_rtt_t *rtt)
+{
+    uint32_t v = rtt->smoothed != 0 ? rtt->smoothed : rtt->latest;
+    return v != 0 ? v : 1;
+}
+
+/**
+ * returns the slope of the linear regression of the samples being stored in the trendline filter
+ */
+static double calc_trend(quicly_cc_t *cc)
+{
+    double sum_x = 0, sum_y = 0, num = 0, den = 0;
+    size_t n = cc->state.media.trend_num, i;
+
+    for (i = 0; i != n; ++i) {
+        sum_x += cc->state.media.trend_x[i];
+        sum_y += cc->state.media.trend_y[i];
+    }
+    double avg_x = sum_x / n, avg_y = sum_y / n;
+    for (i = 0; i != n; ++i) {
+        double dx = cc->state.media.trend_x[i] - avg_x;
+        num += dx * (cc->state.media.trend_y[i] - avg_y);
+        den += dx * dx;
+    }
+    return den != 0 ? num / den : cc->state.media.prev_trend;
+}
+
+static void update_threshold(quicly_cc_t *cc, double modified_trend, int64_t now)
+{
+    double abs_trend = fabs(modified_trend);
+
+    /* do not let spikes (e.g., due to a route change) inflate the threshold */
+    if (abs_trend > cc->state.media.threshold + 15) {
+        cc->state.media.threshold_updated_at = now;
+        return;
+    }
+
+    double k = abs_trend < cc->state.media.threshold ? QUICLY_MEDIA_CC_K_DOWN : QUICLY_MEDIA_CC_K_UP;
+    int64_t elapsed = now - cc->state.media.threshold_updated_at;
+    if (elapsed > 100)
+        elapsed = 100;
+    cc->state.media.threshold += k * (abs_trend - cc->state.media.threshold) * elapsed;
+    if (cc->state.media.threshold < QUICLY_MEDIA_CC_MIN_THRESHOLD)
+        cc->state.media.threshold = QUICLY_MEDIA_CC_MIN_THRESHOLD;
+    if (cc->state.media.threshold > QUICLY_MEDIA_CC_MAX_THRESHOLD)
+        cc->state.media.threshold = QUICLY_MEDIA_CC_MAX_THRESHOLD;
+    cc->state.media.threshold_updated_at = now;
+}
+
+static void detect_overuse(quicly_cc_t *cc, uint32_t rtt_sample, int64_t now)
+{
+    if (cc->state.media.prev_rtt == UINT32_MAX) {
+        cc->state.media.prev_rtt = rtt_sample;
+        cc->state.media.first_sample_at = now;
+        cc->state.media.threshold_updated_at = now;
+        return;
+    }
+
+    /* feed the trendline filter */
+    cc->state.media.accumulated_delay += (double)rtt_sample - cc->state.media.prev_rtt;
+    cc->state.media.prev_rtt = rtt_sample;
+    cc->state.media.smoothed_delay = QUICLY_MEDIA_CC_SMOOTHING_COEF * cc->state.media.smoothed_delay +
+                                     (1 - QUICLY_MEDIA_CC_SMOOTHING_COEF) * cc->state.media.accumulated_delay;
+    cc->state.media.trend_x[cc->state.media.trend_pos] = (double)(now - cc->state.media.first_sample_at);
+    cc->state.media.trend_y[cc->state.media.trend_pos] = cc->state.media.smoothed_delay;
+    cc->state.media.trend_pos = (cc->state.media.trend_pos + 1) % QUICLY_MEDIA_CC_TRENDLINE_WINDOW;
+    if (cc->state.media.trend_num < QUICLY_MEDIA_CC_TRENDLINE_WINDOW)
+        ++cc->state.media.trend_num;
+    if (cc->state.media.num_deltas < QUICLY_MEDIA_CC_MAX_DELTAS)
+        ++cc->state.media.num_deltas;
+    if (cc->state.media.trend_num < QUICLY_MEDIA_CC_TRENDLINE_WINDOW)
+        return;
+
+    /* compare the trend against the threshold */
+    double trend = calc_trend(cc);
+    double modified_trend = cc->state.media.num_deltas * trend * QUICLY_MEDIA_CC_THRESHOLD_GAIN;
+    if (modified_trend > cc->state.media.threshold) {
+        if (cc->state.media.overuse_since == INT64_MAX) {
+            cc->state.media.overuse_since = now;
+            cc->state.media.overuse_count = 0;
+        }
+        ++cc->state.media.overuse_count;
+        if (now - cc->state.media.overuse_since >= QUICLY_MEDIA_CC_OVERUSE_TIME && cc->state.media.overuse_count > 1 &&
+            trend >= cc->state.media.prev_trend) {
+            cc->state.media.overuse_since = INT64_MAX;
+            cc->state.media.usage = QUICLY_MEDIA_CC_USAGE_OVERUSE;
+        }
+    } else if (modified_trend < -cc->state.media.threshold) {
+        cc->state.media.overuse_since = INT64_MAX;
+        cc->state.media.usage = QUICLY_MEDIA_CC_USAGE_UNDERUSE;
+    } else {
+        cc->state.media.overuse_since = INT64_MAX;
+        cc->state.media.usage = QUICLY_MEDIA_CC_USAGE_NORMAL;
+    }
+    cc->state.media.prev_trend = trend;
+    update_threshold(cc, modified_trend, now);
+}
+
+static void set_target_bitrate(quicly_cc_t *cc, double bitrate, const quicly_rtt_t *rtt)
+{
+    if (bitrate < cc->state.media.min_bitrate)
+        bitrate = cc->state.media.min_bitrate;
+    if (bitrate > cc->state.media.max_bitrate)
+        bitrate = cc->state.media.max_bitrate;
+    cc->target_bitrate = (uint64_t)bitrate;
+
+    /* let the window accommodate twice the BDP of the target, and pace at the target */
+    uint64_t cwnd = cc->target_bitrate / 8 * get_rtt(rtt) / 1000 * 2 + 2 * QUICLY_MAX_PACKET_SIZE;
+    if (cwnd < QUICLY_MEDIA_CC_MIN_CWND)
+        cwnd = QUICLY_MEDIA_CC_MIN_CWND;
+    cc->cwnd = cwnd > UINT32_MAX ? UINT32_MAX : (uint32_t)cwnd;
+    cc->pacing_rate = cc->target_bitrate / 8;
+}
+
+static void update_rate(quicly_cc_t *cc, const quicly_rtt_t *rtt, int64_t now)
+{
+    double bitrate = cc->target_bitrate;
+
+    switch (cc->state.media.usage) {
+    case QUICLY_MEDIA_CC_USAGE_OVERUSE:
+        if (cc->state.media.rate_state != QUICLY_MEDIA_CC_RATE_DECREASE)
+            cc->state.media.rate_state = QUICLY_MEDIA_CC_RATE_DECREASE;
+        break;
+    case QUICLY_MEDIA_CC_USAGE_UNDERUSE:
+        /* wait for the queues to drain */
+        cc->state.media.rate_state = QUICLY_MEDIA_CC_RATE_HOLD;
+        break;
+    default:
+        if (cc->state.media.rate_state != QUICLY_MEDIA_CC_RATE_INCREASE)
+            cc->state.media.rate_state = QUICLY_MEDIA_CC_RATE_INCREASE;
+        break;
+    }
+
+    switch (cc->state.media.rate_state) {
+    case QUICLY_MEDIA_CC_RATE_INCREASE: {
+        int64_t elapsed = now - cc->state.media.rate_updated_at;
+        if (elapsed > 1000)
+            elapsed = 1000;
+        bitrate *= pow(QUICLY_MEDIA_CC_INCREASE_FACTOR, elapsed / 1000.);
+        /* do not run away from what is actually being delivered */
+        if (cc->state.media.acked_bitrate != 0) {
+            double cap = 1.5 * cc->state.media.acked_bitrate + 10000;
+            if (bitrate > cap)
+                bitrate = cc->target_bitrate > cap ? cc->target_bitrate : cap;
+        }
+    } break;
+    case QUICLY_MEDIA_CC_RATE_DECREASE:
+        /* decrease at most once per round trip */
+        if (now - cc->state.media.decreased_at >= get_rtt(rtt)) {
+            /* back off relative to the delivery rate, or to the target if the delivery rate is higher (e.g., stale samples) */
+            double base = cc->state.media.acked_bitrate != 0 && cc->state.media.acked_bitrate < bitrate
+                              ? cc->state.media.acked_bitrate
+                              : bitrate;
+            bitrate = base * QUICLY_MEDIA_CC_DECREASE_FACTOR;
+            cc->state.media.decreased_at = now;
+        }
+        cc->state.media.rate_state = QUICLY_MEDIA_CC_RATE_HOLD;
+        break;
+    default:
+        break;
+    }
+
+    cc->state.media.rate_updated_at = now;
+    set_target_bitrate(cc, bitrate, rtt);
+}
+
+static void check_loss(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint64_t largest_acked, uint64_t next_pn)
+{
+    if (largest_acked < cc->state.media.loss_round_end)
+        return;
+
+    uint64_t total = cc->state.media.round_acked + cc->state.media.round_lost;
+    if (total != 0) {
+        double loss = (double)cc->state.media.round_lost / total;
+        if (loss > QUICLY_MEDIA_CC_HIGH_LOSS)
+            set_target_bitrate(cc, cc->target_bitrate * (1 - 0.5 * loss), rtt);
+    }
+    cc->state.media.round_acked = 0;
+    cc->state.media.round_lost = 0;
+    cc->state.media.loss_round_end = next_pn;
+}
+
+static void media_init(quicly_cc_t *cc, int64_t now)
+{
+    cc->ssthresh = UINT32_MAX;
+    cc->state.media.min_bitrate = QUICLY_MEDIA_CC_MIN_BITRATE;
+    cc->state.media.max_bitrate = QUICLY_MEDIA_CC_MAX_BITRATE;
+    cc->state.media.prev_rtt = UINT32_MAX;
+    cc->state.media.threshold = QUICLY_MEDIA_CC_INITIAL_THRESHOLD;
+    cc->state.media.overuse_since = INT64_MAX;
+    cc->state.media.rate_updated_at = now;
+    cc->state.media.decreased_at = INT64_MIN / 2;
+    cc->target_bitrate = QUICLY_MEDIA_CC_START_BITRATE;
+    cc->pacing_rate = cc->target_bitrate / 8;
+    cc->cwnd = QUICLY_INITIAL_WINDOW * QUICLY_MAX_PACKET_SIZE;
+}
+
+static void media_on_acked(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t largest_acked, uint32_t inflight,
+                           uint64_t next_pn, int64_t now, const quicly_rate_sample_t *rs)
+{
+    uint64_t rate;
+
+    cc->state.media.round_acked += bytes;
+
+    if (rs->prior_delivered != UINT64_MAX) {
+        if ((rate = quicly_rate_sample_get_rate(rs) * 8) != 0)
+            cc->state.media.acked_bitrate =
+                cc->state.media.acked_bitrate == 0 ? rate : (cc->state.media.acked_bitrate * 3 + rate) / 4;
+        detect_overuse(cc, rs->rtt, now);
+    }
+
+    update_rate(cc, rtt, now);
+    check_loss(cc, rtt, largest_acked, next_pn);
+}
+
+static void media_on_lost(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t lost_pn, uint64_t next_pn, int64_t now)
+{
+    /* the loss ratio is evaluated once per round trip (see check_loss) */
+    cc->state.media.round_lost += bytes;
+}
+
+static void media_on_persistent_congestion(quicly_cc_t *cc, const quicly_rtt_t *rtt, int64_t now)
+{
+    cc->state.media.acked_bitrate = 0;
+    cc->state.media.prev_rtt = UINT32_MAX;
+    cc->state.media.accumulated_delay = 0;
+    cc->state.media.smoothed_delay = 0;
+    cc->state.media.trend_num = 0;
+    cc->state.media.trend_pos = 0;
+    cc->state.media.num_deltas = 0;
+    cc->state.media.usage = QUICLY_MEDIA_CC_USAGE_NORMAL;
+    cc->state.media.rate_state = QUICLY_MEDIA_CC_RATE_HOLD;
+    cc->state.media.rate_updated_at = now;
+    cc->state.media.decreased_at = now;
+    set_target_bitrate(cc, cc->state.media.min_bitrate, rtt);
+}
+
+const quicly_cc_algorithm_t quicly_cc_media = {"media", media_init, media_on_acked, media_on_lost, media_on_persistent_congestion};
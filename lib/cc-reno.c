@@ -22,24 +22,24 @@
 
 #include "quicly/cc.h"
 
-#define QUICLY_INITIAL_WINDOW 10
-#define QUICLY_MIN_CWND 2
 #define QUICLY_RENO_BETA 0.7
 
-void quicly_cc_init(quicly_cc_t *cc)
+static void reno_init(quicly_cc_t *cc, int64_t now)
 {
-    memset(cc, 0, sizeof(quicly_cc_t));
     cc->cwnd = QUICLY_INITIAL_WINDOW * QUICLY_MAX_PACKET_SIZE;
     cc->ssthresh = UINT32_MAX;
 }
 
-// TODO: Avoid increase if sender was application limited
-void quicly_cc_on_acked(quicly_cc_t *cc, uint32_t bytes, uint64_t largest_acked, uint32_t inflight)
+static void reno_on_acked(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t largest_acked, uint32_t inflight,
+                          uint64_t next_pn, int64_t now, const quicly_rate_sample_t *rs)
 {
     assert(inflight >= bytes);
     // no increases while in recovery
     if (largest_acked < cc->recovery_end)
         return;
+    // no increases if the window was not being utilized
+    if (rs->is_app_limited)
+        return;
 
     // slow start
     if (cc->cwnd < cc->ssthresh) {
@@ -47,16 +47,16 @@ void quicly_cc_on_acked(quicly_cc_t *cc, uint32_t bytes, uint64_t largest_acked,
         return;
     }
     // congestion avoidance
-    cc->stash += bytes;
-    if (cc->stash < cc->cwnd)
+    cc->state.reno.stash += bytes;
+    if (cc->state.reno.stash < cc->cwnd)
         return;
     // increase cwnd by 1 MSS per cwnd acked
-    uint32_t count = cc->stash / cc->cwnd;
-    cc->stash -= count * cc->cwnd;
+    uint32_t count = cc->state.reno.stash / cc->cwnd;
+    cc->state.reno.stash -= count * cc->cwnd;
     cc->cwnd += count * QUICLY_MAX_PACKET_SIZE;
 }
 
-void quicly_cc_on_lost(quicly_cc_t *cc, uint32_t bytes, uint64_t lost_pn, uint64_t next_pn)
+static void reno_on_lost(quicly_cc_t *cc, const quicly_rtt_t *rtt, uint32_t bytes, uint64_t lost_pn, uint64_t next_pn, int64_t now)
 {
     // nothing to do if loss is in recovery window
     if (lost_pn < cc->recovery_end)
@@ -69,7 +69,11 @@ void quicly_cc_on_lost(quicly_cc_t *cc, uint32_t bytes, uint64_t lost_pn, uint64
     cc->ssthresh = cc->cwnd;
 }
 
-void quicly_cc_on_persistent_congestion(quicly_cc_t *cc)
+static void reno_on_persistent_congestion(quicly_cc_t *cc, const quicly_rtt_t *rtt, int64_t now)
 {
-    // TODO
+    // collapse cwnd to the minimum; ssthresh has already been lowered by the loss episode that preceded this event
+    cc->cwnd = QUICLY_MIN_CWND * QUICLY_MAX_PACKET_SIZE;
+    cc->state.reno.stash = 0;
 }
+
+const quicly_cc_algorithm_t quicly_cc_reno = {"reno", reno_init, reno_on_acked, reno_on_lost, reno_on_persistent_congestion};
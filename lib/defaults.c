@@ -24,12 +24,17 @@
 
 #define DEFAULT_MAX_PACKETS_PER_KEY 16777216
 #define DEFAULT_MAX_CRYPTO_BYTES 65536
+#define DEFAULT_MAX_ACK_RANGES (QUICLY_ENCODE_ACK_MAX_BLOCKS - 1)
+
+const quicly_cc_algorithm_t *const quicly_cc_all_algorithms[] = {&quicly_cc_reno, &quicly_cc_cubic, &quicly_cc_bbr,
+                                                                  &quicly_cc_media, NULL};
 
 /* profile that employs IETF specified values */
 const quicly_context_t quicly_spec_context = {
     NULL,                   /* tls */
     QUICLY_MAX_PACKET_SIZE, /* max_packet_size */
     QUICLY_LOSS_SPEC_CONF,  /* loss */
+    &quicly_cc_reno,        /* cc_algorithm */
     {
         {1 * 1024 * 1024, 1 * 1024 * 1024, 1 * 1024 * 1024}, /* max_stream_data */
         16 * 1024 * 1024,                                    /* max_data. Original: 16 * 1024 * 1024 */
@@ -40,6 +45,8 @@ const quicly_context_t quicly_spec_context = {
     },
     DEFAULT_MAX_PACKETS_PER_KEY,
     DEFAULT_MAX_CRYPTO_BYTES,
+    DEFAULT_MAX_ACK_RANGES,
+    QUICLY_ECN_NOT_ECT, /* ecn */
     0, /* enforce_version_negotiation */
     0, /* is_clustered */
     0, /* enlarge_client_hello */
@@ -57,6 +64,7 @@ const quicly_context_t quicly_performant_context = {
     NULL,                         /* tls */
     QUICLY_MAX_PACKET_SIZE,       /* max_packet_size */
     QUICLY_LOSS_PERFORMANT_CONF,  /* loss */
+    &quicly_cc_reno,              /* cc_algorithm */
     {
         {1 * 1024 * 1024, 1 * 1024 * 1024, 1 * 1024 * 1024}, /* max_stream_data */
         16 * 1024 * 1024,                                    /* max_data */
@@ -67,6 +75,8 @@ const quicly_context_t quicly_performant_context = {
     },
     DEFAULT_MAX_PACKETS_PER_KEY,
     DEFAULT_MAX_CRYPTO_BYTES,
+    DEFAULT_MAX_ACK_RANGES,
+    QUICLY_ECN_NOT_ECT, /* ecn */
     0, /* enforce_version_negotiation */
     0, /* is_clustered */
     0, /* enlarge_client_hello */
@@ -86,6 +96,7 @@ static quicly_datagram_t *default_alloc_packet(quicly_packet_allocator_t *self,
     if ((packet = malloc(sizeof(*packet) + payloadsize)) == NULL)
         return NULL;
     packet->data.base = (uint8_t *)packet + sizeof(*packet);
+    packet->ecn = QUICLY_ECN_NOT_ECT;
 
     return packet;
 }
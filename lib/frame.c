@@ -32,7 +32,8 @@ uint8_t *quicly_encode_path_challenge_frame(uint8_t *dst, int is_response, const
     return dst;
 }
 
-uint8_t *quicly_encode_ack_frame(uint8_t *dst, uint8_t *dst_end, quicly_ranges_t *ranges, uint64_t ack_delay, uint64_t largest_ack_received_at)
+uint8_t *quicly_encode_ack_frame(uint8_t *dst, uint8_t *dst_end, quicly_ranges_t *ranges, uint64_t ack_delay, uint64_t largest_ack_received_at,
+                                 const uint64_t *ecn_counts)
 {
 #define WRITE_BLOCK(start, end)                                                                                                    \
     do {                                                                                                                           \
@@ -47,7 +48,7 @@ uint8_t *quicly_encode_ack_frame(uint8_t *dst, uint8_t *dst_end, quicly_ranges_t
 
     assert(ranges->num_ranges != 0);
 
-    *dst++ = QUICLY_FRAME_TYPE_ACK;
+    *dst++ = ecn_counts != NULL ? QUICLY_FRAME_TYPE_ACK_ECN : QUICLY_FRAME_TYPE_ACK;
     dst = quicly_encodev(dst, ranges->ranges[range_index].end - 1); /* largest acknowledged */
     dst = quicly_encodev(dst, largest_ack_received_at);             /* Receive timestamp */
     dst = quicly_encodev(dst, ack_delay);                           /* ack delay */
@@ -60,6 +61,14 @@ uint8_t *quicly_encode_ack_frame(uint8_t *dst, uint8_t *dst_end, quicly_ranges_t
         WRITE_BLOCK(ranges->ranges[range_index].end, ranges->ranges[range_index + 1].start);
     }
 
+    if (ecn_counts != NULL) {
+        size_t i;
+        if (dst_end - dst < 3 * 8)
+            return NULL;
+        for (i = 0; i != 3; ++i)
+            dst = quicly_encodev(dst, ecn_counts[i]);
+    }
+
     return dst;
 
 #undef WRITE_BLOCK
@@ -103,9 +112,8 @@ int quicly_decode_ack_frame(const uint8_t **src, const uint8_t *end, quicly_ack_
     }
 
     if (is_ack_ecn) {
-        /* just skip ECT(0), ECT(1), ECT-CE counters for the time being */
         for (i = 0; i != 3; ++i)
-            if (quicly_decodev(src, end) == UINT64_MAX)
+            if ((frame->ecn_counts[i] = quicly_decodev(src, end)) == UINT64_MAX)
                 goto Error;
     }
     return 0;
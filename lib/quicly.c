@@ -42,6 +42,10 @@
 #endif
 
 #define QUICLY_MIN_INITIAL_DCID_LEN 8
+/**
+ * number of PATH_CHALLENGE frames sent to a new peer address before falling back to the previous one
+ */
+#define QUICLY_MAX_PATH_CHALLENGES 3
 
 #define QUICLY_TLS_EXTENSION_TYPE_TRANSPORT_PARAMETERS 0xffa5
 #define QUICLY_TRANSPORT_PARAMETER_ID_ORIGINAL_CONNECTION_ID 0
@@ -127,6 +131,10 @@ struct st_quicly_pn_space_t {
      * packet count before ack is sent
      */
     uint32_t unacked_count;
+    /**
+     * number of packets received with ECT(0), ECT(1), ECN-CE (reported to the peer using ACK_ECN frames)
+     */
+    uint64_t ecn_counts[3];
 };
 
 struct st_quicly_handshake_space_t {
@@ -260,6 +268,35 @@ struct st_quicly_conn_t {
         struct {
             struct st_quicly_pending_path_challenge_t *head, **tail_ref;
         } path_challenge;
+        /**
+         * validation of the peer address the connection has migrated to
+         */
+        struct {
+            /**
+             * when to resend the challenge (or give up), or INT64_MAX if no validation is in progress
+             */
+            int64_t resend_at;
+            uint8_t data[QUICLY_PATH_CHALLENGE_DATA_LEN];
+            uint8_t num_sent;
+            /**
+             * set if only the port has changed (i.e. NAT rebinding); the amplification limit is not applied in that case
+             */
+            uint8_t is_rebinding;
+            /**
+             * the last validated address, being restored if the validation fails
+             */
+            quicly_address_t prev_address;
+            /**
+             * the congestion controller and the RTT estimate of the last validated address, being restored along with it
+             */
+            quicly_cc_t prev_cc;
+            quicly_rtt_t prev_rtt;
+            /**
+             * bytes received and sent when the migration has been detected, for applying the amplification limit
+             */
+            uint64_t bytes_received;
+            uint64_t bytes_sent;
+        } path_validation;
         /**
          *
          */
@@ -280,6 +317,43 @@ struct st_quicly_conn_t {
          *
          */
         quicly_cc_t cc;
+        /**
+         * latest delivery rate estimate (in bytes per second); samples taken while application-limited only raise the estimate
+         */
+        uint64_t delivery_rate;
+        /**
+         * application-driven send rate (see `quicly_set_send_rate`); a token bucket that replaces cwnd as the send window while
+         * `rate` is non-zero
+         */
+        struct {
+            /**
+             * in bytes per second
+             */
+            uint64_t rate;
+            /**
+             * size of the bucket (in bytes)
+             */
+            uint32_t burst;
+            /**
+             * the budget (in bytes); can become negative as a full-sized packet is sent whenever the budget is positive
+             */
+            int64_t tokens;
+            int64_t updated_at;
+        } send_rate;
+        /**
+         * ECN validation state (RFC 9000 section 13.4.2)
+         */
+        struct {
+            enum {
+                QUICLY_ECN_STATE_DISABLED,
+                QUICLY_ECN_STATE_CAPABLE, /* marking packets, counters reported by the peer are consistent */
+                QUICLY_ECN_STATE_FAILED   /* validation failed; packets are no longer marked */
+            } state;
+            /**
+             * largest ECT(0), ECT(1), ECN-CE counts reported by the peer, per packet number space
+             */
+            uint64_t counts[3][3];
+        } ecn;
     } egress;
     /**
      * crypto data
@@ -344,6 +418,10 @@ struct st_quicly_handle_payload_state_t {
     const uint8_t *src, *const end;
     size_t epoch;
     uint64_t frame_type;
+    /**
+     * the address the packet has been received from, or NULL if unknown
+     */
+    struct sockaddr *src_addr;
 };
 
 static int crypto_stream_receive(quicly_stream_t *stream, size_t off, const void *src, size_t len);
@@ -353,6 +431,7 @@ static const quicly_stream_callbacks_t crypto_stream_callbacks = {quicly_streamb
 
 static int update_traffic_key_cb(ptls_update_traffic_key_t *self, ptls_t *tls, int is_enc, size_t epoch, const void *secret);
 static int discard_sentmap_by_epoch(quicly_conn_t *conn, unsigned ack_epochs);
+static int compare_socket_address(struct sockaddr *x, struct sockaddr *y);
 
 static const quicly_transport_parameters_t default_transport_params = {
     {0, 0, 0}, 0, 0, 0, 0, 0, QUICLY_DEFAULT_ACK_DELAY_EXPONENT, QUICLY_DEFAULT_MAX_ACK_DELAY};
@@ -453,6 +532,7 @@ size_t quicly_decode_packet(quicly_context_t *ctx, quicly_decoded_packet_t *pack
     packet->datagram_size = len;
     packet->token = ptls_iovec_init(NULL, 0);
     packet->decrypted_pn = UINT64_MAX;
+    packet->ecn = QUICLY_ECN_NOT_ECT;
     ++src;
 
     if (QUICLY_PACKET_IS_LONG_HEADER(packet->octets.base[0])) {
@@ -697,6 +777,80 @@ static int schedule_path_challenge(quicly_conn_t *conn, int is_response, const u
     return 0;
 }
 
+static int64_t get_path_challenge_interval(quicly_conn_t *conn)
+{
+    return 2 * (int64_t)quicly_rtt_get_pto(&conn->egress.loss.rtt, conn->super.peer.transport_params.max_ack_delay,
+                                           conn->egress.loss.conf->min_pto);
+}
+
+static int send_path_challenge(quicly_conn_t *conn)
+{
+    int ret;
+
+    if ((ret = schedule_path_challenge(conn, 0, conn->egress.path_validation.data)) != 0)
+        return ret;
+    ++conn->egress.path_validation.num_sent;
+    conn->egress.path_validation.resend_at = now + get_path_challenge_interval(conn);
+    return 0;
+}
+
+/**
+ * Called when a non-probing packet carrying the largest packet number so far arrives from a different address. The connection
+ * moves to the new address right away and validates it using PATH_CHALLENGE. The congestion controller and the RTT estimate are
+ * reset unless only the port has changed (NAT rebinding), in which case the path is most likely the same. `packet_len` is the size
+ * of the packet that triggered the migration; it counts towards the amplification limit of the new address.
+ */
+static int migrate_peer_address(quicly_conn_t *conn, struct sockaddr *src_addr, size_t packet_len)
+{
+    struct sockaddr *cur = &conn->super.peer.address.sa;
+    int is_rebinding = 0;
+
+    if (src_addr->sa_family == cur->sa_family) {
+        if (cur->sa_family == AF_INET) {
+            is_rebinding = ((struct sockaddr_in *)cur)->sin_addr.s_addr == ((struct sockaddr_in *)src_addr)->sin_addr.s_addr;
+        } else if (cur->sa_family == AF_INET6) {
+            is_rebinding = memcmp(&((struct sockaddr_in6 *)cur)->sin6_addr, &((struct sockaddr_in6 *)src_addr)->sin6_addr,
+                                  sizeof(struct in6_addr)) == 0;
+        }
+    }
+
+    /* the previous address remains the fallback if a migration is already in progress */
+    if (conn->egress.path_validation.resend_at == INT64_MAX) {
+        conn->egress.path_validation.prev_address = conn->super.peer.address;
+        conn->egress.path_validation.prev_cc = conn->egress.cc;
+        conn->egress.path_validation.prev_rtt = conn->egress.loss.rtt;
+    }
+    set_address(&conn->super.peer.address, src_addr);
+    ++conn->super.stats.num_migrations;
+
+    if (!is_rebinding) {
+        uint64_t min_bitrate = conn->egress.cc.state.media.min_bitrate, max_bitrate = conn->egress.cc.state.media.max_bitrate;
+        quicly_cc_init(&conn->egress.cc, conn->egress.cc.algo, now);
+        quicly_cc_set_bitrate_limits(&conn->egress.cc, min_bitrate, max_bitrate);
+        quicly_rtt_init(&conn->egress.loss.rtt, &conn->super.ctx->loss, conn->super.ctx->loss.default_initial_rtt);
+    }
+
+    conn->egress.path_validation.is_rebinding = is_rebinding;
+    conn->egress.path_validation.num_sent = 0;
+    conn->egress.path_validation.bytes_received = conn->super.stats.num_bytes.received - packet_len;
+    conn->egress.path_validation.bytes_sent = conn->super.stats.num_bytes.sent;
+    conn->super.ctx->tls->random_bytes(conn->egress.path_validation.data, sizeof(conn->egress.path_validation.data));
+    return send_path_challenge(conn);
+}
+
+static int on_path_validation_timeout(quicly_conn_t *conn)
+{
+    if (conn->egress.path_validation.num_sent < QUICLY_MAX_PATH_CHALLENGES)
+        return send_path_challenge(conn);
+
+    /* give up, and go back to the address that has been validated along with what has been learned about its path */
+    conn->super.peer.address = conn->egress.path_validation.prev_address;
+    conn->egress.cc = conn->egress.path_validation.prev_cc;
+    conn->egress.loss.rtt = conn->egress.path_validation.prev_rtt;
+    conn->egress.path_validation.resend_at = INT64_MAX;
+    return 0;
+}
+
 static int write_crypto_data(quicly_conn_t *conn, ptls_buffer_t *tlsbuf, size_t epoch_offsets[5])
 {
     size_t epoch;
@@ -918,6 +1072,10 @@ int quicly_get_feedback(quicly_conn_t *conn, quicly_feedback_t *fb)
     fb->rtt_smoothed = conn->egress.loss.rtt.smoothed;
     fb->rtt_latest = conn->egress.loss.rtt.latest;
     fb->cwnd = conn->egress.cc.cwnd;
+    fb->pacing_rate = conn->egress.cc.pacing_rate;
+    fb->target_bitrate = conn->egress.cc.target_bitrate;
+    fb->delivery_rate = conn->egress.delivery_rate;
+    fb->send_rate = conn->egress.send_rate.rate * 8;
     fb->bytes_in_flight = conn->egress.sentmap.bytes_in_flight;
     fb->bytes_sent = conn->super.stats.num_bytes.sent;
     fb->bytes_lost = conn->super.stats.num_bytes.lost;
@@ -929,6 +1087,56 @@ int quicly_get_feedback(quicly_conn_t *conn, quicly_feedback_t *fb)
     return 0;
 }
 
+uint64_t quicly_get_target_bitrate(quicly_conn_t *conn)
+{
+    return conn->egress.cc.target_bitrate;
+}
+
+void quicly_set_target_bitrate_limits(quicly_conn_t *conn, uint64_t min_bitrate, uint64_t max_bitrate)
+{
+    quicly_cc_set_bitrate_limits(&conn->egress.cc, min_bitrate, max_bitrate);
+}
+
+static void update_send_rate_tokens(quicly_conn_t *conn)
+{
+    uint64_t delta;
+
+    if (now <= conn->egress.send_rate.updated_at)
+        return;
+    /* retain the timestamp until at least one byte is earned, so that low rates are not rounded down to zero */
+    if ((delta = conn->egress.send_rate.rate * (now - conn->egress.send_rate.updated_at) / 1000) == 0)
+        return;
+    conn->egress.send_rate.tokens += (int64_t)delta;
+    if (conn->egress.send_rate.tokens > conn->egress.send_rate.burst)
+        conn->egress.send_rate.tokens = conn->egress.send_rate.burst;
+    conn->egress.send_rate.updated_at = now;
+}
+
+void quicly_set_send_rate(quicly_conn_t *conn, uint64_t bitrate, uint32_t burst)
+{
+    update_now(conn->super.ctx);
+
+    if (bitrate == 0) {
+        conn->egress.send_rate.rate = 0;
+        return;
+    }
+
+    if (burst == 0)
+        burst = QUICLY_DEFAULT_SEND_RATE_BURST * conn->super.ctx->max_packet_size;
+    if (conn->egress.send_rate.rate == 0) {
+        /* start with a full bucket */
+        conn->egress.send_rate.tokens = burst;
+        conn->egress.send_rate.updated_at = now;
+    } else {
+        /* account for the budget accrued at the previous rate */
+        update_send_rate_tokens(conn);
+    }
+    conn->egress.send_rate.rate = bitrate / 8;
+    conn->egress.send_rate.burst = burst;
+    if (conn->egress.send_rate.tokens > burst)
+        conn->egress.send_rate.tokens = burst;
+}
+
 int quicly_get_stats(quicly_conn_t *conn, quicly_stats_t *stats)
 {
     /* copy the pre-built stats fields */
@@ -937,6 +1145,10 @@ int quicly_get_stats(quicly_conn_t *conn, quicly_stats_t *stats)
     /* set or generate the non-pre-built stats fields here */
     stats->rtt = conn->egress.loss.rtt;
     stats->cc = conn->egress.cc;
+    stats->app_limited = conn->egress.sentmap.rate.app_limited != 0;
+    stats->ecn = conn->egress.ecn.state == QUICLY_ECN_STATE_CAPABLE ? conn->super.ctx->ecn : QUICLY_ECN_NOT_ECT;
+    stats->delivery_rate = conn->egress.delivery_rate;
+    stats->send_rate = conn->egress.send_rate.rate * 8;
     //stats->bytes_in_flight = conn->egress.sentmap.bytes_in_flight;
 
     return 0;
@@ -1030,6 +1242,7 @@ static struct st_quicly_pn_space_t *alloc_pn_space(size_t sz)
     space->largest_pn_received_at = INT64_MAX;
     space->next_expected_packet_number = 0;
     space->unacked_count = 0;
+    memset(space->ecn_counts, 0, sizeof(space->ecn_counts));
     if (sz != sizeof(*space))
         memset((uint8_t *)space + sizeof(*space), 0, sz - sizeof(*space));
 
@@ -1042,20 +1255,35 @@ static void do_free_pn_space(struct st_quicly_pn_space_t *space)
     free(space);
 }
 
-static int record_receipt(quicly_conn_t *conn, struct st_quicly_pn_space_t *space, uint64_t pn, int is_ack_only, size_t epoch)
+static int record_receipt(quicly_conn_t *conn, struct st_quicly_pn_space_t *space, uint64_t pn, uint8_t ecn, int is_ack_only,
+                          size_t epoch)
 {
     int ret;
 
-    if ((ret = quicly_ranges_add(&space->ack_queue, pn, pn + 1)) != 0)
+    size_t max_ack_ranges = conn->super.ctx->max_ack_ranges;
+    if (max_ack_ranges == 0 || max_ack_ranges >= QUICLY_ENCODE_ACK_MAX_BLOCKS)
+        max_ack_ranges = QUICLY_ENCODE_ACK_MAX_BLOCKS - 1;
+    if ((ret = quicly_ranges_add_bounded(&space->ack_queue, pn, pn + 1, max_ack_ranges)) != 0)
         goto Exit;
-    if (space->ack_queue.num_ranges >= QUICLY_ENCODE_ACK_MAX_BLOCKS) {
-        assert(space->ack_queue.num_ranges == QUICLY_ENCODE_ACK_MAX_BLOCKS);
-        quicly_ranges_shrink(&space->ack_queue, 0, 1);
-    }
     if (space->ack_queue.ranges[space->ack_queue.num_ranges - 1].end == pn + 1) {
         /* FIXME implement deduplication at an earlier moment? */
         space->largest_pn_received_at = now;
     }
+    /* count ECN codepoints; ECN-CE is reported immediately so that the peer can react within one RTT */
+    switch (ecn) {
+    case QUICLY_ECN_ECT0:
+        ++space->ecn_counts[0];
+        break;
+    case QUICLY_ECN_ECT1:
+        ++space->ecn_counts[1];
+        break;
+    case QUICLY_ECN_CE:
+        ++space->ecn_counts[2];
+        conn->egress.send_ack_at = now;
+        break;
+    default:
+        break;
+    }
     /* TODO (jri): If not ack-only packet, then maintain count of such packets that are received.
      * Send ack immediately when this number exceeds the threshold.
      */
@@ -1585,6 +1813,10 @@ int quicly_decode_transport_parameter_list(quicly_transport_parameters_t *params
                 case QUICLY_TRANSPORT_PARAMETER_ID_DISABLE_ACTIVE_MIGRATION:
                     params->disable_active_migration = 1;
                     break;
+                case QUICLY_TRANSPORT_PARAMETER_ID_MAX_DATAGRAM_FRAME_SIZE:
+                    if ((ret = quicly_tls_decode_varint(&params->max_datagram_frame_size, &src, end)) != 0)
+                        goto Exit;
+                    break;
                 default:
                     src = end;
                     break;
@@ -1684,8 +1916,10 @@ static quicly_conn_t *create_connection(quicly_context_t *ctx, const char *serve
     init_max_streams(&conn->_.egress.max_streams.uni);
     init_max_streams(&conn->_.egress.max_streams.bidi);
     conn->_.egress.path_challenge.tail_ref = &conn->_.egress.path_challenge.head;
+    conn->_.egress.path_validation.resend_at = INT64_MAX;
     conn->_.egress.send_ack_at = INT64_MAX;
-    quicly_cc_init(&conn->_.egress.cc);
+    quicly_cc_init(&conn->_.egress.cc, ctx->cc_algorithm != NULL ? ctx->cc_algorithm : &quicly_cc_reno, now);
+    conn->_.egress.ecn.state = ctx->ecn != QUICLY_ECN_NOT_ECT ? QUICLY_ECN_STATE_CAPABLE : QUICLY_ECN_STATE_DISABLED;
     conn->_.crypto.tls = tls;
     if (handshake_properties != NULL) {
         assert(handshake_properties->additional_extensions == NULL);
@@ -1744,6 +1978,7 @@ static int client_collected_extensions(ptls_t *tls, ptls_handshake_properties_t
         ZERORTT_VALIDATE(max_stream_data.uni);
         ZERORTT_VALIDATE(max_streams_bidi);
         ZERORTT_VALIDATE(max_streams_uni);
+        ZERORTT_VALIDATE(max_datagram_frame_size);
 #undef ZERORTT_VALIDATE
     }
 
@@ -2236,9 +2471,18 @@ static ssize_t round_send_window(ssize_t window)
     return window;
 }
 
+/**
+ * Returns if the sender is limited neither by cwnd nor by the budget; i.e., if application-level congestion control is in use
+ * without a send rate being set
+ */
+static int is_send_window_ignored(quicly_conn_t *conn)
+{
+    return conn->super.app_cc && conn->egress.send_rate.rate == 0;
+}
+
 /* Helper function to compute send window based on:
  * * state of peer validation,
- * * current cwnd,
+ * * current cwnd (or the budget if the send rate is set by the application),
  * * minimum send requirements in |min_bytes_to_send|, and
  * * if sending is to be restricted to the minimum, indicated in |restrict_sending|
  */
@@ -2252,6 +2496,24 @@ static size_t calc_send_window(quicly_conn_t *conn, size_t min_bytes_to_send, in
         return window - conn->super.stats.num_bytes.sent;
     }
 
+    /* Until the address being migrated to is validated, limit sending to 3x bytes received on that address */
+    if (conn->egress.path_validation.resend_at != INT64_MAX && !conn->egress.path_validation.is_rebinding) {
+        uint64_t window = (conn->super.stats.num_bytes.received - conn->egress.path_validation.bytes_received) * 3,
+                 sent = conn->super.stats.num_bytes.sent - conn->egress.path_validation.bytes_sent;
+        if (window <= sent)
+            return 0;
+        if (window - sent < conn->egress.cc.cwnd)
+            return window - sent;
+    }
+
+    /* Sending rate being controlled by the application; the budget replaces cwnd */
+    if (conn->egress.send_rate.rate != 0) {
+        update_send_rate_tokens(conn);
+        if (!restrict_sending && conn->egress.send_rate.tokens > (int64_t)min_bytes_to_send)
+            return (size_t)conn->egress.send_rate.tokens;
+        return min_bytes_to_send;
+    }
+
     /* Validated address. Ensure there's enough window to send minimum number of packets */
     if (!restrict_sending && conn->egress.cc.cwnd > conn->egress.sentmap.bytes_in_flight + min_bytes_to_send) {
         return conn->egress.cc.cwnd - conn->egress.sentmap.bytes_in_flight;
@@ -2259,27 +2521,48 @@ static size_t calc_send_window(quicly_conn_t *conn, size_t min_bytes_to_send, in
     return min_bytes_to_send;
 }
 
+static void drop_expired_dgram(quicly_conn_t *conn)
+{
+    if (conn->dgram->callbacks->on_send_drop != NULL) {
+        conn->super.stats.num_packets.dropped_late += conn->dgram->callbacks->on_send_drop(conn->dgram, 0);
+    } else {
+        ++conn->super.stats.num_packets.dropped_late;
+        conn->dgram->callbacks->on_send_shift(conn->dgram, 1);
+    }
+}
+
 int64_t quicly_get_first_timeout(quicly_conn_t *conn)
 {
-    if ((calc_send_window(conn, 0, 0) > 0) || conn->super.app_cc) {
+    if ((calc_send_window(conn, 0, 0) > 0) || is_send_window_ignored(conn)) {
         if (conn->pending.flows != 0)
             return 0;
         if (quicly_linklist_is_linked(&conn->pending.streams.control))
             return 0;
         if (scheduler_can_send(conn))
             return 0;
+        if (conn->egress.path_challenge.head != NULL && conn->application != NULL && conn->application->one_rtt_writable)
+            return 0;
     } else if (!conn->super.peer.address_validation.validated) {
         return conn->idle_timeout.at;
     }
 
-    if (now > quicly_dgram_get_expire_time(conn->dgram)) {
-            conn->super.stats.num_packets.dropped_late++;
-            conn->dgram->callbacks->on_send_shift(conn->dgram, 1);
-    }
+    if (now > quicly_dgram_get_expire_time(conn->dgram))
+        drop_expired_dgram(conn);
 
     int64_t at = conn->egress.loss.alarm_at;
     if (conn->egress.send_ack_at < at)
         at = conn->egress.send_ack_at;
+    /* when paced by the application-driven send rate, wake up as soon as the budget becomes positive again */
+    if (conn->egress.send_rate.rate != 0 && conn->egress.send_rate.tokens <= 0 &&
+        (conn->pending.flows != 0 || quicly_linklist_is_linked(&conn->pending.streams.control) || scheduler_can_send(conn))) {
+        int64_t paced_at = conn->egress.send_rate.updated_at +
+                           (int64_t)((1 - conn->egress.send_rate.tokens) * 1000 + conn->egress.send_rate.rate - 1) /
+                               (int64_t)conn->egress.send_rate.rate;
+        if (paced_at < at)
+            at = paced_at;
+    }
+    if (conn->egress.path_validation.resend_at < at)
+        at = conn->egress.path_validation.resend_at;
     if (conn->idle_timeout.at < at)
         at = conn->idle_timeout.at;
 
@@ -2391,7 +2674,9 @@ static int commit_send_packet(quicly_conn_t *conn, quicly_send_context_t *s, int
     /* update CC, commit sentmap */
     if (s->target.ack_eliciting) {
         packet_bytes_in_flight = s->dst - s->target.first_byte_at;
-        s->send_window -= conn->super.app_cc ? 0 : packet_bytes_in_flight;
+        s->send_window -= is_send_window_ignored(conn) ? 0 : packet_bytes_in_flight;
+        if (conn->egress.send_rate.rate != 0)
+            conn->egress.send_rate.tokens -= packet_bytes_in_flight;
     } else {
         packet_bytes_in_flight = 0;
     }
@@ -2472,13 +2757,14 @@ static int _do_allocate_frame(quicly_conn_t *conn, quicly_send_context_t *s, siz
         if (s->num_packets >= s->max_packets)
             return QUICLY_ERROR_SENDBUF_FULL;
         s->send_window = round_send_window(s->send_window);
-        if (ack_eliciting && (s->send_window < (ssize_t)min_space) && (conn->super.app_cc == 0))
+        if (ack_eliciting && (s->send_window < (ssize_t)min_space) && !is_send_window_ignored(conn))
             return QUICLY_ERROR_SENDBUF_FULL;
         if ((s->target.packet = conn->super.ctx->packet_allocator->alloc_packet(conn->super.ctx->packet_allocator,
                                                                                 conn->super.ctx->max_packet_size)) == NULL)
             return PTLS_ERROR_NO_MEMORY;
         s->target.packet->dest = conn->super.peer.address;
         s->target.packet->src = conn->super.host.address;
+        s->target.packet->ecn = conn->egress.ecn.state == QUICLY_ECN_STATE_CAPABLE ? conn->super.ctx->ecn : QUICLY_ECN_NOT_ECT;
         s->target.cipher = s->current.cipher;
         s->dst = s->target.packet->data.base;
         s->dst_end = s->target.packet->data.base + conn->super.ctx->max_packet_size;
@@ -2574,7 +2860,9 @@ static int send_ack(quicly_conn_t *conn, struct st_quicly_pn_space_t *space, qui
 Emit:
     if ((ret = allocate_frame(conn, s, QUICLY_ACK_FRAME_CAPACITY)) != 0)
         return ret;
-    uint8_t *new_dst = quicly_encode_ack_frame(s->dst, s->dst_end, &space->ack_queue, ack_delay, space->largest_pn_received_at);
+    uint8_t *new_dst = quicly_encode_ack_frame(
+        s->dst, s->dst_end, &space->ack_queue, ack_delay, space->largest_pn_received_at,
+        (space->ecn_counts[0] | space->ecn_counts[1] | space->ecn_counts[2]) != 0 ? space->ecn_counts : NULL);
     if (new_dst == NULL) {
         /* no space, retry with new MTU-sized packet */
         if ((ret = commit_send_packet(conn, s, 0)) != 0)
@@ -2908,13 +3196,15 @@ int quicly_send_dgram(quicly_conn_t *conn, quicly_send_context_t *s)
 
 {    if (conn->dgram == NULL)
         return 0;
+    /* DGRAM frames can only be sent in 0-RTT if the remembered peer parameters say they are accepted */
+    if (s->current.first_byte == QUICLY_PACKET_TYPE_0RTT && conn->super.peer.transport_params.max_datagram_frame_size == 0)
+        return 0;
     
     int ret = 0;
     while (quicly_can_send_stream_data(conn, s) && 
            quicly_dgram_can_send(conn->dgram) && ret == 0) {
         if (now > quicly_dgram_get_expire_time(conn->dgram)) {
-            conn->super.stats.num_packets.dropped_late++;
-            conn->dgram->callbacks->on_send_shift(conn->dgram, 1);
+            drop_expired_dgram(conn);
             continue;
         }
         ret = _quicly_send_dgram(conn, s);
@@ -3004,7 +3294,11 @@ static int do_detect_loss(quicly_loss_t *ld, uint64_t largest_acked, uint32_t de
     quicly_conn_t *conn = (void *)((char *)ld - offsetof(quicly_conn_t, egress.loss));
     quicly_sentmap_iter_t iter;
     const quicly_sent_packet_t *sent;
-    uint64_t largest_newly_lost_pn = UINT64_MAX;
+    uint64_t largest_newly_lost_pn = UINT64_MAX, prev_pn = UINT64_MAX;
+    struct {
+        int64_t first_sent_at;
+        int64_t longest;
+    } lost_period = {INT64_MAX, -1};
     int ret;
 
     *loss_time = INT64_MAX;
@@ -3017,12 +3311,24 @@ static int do_detect_loss(quicly_loss_t *ld, uint64_t largest_acked, uint32_t de
            (sent->sent_at <= now - delay_until_lost || /* time threshold */
             (largest_acked >= QUICLY_LOSS_DEFAULT_PACKET_THRESHOLD &&
              sent->packet_number <= largest_acked - QUICLY_LOSS_DEFAULT_PACKET_THRESHOLD))) { /* packet threshold */
+        /* a gap in the packet numbers means that the packets in between have been acknowledged, in which case the period of
+         * consecutive losses (used for detecting persistent congestion) ends */
+        if (sent->packet_number != prev_pn + 1)
+            lost_period.first_sent_at = INT64_MAX;
+        prev_pn = sent->packet_number;
         if (sent->bytes_in_flight != 0 && conn->egress.max_lost_pn <= sent->packet_number) {
+            if (sent->ack_eliciting) {
+                if (lost_period.first_sent_at == INT64_MAX)
+                    lost_period.first_sent_at = sent->sent_at;
+                if (sent->sent_at - lost_period.first_sent_at > lost_period.longest)
+                    lost_period.longest = sent->sent_at - lost_period.first_sent_at;
+            }
             if (sent->packet_number != largest_newly_lost_pn) {
                 //printf("time_diff: %lu, max_delay: %lu, pn: %lu, packetThreshold: %lu\n", now - sent->sent_at, delay_until_lost, sent->packet_number , largest_acked - QUICLY_LOSS_DEFAULT_PACKET_THRESHOLD);
                 ++conn->super.stats.num_packets.lost;
                 largest_newly_lost_pn = sent->packet_number;
-                quicly_cc_on_lost(&conn->egress.cc, sent->bytes_in_flight, sent->packet_number, conn->egress.packet_number);
+                quicly_cc_on_lost(&conn->egress.cc, &conn->egress.loss.rtt, sent->bytes_in_flight, sent->packet_number,
+                                  conn->egress.packet_number, now);
                 QUICLY_PROBE(PACKET_LOST, conn, probe_now(), largest_newly_lost_pn);
                 QUICLY_PROBE(QUICTRACE_LOST, conn, probe_now(), largest_newly_lost_pn);
             }
@@ -3038,6 +3344,15 @@ static int do_detect_loss(quicly_loss_t *ld, uint64_t largest_acked, uint32_t de
                      conn->egress.cc.cwnd);
         QUICLY_PROBE(QUICTRACE_CC_LOST, conn, probe_now(), &conn->egress.loss.rtt, conn->egress.cc.cwnd,
                      conn->egress.sentmap.bytes_in_flight);
+        /* persistent congestion; all the ack-eliciting packets sent over a period longer than the PTO multiplied by the threshold
+         * have been lost */
+        if (lost_period.longest > 0 && conn->egress.loss.rtt.smoothed != 0) {
+            int64_t congestion_period = (int64_t)quicly_rtt_get_pto(&conn->egress.loss.rtt, *conn->egress.loss.max_ack_delay,
+                                                                    conn->egress.loss.conf->min_pto) *
+                                        QUICLY_PERSISTENT_CONGESTION_THRESHOLD;
+            if (lost_period.longest >= congestion_period)
+                quicly_cc_on_persistent_congestion(&conn->egress.cc, &conn->egress.loss.rtt, now);
+        }
     }
 
     /* schedule time-threshold alarm if there is a packet outstanding that is smaller than largest_acked */
@@ -3181,6 +3496,7 @@ quicly_datagram_t *quicly_send_version_negotiation(quicly_context_t *ctx, struct
         return NULL;
     set_address(&packet->dest, dest_addr);
     set_address(&packet->src, src_addr);
+    packet->ecn = QUICLY_ECN_NOT_ECT;
     dst = packet->data.base;
 
     /* type_flags */
@@ -3258,6 +3574,7 @@ quicly_datagram_t *quicly_send_retry(quicly_context_t *ctx, ptls_aead_context_t
         goto Exit;
     set_address(&packet->dest, dest_addr);
     set_address(&packet->src, src_addr);
+    packet->ecn = QUICLY_ECN_NOT_ECT;
     ptls_buffer_init(&buf, packet->data.base, ctx->max_packet_size);
 
     ctx->tls->random_bytes(buf.base + buf.off, 1);
@@ -3467,6 +3784,12 @@ static int do_send(quicly_conn_t *conn, quicly_send_context_t *s)
     int restrict_sending = 0, ret;
     size_t min_packets_to_send = 0;
 
+    /* retransmit PATH_CHALLENGE, or fall back to the last validated address */
+    if (conn->egress.path_validation.resend_at <= now) {
+        if ((ret = on_path_validation_timeout(conn)) != 0)
+            goto Exit;
+    }
+
     /* handle timeouts */
     if (conn->egress.loss.alarm_at <= now) {
         if ((ret = quicly_loss_on_alarm(&conn->egress.loss, conn->egress.packet_number - 1,
@@ -3497,7 +3820,7 @@ static int do_send(quicly_conn_t *conn, quicly_send_context_t *s)
     }
 
     s->send_window = calc_send_window(conn, min_packets_to_send * conn->super.ctx->max_packet_size, restrict_sending);
-    if ((s->send_window == 0) && (conn->super.app_cc == 0)) {
+    if ((s->send_window == 0) && !is_send_window_ignored(conn)) {
         ret = 0;
         goto Exit;
     }
@@ -3584,6 +3907,11 @@ static int do_send(quicly_conn_t *conn, quicly_send_context_t *s)
     if (s->target.packet != NULL)
         commit_send_packet(conn, s, 0);
 
+    /* the application is the bottleneck if everything has been sent without running out of the window or the packet budget */
+    if (s->num_packets < s->max_packets && calc_send_window(conn, 0, 0) > 0 && conn->pending.flows == 0 &&
+        !quicly_linklist_is_linked(&conn->pending.streams.control) && !scheduler_can_send(conn))
+        quicly_sentmap_on_app_limited(&conn->egress.sentmap);
+
     ret = 0;
 Exit:
     if (ret == QUICLY_ERROR_SENDBUF_FULL)
@@ -3671,6 +3999,7 @@ quicly_datagram_t *quicly_send_stateless_reset(quicly_context_t *ctx, struct soc
         return NULL;
     set_address(&dgram->dest, dest_addr);
     set_address(&dgram->src, src_addr);
+    dgram->ecn = QUICLY_ECN_NOT_ECT;
 
     /* build stateless reset packet */
     ctx->tls->random_bytes(dgram->data.base, QUICLY_STATELESS_RESET_PACKET_MIN_LEN - QUICLY_STATELESS_RESET_TOKEN_LEN);
@@ -3883,6 +4212,37 @@ static int handle_reset_stream_frame(quicly_conn_t *conn, struct st_quicly_handl
     return 0;
 }
 
+/**
+ * Validates the ECN counts carried by an ACK frame that newly acknowledges |num_newly_acked| packets (all of which have been sent
+ * with an ECT codepoint, as marking stops once validation fails), and notifies the congestion controller of CE marks. Marking is
+ * disabled if the peer or the path is found to bleach or remark the codepoint (RFC 9000 section 13.4.2.1).
+ */
+static void on_ack_ecn(quicly_conn_t *conn, size_t epoch, const quicly_ack_frame_t *frame, int is_ack_ecn, size_t num_newly_acked)
+{
+    uint64_t *counts = conn->egress.ecn.counts[epoch == QUICLY_EPOCH_INITIAL ? 0 : epoch == QUICLY_EPOCH_HANDSHAKE ? 1 : 2];
+    size_t ect_index = conn->super.ctx->ecn == QUICLY_ECN_ECT0 ? 0 : 1;
+    uint64_t ect_delta, other_delta, ce_delta;
+
+    if (!is_ack_ecn)
+        goto Fail;
+    if (frame->ecn_counts[0] < counts[0] || frame->ecn_counts[1] < counts[1] || frame->ecn_counts[2] < counts[2])
+        goto Fail;
+    ect_delta = frame->ecn_counts[ect_index] - counts[ect_index];
+    other_delta = frame->ecn_counts[1 - ect_index] - counts[1 - ect_index];
+    ce_delta = frame->ecn_counts[2] - counts[2];
+    if (other_delta != 0 || ect_delta + ce_delta < num_newly_acked)
+        goto Fail;
+    memcpy(counts, frame->ecn_counts, sizeof(frame->ecn_counts));
+
+    conn->super.stats.num_packets.ecn_ce += ce_delta;
+    quicly_cc_on_ecn(&conn->egress.cc, &conn->egress.loss.rtt, conn->super.ctx->ecn == QUICLY_ECN_ECT1, (uint32_t)num_newly_acked,
+                     (uint32_t)ce_delta, frame->largest_acknowledged, conn->egress.packet_number, now);
+    return;
+
+Fail:
+    conn->egress.ecn.state = QUICLY_ECN_STATE_FAILED;
+}
+
 static int handle_ack_frame(quicly_conn_t *conn, struct st_quicly_handle_payload_state_t *state)
 {
     quicly_ack_frame_t frame;
@@ -3891,7 +4251,8 @@ static int handle_ack_frame(quicly_conn_t *conn, struct st_quicly_handle_payload
         uint64_t packet_number;
         int64_t sent_at;
     } largest_newly_acked = {UINT64_MAX, INT64_MAX};
-    size_t bytes_acked = 0;
+    size_t bytes_acked = 0, num_newly_acked = 0;
+    quicly_rate_sample_t rs;
     int includes_ack_eliciting = 0, ret;
 
     if ((ret = quicly_decode_ack_frame(&state->src, state->end, &frame, state->frame_type == QUICLY_FRAME_TYPE_ACK_ECN)) != 0)
@@ -3910,6 +4271,7 @@ static int handle_ack_frame(quicly_conn_t *conn, struct st_quicly_handle_payload
     }
 
     init_acks_iter(conn, &iter);
+    quicly_sentmap_init_rate_sample(&rs);
 
     size_t gap_index = frame.num_gaps;
     while (1) {
@@ -3931,11 +4293,13 @@ static int handle_ack_frame(quicly_conn_t *conn, struct st_quicly_handle_payload
                     if (state->epoch == sent->ack_epoch) {
                         largest_newly_acked.packet_number = packet_number;
                         largest_newly_acked.sent_at = sent->sent_at;
+                        ++num_newly_acked;
                         //printf("recv. nr: %lu, now: %ld\n", packet_number, now);
                         includes_ack_eliciting |= sent->ack_eliciting;
                         QUICLY_PROBE(PACKET_ACKED, conn, probe_now(), packet_number, 1);
                         if (sent->bytes_in_flight != 0) {
                             bytes_acked += sent->bytes_in_flight;
+                            quicly_sentmap_on_delivered(&conn->egress.sentmap, &iter, now, &rs);
                         }
                         if ((ret = quicly_sentmap_update(&conn->egress.sentmap, &iter, QUICLY_SENTMAP_EVENT_ACKED, conn)) != 0)
                             return ret;
@@ -3962,15 +4326,26 @@ static int handle_ack_frame(quicly_conn_t *conn, struct st_quicly_handle_payload
 
     QUICLY_PROBE(QUICTRACE_RECV_ACK_DELAY, conn, probe_now(), frame.ack_delay);
 
+    quicly_sentmap_finalize_rate_sample(&conn->egress.sentmap, &rs);
+    {
+        uint64_t delivery_rate = quicly_rate_sample_get_rate(&rs);
+        if (delivery_rate != 0 && (!rs.is_app_limited || delivery_rate > conn->egress.delivery_rate))
+            conn->egress.delivery_rate = delivery_rate;
+    }
+
     /* Update loss detection engine on ack. The function uses ack_delay only when the largest_newly_acked is also the largest acked
      * so far. So, it does not matter if the ack_delay being passed in does not apply to the largest_newly_acked. */
     quicly_loss_on_ack_received(&conn->egress.loss, largest_newly_acked.packet_number, now, largest_newly_acked.sent_at,
                                 frame.ack_delay, includes_ack_eliciting);
 
+    /* validate the ECN counts and react to CE marks, before the window is grown */
+    if (conn->egress.ecn.state == QUICLY_ECN_STATE_CAPABLE && num_newly_acked != 0)
+        on_ack_ecn(conn, state->epoch, &frame, state->frame_type == QUICLY_FRAME_TYPE_ACK_ECN, num_newly_acked);
+
     /* OnPacketAcked and OnPacketAckedCC */
     if (bytes_acked > 0) {
-        quicly_cc_on_acked(&conn->egress.cc, (uint32_t)bytes_acked, frame.largest_acknowledged,
-                           (uint32_t)(conn->egress.sentmap.bytes_in_flight + bytes_acked));
+        quicly_cc_on_acked(&conn->egress.cc, &conn->egress.loss.rtt, (uint32_t)bytes_acked, frame.largest_acknowledged,
+                           (uint32_t)(conn->egress.sentmap.bytes_in_flight + bytes_acked), conn->egress.packet_number, now, &rs);
         QUICLY_PROBE(QUICTRACE_CC_ACK, conn, probe_now(), &conn->egress.loss.rtt, conn->egress.cc.cwnd,
                      conn->egress.sentmap.bytes_in_flight);
     }
@@ -4102,7 +4477,17 @@ static int handle_path_challenge_frame(quicly_conn_t *conn, struct st_quicly_han
 
 static int handle_path_response_frame(quicly_conn_t *conn, struct st_quicly_handle_payload_state_t *state)
 {
-    return QUICLY_TRANSPORT_ERROR_PROTOCOL_VIOLATION;
+    quicly_path_challenge_frame_t frame;
+    int ret;
+
+    if ((ret = quicly_decode_path_challenge_frame(&state->src, state->end, &frame)) != 0)
+        return ret;
+    /* responses to a challenge that is no longer outstanding, or that do not come from the address being validated, are ignored */
+    if (conn->egress.path_validation.resend_at != INT64_MAX &&
+        memcmp(frame.data, conn->egress.path_validation.data, QUICLY_PATH_CHALLENGE_DATA_LEN) == 0 &&
+        (state->src_addr == NULL || compare_socket_address(&conn->super.peer.address.sa, state->src_addr) == 0))
+        conn->egress.path_validation.resend_at = INT64_MAX;
+    return 0;
 }
 
 static int handle_new_token_frame(quicly_conn_t *conn, struct st_quicly_handle_payload_state_t *state)
@@ -4347,8 +4732,8 @@ static int handle_retire_connection_id_frame(quicly_conn_t *conn, struct st_quic
     return QUICLY_TRANSPORT_ERROR_PROTOCOL_VIOLATION;
 }
 
-static int handle_payload(quicly_conn_t *conn, size_t epoch, const uint8_t *_src, size_t _len, uint64_t *offending_frame_type,
-                          int *is_ack_only)
+static int handle_payload(quicly_conn_t *conn, size_t epoch, struct sockaddr *src_addr, const uint8_t *_src, size_t _len,
+                          uint64_t *offending_frame_type, int *is_ack_only, int *is_probe_only)
 {
     /* clang-format off */
 
@@ -4357,61 +4742,63 @@ static int handle_payload(quicly_conn_t *conn, size_t epoch, const uint8_t *_src
         int (*cb)(quicly_conn_t *, struct st_quicly_handle_payload_state_t *); /* callback function that handles the frame */
         uint8_t permitted_epochs;  /* the epochs the frame can appear, calculated as bitwise-or of `1 << epoch` */
         uint8_t ack_eliciting;     /* boolean indicating if the frame is ack-eliciting */
+        uint8_t probing;           /* boolean indicating if the frame is a probing frame (RFC 9000 section 9.1) */
     } frame_handlers[] = {
-#define FRAME(n, i, z, h, o, ae)                                                                                                   \
+#define FRAME(n, i, z, h, o, ae, p)                                                                                                \
     {                                                                                                                              \
         handle_##n##_frame,                                                                                                        \
         (i << QUICLY_EPOCH_INITIAL) | (z << QUICLY_EPOCH_0RTT) | (h << QUICLY_EPOCH_HANDSHAKE) | (o << QUICLY_EPOCH_1RTT),         \
-        ae                                                                                                                         \
-    }
-        /*   +----------------------+-------------------+---------------+
-         *   |                      |  permitted epochs |               |
-         *   |        frame         +----+----+----+----+ ack-eliciting |
-         *   |                      | IN | 0R | HS | 1R |               |
-         *   +----------------------+----+----+----+----+---------------+ */
-        FRAME( padding              ,  1 ,  1 ,  1 ,  1 ,             0 ), /* 0 */
-        FRAME( ping                 ,  1 ,  1 ,  1 ,  1 ,             1 ),
-        FRAME( ack                  ,  1 ,  0 ,  1 ,  1 ,             0 ),
-        FRAME( ack                  ,  1 ,  0 ,  1 ,  1 ,             0 ),
-        FRAME( reset_stream         ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( stop_sending         ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( crypto               ,  1 ,  0 ,  1 ,  1 ,             1 ),
-        FRAME( new_token            ,  0 ,  0 ,  0 ,  1 ,             1 ),
-        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ), /* 8 */
-        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( max_data             ,  0 ,  1 ,  0 ,  1 ,             1 ), /* 16 */
-        FRAME( max_stream_data      ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( max_streams          ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( max_streams          ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( data_blocked         ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( stream_data_blocked  ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( streams_blocked      ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( streams_blocked      ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( new_connection_id    ,  0 ,  1 ,  0 ,  1 ,             1 ), /* 24 */
-        FRAME( retire_connection_id ,  0 ,  0 ,  0 ,  1 ,             1 ),
-        FRAME( path_challenge       ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( path_response        ,  0 ,  0 ,  0 ,  1 ,             1 ),
-        FRAME( transport_close      ,  1 ,  1 ,  1 ,  1 ,             0 ),
-        FRAME( application_close    ,  0 ,  1 ,  0 ,  1 ,             0 ),
-        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ),
-        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 )
-        /*   +----------------------+----+----+----+----+---------------+ */
+        ae,                                                                                                                        \
+        p                                                                                                                          \
+    }
+        /*   +----------------------+-------------------+---------------+---------+
+         *   |                      |  permitted epochs |               |         |
+         *   |        frame         +----+----+----+----+ ack-eliciting | probing |
+         *   |                      | IN | 0R | HS | 1R |               |         |
+         *   +----------------------+----+----+----+----+---------------+---------+ */
+        FRAME( padding              ,  1 ,  1 ,  1 ,  1 ,             0 ,       1 ), /* 0 */
+        FRAME( ping                 ,  1 ,  1 ,  1 ,  1 ,             1 ,       0 ),
+        FRAME( ack                  ,  1 ,  0 ,  1 ,  1 ,             0 ,       0 ),
+        FRAME( ack                  ,  1 ,  0 ,  1 ,  1 ,             0 ,       0 ),
+        FRAME( reset_stream         ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( stop_sending         ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( crypto               ,  1 ,  0 ,  1 ,  1 ,             1 ,       0 ),
+        FRAME( new_token            ,  0 ,  0 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ), /* 8 */
+        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( stream               ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( max_data             ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ), /* 16 */
+        FRAME( max_stream_data      ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( max_streams          ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( max_streams          ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( data_blocked         ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( stream_data_blocked  ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( streams_blocked      ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( streams_blocked      ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( new_connection_id    ,  0 ,  1 ,  0 ,  1 ,             1 ,       1 ), /* 24 */
+        FRAME( retire_connection_id ,  0 ,  0 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( path_challenge       ,  0 ,  1 ,  0 ,  1 ,             1 ,       1 ),
+        FRAME( path_response        ,  0 ,  0 ,  0 ,  1 ,             1 ,       1 ),
+        FRAME( transport_close      ,  1 ,  1 ,  1 ,  1 ,             0 ,       0 ),
+        FRAME( application_close    ,  0 ,  1 ,  0 ,  1 ,             0 ,       0 ),
+        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 ),
+        FRAME( dgram                ,  0 ,  1 ,  0 ,  1 ,             1 ,       0 )
+        /*   +----------------------+----+----+----+----+---------------+---------+ */
 #undef FRAME
     };
     /* clang-format on */
 
-    struct st_quicly_handle_payload_state_t state = {_src, _src + _len, epoch};
-    size_t num_frames = 0, num_frames_ack_eliciting = 0;
+    struct st_quicly_handle_payload_state_t state = {_src, _src + _len, epoch, QUICLY_FRAME_TYPE_PADDING, src_addr};
+    size_t num_frames = 0, num_frames_ack_eliciting = 0, num_frames_non_probing = 0;
     int ret;
 
     do {
@@ -4426,11 +4813,13 @@ static int handle_payload(quicly_conn_t *conn, size_t epoch, const uint8_t *_src
         }
         num_frames += 1;
         num_frames_ack_eliciting += frame_handlers[state.frame_type].ack_eliciting;
+        num_frames_non_probing += !frame_handlers[state.frame_type].probing;
         if ((ret = (*frame_handlers[state.frame_type].cb)(conn, &state)) != 0)
             break;
     } while (state.src != state.end);
 
     *is_ack_only = num_frames_ack_eliciting == 0;
+    *is_probe_only = num_frames_non_probing == 0;
     if (ret != 0)
         *offending_frame_type = state.frame_type;
     return ret;
@@ -4449,7 +4838,7 @@ int quicly_accept(quicly_conn_t **conn, quicly_context_t *ctx, struct sockaddr *
     struct st_quicly_cipher_context_t ingress_cipher = {NULL}, egress_cipher = {NULL};
     ptls_iovec_t payload;
     uint64_t next_expected_pn, pn, offending_frame_type = QUICLY_FRAME_TYPE_PADDING;
-    int is_ack_only, ret;
+    int is_ack_only, is_probe_only, ret;
 
     *conn = NULL;
 
@@ -4507,9 +4896,10 @@ int quicly_accept(quicly_conn_t **conn, quicly_context_t *ctx, struct sockaddr *
     /* handle the input; we ignore is_ack_only, we consult if there's any output from TLS in response to CH anyways */
     (*conn)->super.stats.num_packets.received += 1;
     (*conn)->super.stats.num_bytes.received += packet->octets.len;
-    if ((ret = handle_payload(*conn, QUICLY_EPOCH_INITIAL, payload.base, payload.len, &offending_frame_type, &is_ack_only)) != 0)
+    if ((ret = handle_payload(*conn, QUICLY_EPOCH_INITIAL, src_addr, payload.base, payload.len, &offending_frame_type, &is_ack_only,
+                              &is_probe_only)) != 0)
         goto Exit;
-    if ((ret = record_receipt(*conn, &(*conn)->initial->super, pn, 0, QUICLY_EPOCH_INITIAL)) != 0)
+    if ((ret = record_receipt(*conn, &(*conn)->initial->super, pn, packet->ecn, 0, QUICLY_EPOCH_INITIAL)) != 0)
         goto Exit;
 
 Exit:
@@ -4531,7 +4921,7 @@ int quicly_receive(quicly_conn_t *conn, struct sockaddr *dest_addr, struct socka
     size_t epoch;
     ptls_iovec_t payload;
     uint64_t pn, offending_frame_type = QUICLY_FRAME_TYPE_PADDING;
-    int is_ack_only, ret;
+    int is_ack_only, is_probe_only, is_largest_pn, ret;
 
     update_now(conn->super.ctx);
 
@@ -4543,8 +4933,6 @@ int quicly_receive(quicly_conn_t *conn, struct sockaddr *dest_addr, struct socka
         goto Exit;
     }
 
-    /* FIXME check peer address */
-
     switch (conn->super.state) {
     case QUICLY_STATE_CLOSING:
         conn->super.state = QUICLY_STATE_DRAINING;
@@ -4672,6 +5060,7 @@ int quicly_receive(quicly_conn_t *conn, struct sockaddr *dest_addr, struct socka
 
     QUICLY_PROBE(CRYPTO_DECRYPT, conn, pn, payload.base, payload.len);
     QUICLY_PROBE(QUICTRACE_RECV, conn, probe_now(), pn);
+    is_largest_pn = pn + 1 == (*space)->next_expected_packet_number;
 
     /* update states */
     if (conn->super.state == QUICLY_STATE_FIRSTFLIGHT)
@@ -4690,10 +5079,20 @@ int quicly_receive(quicly_conn_t *conn, struct sockaddr *dest_addr, struct socka
     }
 
     /* handle the payload */
-    if ((ret = handle_payload(conn, epoch, payload.base, payload.len, &offending_frame_type, &is_ack_only)) != 0)
+    if ((ret = handle_payload(conn, epoch, src_addr, payload.base, payload.len, &offending_frame_type, &is_ack_only,
+                              &is_probe_only)) != 0)
         goto Exit;
     if (*space != NULL) {
-        if ((ret = record_receipt(conn, *space, pn, is_ack_only, epoch)) != 0)
+        if ((ret = record_receipt(conn, *space, pn, packet->ecn, is_ack_only, epoch)) != 0)
+            goto Exit;
+    }
+
+    /* Connection migration. The server follows the client to a new address once the handshake is complete, if the packet is not a
+     * reordered one nor a probing one (RFC 9000 section 9.2). The client never changes the destination. */
+    if (epoch == QUICLY_EPOCH_1RTT && is_largest_pn && !is_probe_only && !quicly_is_client(conn) && src_addr != NULL &&
+        conn->super.peer.address.sa.sa_family != AF_UNSPEC && ptls_handshake_is_complete(conn->crypto.tls) &&
+        compare_socket_address(&conn->super.peer.address.sa, src_addr) != 0) {
+        if ((ret = migrate_peer_address(conn, src_addr, packet->octets.len)) != 0)
             goto Exit;
     }
 
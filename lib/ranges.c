@@ -76,6 +76,39 @@ int quicly_ranges_init_with_range(quicly_ranges_t *ranges, uint64_t start, uint6
     return insert_at(ranges, start, end, 0);
 }
 
+/**
+ * returns the index of the first slot within [lo, hi) whose `end` is greater than (or equal to, if `inclusive` is set) `value`, or
+ * `hi` if there is no such slot
+ */
+static size_t find_slot_by_end(const quicly_ranges_t *ranges, uint64_t value, int inclusive, size_t lo, size_t hi)
+{
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ranges->ranges[mid].end < value || (!inclusive && ranges->ranges[mid].end == value)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * returns the index of the first slot within [lo, hi) whose `start` is greater than `value`, or `hi` if there is no such slot
+ */
+static size_t find_slot_by_start(const quicly_ranges_t *ranges, uint64_t value, size_t lo, size_t hi)
+{
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ranges->ranges[mid].start <= value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
 int quicly_ranges_add(quicly_ranges_t *ranges, uint64_t start, uint64_t end)
 {
     size_t slot, end_slot;
@@ -91,29 +124,39 @@ int quicly_ranges_add(quicly_ranges_t *ranges, uint64_t start, uint64_t end)
         return insert_at(ranges, start, end, ranges->num_ranges);
     }
 
-    /* find the slot that should contain `end` */
-    for (slot = ranges->num_ranges - 1;; --slot) {
-        if (ranges->ranges[slot].start <= end)
-            break;
-        if (slot == 0)
+    /* find the slot that should contain `end` (fast path for the in-order case, in which it is the last slot) */
+    if (ranges->ranges[ranges->num_ranges - 1].start <= end) {
+        end_slot = ranges->num_ranges - 1;
+    } else {
+        if ((end_slot = find_slot_by_start(ranges, end, 0, ranges->num_ranges - 1)) == 0)
             return insert_at(ranges, start, end, 0);
+        --end_slot;
     }
-    end_slot = slot;
 
     /* find the slot that should contain `start` */
-    do {
-        if (ranges->ranges[slot].end == start) {
-            return merge_update(ranges, start, end, slot, end_slot);
-        } else if (ranges->ranges[slot].end < start) {
-            if (slot++ == end_slot) {
-                return insert_at(ranges, start, end, slot);
-            } else {
-                return merge_update(ranges, start, end, slot, end_slot);
-            }
-        }
-    } while (slot-- != 0);
+    if (ranges->ranges[end_slot].end < start)
+        return insert_at(ranges, start, end, end_slot + 1);
+    if (end_slot == 0 || ranges->ranges[end_slot - 1].end < start) {
+        slot = end_slot;
+    } else {
+        slot = find_slot_by_end(ranges, start, 1, 0, end_slot - 1);
+    }
+
+    return merge_update(ranges, start, end, slot, end_slot);
+}
+
+int quicly_ranges_add_bounded(quicly_ranges_t *ranges, uint64_t start, uint64_t end, size_t max_ranges)
+{
+    int ret;
 
-    return merge_update(ranges, start, end, 0, end_slot);
+    assert(max_ranges != 0);
+
+    if ((ret = quicly_ranges_add(ranges, start, end)) != 0)
+        return ret;
+    if (ranges->num_ranges > max_ranges)
+        quicly_ranges_shrink(ranges, 0, ranges->num_ranges - max_ranges);
+
+    return 0;
 }
 
 int quicly_ranges_subtract(quicly_ranges_t *ranges, uint64_t start, uint64_t end)
@@ -134,8 +177,7 @@ int quicly_ranges_subtract(quicly_ranges_t *ranges, uint64_t start, uint64_t end
     }
 
     /* find the first overlapping slot */
-    for (slot = 0; ranges->ranges[slot].end < start; ++slot)
-        ;
+    slot = find_slot_by_end(ranges, start, 1, 0, ranges->num_ranges);
 
     if (end <= ranges->ranges[slot].end) {
         /* first overlapping slot is the only slot that we will ever modify */
@@ -166,15 +208,10 @@ int quicly_ranges_subtract(quicly_ranges_t *ranges, uint64_t start, uint64_t end
         shrink_from = slot + 1;
     }
 
-    /* find the last overlapping slot */
-    for (++slot; slot != ranges->num_ranges; ++slot) {
-        if (end <= ranges->ranges[slot].start)
-            break;
-        if (end < ranges->ranges[slot].end) {
-            ranges->ranges[slot].start = end;
-            break;
-        }
-    }
+    /* find the first slot that is not entirely covered, trimming it if it overlaps */
+    slot = find_slot_by_end(ranges, end, 0, slot + 1, ranges->num_ranges);
+    if (slot != ranges->num_ranges && ranges->ranges[slot].start < end)
+        ranges->ranges[slot].start = end;
 
     /* remove shrink_from..slot */
     if (shrink_from != slot)
@@ -94,14 +94,68 @@ void quicly_sentmap_dispose(quicly_sentmap_t *map)
 
 int quicly_sentmap_prepare(quicly_sentmap_t *map, uint64_t packet_number, int64_t now, uint8_t ack_epoch)
 {
+    struct st_quicly_sent_block_t *block;
+    quicly_sent_t *rate;
+
     assert(map->_pending_packet == NULL);
 
+    /* the header and the rate snapshot are allocated from the same block, so that the snapshot is found right after the header */
+    if ((block = map->tail) != NULL && block->next_insert_at + 2 > sizeof(block->entries) / sizeof(block->entries[0])) {
+        if (quicly_sentmap__new_block(map) == NULL)
+            return PTLS_ERROR_NO_MEMORY;
+    }
     if ((map->_pending_packet = quicly_sentmap_allocate(map, quicly_sentmap__type_packet)) == NULL)
         return PTLS_ERROR_NO_MEMORY;
+    rate = quicly_sentmap_allocate(map, quicly_sentmap__type_rate);
+    assert(rate == map->_pending_packet + 1);
+
+    if (map->bytes_in_flight == 0) {
+        /* restart the sampling interval when nothing is in flight, so that idle periods are not counted */
+        map->rate.first_sent_at = now;
+        map->rate.delivered_at = now;
+    }
     map->_pending_packet->data.packet = (quicly_sent_packet_t){packet_number, now, ack_epoch};
+    map->_pending_packet->data.packet.is_app_limited = map->rate.app_limited != 0;
+    rate->data.rate.delivered = map->rate.delivered;
+    rate->data.rate.delivered_at = map->rate.delivered_at;
+    rate->data.rate.first_sent_at = map->rate.first_sent_at;
     return 0;
 }
 
+void quicly_sentmap_on_delivered(quicly_sentmap_t *map, quicly_sentmap_iter_t *iter, int64_t now, quicly_rate_sample_t *rs)
+{
+    const quicly_sent_packet_t *packet = quicly_sentmap_get(iter);
+    const quicly_sent_t *snapshot = iter->p + 1;
+
+    assert(packet->bytes_in_flight != 0);
+    assert(snapshot->acked == quicly_sentmap__type_rate);
+
+    map->rate.delivered += packet->bytes_in_flight;
+    map->rate.delivered_at = now;
+    if (map->rate.app_limited != 0 && map->rate.delivered > map->rate.app_limited)
+        map->rate.app_limited = 0;
+
+    /* use the most recently sent packet for taking the sample */
+    if (rs->prior_delivered == UINT64_MAX || snapshot->data.rate.delivered >= rs->prior_delivered) {
+        rs->prior_delivered = snapshot->data.rate.delivered;
+        rs->_send_elapsed = packet->sent_at - snapshot->data.rate.first_sent_at;
+        rs->_ack_elapsed = now - snapshot->data.rate.delivered_at;
+        rs->rtt = (uint32_t)(now - packet->sent_at);
+        rs->is_app_limited = packet->is_app_limited;
+        map->rate.first_sent_at = packet->sent_at;
+    }
+}
+
+void quicly_sentmap_finalize_rate_sample(quicly_sentmap_t *map, quicly_rate_sample_t *rs)
+{
+    if (rs->prior_delivered == UINT64_MAX)
+        return;
+
+    rs->delivered = map->rate.delivered - rs->prior_delivered;
+    /* use the longer of the send and ack intervals, so that ACK compression does not lead to overestimation */
+    rs->interval = rs->_send_elapsed > rs->_ack_elapsed ? rs->_send_elapsed : rs->_ack_elapsed;
+}
+
 struct st_quicly_sent_block_t *quicly_sentmap__new_block(quicly_sentmap_t *map)
 {
     struct st_quicly_sent_block_t *block;
@@ -180,3 +234,10 @@ int quicly_sentmap__type_packet(struct st_quicly_conn_t *conn, const quicly_sent
     assert(!"quicly_sentmap__type_packet cannot be called");
     return QUICLY_TRANSPORT_ERROR_INTERNAL;
 }
+
+int quicly_sentmap__type_rate(struct st_quicly_conn_t *conn, const quicly_sent_packet_t *packet, quicly_sent_t *sent,
+                              quicly_sentmap_event_t event)
+{
+    /* only used by quicly_sentmap_on_delivered, discarded along with the frames */
+    return 0;
+}
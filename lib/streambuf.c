@@ -276,6 +276,7 @@ int quicly_dgrambuf_create(quicly_dgram_t *dgram, size_t sz)
         return PTLS_ERROR_NO_MEMORY;
     quicly_dgrambuf_init(&dbuf->ingress);
     quicly_dgrambuf_init(&dbuf->egress);
+    memset(&dbuf->drop, 0, sizeof(dbuf->drop));
     if (sz != sizeof(*dbuf))
         memset((char *)dbuf + sizeof(*dbuf), 0, sz - sizeof(*dbuf));
 
@@ -283,12 +284,41 @@ int quicly_dgrambuf_create(quicly_dgram_t *dgram, size_t sz)
     return 0;
 }
 
+static void dispose_vec(quicly_dgram_listbuf_vec_t *vec)
+{
+    if (vec->release != NULL) {
+        vec->release(vec);
+    } else {
+        free(vec->data);
+    }
+}
+
 int quicly_dgrambuf_egress_write(quicly_dgram_t *dgram, const void *src, size_t len, int64_t max_time)
 {
     quicly_dgrambuf_t *dbuf = (quicly_dgrambuf_t *)dgram->data;
     return quicly_dgrambuf_write(dgram, &dbuf->egress, src, len, max_time);
 }
 
+int quicly_dgrambuf_egress_write_vec(quicly_dgram_t *dgram, quicly_dgram_listbuf_vec_t *vec)
+{
+    quicly_dgrambuf_t *dbuf = (quicly_dgrambuf_t *)dgram->data;
+
+    if (vec->frame_id != 0) {
+        if (vec->frame_id == dbuf->drop.frame_id ||
+            (dbuf->drop.until_key && vec->priority != QUICLY_DGRAM_PRIORITY_KEY)) {
+            dispose_vec(vec);
+            ++dbuf->drop.num_discarded;
+            return 0;
+        }
+        if (vec->priority == QUICLY_DGRAM_PRIORITY_KEY)
+            dbuf->drop.until_key = 0;
+    }
+
+    if (vec->max_time == -1)
+        vec->max_time = INT64_MAX;
+    return quicly_dgrambuf_write_vec(dgram, &dbuf->egress, vec);
+}
+
 int quicly_dgrambuf_write(quicly_dgram_t *dgram, quicly_dgram_listbuf_t *buf, const void *src, size_t len, int64_t max_time)
 {
     quicly_dgram_listbuf_vec_t vec = {max_time==-1 ? INT64_MAX : max_time, len, NULL};
@@ -343,13 +373,63 @@ void quicly_dgrambuf_egress_shift(quicly_dgram_t *dgram, size_t delta)
     return quicly_dgrambuf_shift(&dbuf->egress, delta);
 }
 
+size_t quicly_dgrambuf_egress_drop(quicly_dgram_t *dgram, size_t index)
+{
+    quicly_dgrambuf_t *dbuf = (quicly_dgrambuf_t *)dgram->data;
+    quicly_dgram_listbuf_t *b = &dbuf->egress;
+    uint64_t frame_id;
+    int drop_dependents = 0;
+    size_t src, dst;
+
+    assert(index < b->vecs.size);
+
+    frame_id = b->vecs.entries[index].frame_id;
+    if (frame_id != 0) {
+        for (src = 0; src != b->vecs.size; ++src)
+            if (b->vecs.entries[src].frame_id == frame_id && b->vecs.entries[src].priority != QUICLY_DGRAM_PRIORITY_DISPOSABLE)
+                drop_dependents = 1;
+        dbuf->drop.frame_id = frame_id;
+    }
+
+    for (src = 0, dst = 0; src != b->vecs.size; ++src) {
+        quicly_dgram_listbuf_vec_t *vec = b->vecs.entries + src;
+        int drop;
+        if (frame_id == 0) {
+            drop = src == index;
+        } else if (vec->frame_id == frame_id) {
+            drop = 1;
+        } else if (src > index && drop_dependents && vec->frame_id != 0) {
+            /* the frames up to the next key frame cannot be decoded without the one being dropped */
+            if (vec->priority == QUICLY_DGRAM_PRIORITY_KEY) {
+                drop_dependents = 0;
+                drop = 0;
+            } else {
+                drop = 1;
+            }
+        } else {
+            drop = 0;
+        }
+        if (drop) {
+            dispose_vec(vec);
+        } else {
+            b->vecs.entries[dst++] = *vec;
+        }
+    }
+    if (drop_dependents)
+        dbuf->drop.until_key = 1;
+
+    src = b->vecs.size - dst;
+    b->vecs.size = dst;
+    return src;
+}
+
 void quicly_dgrambuf_shift(quicly_dgram_listbuf_t *b, size_t delta)
 {
     assert(delta <= b->vecs.size && delta != 0);
 
     for (int i = 0; i < delta; i++) {
         quicly_dgram_listbuf_vec_t *vec = b->vecs.entries + i;
-        free(vec->data);
+        dispose_vec(vec);
     }
 
     if (delta != b->vecs.size) {
@@ -395,7 +475,7 @@ void quicly_dgram_listbuf_dispose(quicly_dgram_listbuf_t *sb)
 
     for (i = 0; i != sb->vecs.size; ++i) {
         quicly_dgram_listbuf_vec_t *vec = sb->vecs.entries + i;
-        free(vec->data);
+        dispose_vec(vec);
     }
     free(sb->vecs.entries);
 }
@@ -0,0 +1,109 @@
+/* GStreamer
+ * Copyright (C) 2019 FIXME <fixme@example.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_QUICLYCONTROL_H_
+#define _GST_QUICLYCONTROL_H_
+
+#include <string.h>
+#include <glib.h>
+#include "quicly/streambuf.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Control protocol between quiclysink and quiclysrc.
+ *
+ * The client opens the first bidirectional stream (id 0) right after
+ * quicly_connect and keeps it open for the lifetime of the connection.
+ * Both peers write messages to it, each one being a type octet and the
+ * length of the payload as a 16-bit integer in network byte order,
+ * followed by the payload:
+ *
+ *   CAPS (sink -> src)          the caps string
+ *   CAPS_ACK (src -> sink)      the caps string that has been applied
+ *   CAPS_REQUEST (src -> sink)  empty; the sink answers with CAPS
+ *   KEY_FRAME_REQUEST (src -> sink) empty; forwarded upstream of the sink
+ *   FLOWS (src -> sink)         one octet, 1 if the datagrams carry the id
+ *                               of their flow (see below), 0 otherwise
+ *
+ * Echoing the caps in the ack lets the client ack the caps of a
+ * previous session in 0-RTT data, and lets the sink ignore acks of caps
+ * that have been renegotiated in the meantime.
+ *
+ * Flows: with request pads (sink_%u on quiclysink, src_%u on quiclysrc)
+ * further media such as audio or RTCP share the connection, and thus the
+ * handshake and the congestion controller, with the media of the always
+ * pads. Every datagram then starts with the id of its flow: 0 for the
+ * always pads, n for sink_n and src_n. Both peers have to be set up with
+ * request pads, the caps are only exchanged for flow 0. The client
+ * announces whether it expects the flow id with FLOWS, the first message
+ * it writes; the sink closes the connection with the application error
+ * GST_QUICLY_ERROR_FLOW_FRAMING if it is set up differently.
+ */
+#define GST_QUICLY_CONTROL_STREAM_ID 0
+#define GST_QUICLY_CONTROL_HEADER_SIZE 3
+#define GST_QUICLY_FLOW_HEADER_SIZE 1
+#define GST_QUICLY_MAX_FLOWS 256
+#define GST_QUICLY_ERROR_FLOW_FRAMING 1
+
+typedef enum {
+  GST_QUICLY_CONTROL_CAPS = 1,
+  GST_QUICLY_CONTROL_CAPS_ACK = 2,
+  GST_QUICLY_CONTROL_CAPS_REQUEST = 3,
+  GST_QUICLY_CONTROL_KEY_FRAME_REQUEST = 4,
+  GST_QUICLY_CONTROL_FLOWS = 5
+} GstQuiclyControlType;
+
+/* Append a message to the send buffer of the control stream */
+static inline int gst_quicly_control_write(quicly_stream_t *stream, GstQuiclyControlType type, const void *payload,
+                                           gsize len)
+{
+  guint8 hdr[GST_QUICLY_CONTROL_HEADER_SIZE] = {type, (guint8)(len >> 8), (guint8)len};
+  int ret;
+
+  if (len > G_MAXUINT16)
+    return -1;
+  if ((ret = quicly_streambuf_egress_write(stream, hdr, sizeof(hdr))) != 0)
+    return ret;
+  if (len != 0)
+    ret = quicly_streambuf_egress_write(stream, payload, len);
+  return ret;
+}
+
+/*
+ * Parse the message at the start of input. Returns the number of bytes
+ * it occupies, or 0 if it has not been received completely yet
+ */
+static inline gsize gst_quicly_control_parse(ptls_iovec_t input, guint8 *type, ptls_iovec_t *payload)
+{
+  gsize len;
+
+  if (input.len < GST_QUICLY_CONTROL_HEADER_SIZE)
+    return 0;
+  len = ((gsize)input.base[1] << 8) | input.base[2];
+  if (input.len - GST_QUICLY_CONTROL_HEADER_SIZE < len)
+    return 0;
+  *type = input.base[0];
+  *payload = ptls_iovec_init(input.base + GST_QUICLY_CONTROL_HEADER_SIZE, len);
+  return GST_QUICLY_CONTROL_HEADER_SIZE + len;
+}
+
+G_END_DECLS
+
+#endif
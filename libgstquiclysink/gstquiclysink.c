@@ -45,12 +45,20 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include "quicly.h"
 #include "quicly/defaults.h"
 #include "quicly/streambuf.h"
 #include "../deps/picotls/t/util.h"
 
 #include "gstquiclysink.h"
+#include "gstquiclycontrol.h"
 
 // quicly stuff
 GST_DEBUG_CATEGORY_STATIC (gst_quiclysink_debug_category);
@@ -85,6 +93,8 @@ static GstFlowReturn gst_quiclysink_render (GstBaseSink * sink,
     GstBuffer * buffer);
 static GstFlowReturn gst_quiclysink_render_list (GstBaseSink * bsink,
     GstBufferList * buffer_list);
+static gboolean gst_quiclysink_unlock (GstBaseSink * sink);
+static gboolean gst_quiclysink_unlock_stop (GstBaseSink * sink);
 
 static int save_ticket_cb(ptls_save_ticket_t *_self, ptls_t *tls, ptls_iovec_t src);
 static int on_client_hello_cb(ptls_on_client_hello_t *_self, ptls_t *tls, ptls_on_client_hello_parameters_t *params);
@@ -98,9 +108,63 @@ static int on_receive_dgram(quicly_dgram_t *dgram, const void *src, size_t len);
 static int on_receive_stream(quicly_stream_t *stream, size_t off, const void *src, size_t len);
 static int on_receive_reset(quicly_stream_t *stream, int err);
 static int send_pending(GstQuiclysink *quiclysink, guint num);
+static int send_packets(GstQuiclysink *quiclysink, quicly_conn_t *conn, GSocketAddress **addr, quicly_dgram_t *dgram,
+                        guint num, gboolean wait_all);
+static int send_caps(GstQuiclysink *quiclysink, quicly_conn_t *conn);
+static void handle_control_message(GstQuiclysink *quiclysink, quicly_conn_t *conn, guint8 type, ptls_iovec_t payload);
+static gboolean hold_back_media(GstQuiclysink *quiclysink, gboolean acked);
+static void push_key_frame_request(GstQuiclysink *quiclysink);
+static void setup_connection(GstQuiclysink *quiclysink, quicly_conn_t *conn);
+static void setup_clients(GstQuiclysink *quiclysink);
+static int receive_fanout(GstQuiclysink *quiclysink, struct sockaddr_in *sa, quicly_decoded_packet_t *packet);
+static void service_clients(GstQuiclysink *quiclysink);
+static void write_fanout_buffer(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time);
+static GstQuiclysinkClient *find_client(GstQuiclysink *quiclysink, quicly_conn_t *conn);
+static void free_client(GstQuiclysinkClient *client);
+static GstStructure *gst_quiclysink_get_client_stats(GstQuiclysink *quiclysink, const gchar *host, gint port);
 static int receive_packet(GstQuiclysink *quiclysink);
-static void write_dgram_buffer(quicly_dgram_t *dgram, const void *src, size_t len, gint64 max_time);
+static void service_handshake(GstQuiclysink *quiclysink);
+static gboolean hold_preconnect(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time);
+static guint get_queue_level(GstQuiclysink *quiclysink);
+static GstFlowReturn apply_queue_policy(GstQuiclysink *quiclysink, GstBuffer *buffer);
+static void post_queue_qos(GstQuiclysink *quiclysink, GstBuffer *buffer, guint level);
+static gssize receive_with_ecn(GSocket *socket, gchar *buf, gsize size, struct sockaddr_in *sa, guint8 *ecn);
+static void set_ecn_codepoint(GstQuiclysink *quiclysink, guint8 ecn);
+static void update_target_bitrate(GstQuiclysink *quiclysink);
+static void update_peer_address(GSocketAddress **addr, struct sockaddr *sa);
+static void write_dgram_buffer(GstQuiclysink *quiclysink, const void *src, size_t len, gint64 max_time);
+static void release_copied_payload(quicly_dgram_listbuf_vec_t *vec);
+static int write_stream_buffer(GstQuiclysink *quiclysink, GstBuffer *buffer, GstMapInfo *map, gint64 max_time);
+static void write_media_buffer(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time);
+static quicly_stream_t *get_frame_stream(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time);
+static void expire_frame_streams(GstQuiclysink *quiclysink);
+static void close_frame_stream(GstQuiclysink *quiclysink);
+static void on_frame_stream_destroy(quicly_stream_t *stream, int err);
+static int on_frame_stream_stop_sending(quicly_stream_t *stream, int err);
+static void tag_frame(GstQuiclysink *quiclysink, quicly_dgram_listbuf_vec_t *vec);
+static gboolean parse_rtp_frame(GstQuiclysink *quiclysink, const guint8 *rtp, gsize len, guint32 *ts, guint8 *priority);
+static size_t get_drop_index(quicly_dgram_t *dgram);
+static gint64 get_max_time(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 now);
 static GstStructure *gst_quiclysink_create_stats(GstQuiclysink *quiclysink);
+static GstStructure *stats_to_structure(const gchar *name, const quicly_stats_t *stats, guint64 bytes_sent_media);
+static int encrypt_ticket_cb(ptls_encrypt_ticket_t *_self, ptls_t *tls, int is_encrypt, ptls_buffer_t *dst, ptls_iovec_t src);
+static gboolean setup_ticket_key(GstQuiclysink *quiclysink);
+static gboolean start_io_thread(GstQuiclysink *quiclysink);
+static void stop_io_thread(GstQuiclysink *quiclysink);
+static gpointer io_thread_func(gpointer data);
+static void wake_io_thread(GstQuiclysink *quiclysink);
+static gboolean push_io_buffer(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time);
+static gboolean io_thread_stopped(GstQuiclysink *quiclysink);
+
+/* request pads */
+static GstPad *gst_quiclysink_request_new_pad(GstElement *element, GstPadTemplate *templ, const gchar *name,
+                                              const GstCaps *caps);
+static void gst_quiclysink_release_pad(GstElement *element, GstPad *pad);
+static GstFlowReturn gst_quiclysink_flow_chain(GstPad *pad, GstObject *parent, GstBuffer *buffer);
+static gboolean gst_quiclysink_flow_event(GstPad *pad, GstObject *parent, GstEvent *event);
+static GstQuiclysinkPad *find_flow(GstQuiclysink *quiclysink, guint flow);
+static int write_flow_dgram(GstQuiclysink *quiclysink, guint8 flow, quicly_dgram_listbuf_vec_t *vec);
+static void queue_by_priority(GstQuiclysink *quiclysink);
 
 static const char *session_file = NULL;
 
@@ -144,10 +208,17 @@ static const quicly_stream_callbacks_t stream_callbacks = {quicly_streambuf_dest
                                                            on_stop_sending,
                                                            on_receive_stream,
                                                            on_receive_reset};
+static const quicly_stream_callbacks_t frame_stream_callbacks = {on_frame_stream_destroy,
+                                                                 quicly_streambuf_egress_shift,
+                                                                 quicly_streambuf_egress_emit,
+                                                                 on_frame_stream_stop_sending,
+                                                                 on_receive_stream,
+                                                                 on_receive_reset};
 static const quicly_dgram_callbacks_t dgram_callbacks = {quicly_dgrambuf_destroy,
                                                          quicly_dgrambuf_egress_shift,
                                                          quicly_dgrambuf_egress_emit,
-                                                         on_receive_dgram};
+                                                         on_receive_dgram,
+                                                         quicly_dgrambuf_egress_drop};
 
 #define UDP_DEFAULT_BIND_ADDRESS  "0.0.0.0"
 #define UDP_DEFAULT_BIND_PORT     5000
@@ -158,10 +229,50 @@ static const quicly_dgram_callbacks_t dgram_callbacks = {quicly_dgrambuf_destroy
 #define DEFAULT_AUTO_CAPS_EXCHANGE FALSE
 #define RECEIVE_CLOCK_TIME_NS     2000000
 #define FEEDBACK_TIME_INTERVAL_NS 20000000
+#define TARGET_BITRATE_CHANGE_THRESHOLD 2 /* percent */
 #define DEFAULT_APPLICATION_CC    FALSE
 #define DEFAULT_FEEDBACK          FALSE
 #define DEFAULT_DROP_LATE         -1
+#define DEFAULT_MAX_LATENCY       0
+#define DEFAULT_CC_ALGORITHM      "reno"
+#define DEFAULT_MIN_BITRATE       QUICLY_MEDIA_CC_MIN_BITRATE
+#define DEFAULT_MAX_BITRATE       QUICLY_MEDIA_CC_MAX_BITRATE
 #define DEFAULT_SEND_BUFFER       16
+#define DEFAULT_ECN               "none"
+#define DEFAULT_SEND_RATE         0
+#define DEFAULT_SEND_BURST        0
+#define DEFAULT_TICKET_KEY_FILE   NULL
+#define DEFAULT_MAX_CLIENTS       1
+#define DEFAULT_CLIENT_QUEUE_SIZE 256
+#define DEFAULT_IO_THREAD         FALSE
+#define IO_RING_SIZE              1024 /* power of two */
+#define DEFAULT_FRAME_DROP        FALSE
+#define DEFAULT_PRECONNECT_SIZE   256
+#define DEFAULT_PRECONNECT_KEY_FRAME FALSE
+#define DEFAULT_QUEUE_THRESHOLD   0
+#define DEFAULT_QUEUE_POLICY      "qos"
+#define QUEUE_POLL_INTERVAL_US    1000
+#define QOS_INTERVAL_MS           100
+
+/* codecs understood by the frame-aware drop policy */
+enum
+{
+  FRAME_CODEC_NONE,
+  FRAME_CODEC_H264,
+  FRAME_CODEC_H265
+};
+
+/* what render does once queue-threshold datagrams are waiting */
+enum
+{
+  QUEUE_POLICY_BLOCK,
+  QUEUE_POLICY_DROP,
+  QUEUE_POLICY_QOS
+};
+
+#define QUICLYSINK_IS_FANOUT(s)   ((s)->max_clients > 1)
+/* payload that fits into one datagram frame, less the flow id with request pads */
+#define QUICLYSINK_MAX_PAYLOAD(s) ((s)->quicly_mtu - ((s)->flow_framing ? GST_QUICLY_FLOW_HEADER_SIZE : 0))
 
 /* properties */
 enum
@@ -178,13 +289,33 @@ enum
   PROP_AUTO_CAPS_EXCHANGE,
   PROP_APPLICATION_CC,
   PROP_FEEDBACK,
-  PROP_DROP_LATE
+  PROP_DROP_LATE,
+  PROP_MAX_LATENCY,
+  PROP_CC_ALGORITHM,
+  PROP_TARGET_BITRATE,
+  PROP_MIN_BITRATE,
+  PROP_MAX_BITRATE,
+  PROP_ECN,
+  PROP_SEND_RATE,
+  PROP_SEND_BURST,
+  PROP_TICKET_KEY_FILE,
+  PROP_MAX_CLIENTS,
+  PROP_CLIENT_QUEUE_SIZE,
+  PROP_NUM_CLIENTS,
+  PROP_IO_THREAD,
+  PROP_FRAME_DROP,
+  PROP_PRECONNECT_QUEUE_SIZE,
+  PROP_PRECONNECT_KEY_FRAME,
+  PROP_QUEUE_THRESHOLD,
+  PROP_QUEUE_POLICY
 };
 
 /* signals */
 enum
 {
   SIGNAL_ON_FEEDBACK_REPORT,
+  SIGNAL_ON_TARGET_BITRATE,
+  SIGNAL_GET_CLIENT_STATS,
   LAST_SIGNAL
 };
 
@@ -199,6 +330,97 @@ GST_STATIC_PAD_TEMPLATE ("sink",
     GST_STATIC_CAPS_ANY
     );
 
+static GstStaticPadTemplate gst_quiclysink_flow_template =
+GST_STATIC_PAD_TEMPLATE ("sink_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS_ANY
+    );
+
+/* request pad properties */
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_PRIORITY,
+  PROP_PAD_DROP_LATE
+};
+
+G_DEFINE_TYPE (GstQuiclysinkPad, gst_quiclysink_pad, GST_TYPE_PAD);
+
+static void
+gst_quiclysink_pad_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstQuiclysinkPad *pad = GST_QUICLYSINK_PAD (object);
+  GstObject *parent;
+
+  switch (property_id) {
+    case PROP_PAD_PRIORITY:
+      pad->priority = g_value_get_uint(value);
+      if ((parent = gst_object_get_parent(GST_OBJECT(pad))) != NULL) {
+        GST_OBJECT_LOCK(parent);
+        GST_QUICLYSINK(parent)->flow_priority[pad->flow] = pad->priority;
+        GST_OBJECT_UNLOCK(parent);
+        gst_object_unref(parent);
+      }
+      break;
+    case PROP_PAD_DROP_LATE:
+      pad->drop_late = g_value_get_int(value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_quiclysink_pad_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstQuiclysinkPad *pad = GST_QUICLYSINK_PAD (object);
+
+  switch (property_id) {
+    case PROP_PAD_PRIORITY:
+      g_value_set_uint(value, pad->priority);
+      break;
+    case PROP_PAD_DROP_LATE:
+      g_value_set_int(value, pad->drop_late);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_quiclysink_pad_class_init (GstQuiclysinkPadClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *)klass;
+
+  gobject_class->set_property = gst_quiclysink_pad_set_property;
+  gobject_class->get_property = gst_quiclysink_pad_get_property;
+
+  g_object_class_install_property(gobject_class, PROP_PAD_PRIORITY,
+                                g_param_spec_uint("priority", "Priority",
+                                "Datagrams of this flow are sent ahead of the queued datagrams of flows with a lower priority. The media of the sink pad has 0",
+                                0, G_MAXUINT8, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_PAD_DROP_LATE,
+                                g_param_spec_int("drop-late", "DropLate",
+                                "Drop the datagrams of this flow still queued after this many ms. 0: Drop immediatly, -1: Never (Default)",
+                                -1, 65535, DEFAULT_DROP_LATE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_quiclysink_pad_init (GstQuiclysinkPad * pad)
+{
+  pad->flow = 0;
+  pad->priority = 0;
+  pad->drop_late = DEFAULT_DROP_LATE;
+  pad->num_packets = 0;
+  pad->num_bytes = 0;
+  pad->num_dropped = 0;
+}
+
 
 /* class initialization */
 
@@ -218,6 +440,8 @@ gst_quiclysink_class_init (GstQuiclysinkClass * klass)
      base_class_init if you intend to subclass this class. */
   gst_element_class_add_pad_template (GST_ELEMENT_CLASS(klass),
       gst_static_pad_template_get (&gst_quiclysink_sink_template));
+  gst_element_class_add_static_pad_template_with_gtype (GST_ELEMENT_CLASS(klass),
+      &gst_quiclysink_flow_template, GST_TYPE_QUICLYSINK_PAD);
 
   gst_element_class_set_static_metadata (GST_ELEMENT_CLASS(klass),
       "Quic dgram server", "Sink/Network", "Send data over the network via quic",
@@ -239,6 +463,34 @@ gst_quiclysink_class_init (GstQuiclysinkClass * klass)
     G_TYPE_UINT64, G_TYPE_UINT64, G_TYPE_UINT64, G_TYPE_UINT64,
     G_TYPE_UINT64, G_TYPE_UINT, G_TYPE_INT64);
 
+  /**
+   * GstQuiclysink::on-target-bitrate
+   * @quiclysink: the object sending the signal
+   * @bitrate: guint64 containing the media bitrate (bit/s) recommended by the
+   *   congestion controller. Emitted when it changes noticeably. Only
+   *   available with cc-algorithm=media
+   */
+  quiclysink_signals[SIGNAL_ON_TARGET_BITRATE] =
+    g_signal_new("on-target-bitrate", G_TYPE_FROM_CLASS(klass),
+    G_SIGNAL_RUN_LAST, G_STRUCT_OFFSET(GstQuiclysinkClass, on_target_bitrate),
+    NULL, NULL, g_cclosure_marshal_generic, G_TYPE_NONE, 1, G_TYPE_UINT64);
+
+  /**
+   * GstQuiclysink::get-client-stats
+   * @quiclysink: the sink on which the signal is emitted
+   * @host: the address of the client
+   * @port: the port of the client
+   *
+   * Get the statistics of a client in fan-out mode (max-clients > 1).
+   * Returns NULL if there is no such client
+   */
+  quiclysink_signals[SIGNAL_GET_CLIENT_STATS] =
+    g_signal_new("get-client-stats", G_TYPE_FROM_CLASS(klass),
+    G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION, G_STRUCT_OFFSET(GstQuiclysinkClass, get_client_stats),
+    NULL, NULL, g_cclosure_marshal_generic, GST_TYPE_STRUCTURE, 2, G_TYPE_STRING, G_TYPE_INT);
+
+  klass->get_client_stats = gst_quiclysink_get_client_stats;
+
   gobject_class->set_property = gst_quiclysink_set_property;
   gobject_class->get_property = gst_quiclysink_get_property;
   gobject_class->dispose = gst_quiclysink_dispose;
@@ -251,8 +503,12 @@ gst_quiclysink_class_init (GstQuiclysinkClass * klass)
   base_sink_class->set_caps = GST_DEBUG_FUNCPTR (gst_quiclysink_set_caps);
   base_sink_class->render = GST_DEBUG_FUNCPTR (gst_quiclysink_render);
   base_sink_class->render_list = GST_DEBUG_FUNCPTR (gst_quiclysink_render_list);
+  base_sink_class->unlock = GST_DEBUG_FUNCPTR (gst_quiclysink_unlock);
+  base_sink_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_quiclysink_unlock_stop);
 
   gstelement_class->set_clock = GST_DEBUG_FUNCPTR(gst_quiclysink_set_clock);
+  gstelement_class->request_new_pad = GST_DEBUG_FUNCPTR(gst_quiclysink_request_new_pad);
+  gstelement_class->release_pad = GST_DEBUG_FUNCPTR(gst_quiclysink_release_pad);
 
   g_object_class_install_property(gobject_class, PROP_BIND_ADDRESS, 
                   g_param_spec_string("bind-addr", "BindAddr", "the host address to bind", 
@@ -281,7 +537,7 @@ gst_quiclysink_class_init (GstQuiclysinkClass * klass)
                                   DEFAULT_STREAM_MODE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property(gobject_class, PROP_MULTI_STREAM_MODE,
                                   g_param_spec_boolean("multi-stream-mode", "Multi Stream Mode",
-                                  "Use new stream id for each packet.",
+                                  "Send each frame on its own unidirectional stream, reset once the frame misses its deadline (see max-latency and drop-late). Implies stream-mode",
                                   DEFAULT_STREAM_MODE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property(gobject_class, PROP_STATS,
                                   g_param_spec_boxed("stats", "Statistics", "Various Statistics",
@@ -299,6 +555,79 @@ gst_quiclysink_class_init (GstQuiclysinkClass * klass)
                                 g_param_spec_int("drop-late", "DropLate", "Drop late packets. 0: Drop immediatly, -1: Never (Default)",
                                 -1, 65535, DEFAULT_DROP_LATE,
                                 G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_MAX_LATENCY,
+                                g_param_spec_uint("max-latency", "MaxLatency",
+                                "Drop datagrams that are still queued this many ms after the running time of their buffer. 0: Use drop-late (Default)",
+                                0, 65535, DEFAULT_MAX_LATENCY,
+                                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_CC_ALGORITHM,
+                                g_param_spec_string("cc-algorithm", "CCAlgorithm",
+                                "Congestion control algorithm used by quicly (reno, cubic, bbr or media)",
+                                DEFAULT_CC_ALGORITHM, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_TARGET_BITRATE,
+                                g_param_spec_uint64("target-bitrate", "TargetBitrate",
+                                "Media bitrate (bit/s) recommended by the congestion controller. 0 if not available",
+                                0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_MIN_BITRATE,
+                                g_param_spec_uint64("min-bitrate", "MinBitrate",
+                                "Lower bound of the target bitrate (bit/s)",
+                                1, G_MAXUINT64, DEFAULT_MIN_BITRATE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_MAX_BITRATE,
+                                g_param_spec_uint64("max-bitrate", "MaxBitrate",
+                                "Upper bound of the target bitrate (bit/s)",
+                                1, G_MAXUINT64, DEFAULT_MAX_BITRATE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_ECN,
+                                g_param_spec_string("ecn", "ECN",
+                                "ECN marking of the sent packets. none, classic (ECT(0), CE handled as loss) or l4s (ECT(1), scalable response to CE)",
+                                DEFAULT_ECN, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_SEND_RATE,
+                                g_param_spec_uint64("send-rate", "SendRate",
+                                "Rate (bit/s) at which quicly paces the packets, replacing the congestion window. 0: congestion controlled (Default)",
+                                0, G_MAXUINT64, DEFAULT_SEND_RATE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_SEND_BURST,
+                                g_param_spec_uint("send-burst", "SendBurst",
+                                "Number of bytes that can be sent at once when send-rate is set. 0: 10 packets (Default)",
+                                0, G_MAXUINT32, DEFAULT_SEND_BURST, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_TICKET_KEY_FILE,
+                                g_param_spec_string("ticket-key-file", "TicketKeyFile",
+                                "File holding the secret for session tickets (created if missing). Allows clients to resume with 0-RTT after a restart",
+                                DEFAULT_TICKET_KEY_FILE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_MAX_CLIENTS,
+                                g_param_spec_uint("max-clients", "MaxClients",
+                                "Number of clients served at once. Above 1, every buffer is sent to all connected clients (datagram mode only)",
+                                1, G_MAXUINT, DEFAULT_MAX_CLIENTS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_CLIENT_QUEUE_SIZE,
+                                g_param_spec_uint("client-queue-size", "ClientQueueSize",
+                                "Datagrams queued per client in fan-out mode. The oldest one is dropped when a client falls behind",
+                                1, G_MAXUINT, DEFAULT_CLIENT_QUEUE_SIZE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_NUM_CLIENTS,
+                                g_param_spec_uint("num-clients", "NumClients",
+                                "Number of clients connected in fan-out mode",
+                                0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_IO_THREAD,
+                                g_param_spec_boolean("io-thread", "IOThread",
+                                "Do all socket I/O on a dedicated thread driven by epoll and the quicly timer; render only queues the buffers",
+                                DEFAULT_IO_THREAD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_FRAME_DROP,
+                                g_param_spec_boolean("frame-drop", "FrameDrop",
+                                "For H.264/H.265 over RTP: drop whole frames and the frames depending on them instead of single datagrams, never expire key frames",
+                                DEFAULT_FRAME_DROP, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_PRECONNECT_QUEUE_SIZE,
+                                g_param_spec_uint("preconnect-queue-size", "PreconnectQueueSize",
+                                "Buffers kept while waiting for the client, sent as soon as it connected. 0: drop them",
+                                0, G_MAXUINT, DEFAULT_PRECONNECT_SIZE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_PRECONNECT_KEY_FRAME,
+                                g_param_spec_boolean("preconnect-key-frame", "PreconnectKeyFrame",
+                                "For H.264/H.265 over RTP: keep only the latest key frame and the frames following it while waiting for the client",
+                                DEFAULT_PRECONNECT_KEY_FRAME, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_QUEUE_THRESHOLD,
+                                g_param_spec_uint("queue-threshold", "QueueThreshold",
+                                "Datagrams waiting to be sent (of the slowest client in fan-out mode) at which queue-policy applies. 0: disabled (Default)",
+                                0, G_MAXUINT, DEFAULT_QUEUE_THRESHOLD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_QUEUE_POLICY,
+                                g_param_spec_string("queue-policy", "QueuePolicy",
+                                "What happens above queue-threshold. block (render waits), drop (the buffer is discarded) or qos (QoS events are sent upstream)",
+                                DEFAULT_QUEUE_POLICY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -310,18 +639,42 @@ gst_quiclysink_init (GstQuiclysink *quiclysink)
 
   quiclysink->num_packets = 0;
   quiclysink->num_bytes = 0;
+  quiclysink->num_ring_dropped = 0;
   quiclysink->silent = TRUE;
   quiclysink->stream_mode = DEFAULT_STREAM_MODE;
   quiclysink->multi_stream_mode = DEFAULT_STREAM_MODE;
+  g_queue_init(&quiclysink->frame_streams);
+  quiclysink->frame_stream = NULL;
+  quiclysink->frame_stream_eos = FALSE;
+  quiclysink->num_frames_reset = 0;
   quiclysink->received_caps_ack = FALSE;
+  quiclysink->media_held_back = FALSE;
+  quiclysink->num_held_back = 0;
+  quiclysink->key_frame_requested = FALSE;
+  quiclysink->num_key_frame_requests = 0;
   quiclysink->auto_caps_exchange = DEFAULT_AUTO_CAPS_EXCHANGE;
   quiclysink->application_cc = DEFAULT_APPLICATION_CC;
   quiclysink->feedback_active = DEFAULT_FEEDBACK;
   quiclysink->drop_late = DEFAULT_DROP_LATE;
+  quiclysink->max_latency = DEFAULT_MAX_LATENCY;
+  quiclysink->min_bitrate = DEFAULT_MIN_BITRATE;
+  quiclysink->max_bitrate = DEFAULT_MAX_BITRATE;
+  quiclysink->target_bitrate = 0;
   quiclysink->clockId = NULL;
   quiclysink->fbClockId = NULL;
   quiclysink->pipeline_clock = NULL;
   quiclysink->quicly_mtu = QUICLY_DEFAULT_MTU;
+  quiclysink->ecn_tos = QUICLY_ECN_NOT_ECT;
+  quiclysink->send_rate = DEFAULT_SEND_RATE;
+  quiclysink->send_burst = DEFAULT_SEND_BURST;
+  quiclysink->ticket_key_file = g_strdup(DEFAULT_TICKET_KEY_FILE);
+  quiclysink->encrypt_ticket.cb = encrypt_ticket_cb;
+  quiclysink->max_clients = DEFAULT_MAX_CLIENTS;
+  quiclysink->client_queue_size = DEFAULT_CLIENT_QUEUE_SIZE;
+  quiclysink->clients = g_ptr_array_new();
+  g_mutex_init(&quiclysink->clients_lock);
+  quiclysink->ticket_aead[0] = NULL;
+  quiclysink->ticket_aead[1] = NULL;
 
   /* Setup quicly and tls context */
   quiclysink->tlsctx.random_bytes = ptls_openssl_random_bytes;
@@ -361,6 +714,33 @@ gst_quiclysink_init (GstQuiclysink *quiclysink)
   quiclysink->dgram = NULL;
   /* -------- end context init --------------*/
 
+  quiclysink->io_thread = DEFAULT_IO_THREAD;
+  quiclysink->io_thread_handle = NULL;
+  quiclysink->epoll_fd = quiclysink->event_fd = quiclysink->timer_fd = -1;
+  quiclysink->frame_drop = DEFAULT_FRAME_DROP;
+  quiclysink->frame_codec = FRAME_CODEC_NONE;
+  quiclysink->frame_id = 0;
+  quiclysink->frame_ended = FALSE;
+  quiclysink->connected = FALSE;
+  quiclysink->media_open = FALSE;
+  g_queue_init(&quiclysink->preconnect);
+  quiclysink->preconnect_size = DEFAULT_PRECONNECT_SIZE;
+  quiclysink->preconnect_key_frame = DEFAULT_PRECONNECT_KEY_FRAME;
+  quiclysink->preconnect_has_key = FALSE;
+  quiclysink->num_preconnect_dropped = 0;
+  quiclysink->queue_threshold = DEFAULT_QUEUE_THRESHOLD;
+  quiclysink->queue_policy = QUEUE_POLICY_QOS;
+  quiclysink->dgram_pending = 0;
+  quiclysink->flushing = FALSE;
+  quiclysink->qos_active = FALSE;
+  quiclysink->qos_window_start = 0;
+  quiclysink->qos_window_bytes = 0;
+  quiclysink->num_queue_dropped = 0;
+  quiclysink->num_qos_events = 0;
+  quiclysink->flows = g_ptr_array_new();
+  quiclysink->flow_framing = FALSE;
+  memset(quiclysink->flow_priority, 0, sizeof(quiclysink->flow_priority));
+
   quiclysink->recv_buf = malloc(sizeof(gchar) * (2048 + 1));
   quiclysink->recv_buf_size = 2048;
   quiclysink->previousPts = 0;
@@ -421,6 +801,105 @@ gst_quiclysink_set_property (GObject * object, guint property_id,
     case PROP_DROP_LATE:
       quiclysink->drop_late = g_value_get_int(value);
       break;
+    case PROP_MAX_LATENCY:
+      quiclysink->max_latency = g_value_get_uint(value);
+      break;
+    case PROP_CC_ALGORITHM: {
+      const gchar *name = g_value_get_string(value);
+      const quicly_cc_algorithm_t *const *algo;
+      for (algo = quicly_cc_all_algorithms; *algo != NULL; ++algo) {
+        if (g_strcmp0((*algo)->name, name == NULL ? DEFAULT_CC_ALGORITHM : name) == 0)
+          break;
+      }
+      if (*algo != NULL)
+        quiclysink->ctx.cc_algorithm = *algo;
+      else
+        g_printerr("Unknown congestion control algorithm: %s\n", name);
+      break;
+    }
+    case PROP_MIN_BITRATE:
+      quiclysink->min_bitrate = g_value_get_uint64(value);
+      if (quiclysink->conn != NULL) {
+        GST_OBJECT_LOCK(quiclysink);
+        quicly_set_target_bitrate_limits(quiclysink->conn, quiclysink->min_bitrate, 0);
+        GST_OBJECT_UNLOCK(quiclysink);
+      } else if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+        setup_clients(quiclysink);
+      }
+      break;
+    case PROP_MAX_BITRATE:
+      quiclysink->max_bitrate = g_value_get_uint64(value);
+      if (quiclysink->conn != NULL) {
+        GST_OBJECT_LOCK(quiclysink);
+        quicly_set_target_bitrate_limits(quiclysink->conn, 0, quiclysink->max_bitrate);
+        GST_OBJECT_UNLOCK(quiclysink);
+      } else if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+        setup_clients(quiclysink);
+      }
+      break;
+    case PROP_SEND_RATE:
+    case PROP_SEND_BURST:
+      if (property_id == PROP_SEND_RATE)
+        quiclysink->send_rate = g_value_get_uint64(value);
+      else
+        quiclysink->send_burst = g_value_get_uint(value);
+      if (quiclysink->conn != NULL) {
+        GST_OBJECT_LOCK(quiclysink);
+        quicly_set_send_rate(quiclysink->conn, quiclysink->send_rate, quiclysink->send_burst);
+        GST_OBJECT_UNLOCK(quiclysink);
+      } else if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+        setup_clients(quiclysink);
+      }
+      break;
+    case PROP_ECN: {
+      const gchar *mode = g_value_get_string(value);
+      if (mode == NULL || g_strcmp0(mode, "none") == 0)
+        quiclysink->ctx.ecn = QUICLY_ECN_NOT_ECT;
+      else if (g_strcmp0(mode, "classic") == 0)
+        quiclysink->ctx.ecn = QUICLY_ECN_ECT0;
+      else if (g_strcmp0(mode, "l4s") == 0)
+        quiclysink->ctx.ecn = QUICLY_ECN_ECT1;
+      else
+        g_printerr("Unknown ECN mode: %s\n", mode);
+      break;
+    }
+    case PROP_TICKET_KEY_FILE:
+      g_free(quiclysink->ticket_key_file);
+      quiclysink->ticket_key_file = g_value_dup_string(value);
+      break;
+    case PROP_MAX_CLIENTS:
+      quiclysink->max_clients = g_value_get_uint(value);
+      break;
+    case PROP_CLIENT_QUEUE_SIZE:
+      quiclysink->client_queue_size = g_value_get_uint(value);
+      break;
+    case PROP_IO_THREAD:
+      quiclysink->io_thread = g_value_get_boolean(value);
+      break;
+    case PROP_FRAME_DROP:
+      quiclysink->frame_drop = g_value_get_boolean(value);
+      break;
+    case PROP_PRECONNECT_QUEUE_SIZE:
+      quiclysink->preconnect_size = g_value_get_uint(value);
+      break;
+    case PROP_PRECONNECT_KEY_FRAME:
+      quiclysink->preconnect_key_frame = g_value_get_boolean(value);
+      break;
+    case PROP_QUEUE_THRESHOLD:
+      quiclysink->queue_threshold = g_value_get_uint(value);
+      break;
+    case PROP_QUEUE_POLICY: {
+      const gchar *policy = g_value_get_string(value);
+      if (g_strcmp0(policy, "block") == 0)
+        quiclysink->queue_policy = QUEUE_POLICY_BLOCK;
+      else if (g_strcmp0(policy, "drop") == 0)
+        quiclysink->queue_policy = QUEUE_POLICY_DROP;
+      else if (policy == NULL || g_strcmp0(policy, "qos") == 0)
+        quiclysink->queue_policy = QUEUE_POLICY_QOS;
+      else
+        g_printerr("Unknown queue policy: %s\n", policy);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -445,6 +924,31 @@ gst_quiclysink_get_property (GObject * object, guint property_id,
     case PROP_DROP_LATE:
       g_value_set_int(value, quiclysink->drop_late);
       break;
+    case PROP_MAX_LATENCY:
+      g_value_set_uint(value, quiclysink->max_latency);
+      break;
+    case PROP_CC_ALGORITHM:
+      g_value_set_string(value, quiclysink->ctx.cc_algorithm->name);
+      break;
+    case PROP_TARGET_BITRATE:
+      g_value_set_uint64(value, quiclysink->target_bitrate);
+      break;
+    case PROP_MIN_BITRATE:
+      g_value_set_uint64(value, quiclysink->min_bitrate);
+      break;
+    case PROP_MAX_BITRATE:
+      g_value_set_uint64(value, quiclysink->max_bitrate);
+      break;
+    case PROP_SEND_RATE:
+      g_value_set_uint64(value, quiclysink->send_rate);
+      break;
+    case PROP_SEND_BURST:
+      g_value_set_uint(value, quiclysink->send_burst);
+      break;
+    case PROP_ECN:
+      g_value_set_string(value, quiclysink->ctx.ecn == QUICLY_ECN_ECT1 ? "l4s" :
+                                quiclysink->ctx.ecn == QUICLY_ECN_ECT0 ? "classic" : "none");
+      break;
     case PROP_MULTI_STREAM_MODE:
       g_value_set_boolean(value, quiclysink->multi_stream_mode);
       break;
@@ -469,6 +973,39 @@ gst_quiclysink_get_property (GObject * object, guint property_id,
     case PROP_CERTIFICATE:
       g_value_set_string(value, quiclysink->cert);
       break;
+    case PROP_TICKET_KEY_FILE:
+      g_value_set_string(value, quiclysink->ticket_key_file);
+      break;
+    case PROP_MAX_CLIENTS:
+      g_value_set_uint(value, quiclysink->max_clients);
+      break;
+    case PROP_CLIENT_QUEUE_SIZE:
+      g_value_set_uint(value, quiclysink->client_queue_size);
+      break;
+    case PROP_NUM_CLIENTS:
+      g_mutex_lock(&quiclysink->clients_lock);
+      g_value_set_uint(value, quiclysink->clients->len);
+      g_mutex_unlock(&quiclysink->clients_lock);
+      break;
+    case PROP_IO_THREAD:
+      g_value_set_boolean(value, quiclysink->io_thread);
+      break;
+    case PROP_FRAME_DROP:
+      g_value_set_boolean(value, quiclysink->frame_drop);
+      break;
+    case PROP_PRECONNECT_QUEUE_SIZE:
+      g_value_set_uint(value, quiclysink->preconnect_size);
+      break;
+    case PROP_PRECONNECT_KEY_FRAME:
+      g_value_set_boolean(value, quiclysink->preconnect_key_frame);
+      break;
+    case PROP_QUEUE_THRESHOLD:
+      g_value_set_uint(value, quiclysink->queue_threshold);
+      break;
+    case PROP_QUEUE_POLICY:
+      g_value_set_string(value, quiclysink->queue_policy == QUEUE_POLICY_BLOCK ? "block" :
+                                quiclysink->queue_policy == QUEUE_POLICY_DROP ? "drop" : "qos");
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -529,6 +1066,22 @@ gst_quiclysink_finalize (GObject * object)
     free(quiclysink->dgram);
     quiclysink->dgram = NULL;
   }
+  for (int i = 0; i < 2; i++) {
+    if (quiclysink->ticket_aead[i] != NULL) {
+      ptls_aead_free(quiclysink->ticket_aead[i]);
+      quiclysink->ticket_aead[i] = NULL;
+    }
+  }
+  g_free(quiclysink->ticket_key_file);
+  quiclysink->ticket_key_file = NULL;
+  if (quiclysink->clients != NULL) {
+    g_ptr_array_foreach(quiclysink->clients, (GFunc) free_client, NULL);
+    g_ptr_array_free(quiclysink->clients, TRUE);
+    quiclysink->clients = NULL;
+  }
+  g_mutex_clear(&quiclysink->clients_lock);
+  /* the pads themselves are owned by the element */
+  g_ptr_array_free(quiclysink->flows, TRUE);
   G_OBJECT_CLASS (gst_quiclysink_parent_class)->finalize (object);
 }
 
@@ -547,6 +1100,20 @@ gst_quiclysink_start (GstBaseSink * sink)
     return FALSE;
   }
 
+  /* without a ticket key, tickets are only valid for the lifetime of this process */
+  if (quiclysink->ticket_key_file != NULL && !setup_ticket_key(quiclysink))
+    return FALSE;
+
+  /* request pads: their flows are multiplexed with the media, see gstquiclycontrol.h */
+  GST_OBJECT_LOCK(quiclysink);
+  quiclysink->flow_framing = quiclysink->flows->len > 0;
+  GST_OBJECT_UNLOCK(quiclysink);
+  if (quiclysink->flow_framing &&
+      (quiclysink->stream_mode || quiclysink->multi_stream_mode || QUICLYSINK_IS_FANOUT(quiclysink))) {
+    g_printerr("Request pads are only supported in datagram mode with a single client\n");
+    return FALSE;
+  }
+
   GError *err = NULL;
   GInetAddress *iaddr;
 
@@ -571,65 +1138,31 @@ gst_quiclysink_start (GstBaseSink * sink)
     return FALSE;
   }
 
-  int64_t timeout_at;
-  int64_t delta;
-  int64_t wait = 0;
-  err = NULL;
-
-  g_print("Waiting for client...");
-  while(1) {
-    if (quiclysink->conn != NULL) {
-      if (quicly_connection_is_ready(quiclysink->conn))
-        break;
-    }
-    timeout_at = quiclysink->conn != NULL ? quicly_get_first_timeout(quiclysink->conn) : INT64_MAX;
-    if (timeout_at != INT64_MAX) {
-      delta = timeout_at - quiclysink->ctx.now->cb(quiclysink->ctx.now);
-      if (delta > 0) {
-        wait = delta * 1000;
-      } else {
-        wait = 0;
-      }
-    } else {
-      wait = timeout_at;
-    }
-    if (g_socket_condition_timed_wait(quiclysink->socket, G_IO_IN | G_IO_PRI, wait, NULL, &err)) {
-      if (receive_packet(quiclysink) != 0) {
-        g_printerr("Error in receive_packet\n");
-      }
-    }
-    err = NULL;
-    if ((quiclysink->conn != NULL) && 
-         (quicly_get_first_timeout(quiclysink->conn) <= quiclysink->ctx.now->cb(quiclysink->ctx.now))) {
-      if (send_pending(quiclysink, DEFAULT_SEND_BUFFER) != 0) {
-        quicly_free(quiclysink->conn);
-        g_print("Connection closed while sending\n");
-        quiclysink->conn = NULL;
-      }
-    }
+  /* receive the TOS byte of incoming packets, so that the ECN counts can be reported to the peer */
+  {
+    int on = 1;
+    if (setsockopt(g_socket_get_fd(quiclysink->socket), IPPROTO_IP, IP_RECVTOS, &on, sizeof(on)) != 0)
+      g_printerr("Failed to set IP_RECVTOS: %s\n", g_strerror(errno));
   }
 
-  /* init dgram or streams */
-  if (quiclysink->stream_mode) {
-    if (quicly_open_stream(quiclysink->conn, &quiclysink->stream, 0) != 0) {
-      g_printerr("Could not open stream\n");
+  /* fan-out: clients are accepted while running, see receive_async_cb */
+  if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+    if (quiclysink->stream_mode) {
+      g_printerr("max-clients > 1 is only supported in datagram mode\n");
       return FALSE;
     }
-  } else {
-    if (quicly_open_dgram(quiclysink->conn, &quiclysink->dgram) != 0) {
-      g_printerr("Can't open quicly_dgram\n");
+    GstClock *clock = gst_system_clock_obtain();
+    if (!gst_quiclysink_sched_cbs(quiclysink, clock))
       return FALSE;
-    }
+    gst_object_unref(clock);
+    g_print("Accepting up to %u clients\n", quiclysink->max_clients);
+    return TRUE;
   }
 
-  g_print("Connected!\n");
-  /* set application context for stream callbacks */
-  quicly_set_data(quiclysink->conn, (void*) quiclysink);
-  /* set application level cc */
-  if (quiclysink->application_cc) {
-    quicly_set_application_cc(quiclysink->conn, 1);
-  }
-  /* Schedule async callback to receive acks and send feedback*/
+  /* the client is accepted and served by receive_async_cb or the I/O thread, see service_handshake */
+  if (quiclysink->multi_stream_mode)
+    quiclysink->stream_mode = TRUE;
+  g_print("Waiting for client...\n");
   GstClock *clock = gst_system_clock_obtain();
   if (!gst_quiclysink_sched_cbs(quiclysink, clock))
     return FALSE;
@@ -640,29 +1173,88 @@ gst_quiclysink_start (GstBaseSink * sink)
 
 static GstStructure *gst_quiclysink_create_stats(GstQuiclysink *quiclysink)
 {
-  GstStructure *s;
-  
+  /* per-client statistics are available through the get-client-stats action signal */
+  if (quiclysink->conn == NULL) {
+    guint num_clients;
+    g_mutex_lock(&quiclysink->clients_lock);
+    num_clients = quiclysink->clients->len;
+    g_mutex_unlock(&quiclysink->clients_lock);
+    return gst_structure_new("quiclysink-stats",
+        "num-clients", G_TYPE_UINT, num_clients,
+        "bytes-sent-media", G_TYPE_UINT64, quiclysink->num_bytes,
+        "io-queue-dropped", G_TYPE_UINT64, quiclysink->num_ring_dropped,
+        "caps-held-back", G_TYPE_UINT64, quiclysink->num_held_back,
+        "key-frame-requests", G_TYPE_UINT64, quiclysink->num_key_frame_requests,
+        "queue-dropped", G_TYPE_UINT64, quiclysink->num_queue_dropped,
+        "qos-events", G_TYPE_UINT64, quiclysink->num_qos_events, NULL);
+  }
+
   /* Stats could be 20ms out of date...*/
   if (!quiclysink->feedback_active) {
     GST_OBJECT_LOCK(quiclysink);
     quicly_get_stats(quiclysink->conn, &quiclysink->stats);
     GST_OBJECT_UNLOCK(quiclysink);
   }
-  s = gst_structure_new("quiclysink-stats",
-      "packets-received", G_TYPE_UINT64, quiclysink->stats.num_packets.received,
-      "packets-sent", G_TYPE_UINT64, quiclysink->stats.num_packets.sent,
-      "packets-lost", G_TYPE_UINT64, quiclysink->stats.num_packets.lost,
-      "acks-received", G_TYPE_UINT64, quiclysink->stats.num_packets.acked,
-      "bytes-received", G_TYPE_UINT64, quiclysink->stats.num_bytes.received,
-      "bytes-sent", G_TYPE_UINT64, quiclysink->stats.num_bytes.sent,
-      "bytes-sent-media", G_TYPE_UINT64, quiclysink->num_bytes,
-      "rtt-smoothed", G_TYPE_UINT, quiclysink->stats.rtt.smoothed,
-      "rtt-latest", G_TYPE_UINT, quiclysink->stats.rtt.latest,
-      "rtt-minimum", G_TYPE_UINT, quiclysink->stats.rtt.minimum,
-      "rtt-variance", G_TYPE_UINT, quiclysink->stats.rtt.variance,
-      "bytes-in-flight", G_TYPE_UINT64, quiclysink->stats.num_bytes.bytes_in_flight,
-      "dropped-late", G_TYPE_UINT64, quiclysink->stats.num_packets.dropped_late,
-      "cwnd", G_TYPE_UINT, quiclysink->stats.cc.cwnd, NULL);
+  GstStructure *s = stats_to_structure("quiclysink-stats", &quiclysink->stats, quiclysink->num_bytes);
+  gst_structure_set(s, "caps-held-back", G_TYPE_UINT64, quiclysink->num_held_back,
+                    "key-frame-requests", G_TYPE_UINT64, quiclysink->num_key_frame_requests,
+                    "preconnect-dropped", G_TYPE_UINT64, quiclysink->num_preconnect_dropped,
+                    "queue-dropped", G_TYPE_UINT64, quiclysink->num_queue_dropped,
+                    "qos-events", G_TYPE_UINT64, quiclysink->num_qos_events, NULL);
+  if (quiclysink->io_thread)
+    gst_structure_set(s, "io-queue-dropped", G_TYPE_UINT64, quiclysink->num_ring_dropped, NULL);
+  if (quiclysink->multi_stream_mode)
+    gst_structure_set(s, "frames-reset", G_TYPE_UINT64, quiclysink->num_frames_reset, NULL);
+  if (quiclysink->frame_drop && quiclysink->dgram != NULL)
+    gst_structure_set(s, "frame-discarded", G_TYPE_UINT64,
+                      ((quicly_dgrambuf_t *)quiclysink->dgram->data)->drop.num_discarded, NULL);
+  if (quiclysink->flow_framing) {
+    GValue flows = G_VALUE_INIT, flow = G_VALUE_INIT;
+    g_value_init(&flows, GST_TYPE_ARRAY);
+    GST_OBJECT_LOCK(quiclysink);
+    for (guint i = 0; i < quiclysink->flows->len; i++) {
+      GstQuiclysinkPad *pad = g_ptr_array_index(quiclysink->flows, i);
+      g_value_init(&flow, GST_TYPE_STRUCTURE);
+      g_value_take_boxed(&flow, gst_structure_new("flow",
+          "id", G_TYPE_UINT, pad->flow,
+          "packets-sent", G_TYPE_UINT64, pad->num_packets,
+          "bytes-sent", G_TYPE_UINT64, pad->num_bytes,
+          "preconnect-dropped", G_TYPE_UINT64, pad->num_dropped, NULL));
+      gst_value_array_append_and_take_value(&flows, &flow);
+    }
+    GST_OBJECT_UNLOCK(quiclysink);
+    gst_structure_take_value(s, "flows", &flows);
+  }
+  return s;
+}
+
+static GstStructure *stats_to_structure(const gchar *name, const quicly_stats_t *stats, guint64 bytes_sent_media)
+{
+  GstStructure *s;
+
+  s = gst_structure_new(name,
+      "packets-received", G_TYPE_UINT64, stats->num_packets.received,
+      "packets-sent", G_TYPE_UINT64, stats->num_packets.sent,
+      "packets-lost", G_TYPE_UINT64, stats->num_packets.lost,
+      "acks-received", G_TYPE_UINT64, stats->num_packets.acked,
+      "bytes-received", G_TYPE_UINT64, stats->num_bytes.received,
+      "bytes-sent", G_TYPE_UINT64, stats->num_bytes.sent,
+      "bytes-sent-media", G_TYPE_UINT64, bytes_sent_media,
+      "rtt-smoothed", G_TYPE_UINT, stats->rtt.smoothed,
+      "rtt-latest", G_TYPE_UINT, stats->rtt.latest,
+      "rtt-minimum", G_TYPE_UINT, stats->rtt.minimum,
+      "rtt-variance", G_TYPE_UINT, stats->rtt.variance,
+      "bytes-in-flight", G_TYPE_UINT64, stats->num_bytes.bytes_in_flight,
+      "dropped-late", G_TYPE_UINT64, stats->num_packets.dropped_late,
+      "cwnd", G_TYPE_UINT, stats->cc.cwnd,
+      "pacing-rate", G_TYPE_UINT64, stats->cc.pacing_rate,
+      "target-bitrate", G_TYPE_UINT64, stats->cc.target_bitrate,
+      "app-limited", G_TYPE_BOOLEAN, stats->app_limited,
+      "ecn", G_TYPE_UINT, (guint)stats->ecn,
+      "ecn-ce", G_TYPE_UINT64, stats->num_packets.ecn_ce,
+      "migrations", G_TYPE_UINT64, stats->num_migrations,
+      "delivery-rate", G_TYPE_UINT64, stats->delivery_rate,
+      "send-rate", G_TYPE_UINT64, stats->send_rate, NULL);
   return s;
 }
 
@@ -671,11 +1263,35 @@ gst_quiclysink_stop (GstBaseSink * sink)
 {
   GstQuiclysink *quiclysink = GST_QUICLYSINK (sink);
 
+  /* the connections are closed from this thread */
+  stop_io_thread(quiclysink);
+
   GST_DEBUG_OBJECT(quiclysink, 
           "Stop. Num Packets sent: %lu. Kilobytes sent: %lu. Packets left in buffer: %lu\n", 
           quiclysink->num_packets, quiclysink->num_bytes / 1000,
           quicly_dgram_debug(quiclysink->dgram));
 
+  if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+    /* send CONNECTION_CLOSE to all clients, then drop them */
+    g_mutex_lock(&quiclysink->clients_lock);
+    for (guint i = 0; i < quiclysink->clients->len; i++) {
+      GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+      if (quicly_close(client->conn, 0, "") == 0)
+        send_packets(quiclysink, client->conn, &client->addr, client->dgram, DEFAULT_SEND_BUFFER, FALSE);
+    }
+    g_ptr_array_foreach(quiclysink->clients, (GFunc) free_client, NULL);
+    g_ptr_array_set_size(quiclysink->clients, 0);
+    g_mutex_unlock(&quiclysink->clients_lock);
+    return TRUE;
+  }
+
+  clear_preconnect(quiclysink);
+  quiclysink->preconnect_has_key = FALSE;
+  g_atomic_int_set(&quiclysink->connected, FALSE);
+  quiclysink->media_open = FALSE;
+  if (quiclysink->conn == NULL)
+    return TRUE;
+
   if (quicly_close(quiclysink->conn, 0, "") != 0)
     g_printerr("Error on close. Unclean shutdown\n");
 
@@ -695,6 +1311,27 @@ gst_quiclysink_stop (GstBaseSink * sink)
   return TRUE;
 }
 
+/*
+ * Wake up a render blocked by the queue-policy on flushes and state changes
+ */
+static gboolean
+gst_quiclysink_unlock (GstBaseSink * sink)
+{
+  GstQuiclysink *quiclysink = GST_QUICLYSINK (sink);
+
+  g_atomic_int_set(&quiclysink->flushing, TRUE);
+  return TRUE;
+}
+
+static gboolean
+gst_quiclysink_unlock_stop (GstBaseSink * sink)
+{
+  GstQuiclysink *quiclysink = GST_QUICLYSINK (sink);
+
+  g_atomic_int_set(&quiclysink->flushing, FALSE);
+  return TRUE;
+}
+
 /* 
  * Emit feedback signal to application
  */
@@ -702,6 +1339,10 @@ gboolean emit_feedback_signal_cb(GstClock *clock, GstClockTime t, GstClockID id,
 {
   GstQuiclysink *quiclysink = GST_QUICLYSINK(data);
 
+  /* not emitted in fan-out mode, see get-client-stats */
+  if (quiclysink->conn == NULL)
+    return TRUE;
+
   GST_OBJECT_LOCK(quiclysink);
   quicly_get_stats(quiclysink->conn, &quiclysink->stats);
   GST_OBJECT_UNLOCK(quiclysink);
@@ -726,28 +1367,68 @@ gst_quiclysink_render (GstBaseSink * sink, GstBuffer * buffer)
   GST_LOG_OBJECT (quiclysink, "render");
 
   GstMapInfo map;
+  GstFlowReturn flow;
+  gint64 max_time = get_max_time(quiclysink, buffer, quiclysink->ctx.now->cb(quiclysink->ctx.now));
+  gsize size;
   int ret;
 
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
+  if (g_atomic_int_compare_and_exchange(&quiclysink->key_frame_requested, TRUE, FALSE))
+    push_key_frame_request(quiclysink);
+
+  if (hold_preconnect(quiclysink, buffer, max_time))
+    return GST_FLOW_OK;
+  if ((flow = apply_queue_policy(quiclysink, buffer)) != GST_FLOW_OK)
+    return flow == GST_BASE_SINK_FLOW_DROPPED ? GST_FLOW_OK : flow;
+
+  if (quiclysink->io_thread_handle != NULL) {
+    if (io_thread_stopped(quiclysink) || !push_io_buffer(quiclysink, buffer, max_time))
+      return GST_FLOW_ERROR;
+    wake_io_thread(quiclysink);
+    return GST_FLOW_OK;
+  }
+
+  if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+    gsize size = gst_buffer_get_size(buffer);
+    if (size > quiclysink->quicly_mtu) {
+      g_printerr("Max payload size exceeded: %lu. MTU: %u\n", size, quiclysink->quicly_mtu);
+      return GST_FLOW_ERROR;
+    }
+    write_fanout_buffer(quiclysink, buffer, max_time);
+    if ((ret = send_pending(quiclysink, DEFAULT_SEND_BUFFER)) != 0)
+      g_printerr("Send failed in render\n");
+    ++quiclysink->num_packets;
+    quiclysink->num_bytes += size;
+    return GST_FLOW_OK;
+  }
+
+  if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    g_printerr("Failed to map buffer\n");
+    return GST_FLOW_ERROR;
+  }
+  size = map.size;
 
   /* write buffer to quicly dgram buffer */
   if (!quiclysink->stream_mode){
     /* Check if payload size fits in one quicly datagram frame */
-    if (map.size > quiclysink->quicly_mtu) {
+    if (map.size > QUICLYSINK_MAX_PAYLOAD(quiclysink)) {
       g_printerr("Max payload size exceeded: %lu. MTU: %u\n", map.size, quiclysink->quicly_mtu);
+      gst_buffer_unmap(buffer, &map);
       return GST_FLOW_ERROR;
     }
-    write_dgram_buffer(quiclysink->dgram, map.data, map.size, 
-                       quiclysink->drop_late > 0 ? (quiclysink->ctx.now->cb(quiclysink->ctx.now) + 2) : quiclysink->drop_late);
+    /* the request pads write to the same queue */
+    GST_OBJECT_LOCK(quiclysink);
+    write_dgram_buffer(quiclysink, map.data, map.size, max_time);
+    GST_OBJECT_UNLOCK(quiclysink);
+    gst_buffer_unmap(buffer, &map);
   } else {
-    quicly_streambuf_egress_write_rtp_framing(quiclysink->stream, map.data, map.size);
+    /* the stream takes over the mapping */
+    write_stream_buffer(quiclysink, buffer, &map, max_time);
   }
   if ((ret = send_pending(quiclysink, DEFAULT_SEND_BUFFER)) != 0) {
     g_printerr("Send failed in render\n");
   }
   ++quiclysink->num_packets;
-  quiclysink->num_bytes += map.size;
-  gst_buffer_unmap(buffer, &map);
+  quiclysink->num_bytes += size;
 
   return GST_FLOW_OK;
 }
@@ -758,39 +1439,84 @@ gst_quiclysink_render_list (GstBaseSink * sink, GstBufferList * buffer_list)
   GstQuiclysink *quiclysink = GST_QUICLYSINK (sink);
   GstBuffer *buffer;
   GstFlowReturn flow;
-  guint num_buffers, i;
+  guint num_buffers, first, i;
   GstMapInfo map;
   gint64 now = quiclysink->ctx.now->cb(quiclysink->ctx.now);
   int ret;
 
   GST_LOG_OBJECT(quiclysink, "render_list");
 
+  if (g_atomic_int_compare_and_exchange(&quiclysink->key_frame_requested, TRUE, FALSE))
+    push_key_frame_request(quiclysink);
+
   num_buffers = gst_buffer_list_length(buffer_list);
   if (num_buffers == 0) {
     GST_LOG_OBJECT(quiclysink, "empty buffer list");
     return GST_FLOW_OK;
   }
 
+  /* the buffers rendered before the client connected are queued */
+  for (first = 0; first < num_buffers; ++first) {
+    buffer = gst_buffer_list_get(buffer_list, first);
+    if (!hold_preconnect(quiclysink, buffer, get_max_time(quiclysink, buffer, now)))
+      break;
+  }
+  if (first == num_buffers)
+    return GST_FLOW_OK;
+
+  if (quiclysink->io_thread_handle != NULL) {
+    if (io_thread_stopped(quiclysink))
+      return GST_FLOW_ERROR;
+    for (i = first; i < num_buffers; ++i) {
+      buffer = gst_buffer_list_get(buffer_list, i);
+      if ((flow = apply_queue_policy(quiclysink, buffer)) == GST_FLOW_FLUSHING)
+        return flow;
+      if (flow != GST_FLOW_OK)
+        continue;
+      if (!push_io_buffer(quiclysink, buffer, get_max_time(quiclysink, buffer, now)))
+        return GST_FLOW_ERROR;
+    }
+    wake_io_thread(quiclysink);
+    return GST_FLOW_OK;
+  }
+
   /* write buffers to quicly dgram buffer */
-  for (i = 0; i < num_buffers; ++i) {
+  for (i = first; i < num_buffers; ++i) {
     buffer = gst_buffer_list_get(buffer_list, i);
+    if ((flow = apply_queue_policy(quiclysink, buffer)) == GST_FLOW_FLUSHING)
+      return flow;
+    if (flow != GST_FLOW_OK)
+      continue;
+    if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+      gsize size = gst_buffer_get_size(buffer);
+      if (size > quiclysink->quicly_mtu) {
+        g_printerr("Max payload size exceeded: %lu\n", size);
+        return GST_FLOW_ERROR;
+      }
+      write_fanout_buffer(quiclysink, buffer, get_max_time(quiclysink, buffer, now));
+      ++quiclysink->num_packets;
+      quiclysink->num_bytes += size;
+      continue;
+    }
     if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
       if (!quiclysink->stream_mode) {
         /* Check if payload size fits in one quicly datagram frame */
-        if (map.size > quiclysink->quicly_mtu) {
+        if (map.size > QUICLYSINK_MAX_PAYLOAD(quiclysink)) {
           g_printerr("Max payload size exceeded: %lu\n", map.size);
+          gst_buffer_unmap(buffer, &map);
           return GST_FLOW_ERROR;
         }
-        write_dgram_buffer(quiclysink->dgram, map.data, map.size, 
-                           quiclysink->drop_late > 0 ? (now + 2 * i) : quiclysink->drop_late);
+        GST_OBJECT_LOCK(quiclysink);
+        write_dgram_buffer(quiclysink, map.data, map.size, get_max_time(quiclysink, buffer, now));
+        GST_OBJECT_UNLOCK(quiclysink);
+        gst_buffer_unmap(buffer, &map);
       } else {
-        /* TODO: Move rtp framing to quiclysink.c */
-        quicly_streambuf_egress_write_rtp_framing(quiclysink->stream, map.data, map.size);
+        /* the stream takes over the mapping */
+        write_stream_buffer(quiclysink, buffer, &map, get_max_time(quiclysink, buffer, now));
       }
       ++quiclysink->num_packets;
       quiclysink->num_bytes += map.size;
     }
-    gst_buffer_unmap(buffer, &map);
   }
 
   /* SEND */
@@ -813,6 +1539,22 @@ gboolean receive_async_cb(GstClock *clock, GstClockTime t, GstClockID id, gpoint
 {
   GstQuiclysink *quiclysink = GST_QUICLYSINK(data);
 
+  if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+    /* accept and serve the clients; timers and ACKs of idle clients are handled here as well */
+    g_mutex_lock(&quiclysink->clients_lock);
+    while (g_socket_condition_check(quiclysink->socket, G_IO_IN | G_IO_PRI) & (G_IO_IN | G_IO_PRI)) {
+      GST_OBJECT_LOCK(quiclysink);
+      int ret = receive_packet(quiclysink);
+      GST_OBJECT_UNLOCK(quiclysink);
+      if (ret != 0)
+        break;
+    }
+    service_clients(quiclysink);
+    g_mutex_unlock(&quiclysink->clients_lock);
+    update_target_bitrate(quiclysink);
+    return TRUE;
+  }
+
   /* Try to receive one packet */
   GIOCondition con;
   if ((con = g_socket_condition_check(quiclysink->socket, G_IO_IN | G_IO_PRI)) & 
@@ -821,35 +1563,115 @@ gboolean receive_async_cb(GstClock *clock, GstClockTime t, GstClockID id, gpoint
       if (receive_packet(quiclysink) != 0)
         g_printerr("Receive failed\n");
       GST_OBJECT_UNLOCK(quiclysink);
+      update_target_bitrate(quiclysink);
   }
+  /* render sends once the client is connected */
+  service_handshake(quiclysink);
 
   return TRUE;
 }
 
+/*
+ * Emit the target bitrate signal, if it changed by more than
+ * TARGET_BITRATE_CHANGE_THRESHOLD percent since the last emission
+ */
+static void update_target_bitrate(GstQuiclysink *quiclysink)
+{
+  guint64 bitrate, diff;
+
+  if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+    /* the encoder is shared, so it follows the slowest client */
+    bitrate = 0;
+    g_mutex_lock(&quiclysink->clients_lock);
+    for (guint i = 0; i < quiclysink->clients->len; i++) {
+      GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+      guint64 b = quicly_get_target_bitrate(client->conn);
+      if (client->dgram != NULL && b != 0 && (bitrate == 0 || b < bitrate))
+        bitrate = b;
+    }
+    g_mutex_unlock(&quiclysink->clients_lock);
+  } else {
+    GST_OBJECT_LOCK(quiclysink);
+    bitrate = quiclysink->conn != NULL ? quicly_get_target_bitrate(quiclysink->conn) : 0;
+    GST_OBJECT_UNLOCK(quiclysink);
+  }
+  if (bitrate == 0)
+    return;
+
+  diff = bitrate > quiclysink->target_bitrate ? bitrate - quiclysink->target_bitrate
+                                              : quiclysink->target_bitrate - bitrate;
+  if (diff * 100 <= quiclysink->target_bitrate * TARGET_BITRATE_CHANGE_THRESHOLD)
+    return;
+
+  quiclysink->target_bitrate = bitrate;
+  g_signal_emit(quiclysink, quiclysink_signals[SIGNAL_ON_TARGET_BITRATE], 0, bitrate);
+}
+
+static gssize receive_with_ecn(GSocket *socket, gchar *buf, gsize size, struct sockaddr_in *sa, guint8 *ecn)
+{
+  struct iovec vec = {buf, size};
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } cmsgbuf;
+  struct msghdr mess;
+  struct cmsghdr *cmsg;
+  gssize rret;
+
+  memset(&mess, 0, sizeof(mess));
+  mess.msg_name = sa;
+  mess.msg_namelen = sizeof(*sa);
+  mess.msg_iov = &vec;
+  mess.msg_iovlen = 1;
+  mess.msg_control = &cmsgbuf;
+  mess.msg_controllen = sizeof(cmsgbuf);
+
+  /* GSocket does not deliver unknown control messages, hence recvmsg on the underlying fd */
+  while ((rret = recvmsg(g_socket_get_fd(socket), &mess, 0)) == -1 && errno == EINTR)
+    ;
+  if (rret < 0)
+    return -1;
+
+  *ecn = QUICLY_ECN_NOT_ECT;
+  for (cmsg = CMSG_FIRSTHDR(&mess); cmsg != NULL; cmsg = CMSG_NXTHDR(&mess, cmsg)) {
+#ifdef IP_RECVTOS
+    if (cmsg->cmsg_level == IPPROTO_IP && (cmsg->cmsg_type == IP_TOS || cmsg->cmsg_type == IP_RECVTOS))
+      *ecn = *(unsigned char *)CMSG_DATA(cmsg) & 0x3;
+#endif
+  }
+  return rret;
+}
+
+static void set_ecn_codepoint(GstQuiclysink *quiclysink, guint8 ecn)
+{
+  int tos = ecn;
+
+  if (ecn == quiclysink->ecn_tos)
+    return;
+  if (setsockopt(g_socket_get_fd(quiclysink->socket), IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) != 0) {
+    g_printerr("Failed to set IP_TOS: %s\n", g_strerror(errno));
+    return;
+  }
+  quiclysink->ecn_tos = ecn;
+}
+
 static int receive_packet(GstQuiclysink *quiclysink)
 {
-  GError *err = NULL;
   GSocketAddress *in_addr;
+  struct sockaddr_in native_sa;
+  guint8 ecn;
   size_t off, plen;
   gssize rret;
-  if ((rret = g_socket_receive_from(quiclysink->socket,
-                                    &in_addr,
-                                    quiclysink->recv_buf,
-                                    quiclysink->recv_buf_size,
-                                    NULL,
-                                    &err)) < 0) {
-    g_printerr("Socket receive failed. Code: %s\n", err->message);
+  if ((rret = receive_with_ecn(quiclysink->socket,
+                               quiclysink->recv_buf,
+                               quiclysink->recv_buf_size,
+                               &native_sa,
+                               &ecn)) < 0) {
+    g_printerr("Socket receive failed. Code: %s\n", g_strerror(errno));
     return -1;
   }
   off = 0;
-  /* TODO: Remove sockaddr cast by using recvfrom */
-  /* Convert GSocketAddress to native */
-  struct sockaddr native_sa;
-  gssize len = g_socket_address_get_native_size(in_addr);
-  if (!g_socket_address_to_native(in_addr, &native_sa, len, &err)) {
-    g_printerr("Could not convert GSocketAddress to native. Error: %s\n", err->message);
-    goto error;
-  }
+  in_addr = g_socket_address_new_from_native(&native_sa, sizeof(native_sa));
   while (off != rret) {
     quicly_decoded_packet_t packet;
     plen = quicly_decode_packet(&quiclysink->ctx, &packet, 
@@ -857,8 +1679,11 @@ static int receive_packet(GstQuiclysink *quiclysink)
                                 rret - off);
     if (plen == SIZE_MAX)
       break;
-    if (quiclysink->conn != NULL) {
-      quicly_receive(quiclysink->conn, NULL, &native_sa, &packet);
+    packet.ecn = ecn;
+    if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+      receive_fanout(quiclysink, &native_sa, &packet);
+    } else if (quiclysink->conn != NULL) {
+      quicly_receive(quiclysink->conn, NULL, (struct sockaddr *)&native_sa, &packet);
     } else if (QUICLY_PACKET_IS_LONG_HEADER(packet.octets.base[0])) {
       
       /* TODO: handle unbound connection */
@@ -866,14 +1691,16 @@ static int receive_packet(GstQuiclysink *quiclysink)
 
       quicly_address_token_plaintext_t *token = NULL;
       if (quicly_accept(&quiclysink->conn, &quiclysink->ctx, NULL,
-                          &native_sa, &packet, token,
+                          (struct sockaddr *)&native_sa, &packet, token,
                           &quiclysink->next_cid, NULL) == 0) {
         if (quiclysink->conn == NULL) {
           g_printerr("Quicly accept returned success but conn is NULL\n");
           goto error;
         }
-        quiclysink->conn_addr = in_addr;
+        quiclysink->conn_addr = g_object_ref(in_addr);
         ++quiclysink->next_cid.master_id;
+        /* 0-RTT data can be delivered to the callbacks before the handshake completes */
+        quicly_set_data(quiclysink->conn, (void*) quiclysink);
       } else {
         if (quiclysink->conn == NULL) {
           g_printerr("Failed to accept connection\n");
@@ -896,22 +1723,940 @@ static int receive_packet(GstQuiclysink *quiclysink)
     }
 }
 
-/* 
- * write packet to send buffer.
- * Set max_time to -1 to disable dropping.
+/*
+ * Buffer rendered before the client connected
  */
-static void write_dgram_buffer(quicly_dgram_t *dgram, const void *src, size_t len, gint64 max_time) 
+typedef struct {
+  GstBuffer *buffer;
+  gint64 max_time;
+} GstQuiclysinkQueued;
+
+static void free_queued(GstQuiclysinkQueued *queued)
 {
-  int ret;
-  if ((ret = quicly_dgrambuf_egress_write(dgram, src, len, max_time)) != 0)
-    g_printerr("quicly_dgrambuf_egress_write returns: %i\n", ret);
+  gst_buffer_unref(queued->buffer);
+  g_slice_free(GstQuiclysinkQueued, queued);
 }
 
-/*
- * Send all committed buffers as fast as possible
- * Does not return until everythin is sent
- */
+static void clear_preconnect(GstQuiclysink *quiclysink)
+{
+  GstQuiclysinkQueued *queued;
+
+  while ((queued = g_queue_pop_head(&quiclysink->preconnect)) != NULL) {
+    free_queued(queued);
+    ++quiclysink->num_preconnect_dropped;
+  }
+}
+
+/*
+ * Single client mode: queue the buffer if the client has not connected
+ * yet. Returns FALSE if it can be sent right away.
+ * With preconnect-key-frame set, only the latest key frame and the
+ * frames following it are kept, as nothing before it can be decoded
+ */
+static gboolean hold_preconnect(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time)
+{
+  GstQuiclysinkQueued *queued;
+  GstMapInfo map;
+  guint32 ts;
+  guint8 priority;
+  gboolean parsed = FALSE;
+
+  if (QUICLYSINK_IS_FANOUT(quiclysink) || g_atomic_int_get(&quiclysink->connected))
+    return FALSE;
+
+  if (!quiclysink->stream_mode && gst_buffer_get_size(buffer) > QUICLYSINK_MAX_PAYLOAD(quiclysink)) {
+    g_printerr("Max payload size exceeded: %lu. MTU: %u\n", gst_buffer_get_size(buffer), quiclysink->quicly_mtu);
+    return TRUE;
+  }
+  if (quiclysink->preconnect_key_frame && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    parsed = parse_rtp_frame(quiclysink, map.data, map.size, &ts, &priority);
+    gst_buffer_unmap(buffer, &map);
+  }
+
+  GST_OBJECT_LOCK(quiclysink);
+  /* connected in the meantime, the queue has been handed over already */
+  if (g_atomic_int_get(&quiclysink->connected)) {
+    GST_OBJECT_UNLOCK(quiclysink);
+    return FALSE;
+  }
+  if (parsed) {
+    if (priority == QUICLY_DGRAM_PRIORITY_KEY && (!quiclysink->preconnect_has_key || ts != quiclysink->preconnect_key_ts)) {
+      clear_preconnect(quiclysink);
+      quiclysink->preconnect_has_key = TRUE;
+      quiclysink->preconnect_key_ts = ts;
+    } else if (!quiclysink->preconnect_has_key) {
+      ++quiclysink->num_preconnect_dropped;
+      GST_OBJECT_UNLOCK(quiclysink);
+      return TRUE;
+    }
+  }
+  if (g_queue_get_length(&quiclysink->preconnect) >= quiclysink->preconnect_size) {
+    /* keep the key frame the queued frames depend on, otherwise the latest buffers */
+    if (quiclysink->preconnect_size == 0 || quiclysink->preconnect_has_key) {
+      ++quiclysink->num_preconnect_dropped;
+      GST_OBJECT_UNLOCK(quiclysink);
+      return TRUE;
+    }
+    free_queued(g_queue_pop_head(&quiclysink->preconnect));
+    ++quiclysink->num_preconnect_dropped;
+  }
+  queued = g_slice_new(GstQuiclysinkQueued);
+  queued->buffer = gst_buffer_ref(buffer);
+  queued->max_time = max_time;
+  g_queue_push_tail(&quiclysink->preconnect, queued);
+  GST_OBJECT_UNLOCK(quiclysink);
+
+  ++quiclysink->num_packets;
+  quiclysink->num_bytes += gst_buffer_get_size(buffer);
+  return TRUE;
+}
+
+/*
+ * Single client mode: open the media flow of the client that completed
+ * the handshake. Called with the object lock held
+ */
+static int setup_media(GstQuiclysink *quiclysink)
+{
+  int ret = 0;
+
+  /* in multi stream mode, the streams are opened per frame */
+  if (quiclysink->stream_mode && !quiclysink->multi_stream_mode)
+    ret = quicly_open_stream(quiclysink->conn, &quiclysink->stream, 0);
+  else if (!quiclysink->stream_mode)
+    ret = quicly_open_dgram(quiclysink->conn, &quiclysink->dgram);
+  if (ret != 0)
+    return ret;
+
+  g_print("Connected!\n");
+  setup_connection(quiclysink, quiclysink->conn);
+  quiclysink->target_bitrate = quicly_get_target_bitrate(quiclysink->conn);
+  quiclysink->media_open = TRUE;
+  return 0;
+}
+
+/*
+ * Hand over what has been rendered before the client was able to
+ * receive it. Called with the object lock held
+ */
+static void flush_preconnect(GstQuiclysink *quiclysink)
+{
+  GstQuiclysinkQueued *queued;
+
+  while ((queued = g_queue_pop_head(&quiclysink->preconnect)) != NULL) {
+    write_media_buffer(quiclysink, queued->buffer, queued->max_time);
+    free_queued(queued);
+  }
+  quiclysink->preconnect_has_key = FALSE;
+  g_atomic_int_set(&quiclysink->connected, TRUE);
+}
+
+/*
+ * Single client mode: drive the handshake of the client accepted by
+ * receive_packet. The queued media goes out the moment the handshake
+ * completed, or the client acked the caps if they are exchanged.
+ * A client lost before that is dropped and the next one is accepted
+ */
+static void service_handshake(GstQuiclysink *quiclysink)
+{
+  int ret = 0;
+
+  if (quiclysink->conn == NULL || g_atomic_int_get(&quiclysink->connected))
+    return;
+
+  GST_OBJECT_LOCK(quiclysink);
+  if (!quiclysink->media_open && quicly_connection_is_ready(quiclysink->conn))
+    ret = setup_media(quiclysink);
+  if (quiclysink->media_open &&
+      (!quiclysink->auto_caps_exchange || g_atomic_int_get(&quiclysink->received_caps_ack)))
+    flush_preconnect(quiclysink);
+  GST_OBJECT_UNLOCK(quiclysink);
+  if (ret != 0)
+    GST_ELEMENT_ERROR(quiclysink, RESOURCE, OPEN_WRITE, (NULL), ("Could not open the media flow: %d", ret));
+
+  if (ret == 0 && send_packets(quiclysink, quiclysink->conn, &quiclysink->conn_addr, quiclysink->dgram,
+                               DEFAULT_SEND_BUFFER, FALSE) == 0)
+    return;
+
+  /* the media has been handed over, render owns the connection now */
+  if (g_atomic_int_get(&quiclysink->connected)) {
+    GST_ELEMENT_ERROR(quiclysink, RESOURCE, WRITE, (NULL), ("Connection closed while sending the queued media"));
+    return;
+  }
+  /* keep the queued media for the next client */
+  g_print("Connection closed during the handshake\n");
+  GST_OBJECT_LOCK(quiclysink);
+  /* quicly_free disposes the media flow as well */
+  quicly_free(quiclysink->conn);
+  quiclysink->conn = NULL;
+  quiclysink->dgram = NULL;
+  quiclysink->stream = NULL;
+  quiclysink->media_open = FALSE;
+  g_atomic_int_set(&quiclysink->received_caps_ack, FALSE);
+  GST_OBJECT_UNLOCK(quiclysink);
+  g_clear_object(&quiclysink->conn_addr);
+}
+
+/*
+ * Datagrams waiting to be sent: the buffers handed to the I/O thread and
+ * the datagrams queued in quicly, as published by the sending thread
+ * after each round. In fan-out mode the slowest client counts.
+ * Stream mode is flow controlled by quicly, only the ring is counted
+ */
+static guint get_queue_level(GstQuiclysink *quiclysink)
+{
+  guint level = 0, pending = 0;
+
+  if (quiclysink->io_thread_handle != NULL)
+    level = (guint)(g_atomic_int_get(&quiclysink->ring.tail) - g_atomic_int_get(&quiclysink->ring.head));
+
+  if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+    g_mutex_lock(&quiclysink->clients_lock);
+    for (guint i = 0; i < quiclysink->clients->len; i++) {
+      GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+      pending = MAX(pending, (guint)quicly_dgram_num_pending(client->dgram));
+    }
+    g_mutex_unlock(&quiclysink->clients_lock);
+  } else if (!quiclysink->stream_mode) {
+    pending = (guint)g_atomic_int_get(&quiclysink->dgram_pending);
+  }
+  return level + pending;
+}
+
+/*
+ * Backpressure from the send queue, applied to every rendered buffer.
+ * Returns GST_FLOW_OK if the buffer is to be sent,
+ * GST_BASE_SINK_FLOW_DROPPED if it is discarded and GST_FLOW_FLUSHING if
+ * the sink has been unlocked while waiting
+ */
+static GstFlowReturn apply_queue_policy(GstQuiclysink *quiclysink, GstBuffer *buffer)
+{
+  guint level;
+
+  if (quiclysink->queue_threshold == 0)
+    return GST_FLOW_OK;
+
+  level = get_queue_level(quiclysink);
+  switch (quiclysink->queue_policy) {
+    case QUEUE_POLICY_QOS:
+      post_queue_qos(quiclysink, buffer, level);
+      return GST_FLOW_OK;
+    case QUEUE_POLICY_DROP:
+      if (level < quiclysink->queue_threshold)
+        return GST_FLOW_OK;
+      ++quiclysink->num_queue_dropped;
+      GST_LOG_OBJECT(quiclysink, "%u datagrams queued, dropping buffer", level);
+      return GST_BASE_SINK_FLOW_DROPPED;
+    default:
+      break;
+  }
+
+  /* block: the queue drains through the I/O thread, or through this
+   * thread otherwise. ACKs are received by the clock callback */
+  while (level >= quiclysink->queue_threshold) {
+    if (g_atomic_int_get(&quiclysink->flushing))
+      return GST_FLOW_FLUSHING;
+    if (quiclysink->io_thread_handle != NULL) {
+      if (!g_atomic_int_get(&quiclysink->io_running))
+        break;
+      wake_io_thread(quiclysink);
+    } else if (send_pending(quiclysink, DEFAULT_SEND_BUFFER) != 0) {
+      break;
+    }
+    g_usleep(QUEUE_POLL_INTERVAL_US);
+    level = get_queue_level(quiclysink);
+  }
+  return GST_FLOW_OK;
+}
+
+/*
+ * Send a QoS event upstream, so that encoders and rate-aware elements
+ * slow down before the queue overflows. The proportion is the rate
+ * rendered during the last interval relative to the target bitrate of
+ * the connection, diff the time the queued datagrams need to go out.
+ * Sent at most every QOS_INTERVAL_MS while above the threshold, and once
+ * more after dropping below it, announcing the spare capacity
+ */
+static void post_queue_qos(GstQuiclysink *quiclysink, GstBuffer *buffer, guint level)
+{
+  GstBaseSink *bsink = GST_BASE_SINK(quiclysink);
+  gint64 now = quiclysink->ctx.now->cb(quiclysink->ctx.now), elapsed;
+  gboolean overflow = level >= quiclysink->queue_threshold;
+  guint64 target = quiclysink->target_bitrate, input_rate, avg_size;
+  GstClockTime running_time;
+  GstClockTimeDiff diff = 0;
+  gdouble proportion;
+
+  if (quiclysink->qos_window_start == 0)
+    quiclysink->qos_window_start = now;
+  quiclysink->qos_window_bytes += gst_buffer_get_size(buffer);
+  if ((elapsed = now - quiclysink->qos_window_start) < QOS_INTERVAL_MS)
+    return;
+  input_rate = quiclysink->qos_window_bytes * 8 * 1000 / elapsed;
+  quiclysink->qos_window_start = now;
+  quiclysink->qos_window_bytes = 0;
+
+  if (!overflow && !quiclysink->qos_active)
+    return;
+  quiclysink->qos_active = overflow;
+
+  if (bsink->segment.format != GST_FORMAT_TIME ||
+      !GST_CLOCK_TIME_IS_VALID(running_time = gst_segment_to_running_time(&bsink->segment, GST_FORMAT_TIME,
+                                                                          GST_BUFFER_PTS(buffer))))
+    return;
+
+  if (target != 0) {
+    proportion = (gdouble)input_rate / target;
+    avg_size = quiclysink->num_packets > 0 ? quiclysink->num_bytes / quiclysink->num_packets : quiclysink->quicly_mtu;
+    diff = gst_util_uint64_scale(level * avg_size * 8, GST_SECOND, target);
+  } else {
+    proportion = (gdouble)level / quiclysink->queue_threshold;
+  }
+
+  GST_DEBUG_OBJECT(quiclysink, "%u datagrams queued, proportion %f, diff %" G_GINT64_FORMAT, level, proportion, diff);
+  ++quiclysink->num_qos_events;
+  gst_pad_push_event(GST_BASE_SINK_PAD(quiclysink),
+                     gst_event_new_qos(GST_QOS_TYPE_OVERFLOW, proportion, diff, running_time));
+}
+
+/*
+ * Deadline (in quicly time) after which a queued datagram is dropped.
+ * With max-latency set, the deadline is the running time of the buffer
+ * plus the latency budget, so a burst is not dropped just because it is
+ * queued behind other packets. Buffers without a timestamp and the
+ * drop-late property fall back to a deadline relative to now.
+ * Returns -1 if the datagram must not be dropped.
+ */
+static gint64 get_max_time(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 now)
+{
+  GstBaseSink *bsink = GST_BASE_SINK(quiclysink);
+  GstClockTime ts = GST_BUFFER_DTS_OR_PTS(buffer), running_time, clock_time;
+  GstClockTimeDiff remaining;
+  GstClock *clock;
+
+  if (quiclysink->max_latency != 0 && GST_CLOCK_TIME_IS_VALID(ts) && bsink->segment.format == GST_FORMAT_TIME &&
+      (clock = gst_element_get_clock(GST_ELEMENT(quiclysink))) != NULL) {
+    running_time = gst_segment_to_running_time(&bsink->segment, GST_FORMAT_TIME, ts);
+    clock_time = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    if (GST_CLOCK_TIME_IS_VALID(running_time)) {
+      remaining = GST_CLOCK_DIFF(clock_time - gst_element_get_base_time(GST_ELEMENT(quiclysink)),
+                                 running_time + quiclysink->max_latency * GST_MSECOND);
+      /* a negative remainder makes the datagram expire right away (-1 would mean never) */
+      now += remaining / (GstClockTimeDiff)GST_MSECOND;
+      return now >= 0 ? now : 0;
+    }
+  }
+
+  if (quiclysink->max_latency != 0)
+    return now + quiclysink->max_latency;
+  if (quiclysink->drop_late > 0)
+    return now + quiclysink->drop_late;
+  return quiclysink->drop_late;
+}
+
+/* 
+ * write packet to send buffer.
+ * Set max_time to -1 to disable dropping.
+ * Called with the object lock held in single client mode
+ */
+static void write_dgram_buffer(GstQuiclysink *quiclysink, const void *src, size_t len, gint64 max_time) 
+{
+  int ret;
+
+  if (hold_back_media(quiclysink, g_atomic_int_get(&quiclysink->received_caps_ack)))
+    return;
+  if ((quiclysink->frame_drop && quiclysink->frame_codec != FRAME_CODEC_NONE) || quiclysink->flow_framing) {
+    quicly_dgram_listbuf_vec_t vec = {max_time, len, (void *)src};
+    tag_frame(quiclysink, &vec);
+    if ((ret = write_flow_dgram(quiclysink, 0, &vec)) != 0)
+      g_printerr("quicly_dgrambuf_egress_write_vec returns: %i\n", ret);
+    return;
+  }
+  if ((ret = quicly_dgrambuf_egress_write(quiclysink->dgram, src, len, max_time)) != 0)
+    g_printerr("quicly_dgrambuf_egress_write returns: %i\n", ret);
+}
+
+static void release_copied_payload(quicly_dgram_listbuf_vec_t *vec)
+{
+  g_free(vec->data);
+}
+
+/*
+ * Queue a copy of the payload vec points to. With request pads, it is
+ * prefixed by the id of its flow. Called with the object lock held
+ */
+static int write_flow_dgram(GstQuiclysink *quiclysink, guint8 flow, quicly_dgram_listbuf_vec_t *vec)
+{
+  gsize off = quiclysink->flow_framing ? GST_QUICLY_FLOW_HEADER_SIZE : 0;
+  guint8 *data = g_malloc(off + vec->len);
+  int ret;
+
+  if (off != 0)
+    data[0] = flow;
+  memcpy(data + off, vec->data, vec->len);
+  vec->data = data;
+  vec->len += off;
+  vec->release = release_copied_payload;
+  if ((ret = quicly_dgrambuf_egress_write_vec(quiclysink->dgram, vec)) != 0) {
+    g_free(data);
+    return ret;
+  }
+  if (off != 0)
+    queue_by_priority(quiclysink);
+  return 0;
+}
+
+/*
+ * Move the datagram queued last ahead of the datagrams of flows with a
+ * lower priority. The queue stays ordered by priority, and by age within
+ * one priority. Every datagram queued starts with its flow id
+ */
+static void queue_by_priority(GstQuiclysink *quiclysink)
+{
+  quicly_dgram_listbuf_t *egress = &((quicly_dgrambuf_t *)quiclysink->dgram->data)->egress;
+  quicly_dgram_listbuf_vec_t vec;
+  guint8 priority;
+  size_t i;
+
+  if (egress->vecs.size < 2)
+    return;
+  assert(quiclysink->flow_framing);
+  i = egress->vecs.size - 1;
+  vec = egress->vecs.entries[i];
+  assert(vec.len >= GST_QUICLY_FLOW_HEADER_SIZE);
+  priority = quiclysink->flow_priority[*(guint8 *)vec.data];
+  while (i != 0) {
+    assert(egress->vecs.entries[i - 1].len >= GST_QUICLY_FLOW_HEADER_SIZE);
+    if (quiclysink->flow_priority[*(guint8 *)egress->vecs.entries[i - 1].data] >= priority)
+      break;
+    --i;
+  }
+  if (i != egress->vecs.size - 1) {
+    memmove(egress->vecs.entries + i + 1, egress->vecs.entries + i, (egress->vecs.size - 1 - i) * sizeof(vec));
+    egress->vecs.entries[i] = vec;
+  }
+}
+
+static GstQuiclysinkPad *find_flow(GstQuiclysink *quiclysink, guint flow)
+{
+  for (guint i = 0; i < quiclysink->flows->len; i++) {
+    GstQuiclysinkPad *pad = g_ptr_array_index(quiclysink->flows, i);
+    if (pad->flow == flow)
+      return pad;
+  }
+  return NULL;
+}
+
+/*
+ * Request pads are only added before the sink starts, as the flow ids
+ * are prefixed from then on. Without a name, the lowest free id is used
+ */
+static GstPad *gst_quiclysink_request_new_pad(GstElement *element, GstPadTemplate *templ, const gchar *name,
+                                              const GstCaps *caps)
+{
+  GstQuiclysink *quiclysink = GST_QUICLYSINK(element);
+  GstQuiclysinkPad *pad;
+  gchar *pad_name;
+  guint flow = 1;
+
+  GST_OBJECT_LOCK(quiclysink);
+  if (GST_STATE(quiclysink) > GST_STATE_READY) {
+    GST_OBJECT_UNLOCK(quiclysink);
+    g_printerr("Request pads can only be added before the sink is started\n");
+    return NULL;
+  }
+  if (name != NULL) {
+    if (sscanf(name, "sink_%u", &flow) != 1)
+      flow = 0;
+  } else {
+    while (flow < GST_QUICLY_MAX_FLOWS && find_flow(quiclysink, flow) != NULL)
+      ++flow;
+  }
+  /* flow 0 is the media of the sink pad */
+  if (flow == 0 || flow >= GST_QUICLY_MAX_FLOWS || find_flow(quiclysink, flow) != NULL) {
+    GST_OBJECT_UNLOCK(quiclysink);
+    g_printerr("Invalid or used request pad %s\n", name != NULL ? name : "sink_%u");
+    return NULL;
+  }
+  pad_name = g_strdup_printf("sink_%u", flow);
+  pad = g_object_new(GST_TYPE_QUICLYSINK_PAD, "name", pad_name, "direction", GST_PAD_TEMPLATE_DIRECTION(templ), "template", templ, NULL);
+  g_free(pad_name);
+  pad->flow = flow;
+  quiclysink->flow_priority[flow] = pad->priority;
+  g_ptr_array_add(quiclysink->flows, pad);
+  GST_OBJECT_UNLOCK(quiclysink);
+
+  gst_pad_set_chain_function(GST_PAD(pad), GST_DEBUG_FUNCPTR(gst_quiclysink_flow_chain));
+  gst_pad_set_event_function(GST_PAD(pad), GST_DEBUG_FUNCPTR(gst_quiclysink_flow_event));
+  gst_element_add_pad(element, GST_PAD(pad));
+  return GST_PAD(pad);
+}
+
+static void gst_quiclysink_release_pad(GstElement *element, GstPad *pad)
+{
+  GstQuiclysink *quiclysink = GST_QUICLYSINK(element);
+
+  GST_OBJECT_LOCK(quiclysink);
+  g_ptr_array_remove(quiclysink->flows, pad);
+  GST_OBJECT_UNLOCK(quiclysink);
+  gst_element_remove_pad(element, pad);
+}
+
+/*
+ * Buffers of the request pads are sent right away, without waiting for
+ * the clock. Until the client connected, they are dropped
+ */
+static GstFlowReturn gst_quiclysink_flow_chain(GstPad *pad, GstObject *parent, GstBuffer *buffer)
+{
+  GstQuiclysink *quiclysink = GST_QUICLYSINK(parent);
+  GstQuiclysinkPad *flow = GST_QUICLYSINK_PAD(pad);
+  quicly_dgram_listbuf_vec_t vec = {-1};
+  GstMapInfo map;
+  int ret;
+
+  if (!quiclysink->flow_framing || !g_atomic_int_get(&quiclysink->connected)) {
+    ++flow->num_dropped;
+    gst_buffer_unref(buffer);
+    return GST_FLOW_OK;
+  }
+  if (io_thread_stopped(quiclysink) || !gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    gst_buffer_unref(buffer);
+    return GST_FLOW_ERROR;
+  }
+  if (map.size > QUICLYSINK_MAX_PAYLOAD(quiclysink)) {
+    g_printerr("Max payload size exceeded on %s: %lu. MTU: %u\n", GST_PAD_NAME(pad), map.size, quiclysink->quicly_mtu);
+    gst_buffer_unmap(buffer, &map);
+    gst_buffer_unref(buffer);
+    return GST_FLOW_ERROR;
+  }
+
+  if (flow->drop_late > 0)
+    vec.max_time = quiclysink->ctx.now->cb(quiclysink->ctx.now) + flow->drop_late;
+  else
+    vec.max_time = flow->drop_late;
+  vec.len = map.size;
+  vec.data = map.data;
+  GST_OBJECT_LOCK(quiclysink);
+  ret = write_flow_dgram(quiclysink, flow->flow, &vec);
+  GST_OBJECT_UNLOCK(quiclysink);
+  if (ret != 0)
+    g_printerr("quicly_dgrambuf_egress_write_vec returns: %i\n", ret);
+  ++flow->num_packets;
+  flow->num_bytes += map.size;
+  gst_buffer_unmap(buffer, &map);
+  gst_buffer_unref(buffer);
+
+  if (quiclysink->io_thread_handle != NULL)
+    wake_io_thread(quiclysink);
+  else if (send_pending(quiclysink, DEFAULT_SEND_BUFFER) != 0)
+    g_printerr("Send failed on %s\n", GST_PAD_NAME(pad));
+  return GST_FLOW_OK;
+}
+
+/* Nothing is forwarded, the caps of the flows are not exchanged */
+static gboolean gst_quiclysink_flow_event(GstPad *pad, GstObject *parent, GstEvent *event)
+{
+  GST_LOG_OBJECT(pad, "Dropping %" GST_PTR_FORMAT, event);
+  gst_event_unref(event);
+  return TRUE;
+}
+
+/*
+ * Priority of an H.264 RTP payload (RFC 6184). Aggregation packets take
+ * the highest priority among the NAL units they carry
+ */
+static guint8 get_h264_priority(const guint8 *nal, gsize len)
+{
+  guint8 type = nal[0] & 0x1f, priority = QUICLY_DGRAM_PRIORITY_DISPOSABLE;
+  gsize off;
+
+  switch (type) {
+    case 24: /* STAP-A */
+      for (off = 1; off + 3 <= len; off += 2 + GST_READ_UINT16_BE(nal + off))
+        priority = MAX(priority, get_h264_priority(nal + off + 2, len - off - 2));
+      return priority;
+    case 28: /* FU-A */
+      if (len < 2)
+        return priority;
+      type = nal[1] & 0x1f;
+      break;
+  }
+  /* IDR slice, SPS, PPS */
+  if (type == 5 || type == 7 || type == 8)
+    return QUICLY_DGRAM_PRIORITY_KEY;
+  return (nal[0] & 0x60) != 0 ? QUICLY_DGRAM_PRIORITY_REFERENCE : QUICLY_DGRAM_PRIORITY_DISPOSABLE;
+}
+
+/*
+ * Priority of an H.265 RTP payload (RFC 7798)
+ */
+static guint8 get_h265_priority(const guint8 *nal, gsize len)
+{
+  guint8 type, priority = QUICLY_DGRAM_PRIORITY_DISPOSABLE;
+  gsize off;
+
+  if (len < 2)
+    return priority;
+  type = (nal[0] >> 1) & 0x3f;
+  switch (type) {
+    case 48: /* AP */
+      for (off = 2; off + 4 <= len; off += 2 + GST_READ_UINT16_BE(nal + off))
+        priority = MAX(priority, get_h265_priority(nal + off + 2, len - off - 2));
+      return priority;
+    case 49: /* FU */
+      if (len < 3)
+        return priority;
+      type = nal[2] & 0x3f;
+      break;
+  }
+  /* IRAP pictures, VPS, SPS, PPS */
+  if ((type >= 16 && type <= 23) || (type >= 32 && type <= 34))
+    return QUICLY_DGRAM_PRIORITY_KEY;
+  /* even VCL types are sub-layer non-reference pictures; non-VCL units follow the slices of their frame */
+  if (type < 16 && type % 2 != 0)
+    return QUICLY_DGRAM_PRIORITY_REFERENCE;
+  return priority;
+}
+
+/*
+ * RTP timestamp and priority of an H.264/H.265 RTP packet. Returns FALSE
+ * if the codec is not known or the packet can't be parsed
+ */
+static gboolean parse_rtp_frame(GstQuiclysink *quiclysink, const guint8 *rtp, gsize len, guint32 *ts, guint8 *priority)
+{
+  gsize off;
+
+  if (quiclysink->frame_codec == FRAME_CODEC_NONE || len < 12 || (rtp[0] >> 6) != 2)
+    return FALSE;
+  off = 12 + (rtp[0] & 0x0f) * 4;
+  if ((rtp[0] & 0x10) != 0) {
+    if (len < off + 4)
+      return FALSE;
+    off += 4 + GST_READ_UINT16_BE(rtp + off + 2) * 4;
+  }
+  if (off >= len)
+    return FALSE;
+
+  *ts = GST_READ_UINT32_BE(rtp + 4);
+  if (quiclysink->frame_codec == FRAME_CODEC_H264)
+    *priority = get_h264_priority(rtp + off, len - off);
+  else
+    *priority = get_h265_priority(rtp + off, len - off);
+  return TRUE;
+}
+
+/*
+ * Tag an RTP packet with the frame (RTP timestamp, terminated by the marker
+ * bit) it belongs to. Key frames are exempt from the drop deadline, as
+ * everything up to the next key frame depends on them
+ */
+static void tag_frame(GstQuiclysink *quiclysink, quicly_dgram_listbuf_vec_t *vec)
+{
+  const guint8 *rtp = vec->data;
+  guint32 ts;
+  guint8 priority;
+
+  if (!quiclysink->frame_drop || !parse_rtp_frame(quiclysink, rtp, vec->len, &ts, &priority))
+    return;
+
+  if (quiclysink->frame_id == 0 || quiclysink->frame_ended || ts != quiclysink->frame_rtp_ts) {
+    ++quiclysink->frame_id;
+    quiclysink->frame_rtp_ts = ts;
+  }
+  quiclysink->frame_ended = (rtp[1] & 0x80) != 0;
+
+  vec->frame_id = quiclysink->frame_id;
+  vec->priority = priority;
+  if (vec->priority == QUICLY_DGRAM_PRIORITY_KEY)
+    vec->max_time = -1;
+}
+
+/*
+ * RTP packet queued on the media stream without copying. The packet is
+ * preceded by its length in host byte order, as expected by quiclysrc,
+ * and the buffer stays mapped until the stream data has been acked
+ */
+typedef struct {
+  GstBuffer *buffer;
+  GstMapInfo map;
+  guint16 framing;
+} GstQuiclysinkStreamPayload;
+
+static int flatten_stream_payload(quicly_sendbuf_vec_t *vec, void *dst, size_t off, size_t len)
+{
+  GstQuiclysinkStreamPayload *payload = vec->cbdata;
+  guint8 *p = dst;
+
+  if (len == 0)
+    return 0;
+  for (; off < sizeof(payload->framing) && len != 0; ++off, --len)
+    *p++ = ((const guint8 *)&payload->framing)[off];
+  memcpy(p, payload->map.data + off - sizeof(payload->framing), len);
+  return 0;
+}
+
+static void discard_stream_payload(quicly_sendbuf_vec_t *vec)
+{
+  GstQuiclysinkStreamPayload *payload = vec->cbdata;
+  gst_buffer_unmap(payload->buffer, &payload->map);
+  gst_buffer_unref(payload->buffer);
+  g_slice_free(GstQuiclysinkStreamPayload, payload);
+}
+
+static const quicly_streambuf_sendvec_callbacks_t stream_payload_callbacks = {flatten_stream_payload,
+                                                                              discard_stream_payload};
+
+/*
+ * Queue a mapped buffer on the media stream. The mapping is taken over and
+ * released once the stream data has been acked
+ */
+static int write_stream_buffer(GstQuiclysink *quiclysink, GstBuffer *buffer, GstMapInfo *map, gint64 max_time)
+{
+  GstQuiclysinkStreamPayload *payload;
+  quicly_stream_t *stream = quiclysink->stream;
+  quicly_streambuf_t *sbuf;
+  size_t num_vecs;
+  int ret;
+
+  if (hold_back_media(quiclysink, g_atomic_int_get(&quiclysink->received_caps_ack))) {
+    gst_buffer_unmap(buffer, map);
+    return 0;
+  }
+  if (quiclysink->multi_stream_mode && (stream = get_frame_stream(quiclysink, buffer, max_time)) == NULL) {
+    gst_buffer_unmap(buffer, map);
+    return -1;
+  }
+  sbuf = stream->data;
+  num_vecs = sbuf->egress.vecs.size;
+
+  payload = g_slice_new(GstQuiclysinkStreamPayload);
+  payload->buffer = gst_buffer_ref(buffer);
+  payload->map = *map;
+  payload->framing = payload->map.size;
+
+  quicly_sendbuf_vec_t vec = {&stream_payload_callbacks, payload->map.size + sizeof(payload->framing), payload};
+  gboolean marker = payload->map.size >= 2 && (payload->map.data[1] & 0x80) != 0;
+  if ((ret = quicly_streambuf_egress_write_vec(stream, &vec)) != 0) {
+    g_printerr("quicly_streambuf_egress_write_vec returns: %i\n", ret);
+    /* the vec is owned by the stream once appended, even if syncing the stream failed */
+    if (sbuf->egress.vecs.size == num_vecs)
+      discard_stream_payload(&vec);
+  }
+
+  /* the marker bit ends the frame */
+  if (quiclysink->multi_stream_mode && marker) {
+    quicly_streambuf_egress_shutdown(stream);
+    quiclysink->frame_stream = NULL;
+  }
+  return ret;
+}
+
+/*
+ * Queue a buffer on the datagram flow or the stream(s) of the client
+ */
+static void write_media_buffer(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time)
+{
+  GstMapInfo map;
+
+  if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+    return;
+  if (quiclysink->stream_mode) {
+    write_stream_buffer(quiclysink, buffer, &map, max_time);
+  } else {
+    write_dgram_buffer(quiclysink, map.data, map.size, max_time);
+    gst_buffer_unmap(buffer, &map);
+  }
+}
+
+/*
+ * A frame stream and the time after which it is reset, -1 for never
+ */
+typedef struct {
+  quicly_stream_t *stream;
+  gint64 deadline;
+  gboolean reset; /* by us or on STOP_SENDING of the client */
+} GstQuiclysinkFrameStream;
+
+static GstQuiclysinkFrameStream *find_frame_stream(GstQuiclysink *quiclysink, quicly_stream_t *stream, GList **link)
+{
+  for (GList *l = quiclysink->frame_streams.head; l != NULL; l = l->next) {
+    GstQuiclysinkFrameStream *frame = l->data;
+    if (frame->stream == stream) {
+      if (link != NULL)
+        *link = l;
+      return frame;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * The stream of the frame an RTP packet belongs to. A new unidirectional
+ * stream is opened whenever the RTP timestamp changes
+ */
+static quicly_stream_t *get_frame_stream(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time)
+{
+  GstQuiclysinkFrameStream *frame;
+  quicly_stream_t *stream;
+  guint8 hdr[8];
+  guint32 ts;
+
+  if (gst_buffer_extract(buffer, 0, hdr, sizeof(hdr)) != sizeof(hdr))
+    return NULL;
+  ts = GST_READ_UINT32_BE(hdr + 4);
+
+  if (quiclysink->frame_stream != NULL) {
+    if (ts == quiclysink->frame_stream_ts)
+      return quiclysink->frame_stream;
+    /* the previous frame ended without a marker bit */
+    close_frame_stream(quiclysink);
+  }
+
+  if (quicly_open_stream(quiclysink->conn, &stream, 1) != 0) {
+    g_printerr("Could not open frame stream\n");
+    return NULL;
+  }
+  stream->callbacks = &frame_stream_callbacks;
+  frame = g_slice_new(GstQuiclysinkFrameStream);
+  frame->stream = stream;
+  frame->deadline = max_time;
+  frame->reset = FALSE;
+  g_queue_push_tail(&quiclysink->frame_streams, frame);
+
+  quiclysink->frame_stream = stream;
+  quiclysink->frame_stream_ts = ts;
+  return stream;
+}
+
+/*
+ * Reset the frame streams that missed their deadline, so that late frames
+ * are neither retransmitted nor block the newer ones. The frame still
+ * being written is left alone
+ */
+static void expire_frame_streams(GstQuiclysink *quiclysink)
+{
+  gint64 now;
+
+  if (g_queue_is_empty(&quiclysink->frame_streams))
+    return;
+  now = quiclysink->ctx.now->cb(quiclysink->ctx.now);
+  for (GList *l = quiclysink->frame_streams.head; l != NULL; l = l->next) {
+    GstQuiclysinkFrameStream *frame = l->data;
+    if (frame->deadline == -1 || now <= frame->deadline || frame->stream == quiclysink->frame_stream)
+      continue;
+    if (!frame->reset && !quicly_sendstate_transfer_complete(&frame->stream->sendstate)) {
+      quicly_reset_stream(frame->stream, QUICLY_ERROR_FROM_APPLICATION_ERROR_CODE(0));
+      frame->reset = TRUE;
+      ++quiclysink->num_frames_reset;
+    }
+    frame->deadline = -1;
+  }
+}
+
+/* Shut down the stream of the frame being written, if any */
+static void close_frame_stream(GstQuiclysink *quiclysink)
+{
+  if (quiclysink->frame_stream != NULL) {
+    quicly_streambuf_egress_shutdown(quiclysink->frame_stream);
+    quiclysink->frame_stream = NULL;
+  }
+}
+
+/* quicly resets the stream before calling back */
+static int on_frame_stream_stop_sending(quicly_stream_t *stream, int err)
+{
+  GstQuiclysink *quiclysink = GST_QUICLYSINK (*quicly_get_data(stream->conn));
+  GstQuiclysinkFrameStream *frame;
+
+  if ((frame = find_frame_stream(quiclysink, stream, NULL)) != NULL)
+    frame->reset = TRUE;
+  return on_stop_sending(stream, err);
+}
+
+static void on_frame_stream_destroy(quicly_stream_t *stream, int err)
+{
+  GstQuiclysink *quiclysink = GST_QUICLYSINK (*quicly_get_data(stream->conn));
+  GstQuiclysinkFrameStream *frame;
+  GList *link;
+
+  if ((frame = find_frame_stream(quiclysink, stream, &link)) != NULL) {
+    g_queue_delete_link(&quiclysink->frame_streams, link);
+    g_slice_free(GstQuiclysinkFrameStream, frame);
+  }
+  if (quiclysink->frame_stream == stream)
+    quiclysink->frame_stream = NULL;
+  quicly_streambuf_destroy(stream, err);
+}
+
+/*
+ * The datagram to drop when a client queue is full: the oldest one of the
+ * lowest priority, so key frames go last
+ */
+static size_t get_drop_index(quicly_dgram_t *dgram)
+{
+  quicly_dgrambuf_t *dbuf = (quicly_dgrambuf_t *)dgram->data;
+  size_t i, index = 0;
+
+  for (i = 1; i < dbuf->egress.vecs.size; i++) {
+    if (dbuf->egress.vecs.entries[i].priority < dbuf->egress.vecs.entries[index].priority)
+      index = i;
+  }
+  return index;
+}
+
+/*
+ * Replace the destination address if it differs from the one quicly sends to
+ */
+static void update_peer_address(GSocketAddress **addr, struct sockaddr *sa)
+{
+  struct sockaddr_in cur;
+
+  if (sa->sa_family != AF_INET)
+    return;
+  if (*addr != NULL && g_socket_address_to_native(*addr, &cur, sizeof(cur), NULL) &&
+      cur.sin_addr.s_addr == ((struct sockaddr_in *)sa)->sin_addr.s_addr &&
+      cur.sin_port == ((struct sockaddr_in *)sa)->sin_port)
+    return;
+
+  if (*addr != NULL)
+    g_object_unref(*addr);
+  *addr = g_socket_address_new_from_native(sa, sizeof(struct sockaddr_in));
+  g_print("Peer address changed\n");
+}
+
+/*
+ * Send all committed buffers as fast as possible
+ * Does not return until everythin is sent
+ * In fan-out mode, sends what the congestion controller of each client permits
+ */
 static int send_pending(GstQuiclysink *quiclysink, guint num)
+{
+  int ret;
+
+  if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+    g_mutex_lock(&quiclysink->clients_lock);
+    service_clients(quiclysink);
+    g_mutex_unlock(&quiclysink->clients_lock);
+    return 0;
+  }
+
+  /* the clock callback receives concurrently, e.g. while render blocks on the queue */
+  GST_OBJECT_LOCK(quiclysink);
+  expire_frame_streams(quiclysink);
+  GST_OBJECT_UNLOCK(quiclysink);
+  ret = send_packets(quiclysink, quiclysink->conn, &quiclysink->conn_addr, quiclysink->dgram, num, TRUE);
+  GST_OBJECT_LOCK(quiclysink);
+  g_atomic_int_set(&quiclysink->dgram_pending, (gint)quicly_dgram_num_pending(quiclysink->dgram));
+  GST_OBJECT_UNLOCK(quiclysink);
+  return ret;
+}
+
+/*
+ * Send the packets of one connection. With wait_all set, loops until all
+ * the queued data has been sent
+ */
+static int send_packets(GstQuiclysink *quiclysink, quicly_conn_t *conn, GSocketAddress **addr, quicly_dgram_t *dgram,
+                        guint num, gboolean wait_all)
 {
   quicly_datagram_t *packets[num];
   size_t num_packets, i;
@@ -923,11 +2668,15 @@ static int send_pending(GstQuiclysink *quiclysink, guint num)
   do {
       num_packets = sizeof(packets) / sizeof(packets[0]);
       GST_OBJECT_LOCK(quiclysink);
-      ret = quicly_send(quiclysink->conn, packets, &num_packets);
+      ret = quicly_send(conn, packets, &num_packets);
       GST_OBJECT_UNLOCK(quiclysink);
       if (ret == 0) {
+        /* quicly follows the client when it migrates (e.g. NAT rebinding) */
+        if (num_packets != 0)
+          update_peer_address(addr, &packets[0]->dest.sa);
         for (i = 0; i != num_packets; ++i) {
-          if ((rret = g_socket_send_to(quiclysink->socket, quiclysink->conn_addr, 
+          set_ecn_codepoint(quiclysink, packets[i]->ecn);
+          if ((rret = g_socket_send_to(quiclysink->socket, *addr, 
                                        (gchar *)packets[i]->data.base, 
                                        packets[i]->data.len,
                                        NULL, &err)) < 0) {
@@ -943,56 +2692,694 @@ static int send_pending(GstQuiclysink *quiclysink, guint num)
           quicly_packet_allocator_t *pa = quiclysink->ctx.packet_allocator;
           pa->free_packet(pa, packets[i]);
         }
-      } else {
+      } else if (ret != QUICLY_ERROR_FREE_CONNECTION || !QUICLYSINK_IS_FANOUT(quiclysink)) {
         g_printerr("Send returned %i.\n", ret);
       }
 
-  } while ((ret == 0) && 
-    (quicly_dgram_can_send(quiclysink->dgram) || 
-    quiclysink->ctx.stream_scheduler->can_send(quiclysink->ctx.stream_scheduler, quiclysink->conn, 0)));
+  } while ((ret == 0) && (wait_all ?
+    (quicly_dgram_can_send(dgram) || 
+    quiclysink->ctx.stream_scheduler->can_send(quiclysink->ctx.stream_scheduler, conn, 0)) :
+    num_packets == sizeof(packets) / sizeof(packets[0])));
 
   return ret;
 }
 
-static int send_caps(GstQuiclysink *quiclysink)
+/*
+ * Queue the caps on the control stream. If the client has not opened it
+ * yet, the caps are sent once it asks for them
+ */
+static int send_caps(GstQuiclysink *quiclysink, quicly_conn_t *conn)
 {
-  gchar *cp = gst_caps_to_string(quiclysink->caps);
   quicly_stream_t *stream;
+  gchar *cp;
   int ret;
-  if ((ret = quicly_open_stream(quiclysink->conn, &stream, 0)) == 0) {
-    gchar send[strlen(cp) + 20];
-    sprintf(send, "MSG:CAPS;DATA:%s\n", cp);
-    quicly_streambuf_egress_write(stream, send, strlen(send));
-    quicly_streambuf_egress_shutdown(stream);
-  }
+
+  if ((stream = quicly_get_stream(conn, GST_QUICLY_CONTROL_STREAM_ID)) == NULL)
+    return 0;
+  cp = gst_caps_to_string(quiclysink->caps);
+  ret = gst_quicly_control_write(stream, GST_QUICLY_CONTROL_CAPS, cp, strlen(cp));
   g_free(cp);
   return ret;
 }
 
+/*
+ * Called from the receive path, i.e. with the object lock held. Returns
+ * the error to close the connection with, if any
+ */
+static int handle_control_message(GstQuiclysink *quiclysink, quicly_conn_t *conn, guint8 type, ptls_iovec_t payload)
+{
+  GstQuiclysinkClient *client = NULL;
+  gboolean acked;
+  GstCaps *caps;
+  gchar *str;
+
+  if (QUICLYSINK_IS_FANOUT(quiclysink))
+    client = find_client(quiclysink, conn);
+
+  switch (type) {
+    case GST_QUICLY_CONTROL_CAPS_ACK:
+      str = g_strndup((const gchar *)payload.base, payload.len);
+      caps = gst_caps_from_string(str);
+      g_free(str);
+      acked = caps != NULL && quiclysink->caps != NULL && gst_caps_is_equal(caps, quiclysink->caps);
+      if (caps != NULL)
+        gst_caps_unref(caps);
+      if (!acked) {
+        /* an ack of the caps of an earlier session, or of caps that have been replaced since */
+        GST_DEBUG_OBJECT(quiclysink, "Ignoring ack of outdated caps");
+        if (quiclysink->caps != NULL)
+          send_caps(quiclysink, conn);
+        break;
+      }
+      GST_LOG_OBJECT(quiclysink, "RECEIVED CAPS ACK");
+      if (client != NULL)
+        client->received_caps_ack = TRUE;
+      else if (!QUICLYSINK_IS_FANOUT(quiclysink))
+        g_atomic_int_set(&quiclysink->received_caps_ack, TRUE);
+      /* the peer missed the media sent in the meantime and can't decode without a key frame */
+      if (g_atomic_int_compare_and_exchange(&quiclysink->media_held_back, TRUE, FALSE))
+        g_atomic_int_set(&quiclysink->key_frame_requested, TRUE);
+      break;
+    case GST_QUICLY_CONTROL_CAPS_REQUEST:
+      if (quiclysink->caps != NULL)
+        send_caps(quiclysink, conn);
+      break;
+    case GST_QUICLY_CONTROL_KEY_FRAME_REQUEST:
+      ++quiclysink->num_key_frame_requests;
+      g_atomic_int_set(&quiclysink->key_frame_requested, TRUE);
+      break;
+    case GST_QUICLY_CONTROL_FLOWS:
+      /* the datagrams could not be told apart */
+      if (payload.len != 1 || (payload.base[0] != 0) != (quiclysink->flow_framing != FALSE)) {
+        g_printerr("Request pads of the client do not match, closing the connection\n");
+        return QUICLY_ERROR_FROM_APPLICATION_ERROR_CODE(GST_QUICLY_ERROR_FLOW_FRAMING);
+      }
+      break;
+    default:
+      GST_DEBUG_OBJECT(quiclysink, "Ignoring control message of unknown type %u", type);
+      break;
+  }
+  return 0;
+}
+
+/*
+ * Media is held back from a peer that has not acked the current caps yet
+ */
+static gboolean hold_back_media(GstQuiclysink *quiclysink, gboolean acked)
+{
+  if (!quiclysink->auto_caps_exchange || acked)
+    return FALSE;
+  ++quiclysink->num_held_back;
+  g_atomic_int_set(&quiclysink->media_held_back, TRUE);
+  return TRUE;
+}
+
+/*
+ * Ask the encoder for a key frame. Only called from the streaming thread
+ */
+static void push_key_frame_request(GstQuiclysink *quiclysink)
+{
+  GstEvent *event = gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM,
+      gst_structure_new("GstForceKeyUnit", "running-time", GST_TYPE_CLOCK_TIME, GST_CLOCK_TIME_NONE,
+                        "all-headers", G_TYPE_BOOLEAN, TRUE, NULL));
+
+  GST_DEBUG_OBJECT(quiclysink, "Requesting key frame upstream");
+  if (!gst_pad_push_event(GST_BASE_SINK_PAD(quiclysink), event))
+    GST_DEBUG_OBJECT(quiclysink, "Key frame request not handled upstream");
+}
+
+/*
+ * Apply the congestion control and rate settings to a connection
+ */
+static void setup_connection(GstQuiclysink *quiclysink, quicly_conn_t *conn)
+{
+  /* set application level cc */
+  if (quiclysink->application_cc) {
+    quicly_set_application_cc(conn, 1);
+  }
+  quicly_set_send_rate(conn, quiclysink->send_rate, quiclysink->send_burst);
+  quicly_set_target_bitrate_limits(conn, quiclysink->min_bitrate, quiclysink->max_bitrate);
+}
+
+static void setup_clients(GstQuiclysink *quiclysink)
+{
+  g_mutex_lock(&quiclysink->clients_lock);
+  for (guint i = 0; i < quiclysink->clients->len; i++) {
+    GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+    if (client->dgram != NULL)
+      setup_connection(quiclysink, client->conn);
+  }
+  g_mutex_unlock(&quiclysink->clients_lock);
+}
+
+static GstQuiclysinkClient *find_client(GstQuiclysink *quiclysink, quicly_conn_t *conn)
+{
+  for (guint i = 0; i < quiclysink->clients->len; i++) {
+    GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+    if (client->conn == conn)
+      return client;
+  }
+  return NULL;
+}
+
+static void free_client(GstQuiclysinkClient *client)
+{
+  /* quicly_free disposes the datagram queue as well */
+  quicly_free(client->conn);
+  g_object_unref(client->addr);
+  g_free(client);
+}
+
+/*
+ * Fan-out mode: hand the packet to the client it belongs to or accept a new one.
+ * Called with clients_lock held
+ */
+static int receive_fanout(GstQuiclysink *quiclysink, struct sockaddr_in *sa, quicly_decoded_packet_t *packet)
+{
+  GstQuiclysinkClient *client;
+  quicly_conn_t *conn = NULL;
+
+  for (guint i = 0; i < quiclysink->clients->len; i++) {
+    client = g_ptr_array_index(quiclysink->clients, i);
+    if (quicly_is_destination(client->conn, NULL, (struct sockaddr *)sa, packet))
+      return quicly_receive(client->conn, NULL, (struct sockaddr *)sa, packet);
+  }
+
+  if (!QUICLY_PACKET_IS_LONG_HEADER(packet->octets.base[0]))
+    return 0;
+  if (quiclysink->clients->len >= quiclysink->max_clients) {
+    GST_DEBUG_OBJECT(quiclysink, "Client limit of %u reached, ignoring new connection", quiclysink->max_clients);
+    return 0;
+  }
+  if (quicly_accept(&conn, &quiclysink->ctx, NULL, (struct sockaddr *)sa, packet, NULL,
+                    &quiclysink->next_cid, NULL) != 0 || conn == NULL) {
+    g_printerr("Failed to accept connection\n");
+    return -1;
+  }
+  ++quiclysink->next_cid.master_id;
+  quicly_set_data(conn, (void*) quiclysink);
+
+  client = g_new0(GstQuiclysinkClient, 1);
+  client->conn = conn;
+  client->addr = g_socket_address_new_from_native(sa, sizeof(*sa));
+  g_ptr_array_add(quiclysink->clients, client);
+  g_print("Client %u connected\n", quiclysink->clients->len);
+  return 0;
+}
+
+/*
+ * Open the datagram flow of newly connected clients, send what each
+ * connection permits and drop the closed ones.
+ * Called with clients_lock held
+ */
+static void service_clients(GstQuiclysink *quiclysink)
+{
+  guint i = 0;
+
+  while (i < quiclysink->clients->len) {
+    GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+    if (client->dgram == NULL && quicly_connection_is_ready(client->conn)) {
+      if (quicly_open_dgram(client->conn, &client->dgram) != 0) {
+        g_printerr("Can't open quicly_dgram\n");
+      } else {
+        setup_connection(quiclysink, client->conn);
+        if (quiclysink->auto_caps_exchange && quiclysink->caps != NULL && !client->received_caps_ack)
+          send_caps(quiclysink, client->conn);
+      }
+    }
+    if (send_packets(quiclysink, client->conn, &client->addr, client->dgram, DEFAULT_SEND_BUFFER, FALSE) != 0) {
+      g_print("Client %u disconnected\n", i + 1);
+      g_ptr_array_remove_index_fast(quiclysink->clients, i);
+      free_client(client);
+      continue;
+    }
+    ++i;
+  }
+}
+
+/*
+ * Payload shared between the datagram queues of all clients.
+ * The buffer is mapped once and released with the last queue entry
+ */
+typedef struct {
+  gint refcnt;
+  GstBuffer *buffer;
+  GstMapInfo map;
+} GstQuiclysinkSharedPayload;
+
+static void release_shared_payload(quicly_dgram_listbuf_vec_t *vec)
+{
+  GstQuiclysinkSharedPayload *payload = vec->cbdata;
+  if (g_atomic_int_dec_and_test(&payload->refcnt)) {
+    gst_buffer_unmap(payload->buffer, &payload->map);
+    gst_buffer_unref(payload->buffer);
+    g_slice_free(GstQuiclysinkSharedPayload, payload);
+  }
+}
+
+/*
+ * Queue one buffer on every client that is ready to receive media.
+ * If a client's queue is full, its oldest datagram is dropped
+ */
+static void write_fanout_buffer(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time)
+{
+  GstQuiclysinkSharedPayload *payload = g_slice_new(GstQuiclysinkSharedPayload);
+  payload->refcnt = 1;
+  payload->buffer = gst_buffer_ref(buffer);
+  if (!gst_buffer_map(buffer, &payload->map, GST_MAP_READ)) {
+    g_printerr("Failed to map buffer\n");
+    gst_buffer_unref(buffer);
+    g_slice_free(GstQuiclysinkSharedPayload, payload);
+    return;
+  }
+
+  quicly_dgram_listbuf_vec_t tagged = {max_time, payload->map.size, payload->map.data, release_shared_payload, payload};
+  tag_frame(quiclysink, &tagged);
+
+  g_mutex_lock(&quiclysink->clients_lock);
+  for (guint i = 0; i < quiclysink->clients->len; i++) {
+    GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+    if (client->dgram == NULL || hold_back_media(quiclysink, client->received_caps_ack))
+      continue;
+    if (quicly_dgram_num_pending(client->dgram) >= quiclysink->client_queue_size)
+      client->num_dropped += quicly_dgrambuf_egress_drop(client->dgram, get_drop_index(client->dgram));
+    quicly_dgram_listbuf_vec_t vec = tagged;
+    g_atomic_int_inc(&payload->refcnt);
+    if (quicly_dgrambuf_egress_write_vec(client->dgram, &vec) != 0) {
+      release_shared_payload(&vec);
+      continue;
+    }
+    ++client->num_packets;
+    client->num_bytes += payload->map.size;
+  }
+  g_mutex_unlock(&quiclysink->clients_lock);
+
+  release_shared_payload(&(quicly_dgram_listbuf_vec_t){.cbdata = payload});
+}
+
+static GstStructure *gst_quiclysink_get_client_stats(GstQuiclysink *quiclysink, const gchar *host, gint port)
+{
+  GstStructure *s = NULL;
+  quicly_stats_t stats;
+
+  g_mutex_lock(&quiclysink->clients_lock);
+  for (guint i = 0; i < quiclysink->clients->len; i++) {
+    GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+    GInetSocketAddress *addr = G_INET_SOCKET_ADDRESS(client->addr);
+    gchar *addr_host = g_inet_address_to_string(g_inet_socket_address_get_address(addr));
+    gboolean match = g_strcmp0(addr_host, host) == 0 && g_inet_socket_address_get_port(addr) == port;
+    g_free(addr_host);
+    if (!match)
+      continue;
+    GST_OBJECT_LOCK(quiclysink);
+    quicly_get_stats(client->conn, &stats);
+    GST_OBJECT_UNLOCK(quiclysink);
+    s = stats_to_structure("quiclysink-client-stats", &stats, client->num_bytes);
+    gst_structure_set(s,
+        "host", G_TYPE_STRING, host,
+        "port", G_TYPE_INT, port,
+        "dropped-queue-full", G_TYPE_UINT64, client->num_dropped,
+        "caps-acked", G_TYPE_BOOLEAN, client->received_caps_ack, NULL);
+    break;
+  }
+  g_mutex_unlock(&quiclysink->clients_lock);
+
+  return s;
+}
+
+/*
+ * Queue a rendered buffer for the I/O thread. Called from the streaming
+ * thread only. The buffer is dropped if the I/O thread falls behind
+ */
+static gboolean push_io_buffer(GstQuiclysink *quiclysink, GstBuffer *buffer, gint64 max_time)
+{
+  GstQuiclysinkRing *ring = &quiclysink->ring;
+  gsize size = gst_buffer_get_size(buffer);
+  gint tail = g_atomic_int_get(&ring->tail);
+
+  if (!quiclysink->stream_mode && size > QUICLYSINK_MAX_PAYLOAD(quiclysink)) {
+    g_printerr("Max payload size exceeded: %lu. MTU: %u\n", size, quiclysink->quicly_mtu);
+    return FALSE;
+  }
+  if ((guint)(tail - g_atomic_int_get(&ring->head)) == ring->capacity) {
+    ++quiclysink->num_ring_dropped;
+    GST_WARNING_OBJECT(quiclysink, "I/O thread falling behind, dropping buffer");
+    return TRUE;
+  }
+  ring->entries[tail & (ring->capacity - 1)].buffer = gst_buffer_ref(buffer);
+  ring->entries[tail & (ring->capacity - 1)].max_time = max_time;
+  g_atomic_int_set(&ring->tail, tail + 1);
+
+  ++quiclysink->num_packets;
+  quiclysink->num_bytes += size;
+  return TRUE;
+}
+
+/* The I/O thread quit on an error, the connection is not served anymore */
+static gboolean io_thread_stopped(GstQuiclysink *quiclysink)
+{
+  return quiclysink->io_thread_handle != NULL && !g_atomic_int_get(&quiclysink->io_running);
+}
+
+static void wake_io_thread(GstQuiclysink *quiclysink)
+{
+  guint64 one = 1;
+  if (quiclysink->event_fd != -1 && write(quiclysink->event_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+    g_printerr("Failed to wake up the I/O thread: %s\n", g_strerror(errno));
+}
+
+/*
+ * Move the queued buffers to the datagram (or stream) buffers of the connection(s)
+ */
+static void drain_io_ring(GstQuiclysink *quiclysink)
+{
+  GstQuiclysinkRing *ring = &quiclysink->ring;
+  gint head = g_atomic_int_get(&ring->head), tail = g_atomic_int_get(&ring->tail);
+
+  for (; head != tail; ++head) {
+    GstBuffer *buffer = ring->entries[head & (ring->capacity - 1)].buffer;
+    gint64 max_time = ring->entries[head & (ring->capacity - 1)].max_time;
+    if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+      write_fanout_buffer(quiclysink, buffer, max_time);
+    } else if (quiclysink->conn != NULL) {
+      GST_OBJECT_LOCK(quiclysink);
+      write_media_buffer(quiclysink, buffer, max_time);
+      GST_OBJECT_UNLOCK(quiclysink);
+    }
+    gst_buffer_unref(buffer);
+  }
+  g_atomic_int_set(&ring->head, head);
+}
+
+/*
+ * Arm the timer for the earliest quicly timeout of the connection(s)
+ */
+static void update_io_timer(GstQuiclysink *quiclysink)
+{
+  struct itimerspec spec = {{0, 0}, {0, 0}};
+  int64_t timeout_at = INT64_MAX, now;
+
+  if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+    g_mutex_lock(&quiclysink->clients_lock);
+    for (guint i = 0; i < quiclysink->clients->len; i++) {
+      GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+      int64_t at = quicly_get_first_timeout(client->conn);
+      if (at < timeout_at)
+        timeout_at = at;
+    }
+    g_mutex_unlock(&quiclysink->clients_lock);
+  } else if (quiclysink->conn != NULL) {
+    GST_OBJECT_LOCK(quiclysink);
+    timeout_at = quicly_get_first_timeout(quiclysink->conn);
+    GST_OBJECT_UNLOCK(quiclysink);
+  }
+
+  if (timeout_at != INT64_MAX) {
+    now = quiclysink->ctx.now->cb(quiclysink->ctx.now);
+    if (timeout_at > now) {
+      spec.it_value.tv_sec = (timeout_at - now) / 1000;
+      spec.it_value.tv_nsec = ((timeout_at - now) % 1000) * 1000000;
+    } else {
+      /* a zero value disarms the timer */
+      spec.it_value.tv_nsec = 1;
+    }
+  }
+  timerfd_settime(quiclysink->timer_fd, 0, &spec, NULL);
+}
+
+/*
+ * The I/O loop: drain the socket, hand the queued buffers to quicly, send
+ * what the congestion controller permits and sleep until the next event
+ */
+static gpointer io_thread_func(gpointer data)
+{
+  GstQuiclysink *quiclysink = GST_QUICLYSINK(data);
+  struct epoll_event events[3];
+  guint64 counter;
+  int n, i, ret;
+  gboolean failed = FALSE, eos;
+
+  while (g_atomic_int_get(&quiclysink->io_running)) {
+    if ((n = epoll_wait(quiclysink->epoll_fd, events, G_N_ELEMENTS(events), -1)) == -1) {
+      if (errno == EINTR)
+        continue;
+      g_printerr("epoll_wait failed: %s\n", g_strerror(errno));
+      failed = TRUE;
+      break;
+    }
+    for (i = 0; i != n; ++i) {
+      if (events[i].data.fd == quiclysink->event_fd || events[i].data.fd == quiclysink->timer_fd) {
+        if (read(events[i].data.fd, &counter, sizeof(counter)) == -1 && errno != EAGAIN)
+          g_printerr("read on I/O thread fd failed: %s\n", g_strerror(errno));
+      }
+    }
+    if (!g_atomic_int_get(&quiclysink->io_running))
+      break;
+
+    /* EOS is flagged after the last buffer has been queued */
+    eos = g_atomic_int_compare_and_exchange(&quiclysink->frame_stream_eos, TRUE, FALSE);
+    drain_io_ring(quiclysink);
+    if (eos) {
+      GST_OBJECT_LOCK(quiclysink);
+      close_frame_stream(quiclysink);
+      GST_OBJECT_UNLOCK(quiclysink);
+    }
+
+    if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+      g_mutex_lock(&quiclysink->clients_lock);
+      while (g_socket_condition_check(quiclysink->socket, G_IO_IN | G_IO_PRI) & (G_IO_IN | G_IO_PRI)) {
+        GST_OBJECT_LOCK(quiclysink);
+        ret = receive_packet(quiclysink);
+        GST_OBJECT_UNLOCK(quiclysink);
+        if (ret != 0)
+          break;
+      }
+      service_clients(quiclysink);
+      g_mutex_unlock(&quiclysink->clients_lock);
+    } else {
+      while (g_socket_condition_check(quiclysink->socket, G_IO_IN | G_IO_PRI) & (G_IO_IN | G_IO_PRI)) {
+        GST_OBJECT_LOCK(quiclysink);
+        ret = receive_packet(quiclysink);
+        GST_OBJECT_UNLOCK(quiclysink);
+        if (ret != 0)
+          break;
+      }
+      if (!g_atomic_int_get(&quiclysink->connected)) {
+        service_handshake(quiclysink);
+        update_io_timer(quiclysink);
+        continue;
+      }
+      GST_OBJECT_LOCK(quiclysink);
+      expire_frame_streams(quiclysink);
+      GST_OBJECT_UNLOCK(quiclysink);
+      if (send_packets(quiclysink, quiclysink->conn, &quiclysink->conn_addr, quiclysink->dgram, DEFAULT_SEND_BUFFER,
+                       FALSE) != 0) {
+        g_printerr("Connection closed while sending\n");
+        failed = TRUE;
+        break;
+      }
+      g_atomic_int_set(&quiclysink->dgram_pending, (gint)quicly_dgram_num_pending(quiclysink->dgram));
+    }
+
+    update_target_bitrate(quiclysink);
+    update_io_timer(quiclysink);
+  }
+
+  g_atomic_int_set(&quiclysink->io_running, FALSE);
+  /* render returns an error from now on, see io_thread_stopped */
+  if (failed)
+    GST_ELEMENT_ERROR(quiclysink, RESOURCE, WRITE, (NULL), ("The I/O thread stopped"));
+  return NULL;
+}
+
+static gboolean start_io_thread(GstQuiclysink *quiclysink)
+{
+  struct epoll_event ev = {EPOLLIN};
+  GError *err = NULL;
+
+  quiclysink->ring.capacity = IO_RING_SIZE;
+  quiclysink->ring.entries = g_new0(typeof(*quiclysink->ring.entries), IO_RING_SIZE);
+  quiclysink->ring.head = quiclysink->ring.tail = 0;
+  quiclysink->frame_stream_eos = FALSE;
+
+  if ((quiclysink->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+      (quiclysink->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+      (quiclysink->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+    g_printerr("Failed to set up the I/O thread: %s\n", g_strerror(errno));
+    return FALSE;
+  }
+  ev.data.fd = g_socket_get_fd(quiclysink->socket);
+  epoll_ctl(quiclysink->epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+  ev.data.fd = quiclysink->event_fd;
+  epoll_ctl(quiclysink->epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+  ev.data.fd = quiclysink->timer_fd;
+  epoll_ctl(quiclysink->epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+  g_atomic_int_set(&quiclysink->io_running, TRUE);
+  if ((quiclysink->io_thread_handle = g_thread_try_new("quiclysink-io", io_thread_func, quiclysink, &err)) == NULL) {
+    g_printerr("Failed to start the I/O thread: %s\n", err->message);
+    g_error_free(err);
+    g_atomic_int_set(&quiclysink->io_running, FALSE);
+    return FALSE;
+  }
+  /* serve the timers of a connection that is already established */
+  update_io_timer(quiclysink);
+  return TRUE;
+}
+
+static void stop_io_thread(GstQuiclysink *quiclysink)
+{
+  if (quiclysink->io_thread_handle != NULL) {
+    g_atomic_int_set(&quiclysink->io_running, FALSE);
+    wake_io_thread(quiclysink);
+    g_thread_join(quiclysink->io_thread_handle);
+    quiclysink->io_thread_handle = NULL;
+    /* buffers that have not been handed over yet are sent by the caller */
+    drain_io_ring(quiclysink);
+    g_free(quiclysink->ring.entries);
+    quiclysink->ring.entries = NULL;
+  }
+  if (quiclysink->epoll_fd != -1)
+    close(quiclysink->epoll_fd);
+  if (quiclysink->event_fd != -1)
+    close(quiclysink->event_fd);
+  if (quiclysink->timer_fd != -1)
+    close(quiclysink->timer_fd);
+  quiclysink->epoll_fd = quiclysink->event_fd = quiclysink->timer_fd = -1;
+}
+
+/* Seals session tickets with the key loaded by setup_ticket_key. The ticket is prefixed by the random sequence number used as
+ * the nonce. Note that nothing protects against replay of the 0-RTT data; the client only sends the caps ack in early data */
+static int encrypt_ticket_cb(ptls_encrypt_ticket_t *_self, ptls_t *tls, int is_encrypt, ptls_buffer_t *dst, ptls_iovec_t src)
+{
+  GstQuiclysink *quiclysink = (void *)((char *)_self - offsetof(GstQuiclysink, encrypt_ticket));
+  ptls_aead_context_t *aead = quiclysink->ticket_aead[is_encrypt];
+  uint64_t seq;
+  size_t len;
+  int ret;
+
+  if (is_encrypt) {
+    if ((ret = ptls_buffer_reserve(dst, sizeof(seq) + src.len + aead->algo->tag_size)) != 0)
+      return ret;
+    quiclysink->tlsctx.random_bytes(&seq, sizeof(seq));
+    memcpy(dst->base + dst->off, &seq, sizeof(seq));
+    dst->off += sizeof(seq);
+    dst->off += ptls_aead_encrypt(aead, dst->base + dst->off, src.base, src.len, seq, NULL, 0);
+  } else {
+    if (src.len < sizeof(seq) + aead->algo->tag_size)
+      return PTLS_ALERT_DECODE_ERROR;
+    if ((ret = ptls_buffer_reserve(dst, src.len)) != 0)
+      return ret;
+    memcpy(&seq, src.base, sizeof(seq));
+    if ((len = ptls_aead_decrypt(aead, dst->base + dst->off, src.base + sizeof(seq), src.len - sizeof(seq), seq, NULL, 0)) ==
+        SIZE_MAX)
+      return PTLS_ALERT_DECODE_ERROR;
+    dst->off += len;
+  }
+
+  return 0;
+}
+
+/* Load the ticket secret from ticket-key-file, or create the file with a random secret */
+static gboolean setup_ticket_key(GstQuiclysink *quiclysink)
+{
+  uint8_t secret[PTLS_MAX_DIGEST_SIZE];
+  size_t secret_len = ptls_openssl_sha256.digest_size;
+  FILE *fp;
+
+  if ((fp = fopen(quiclysink->ticket_key_file, "rb")) != NULL) {
+    size_t len = fread(secret, 1, secret_len, fp);
+    fclose(fp);
+    if (len != secret_len) {
+      g_printerr("Invalid ticket key file: %s\n", quiclysink->ticket_key_file);
+      return FALSE;
+    }
+  } else {
+    quiclysink->tlsctx.random_bytes(secret, secret_len);
+    int fd;
+    if ((fd = open(quiclysink->ticket_key_file, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+      g_printerr("Failed to create ticket key file %s: %s\n", quiclysink->ticket_key_file, g_strerror(errno));
+      return FALSE;
+    }
+    if (write(fd, secret, secret_len) != secret_len) {
+      g_printerr("Failed to write ticket key file %s: %s\n", quiclysink->ticket_key_file, g_strerror(errno));
+      close(fd);
+      return FALSE;
+    }
+    close(fd);
+  }
+
+  for (int is_enc = 0; is_enc < 2; is_enc++) {
+    if (quiclysink->ticket_aead[is_enc] != NULL)
+      ptls_aead_free(quiclysink->ticket_aead[is_enc]);
+    if ((quiclysink->ticket_aead[is_enc] = ptls_aead_new(&ptls_openssl_aes128gcm, &ptls_openssl_sha256, is_enc, secret,
+                                                         "quiclysink ticket")) == NULL) {
+      g_printerr("Failed to setup ticket encryption\n");
+      return FALSE;
+    }
+  }
+  ptls_clear_memory(secret, sizeof(secret));
+
+  quiclysink->tlsctx.encrypt_ticket = &quiclysink->encrypt_ticket;
+  return TRUE;
+}
+
 static gboolean gst_quiclysink_set_caps (GstBaseSink *sink, GstCaps *caps)
 {
   GstQuiclysink *quiclysink = GST_QUICLYSINK (sink);
   GST_LOG_OBJECT (quiclysink, "Caps set: %s", gst_caps_to_string(caps));
+
+  const gchar *encoding = gst_structure_get_string(gst_caps_get_structure(caps, 0), "encoding-name");
+  if (g_strcmp0(encoding, "H264") == 0)
+    quiclysink->frame_codec = FRAME_CODEC_H264;
+  else if (g_strcmp0(encoding, "H265") == 0)
+    quiclysink->frame_codec = FRAME_CODEC_H265;
+  else
+    quiclysink->frame_codec = FRAME_CODEC_NONE;
   
   if (!quiclysink->auto_caps_exchange)
     return TRUE;
 
-  int ret = -1;
+  int ret;
+  GST_OBJECT_LOCK(quiclysink);
   if (quiclysink->caps)
-    gst_caps_unref(caps);
+    gst_caps_unref(quiclysink->caps);
   quiclysink->caps = gst_caps_copy (caps);
-  if (quiclysink->conn != NULL) {
-    if (send_caps(quiclysink) == 0) {
-      do {
-        ret = send_pending(quiclysink, DEFAULT_SEND_BUFFER);
-      } while ((ret == 0) && (!quiclysink->received_caps_ack));
-      GST_INFO_OBJECT(quiclysink, "Send caps and received ack");
+  GST_OBJECT_UNLOCK(quiclysink);
+
+  /* don't block on the peers; each one receives media again once it acked the new caps */
+  if (QUICLYSINK_IS_FANOUT(quiclysink)) {
+    g_mutex_lock(&quiclysink->clients_lock);
+    for (guint i = 0; i < quiclysink->clients->len; i++) {
+      GstQuiclysinkClient *client = g_ptr_array_index(quiclysink->clients, i);
+      if (client->dgram != NULL) {
+        client->received_caps_ack = FALSE;
+        GST_OBJECT_LOCK(quiclysink);
+        send_caps(quiclysink, client->conn);
+        GST_OBJECT_UNLOCK(quiclysink);
+      }
     }
+    if (quiclysink->io_thread_handle == NULL)
+      service_clients(quiclysink);
+    g_mutex_unlock(&quiclysink->clients_lock);
+    wake_io_thread(quiclysink);
+    return TRUE;
   }
-  if (ret != 0)
+  /* the caps are sent once the client asks for them, if it has not opened the control stream yet */
+  g_atomic_int_set(&quiclysink->received_caps_ack, FALSE);
+  GST_OBJECT_LOCK(quiclysink);
+  ret = quiclysink->conn != NULL ? send_caps(quiclysink, quiclysink->conn) : 0;
+  GST_OBJECT_UNLOCK(quiclysink);
+  if (ret != 0) {
     GST_ERROR_OBJECT(quiclysink, "Send caps failed");
+    return FALSE;
+  }
+  if (quiclysink->io_thread_handle != NULL)
+    wake_io_thread(quiclysink);
+  else if (g_atomic_int_get(&quiclysink->connected))
+    send_pending(quiclysink, DEFAULT_SEND_BUFFER);
 
-  return (ret == 0) ? TRUE : FALSE;
+  return TRUE;
 }
 
 static int on_receive_dgram(quicly_dgram_t *dgram, const void *src, size_t len)
@@ -1004,21 +3391,23 @@ static int on_receive_dgram(quicly_dgram_t *dgram, const void *src, size_t len)
 static int on_receive_stream(quicly_stream_t *stream, size_t off, const void *src, size_t len)
 {
   GstQuiclysink *quiclysink = GST_QUICLYSINK (*quicly_get_data(stream->conn));
-  ptls_iovec_t input;
+  ptls_iovec_t payload;
+  guint8 type;
+  gsize consumed;
   int ret;
 
   if ((ret = quicly_streambuf_ingress_receive(stream, off, src, len)) != 0)
     return ret;
 
-  if ((input = quicly_streambuf_ingress_get(stream)).len != 0) {
-    char head[4] = {input.base[0], input.base[1], input.base[2], '\0'};
-    g_print("STREAM MESSAGE: %s\n", head);
-    if (strcmp(head, "MSG") == 0) {
-      /* TODO: Read all of the message. For now I only have the caps ack */
-      /* Set received_caps_ack */
-      GST_LOG_OBJECT(quiclysink, "RECEIVED CAPS ACK");
-      quiclysink->received_caps_ack = TRUE;
-    } 
+  if (stream->stream_id != GST_QUICLY_CONTROL_STREAM_ID) {
+    /* nothing else is expected from the client */
+    quicly_streambuf_ingress_shift(stream, quicly_streambuf_ingress_get(stream).len);
+    return 0;
+  }
+  while ((consumed = gst_quicly_control_parse(quicly_streambuf_ingress_get(stream), &type, &payload)) != 0) {
+    if ((ret = handle_control_message(quiclysink, stream->conn, type, payload)) != 0)
+      return ret;
+    quicly_streambuf_ingress_shift(stream, consumed);
   }
   return 0;
 }
@@ -1098,7 +3487,7 @@ int save_ticket_cb(ptls_save_ticket_t *_self, ptls_t *tls, ptls_iovec_t src)
 
     /* write file */
     if ((fp = fopen(session_file, "wb")) == NULL) {
-        fprintf(stderr, "failed to open file:%s:%s\n", session_file, strerror(errno));
+        fprintf(stderr, "failed to open file:%s:%s\n", session_file, g_strerror(errno));
         ret = PTLS_ERROR_LIBRARY;
         goto Exit;
     }
@@ -1117,13 +3506,18 @@ static gboolean gst_quiclysink_sched_cbs(GstQuiclysink *quiclysink, GstClock *cl
 {
   gboolean ret = TRUE;
 
-  if ((quiclysink->clockId = gst_clock_new_periodic_id(clock, 
-                               gst_clock_get_internal_time(clock), 
-                               RECEIVE_CLOCK_TIME_NS)) == NULL)
-    ret = FALSE;
+  if (quiclysink->io_thread) {
+    if (!start_io_thread(quiclysink))
+      ret = FALSE;
+  } else {
+    if ((quiclysink->clockId = gst_clock_new_periodic_id(clock, 
+                                 gst_clock_get_internal_time(clock), 
+                                 RECEIVE_CLOCK_TIME_NS)) == NULL)
+      ret = FALSE;
 
-  if (gst_clock_id_wait_async(quiclysink->clockId, receive_async_cb, quiclysink, NULL) != GST_CLOCK_OK)
-    ret = FALSE;
+    if (gst_clock_id_wait_async(quiclysink->clockId, receive_async_cb, quiclysink, NULL) != GST_CLOCK_OK)
+      ret = FALSE;
+  }
 
   if (quiclysink->feedback_active) {
     if ((quiclysink->fbClockId = gst_clock_new_periodic_id(clock, 
@@ -1152,6 +3546,16 @@ gboolean gst_quiclysink_set_clock(GstElement *element, GstClock *clock)
 static void send_remaining_before_close(GstQuiclysink *quiclysink)
 {
   GST_DEBUG_OBJECT(quiclysink, "Sending final packets\n");
+  if (quiclysink->io_thread_handle != NULL) {
+    /* the frame stream is written by the I/O thread, it is closed after the last buffer */
+    g_atomic_int_set(&quiclysink->frame_stream_eos, TRUE);
+    wake_io_thread(quiclysink);
+    return;
+  }
+  /* what has been queued before the client connected is dropped on stop */
+  if (!QUICLYSINK_IS_FANOUT(quiclysink) && !g_atomic_int_get(&quiclysink->connected))
+    return;
+  close_frame_stream(quiclysink);
   send_pending(quiclysink, DEFAULT_SEND_BUFFER);
 }
 
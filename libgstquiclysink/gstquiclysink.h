@@ -24,6 +24,7 @@
 #include <gst/base/gstbasesink.h>
 #include <gio/gio.h>
 #include "quicly.h"
+#include "gstquiclycontrol.h"
 
 G_BEGIN_DECLS
 
@@ -33,8 +34,64 @@ G_BEGIN_DECLS
 #define GST_IS_QUICLYSINK(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_QUICLYSINK))
 #define GST_IS_QUICLYSINK_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_QUICLYSINK))
 
+#define GST_TYPE_QUICLYSINK_PAD   (gst_quiclysink_pad_get_type())
+#define GST_QUICLYSINK_PAD(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_QUICLYSINK_PAD,GstQuiclysinkPad))
+#define GST_IS_QUICLYSINK_PAD(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_QUICLYSINK_PAD))
+
 typedef struct _GstQuiclysink GstQuiclysink;
 typedef struct _GstQuiclysinkClass GstQuiclysinkClass;
+typedef struct _GstQuiclysinkClient GstQuiclysinkClient;
+typedef struct _GstQuiclysinkRing GstQuiclysinkRing;
+typedef struct _GstQuiclysinkPad GstQuiclysinkPad;
+typedef struct _GstQuiclysinkPadClass GstQuiclysinkPadClass;
+
+/* Request pad (sink_%u): an additional datagram flow sharing the
+ * connection of the media, its id being the number of the pad */
+struct _GstQuiclysinkPad
+{
+  GstPad parent;
+
+  guint flow;
+  guint priority; /* queued ahead of the datagrams of lower priority flows */
+  gint drop_late;
+
+  guint64 num_packets;
+  guint64 num_bytes;
+  guint64 num_dropped; /* rendered before the client connected */
+};
+
+struct _GstQuiclysinkPadClass
+{
+  GstPadClass parent_class;
+};
+
+/* A viewer in fan-out mode (max-clients > 1). Each one has its own
+ * congestion controller and datagram queue */
+struct _GstQuiclysinkClient
+{
+  quicly_conn_t *conn;
+  quicly_dgram_t *dgram;
+  GSocketAddress *addr;
+  gboolean received_caps_ack;
+
+  guint64 num_packets;
+  guint64 num_bytes;
+  guint64 num_dropped; /* datagrams dropped because the queue was full */
+};
+
+/* Single-producer single-consumer queue handing the rendered buffers
+ * over to the I/O thread. head is only written by the consumer, tail
+ * only by the producer */
+struct _GstQuiclysinkRing
+{
+  struct {
+    GstBuffer *buffer;
+    gint64 max_time;
+  } *entries;
+  guint capacity; /* power of two */
+  gint head;
+  gint tail;
+};
 
 struct _GstQuiclysink
 {
@@ -65,12 +122,30 @@ struct _GstQuiclysink
   /* certificate chain and key location */
   gchar *cert;
   gchar *key;
+  /* secret used for sealing session tickets, so that 0-RTT works across restarts */
+  gchar *ticket_key_file;
+  ptls_encrypt_ticket_t encrypt_ticket;
+  ptls_aead_context_t *ticket_aead[2]; /* [0]: decrypt, [1]: encrypt */
 
-  /* crutch */
+  /* caps exchange over the control stream, see gstquiclycontrol.h */
   gboolean received_caps_ack;
+  gint media_held_back; /* media was withheld while waiting for a caps ack */
+  guint64 num_held_back;
+  gint key_frame_requested; /* pushed upstream from the streaming thread */
+  guint64 num_key_frame_requests;
   
   quicly_dgram_t *dgram;
   quicly_stream_t *stream;
+  /* single client mode: the client is accepted while running. Buffers
+   * rendered before it can receive them are queued */
+  gint connected;
+  gboolean media_open;
+  GQueue preconnect;
+  guint preconnect_size;
+  gboolean preconnect_key_frame;
+  gboolean preconnect_has_key;
+  guint32 preconnect_key_ts;
+  guint64 num_preconnect_dropped;
   /* quicly recv buffer */
   gchar *recv_buf;
   gsize recv_buf_size;
@@ -80,6 +155,12 @@ struct _GstQuiclysink
 
   gboolean stream_mode;
   gboolean multi_stream_mode;
+  /* multi stream mode: one unidirectional stream per frame */
+  GQueue frame_streams;
+  quicly_stream_t *frame_stream; /* stream of the frame being written */
+  guint32 frame_stream_ts;
+  gint frame_stream_eos; /* the I/O thread closes the frame stream, see send_remaining_before_close */
+  guint64 num_frames_reset;
 
   quicly_feedback_t feedback;
   quicly_stats_t stats;
@@ -90,6 +171,58 @@ struct _GstQuiclysink
   GstClock *pipeline_clock;
   GstClockTime previousPts;
   gint drop_late;
+  guint max_latency; /* ms after the running time of a buffer until it is dropped, 0: use drop-late */
+  /* target bitrate of the media congestion controller (bit/s) */
+  guint64 target_bitrate;
+  guint64 min_bitrate;
+  guint64 max_bitrate;
+
+  /* fan-out: the rendered buffers are queued to all clients without copying */
+  guint max_clients;
+  guint client_queue_size;
+  GPtrArray *clients;
+  GMutex clients_lock;
+
+  /* I/O thread: owns the connections while running, woken up by the
+   * socket, by the quicly timer and by render */
+  gboolean io_thread;
+  GThread *io_thread_handle;
+  gint io_running;
+  int epoll_fd;
+  int event_fd;
+  int timer_fd;
+  GstQuiclysinkRing ring;
+  guint64 num_ring_dropped;
+
+  /* frame-aware dropping: RTP packets are tagged with the frame they
+   * belong to and its priority derived from the NAL unit types */
+  gboolean frame_drop;
+  gint frame_codec;
+  guint64 frame_id;
+  guint32 frame_rtp_ts;
+  gboolean frame_ended;
+
+  /* backpressure: applied to the rendered buffers once queue_threshold
+   * datagrams are waiting to be sent */
+  guint queue_threshold;
+  gint queue_policy;
+  gint dgram_pending; /* published by the sending thread */
+  gint flushing; /* set by unlock, releases a blocked render */
+  gboolean qos_active;
+  gint64 qos_window_start;
+  guint64 qos_window_bytes;
+  guint64 num_queue_dropped;
+  guint64 num_qos_events;
+
+  /* request pads: the flows are fixed while running, each datagram is
+   * prefixed by the id of its flow then (see gstquiclycontrol.h) */
+  GPtrArray *flows;
+  gboolean flow_framing;
+  guint8 flow_priority[GST_QUICLY_MAX_FLOWS];
+
+  guint8 ecn_tos; /* ECN codepoint currently set on the socket (IP_TOS) */
+  guint64 send_rate; /* bit/s, 0 if paced by the congestion controller */
+  guint send_burst;
 };
 
 struct _GstQuiclysinkClass
@@ -99,9 +232,14 @@ struct _GstQuiclysinkClass
   /* signals */
   void (*on_feedback_report) (GstQuiclysink *quiclysink, guint32 lrtt,
                              guint32 srtt, guint64 sent, guint64 lost);
+  void (*on_target_bitrate) (GstQuiclysink *quiclysink, guint64 bitrate);
+
+  /* actions */
+  GstStructure * (*get_client_stats) (GstQuiclysink *quiclysink, const gchar *host, gint port);
 };
 
 GType gst_quiclysink_get_type (void);
+GType gst_quiclysink_pad_get_type (void);
 
 G_END_DECLS
 
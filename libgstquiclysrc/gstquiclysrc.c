@@ -36,12 +36,19 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "quicly/defaults.h"
 #include "quicly/streambuf.h"
 #include "../deps/picotls/t/util.h"
 
 #include "gstquiclysrc.h"
+#include "../libgstquiclysink/gstquiclycontrol.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_quiclysrc_debug_category);
 #define GST_CAT_DEFAULT gst_quiclysrc_debug_category
@@ -79,6 +86,7 @@ static gboolean gst_quiclysrc_start (GstBaseSrc * src);
 static gboolean gst_quiclysrc_stop (GstBaseSrc * src);
 static gboolean gst_quiclysrc_unlock (GstBaseSrc * src);
 static gboolean gst_quiclysrc_unlock_stop (GstBaseSrc * src);
+static gboolean gst_quiclysrc_event (GstBaseSrc * src, GstEvent * event);
 static gboolean gst_quiclysrc_decide_allocation (GstBaseSrc * bsrc, GstQuery * query);
 static gboolean gst_quiclysrc_set_clock(GstQuiclysrc *quiclysrc, GstClock *clock);
 gboolean send_async_ack_cb(GstClock *clock, GstClockTime t, GstClockID id, gpointer data);
@@ -86,13 +94,33 @@ gboolean send_async_ack_cb(GstClock *clock, GstClockTime t, GstClockID id, gpoin
 // buffer list
 static GstFlowReturn gst_quiclysrc_create(GstPushSrc *src, GstBuffer **buf);
 static gboolean gst_quiclysrc_negotiate(GstBaseSrc *basesrc);
-static gboolean gst_quiclysrc_free_buffer_list_mem(GstQuiclysrc *src);
-static gboolean gst_quiclysrc_realloc_mem_sizes(GstQuiclysrc *src);
-//static gboolean gst_quiclysrc_alloc_mem(GstQuiclysrc *src, GstMemory **pmem, GstMapInfo *map);
+static GstBufferPool *gst_quiclysrc_new_pool(GstQuiclysrc *src, GstCaps *caps, GstAllocator *allocator,
+                                             GstAllocationParams *params);
+static void gst_quiclysrc_release_slots(GstQuiclysrc *src);
+static void gst_quiclysrc_set_pool(GstQuiclysrc *src, GstBufferPool *pool);
+static gboolean gst_quiclysrc_ensure_pool(GstQuiclysrc *src);
 static gboolean gst_quiclysrc_ensure_mem(GstQuiclysrc *src);
+static gboolean receive_full(GstQuiclysrc *quiclysrc);
+static gboolean store_packet(GstQuiclysrc *quiclysrc, const void *data, gsize len);
+static void drain_pending(GstQuiclysrc *quiclysrc);
+static GstFlowReturn take_received(GstQuiclysrc *quiclysrc, GstBuffer **buf);
+static void apply_pending_caps(GstQuiclysrc *quiclysrc);
+static void add_arrival_meta(GstQuiclysrc *quiclysrc, GstBuffer *buffer);
+static void record_latency(GstQuiclysrc *quiclysrc, GstBuffer *buffer, GstClockTime now);
+static void update_jitter(GstQuiclysrc *quiclysrc, const guint8 *rtp, gsize len);
+static guint64 jitter_to_time(GstQuiclysrc *quiclysrc, guint64 jitter);
+
+/* receive thread */
+static gboolean start_receive_thread(GstQuiclysrc *quiclysrc);
+static void stop_receive_thread(GstQuiclysrc *quiclysrc);
+static gpointer receive_thread_func(gpointer data);
+static void wake_receive_thread(GstQuiclysrc *quiclysrc);
+static void signal_received(GstQuiclysrc *quiclysrc);
 
 /* quicly prototypes */
 static int save_ticket_cb(ptls_save_ticket_t *_self, ptls_t *tls, ptls_iovec_t src);
+static void save_session(GstQuiclysrc *quiclysrc);
+static gboolean load_session(GstQuiclysrc *quiclysrc);
 static void on_closed_by_peer(quicly_closed_by_peer_t *self, quicly_conn_t *conn, int err, uint64_t frame_type, const char *reason,
                               size_t reason_len);
 static int on_dgram_open(quicly_dgram_open_t *self, quicly_dgram_t *dgram);
@@ -101,15 +129,27 @@ static int on_stop_sending(quicly_stream_t *stream, int err);
 static int on_receive_dgram(quicly_dgram_t *dgram, const void *src, size_t len);
 static int on_receive_stream(quicly_stream_t *stream, size_t off, const void *src, size_t len);
 static int on_receive_reset(quicly_stream_t *stream, int err);
+static void receive_frame_stream(GstQuiclysrc *quiclysrc, quicly_stream_t *stream);
 static int send_pending(GstQuiclysrc *quiclysrc);
+static void flush_control(GstQuiclysrc *quiclysrc);
+static void ack_caps_receive(GstQuiclysrc *quiclysrc);
+static void request_key_frame(GstQuiclysrc *quiclysrc);
 static int receive_packet(GstQuiclysrc *quiclysrc, GError *err);
+static gssize receive_with_cmsg(GSocket *socket, gchar *buf, gsize size, struct sockaddr_in *sa, guint8 *ecn,
+                                GstClockTime *arrival);
 static GstStructure *gst_quiclysrc_create_stats(GstQuiclysrc *quiclysrc);
 
-/* TODO: do something with that, needs to be a property */
-static const char *session_file = NULL;
+/* request pads */
+static GstPad *gst_quiclysrc_request_new_pad(GstElement *element, GstPadTemplate *templ, const gchar *name,
+                                             const GstCaps *caps);
+static void gst_quiclysrc_release_pad(GstElement *element, GstPad *pad);
+static gboolean gst_quiclysrc_flow_query(GstPad *pad, GstObject *parent, GstQuery *query);
+static GstQuiclysrcPad *find_flow(GstQuiclysrc *quiclysrc, guint flow);
+static void receive_flow(GstQuiclysrc *quiclysrc, guint flow, const void *data, gsize len);
+static void push_flows(GstQuiclysrc *quiclysrc);
+static void push_flows_eos(GstQuiclysrc *quiclysrc);
 
 /* quicly callbacks */
-static ptls_save_ticket_t save_ticket = {save_ticket_cb};
 static quicly_dgram_open_t dgram_open = {&on_dgram_open};
 static quicly_stream_open_t stream_open = {&on_stream_open};
 static quicly_closed_by_peer_t closed_by_peer = {&on_closed_by_peer};
@@ -133,8 +173,15 @@ static const quicly_dgram_callbacks_t dgram_callbacks = {quicly_dgrambuf_destroy
 #define QUICLY_DEFAULT_MTU    1280
 #define DEFAULT_HOST          "127.0.0.1"
 #define DEFAULT_PORT          5000
+#define DEFAULT_SESSION_FILE  NULL
 #define MAX_BUFFER_LIST_SIZE  100
+#define MAX_FRAME_STREAMS     100 /* concurrent per-frame streams the sink may open */
 #define SEND_CLOCK_TIME_NS    2000000
+#define RECEIVE_TIMEOUT_US    6000000 /* end of stream if nothing arrives for this long */
+#define DEFAULT_RECEIVE_THREAD FALSE
+#define RECEIVE_RING_SIZE     1024 /* power of two */
+#define FLOW_QUEUE_SIZE       256 /* packets per request pad until the streaming thread pushes them */
+#define FRAME_QUEUE_SIZE      1024 /* packets of per-frame streams that did not fit into the buffer list */
 
 enum
 {
@@ -145,7 +192,9 @@ enum
   PROP_PORT,
   PROP_CAPS,
   PROP_QUICLY_MTU,
-  PROP_STATS
+  PROP_STATS,
+  PROP_SESSION_FILE,
+  PROP_RECEIVE_THREAD
 };
 
 /* rtp header */
@@ -167,6 +216,9 @@ typedef struct {
     uint32_t ssrc;
 } rtp_hdr_;
 
+/* reference of the arrival timestamps, see add_arrival_meta */
+static GstCaps *arrival_ts_caps;
+
 /* pad templates */
 
 static GstStaticPadTemplate gst_quiclysrc_src_template =
@@ -175,6 +227,94 @@ GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS_ANY);
 
+static GstStaticPadTemplate gst_quiclysrc_flow_template =
+GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS_ANY);
+
+/* request pad properties */
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_CAPS
+};
+
+G_DEFINE_TYPE (GstQuiclysrcPad, gst_quiclysrc_pad, GST_TYPE_PAD);
+
+static void
+gst_quiclysrc_pad_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstQuiclysrcPad *pad = GST_QUICLYSRC_PAD (object);
+
+  switch (property_id) {
+    case PROP_PAD_CAPS:
+      GST_OBJECT_LOCK(pad);
+      gst_caps_replace(&pad->caps, gst_value_get_caps(value));
+      GST_OBJECT_UNLOCK(pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_quiclysrc_pad_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstQuiclysrcPad *pad = GST_QUICLYSRC_PAD (object);
+
+  switch (property_id) {
+    case PROP_PAD_CAPS:
+      GST_OBJECT_LOCK(pad);
+      gst_value_set_caps(value, pad->caps);
+      GST_OBJECT_UNLOCK(pad);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_quiclysrc_pad_finalize (GObject * object)
+{
+  GstQuiclysrcPad *pad = GST_QUICLYSRC_PAD (object);
+
+  gst_caps_replace(&pad->caps, NULL);
+  g_queue_clear_full(&pad->pending, (GDestroyNotify)gst_buffer_unref);
+
+  G_OBJECT_CLASS (gst_quiclysrc_pad_parent_class)->finalize (object);
+}
+
+static void
+gst_quiclysrc_pad_class_init (GstQuiclysrcPadClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *)klass;
+
+  gobject_class->set_property = gst_quiclysrc_pad_set_property;
+  gobject_class->get_property = gst_quiclysrc_pad_get_property;
+  gobject_class->finalize = gst_quiclysrc_pad_finalize;
+
+  g_object_class_install_property(gobject_class, PROP_PAD_CAPS,
+                                  g_param_spec_boxed("caps", "Caps",
+                                  "The caps of the flow, they are not exchanged with the sink",
+                                  GST_TYPE_CAPS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_quiclysrc_pad_init (GstQuiclysrcPad * pad)
+{
+  pad->flow = 0;
+  pad->caps = NULL;
+  g_queue_init(&pad->pending);
+  pad->need_events = TRUE;
+  pad->num_packets = 0;
+  pad->num_dropped = 0;
+}
+
 
 /* class initialization */
 
@@ -188,12 +328,17 @@ gst_quiclysrc_class_init (GstQuiclysrcClass * klass)
   GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstBaseSrcClass *base_src_class = GST_BASE_SRC_CLASS (klass);
   GstPushSrcClass *push_src_class = (GstPushSrcClass *) klass;
-  //GstElementClass *gstelement_class = (GstElementClass *) klass;
+  GstElementClass *gstelement_class = (GstElementClass *) klass;
 
   /* Setting up pads and setting metadata should be moved to
      base_class_init if you intend to subclass this class. */
   gst_element_class_add_pad_template (GST_ELEMENT_CLASS(klass),
       gst_static_pad_template_get (&gst_quiclysrc_src_template));
+  gst_element_class_add_static_pad_template_with_gtype (GST_ELEMENT_CLASS(klass),
+      &gst_quiclysrc_flow_template, GST_TYPE_QUICLYSRC_PAD);
+
+  arrival_ts_caps = gst_caps_new_empty_simple("timestamp/x-unix");
+  GST_MINI_OBJECT_FLAG_SET(arrival_ts_caps, GST_MINI_OBJECT_FLAG_MAY_BE_LEAKED);
 
   gst_element_class_set_static_metadata (GST_ELEMENT_CLASS(klass),
       "Quic client source plugin", "Source/Network", "Connects to a quic server and receives packets",
@@ -209,11 +354,15 @@ gst_quiclysrc_class_init (GstQuiclysrcClass * klass)
   base_src_class->stop = GST_DEBUG_FUNCPTR (gst_quiclysrc_stop);
   base_src_class->unlock = GST_DEBUG_FUNCPTR (gst_quiclysrc_unlock);
   base_src_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_quiclysrc_unlock_stop);
+  base_src_class->event = GST_DEBUG_FUNCPTR (gst_quiclysrc_event);
 
   /* buffer list */
   push_src_class->create = GST_DEBUG_FUNCPTR (gst_quiclysrc_create);
   base_src_class->negotiate = GST_DEBUG_FUNCPTR (gst_quiclysrc_negotiate);
 
+  gstelement_class->request_new_pad = GST_DEBUG_FUNCPTR (gst_quiclysrc_request_new_pad);
+  gstelement_class->release_pad = GST_DEBUG_FUNCPTR (gst_quiclysrc_release_pad);
+
   g_object_class_install_property(gobject_class, PROP_HOST,
                                   g_param_spec_string("host", 
                                   "Host", 
@@ -245,6 +394,14 @@ gst_quiclysrc_class_init (GstQuiclysrcClass * klass)
   g_object_class_install_property(gobject_class, PROP_STATS,
           g_param_spec_boxed("stats", "Statistics", "Various Statistics",
           GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_SESSION_FILE,
+          g_param_spec_string("session-file", "Session File",
+          "File to load and store the session ticket, transport parameters and caps in, for resuming with 0-RTT",
+          DEFAULT_SESSION_FILE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property(gobject_class, PROP_RECEIVE_THREAD,
+          g_param_spec_boolean("receive-thread", "Receive Thread",
+          "Read the socket and send the ACKs on a dedicated thread, independent of downstream blocking; create only takes the received buffers",
+          DEFAULT_RECEIVE_THREAD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -272,16 +429,22 @@ gst_quiclysrc_init (GstQuiclysrc *quiclysrc)
   quiclysrc->tlsctx.key_exchanges = quiclysrc->key_exchanges;
   quiclysrc->tlsctx.cipher_suites = ptls_openssl_cipher_suites;
   quiclysrc->tlsctx.require_dhe_on_psk = 1;
-  quiclysrc->tlsctx.save_ticket = &save_ticket;
 
   quiclysrc->ctx = quicly_spec_context;
   quiclysrc->ctx.tls = &quiclysrc->tlsctx;
   quiclysrc->ctx.stream_open = &stream_open;
   quiclysrc->ctx.dgram_open = &dgram_open;
   quiclysrc->ctx.closed_by_peer = &closed_by_peer;
+  /* the sink may send each frame on its own unidirectional stream */
+  quiclysrc->ctx.transport_params.max_streams_uni = MAX_FRAME_STREAMS;
 
   setup_session_cache(quiclysrc->ctx.tls);
   quicly_amend_ptls_context(quiclysrc->ctx.tls);
+  /* set after the session cache, so that the ticket ends up in session-file */
+  quiclysrc->save_ticket.cb = save_ticket_cb;
+  quiclysrc->tlsctx.save_ticket = &quiclysrc->save_ticket;
+  quiclysrc->session_file = g_strdup(DEFAULT_SESSION_FILE);
+  quiclysrc->session_ticket = ptls_iovec_init(NULL, 0);
 
   /* key exchange */
   quiclysrc->key_exchanges[0] = &ptls_openssl_secp256r1;
@@ -289,6 +452,12 @@ gst_quiclysrc_init (GstQuiclysrc *quiclysrc)
   quiclysrc->conn = NULL;
   quiclysrc->dgram = NULL;
   quiclysrc->stream = NULL;
+  quiclysrc->control_stream = NULL;
+  quiclysrc->key_frame_requested = FALSE;
+  quiclysrc->num_key_frame_requests = 0;
+  g_queue_init(&quiclysrc->frame_packets);
+  quiclysrc->num_frames_reset = 0;
+  quiclysrc->num_frame_packets_dropped = 0;
   /* -------- end context init --------------*/
 
   quiclysrc->num_packets = 0;
@@ -299,22 +468,33 @@ gst_quiclysrc_init (GstQuiclysrc *quiclysrc)
   quiclysrc->recv_buf = malloc(sizeof(gchar) * (2048 + 1));
   quiclysrc->recv_buf_size = 2048;
 
-  /* init mem alloc for buffer list */
-  quiclysrc->mem_list = NULL;
-  quiclysrc->map_list = NULL;
-  quiclysrc->vec_list = NULL;
-  quiclysrc->pushed_list = NULL;
-  quiclysrc->mem_list_allocated = FALSE;
-  quiclysrc->mem_list_size = MAX_BUFFER_LIST_SIZE;
-  quiclysrc->allocator = NULL;
-  gst_allocation_params_init(&quiclysrc->params);
-  gst_quiclysrc_realloc_mem_sizes(quiclysrc);
-
-  quiclysrc->jitter = 0;
-  quiclysrc->prev_arrival_time = 0;
+  /* buffer list, the pool is set up by negotiation */
+  quiclysrc->pool = NULL;
+  quiclysrc->batch_size = MAX_BUFFER_LIST_SIZE;
+  quiclysrc->slots = g_new0(GstQuiclysrcSlot, quiclysrc->batch_size);
+
+  quiclysrc->receive_thread = DEFAULT_RECEIVE_THREAD;
+  quiclysrc->receive_thread_handle = NULL;
+  quiclysrc->receive_running = FALSE;
+  quiclysrc->event_fd = -1;
+  quiclysrc->caps_pending = FALSE;
+  quiclysrc->num_ring_dropped = 0;
+  g_mutex_init(&quiclysrc->ring_lock);
+  g_cond_init(&quiclysrc->ring_cond);
+
+  quiclysrc->arrival_time = 0;
+  quiclysrc->jitter_caps = NULL;
+  quiclysrc->clock_rate = 0;
+  quiclysrc->have_transit = FALSE;
   quiclysrc->prev_transit = 0;
+  quiclysrc->jitter = 0;
   quiclysrc->max_jitter = 0;
   quiclysrc->num_jitter_spikes = 0;
+  memset(quiclysrc->latency_histogram, 0, sizeof(quiclysrc->latency_histogram));
+
+  quiclysrc->flows = g_ptr_array_new();
+  quiclysrc->flow_framing = FALSE;
+  quiclysrc->flows_pending = 0;
 }
 
 void
@@ -371,6 +551,13 @@ gst_quiclysrc_set_property (GObject * object, guint property_id,
       gst_pad_mark_reconfigure(GST_BASE_SRC_PAD(quiclysrc));
       break;
     }
+    case PROP_SESSION_FILE:
+      g_free(quiclysrc->session_file);
+      quiclysrc->session_file = g_value_dup_string(value);
+      break;
+    case PROP_RECEIVE_THREAD:
+      quiclysrc->receive_thread = g_value_get_boolean(value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -409,6 +596,12 @@ gst_quiclysrc_get_property (GObject * object, guint property_id,
     case PROP_STATS:
       g_value_take_boxed(value, gst_quiclysrc_create_stats(quiclysrc));
       break;
+    case PROP_SESSION_FILE:
+      g_value_set_string(value, quiclysrc->session_file);
+      break;
+    case PROP_RECEIVE_THREAD:
+      g_value_set_boolean(value, quiclysrc->receive_thread);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -431,9 +624,12 @@ gst_quiclysrc_finalize (GObject * object)
   if (quiclysrc->socket)
     g_object_unref(quiclysrc->socket);
 
+  g_queue_clear_full(&quiclysrc->frame_packets, (GDestroyNotify)g_bytes_unref);
+
   if (quiclysrc->caps)
     gst_caps_unref(quiclysrc->caps);
   quiclysrc->caps = NULL;
+  gst_caps_replace(&quiclysrc->jitter_caps, NULL);
 
   g_free(quiclysrc->host);
   quiclysrc->host = NULL;
@@ -441,6 +637,11 @@ gst_quiclysrc_finalize (GObject * object)
   g_free(quiclysrc->bind_addr);
   quiclysrc->bind_addr = NULL;
 
+  g_free(quiclysrc->session_file);
+  quiclysrc->session_file = NULL;
+  free(quiclysrc->session_ticket.base);
+  quiclysrc->session_ticket = ptls_iovec_init(NULL, 0);
+
   if (quiclysrc->conn != NULL)
     free(quiclysrc->conn);
   quiclysrc->conn = NULL;
@@ -452,7 +653,13 @@ gst_quiclysrc_finalize (GObject * object)
   g_free(quiclysrc->recv_buf);
   quiclysrc->recv_buf = NULL;
 
-  gst_quiclysrc_free_buffer_list_mem(quiclysrc);
+  gst_quiclysrc_set_pool(quiclysrc, NULL);
+  g_free(quiclysrc->slots);
+  quiclysrc->slots = NULL;
+  g_mutex_clear(&quiclysrc->ring_lock);
+  g_cond_clear(&quiclysrc->ring_cond);
+  /* the pads themselves are owned by the element */
+  g_ptr_array_free(quiclysrc->flows, TRUE);
 
   G_OBJECT_CLASS (gst_quiclysrc_parent_class)->finalize (object);
 }
@@ -495,6 +702,14 @@ gst_quiclysrc_start (GstBaseSrc * src)
 
   GST_DEBUG_OBJECT (quiclysrc, "start");
 
+  /* request pads: the datagrams carry the id of their flow, see gstquiclycontrol.h */
+  GST_OBJECT_LOCK(quiclysrc);
+  quiclysrc->flow_framing = quiclysrc->flows->len > 0;
+  for (guint i = 0; i < quiclysrc->flows->len; i++)
+    GST_QUICLYSRC_PAD(g_ptr_array_index(quiclysrc->flows, i))->need_events = TRUE;
+  quiclysrc->flows_pending = 0;
+  GST_OBJECT_UNLOCK(quiclysrc);
+
   gst_quiclysrc_create_cancellable(quiclysrc);
 
   GError *err = NULL;
@@ -532,6 +747,16 @@ gst_quiclysrc_start (GstBaseSrc * src)
   }
   g_object_unref(bind_addr_t);
 
+  /* receive the TOS byte of incoming packets, so that the ECN counts can be reported to the peer */
+  {
+    int on = 1;
+    if (setsockopt(g_socket_get_fd(quiclysrc->socket), IPPROTO_IP, IP_RECVTOS, &on, sizeof(on)) != 0)
+      g_printerr("Failed to set IP_RECVTOS: %s\n", g_strerror(errno));
+    /* and the time the kernel received them, for the arrival timestamps and the jitter */
+    if (setsockopt(g_socket_get_fd(quiclysrc->socket), SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0)
+      g_printerr("Failed to set SO_TIMESTAMPNS: %s\n", g_strerror(errno));
+  }
+
     /* convert to native for quicly_connect */
   gssize len = g_socket_address_get_native_size(quiclysrc->dst_addr);
   struct sockaddr native_sa;
@@ -548,6 +773,8 @@ gst_quiclysrc_start (GstBaseSrc * src)
   int64_t wait = 0;
   err = NULL;
   int ret;
+  guint8 framing;
+  gboolean resumed = load_session(quiclysrc);
 
   if ((ret = quicly_connect(&quiclysrc->conn, &quiclysrc->ctx,
                             quiclysrc->host,
@@ -561,6 +788,27 @@ gst_quiclysrc_start (GstBaseSrc * src)
     return FALSE;
   }
   ++quiclysrc->next_cid.master_id;
+  /* set application context early, the server may send 0.5-RTT data along with its handshake */
+  quicly_set_data(quiclysrc->conn, (void*) quiclysrc);
+
+  /* the control stream is the first bidirectional stream, it stays open for the lifetime of the connection */
+  if ((ret = quicly_open_stream(quiclysrc->conn, &quiclysrc->control_stream, 0)) != 0) {
+    g_printerr("Could not open control stream\n");
+    return FALSE;
+  }
+  assert(quiclysrc->control_stream->stream_id == GST_QUICLY_CONTROL_STREAM_ID);
+  framing = quiclysrc->flow_framing;
+  gst_quicly_control_write(quiclysrc->control_stream, GST_QUICLY_CONTROL_FLOWS, &framing, sizeof(framing));
+
+  /* The application space exists right after connect if 0-RTT keys are available. In that case the caps of the previous
+   * session are acked in early data, so that the server can start sending immediately instead of waiting for the round trip
+   * of the caps exchange. If the server sends different caps, they are applied when received. */
+  if (resumed && quicly_connection_is_ready(quiclysrc->conn) && quiclysrc->caps != NULL) {
+    GST_INFO_OBJECT(quiclysrc, "Resuming with 0-RTT, caps: %" GST_PTR_FORMAT, quiclysrc->caps);
+    ack_caps_receive(quiclysrc);
+  } else {
+    gst_quicly_control_write(quiclysrc->control_stream, GST_QUICLY_CONTROL_CAPS_REQUEST, NULL, 0);
+  }
 
   if ((ret = send_pending(quiclysrc)) != 0)
     g_printerr("Could not send inital packets.\n");
@@ -577,7 +825,10 @@ gst_quiclysrc_start (GstBaseSrc * src)
       }
     }
     if (g_socket_condition_timed_wait(quiclysrc->socket, G_IO_IN, wait, NULL, &err)) {
-      if (receive_packet(quiclysrc, err) != 0) {
+      GST_OBJECT_LOCK(quiclysrc);
+      ret = receive_packet(quiclysrc, err);
+      GST_OBJECT_UNLOCK(quiclysrc);
+      if (ret != 0) {
         g_printerr("Error in receive_packet\n");
       }
     }
@@ -591,41 +842,89 @@ gst_quiclysrc_start (GstBaseSrc * src)
       }
     }
   }
-  /* Schedule async callback to send acks */
-  GstClock *clock = gst_system_clock_obtain();
-  if (!gst_quiclysrc_set_clock(quiclysrc, clock))
-    return FALSE;
-  gst_object_unref(clock);
-
   /* set connected, for the on_receive functions */
   quiclysrc->connected = TRUE;
-  /* set application context */
-  quicly_set_data(quiclysrc->conn, (void*) quiclysrc);
+
+  if (quiclysrc->receive_thread) {
+    /* the thread sends the ACKs as well */
+    if (!start_receive_thread(quiclysrc))
+      return FALSE;
+  } else {
+    /* Schedule async callback to send acks */
+    GstClock *clock = gst_system_clock_obtain();
+    if (!gst_quiclysrc_set_clock(quiclysrc, clock))
+      return FALSE;
+    gst_object_unref(clock);
+  }
 
   g_print("Done\n");
   return TRUE;
 }
 
-static int receive_packet(GstQuiclysrc *quiclysrc, GError *err)
+/*
+ * Receive a datagram along with its ECN codepoint and the time the
+ * kernel received it. The time is taken here if the kernel does not
+ * report it
+ */
+static gssize receive_with_cmsg(GSocket *socket, gchar *buf, gsize size, struct sockaddr_in *sa, guint8 *ecn,
+                                GstClockTime *arrival)
 {
+  struct iovec vec = {buf, size};
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct timespec))];
+  } cmsgbuf;
+  struct msghdr mess;
+  struct cmsghdr *cmsg;
   gssize rret;
-  size_t off, plen;
-  GSocketAddress *in_addr;
-  struct sockaddr native_sa;
 
-  if ((rret = g_socket_receive_from(quiclysrc->socket, &in_addr, 
-                                    quiclysrc->recv_buf,
-                                    quiclysrc->recv_buf_size,
-                                    quiclysrc->cancellable,
-                                    &err)) < 0) {
-    g_printerr("Error receiving from socket: %s\n", err->message);
+  memset(&mess, 0, sizeof(mess));
+  mess.msg_name = sa;
+  mess.msg_namelen = sizeof(*sa);
+  mess.msg_iov = &vec;
+  mess.msg_iovlen = 1;
+  mess.msg_control = &cmsgbuf;
+  mess.msg_controllen = sizeof(cmsgbuf);
+
+  /* GSocket does not deliver unknown control messages, hence recvmsg on the underlying fd */
+  while ((rret = recvmsg(g_socket_get_fd(socket), &mess, 0)) == -1 && errno == EINTR)
+    ;
+  if (rret < 0)
     return -1;
+
+  *ecn = QUICLY_ECN_NOT_ECT;
+  *arrival = GST_CLOCK_TIME_NONE;
+  for (cmsg = CMSG_FIRSTHDR(&mess); cmsg != NULL; cmsg = CMSG_NXTHDR(&mess, cmsg)) {
+#ifdef IP_RECVTOS
+    if (cmsg->cmsg_level == IPPROTO_IP && (cmsg->cmsg_type == IP_TOS || cmsg->cmsg_type == IP_RECVTOS))
+      *ecn = *(unsigned char *)CMSG_DATA(cmsg) & 0x3;
+#endif
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+      struct timespec ts;
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+      *arrival = GST_TIMESPEC_TO_TIME(ts);
+    }
   }
-  /* TODO: maybe use recvfrom directly instead of the g_socket variant? */
-  gssize len = g_socket_address_get_native_size(in_addr);
-  if (!g_socket_address_to_native(in_addr, &native_sa, len, &err)) {
-    g_printerr("Could not convert GSocketAddress to native. Error: %s\n", err->message);
-    g_object_unref(in_addr);
+  if (*arrival == GST_CLOCK_TIME_NONE)
+    *arrival = g_get_real_time() * GST_USECOND;
+  return rret;
+}
+
+/* Called with the object lock held */
+static int receive_packet(GstQuiclysrc *quiclysrc, GError *err)
+{
+  gssize rret;
+  size_t off, plen;
+  struct sockaddr_in native_sa;
+  guint8 ecn;
+
+  if ((rret = receive_with_cmsg(quiclysrc->socket,
+                                quiclysrc->recv_buf,
+                                quiclysrc->recv_buf_size,
+                                &native_sa,
+                                &ecn,
+                                &quiclysrc->arrival_time)) < 0) {
+    g_printerr("Error receiving from socket: %s\n", g_strerror(errno));
     return -1;
   }
   off = 0;
@@ -636,12 +935,10 @@ static int receive_packet(GstQuiclysrc *quiclysrc, GError *err)
                                 rret - off);
     if (plen == SIZE_MAX)
       break;
-    GST_OBJECT_LOCK(quiclysrc);
-    quicly_receive(quiclysrc->conn, NULL, &native_sa, &packet);
-    GST_OBJECT_UNLOCK(quiclysrc);
+    packet.ecn = ecn;
+    quicly_receive(quiclysrc->conn, NULL, (struct sockaddr *)&native_sa, &packet);
     off += plen;
   }
-  g_object_unref(in_addr);
 
   return 0;
 }
@@ -657,8 +954,10 @@ static int send_pending(GstQuiclysrc *quiclysrc) {
   do {
     num_packets = sizeof(packets) / sizeof(packets[0]);
     if ((ret = quicly_send(quiclysrc->conn, packets, &num_packets)) == 0) {
-      /* TODO: unnecessary? */
+      /* always the peer address that quicly is using */
       if (num_packets > 0) {
+        if (addr)
+          g_object_unref(addr);
         addr = g_socket_address_new_from_native(&packets[0]->dest.sa,
                                                  quicly_get_socklen(&packets[0]->dest.sa));
         if (!addr) {
@@ -703,9 +1002,40 @@ static GstStructure *gst_quiclysrc_create_stats(GstQuiclysrc *quiclysrc)
       "rtt-latest", G_TYPE_UINT, stats.rtt.latest,
       "rtt-minimum", G_TYPE_UINT, stats.rtt.minimum,
       "rtt-variance", G_TYPE_UINT, stats.rtt.variance,
-      "jitter", G_TYPE_UINT64, quiclysrc->jitter, 
-      "jitter-spikes", G_TYPE_UINT, quiclysrc->num_jitter_spikes, NULL);
+      "jitter", G_TYPE_UINT64, jitter_to_time(quiclysrc, quiclysrc->jitter),
+      "jitter-max", G_TYPE_UINT64, jitter_to_time(quiclysrc, quiclysrc->max_jitter),
+      "jitter-spikes", G_TYPE_UINT, quiclysrc->num_jitter_spikes,
+      "frames-reset", G_TYPE_UINT64, quiclysrc->num_frames_reset,
+      "frame-packets-dropped", G_TYPE_UINT64, quiclysrc->num_frame_packets_dropped,
+      "key-frame-requests", G_TYPE_UINT64, quiclysrc->num_key_frame_requests, NULL);
+  if (quiclysrc->receive_thread)
+    gst_structure_set(s, "receive-queue-dropped", G_TYPE_UINT64, quiclysrc->num_ring_dropped, NULL);
+  if (quiclysrc->flow_framing) {
+    GValue flows = G_VALUE_INIT, flow = G_VALUE_INIT;
+    g_value_init(&flows, GST_TYPE_ARRAY);
+    for (guint i = 0; i < quiclysrc->flows->len; i++) {
+      GstQuiclysrcPad *pad = g_ptr_array_index(quiclysrc->flows, i);
+      g_value_init(&flow, GST_TYPE_STRUCTURE);
+      g_value_take_boxed(&flow, gst_structure_new("flow",
+          "id", G_TYPE_UINT, pad->flow,
+          "packets-received", G_TYPE_UINT64, pad->num_packets,
+          "dropped", G_TYPE_UINT64, pad->num_dropped, NULL));
+      gst_value_array_append_and_take_value(&flows, &flow);
+    }
+    gst_structure_take_value(s, "flows", &flows);
+  }
   GST_OBJECT_UNLOCK(quiclysrc);
+
+  /* bucket i: latency below 2^i us, see latency_histogram */
+  GValue histogram = G_VALUE_INIT, count = G_VALUE_INIT;
+  g_value_init(&histogram, GST_TYPE_ARRAY);
+  g_value_init(&count, G_TYPE_UINT64);
+  for (guint i = 0; i < GST_QUICLYSRC_LATENCY_BUCKETS; i++) {
+    g_value_set_uint64(&count, quiclysrc->latency_histogram[i]);
+    gst_value_array_append_value(&histogram, &count);
+  }
+  gst_structure_take_value(s, "latency-histogram", &histogram);
+  g_value_unset(&count);
   return s;
 }
 
@@ -717,7 +1047,18 @@ gst_quiclysrc_stop (GstBaseSrc * src)
   GST_DEBUG_OBJECT(quiclysrc, "Stop. Packets received: %lu. Kilobytes received: %lu\n.", 
           quiclysrc->num_packets, quiclysrc->num_bytes / 1000);
   
+  stop_receive_thread(quiclysrc);
   gst_quiclysrc_free_cancellable(quiclysrc);
+  gst_quiclysrc_set_pool(quiclysrc, NULL);
+
+  GST_OBJECT_LOCK(quiclysrc);
+  for (guint i = 0; i < quiclysrc->flows->len; i++) {
+    GstQuiclysrcPad *pad = g_ptr_array_index(quiclysrc->flows, i);
+    g_queue_clear_full(&pad->pending, (GDestroyNotify)gst_buffer_unref);
+    g_queue_init(&pad->pending);
+  }
+  quiclysrc->flows_pending = 0;
+  GST_OBJECT_UNLOCK(quiclysrc);
 
   return TRUE;
 }
@@ -731,10 +1072,29 @@ gst_quiclysrc_unlock (GstBaseSrc * src)
 
   GST_DEBUG_OBJECT (quiclysrc, "unlock");
   g_cancellable_cancel (quiclysrc->cancellable);
+  /* create may be waiting for the receive thread */
+  signal_received (quiclysrc);
 
   return TRUE;
 }
 
+/*
+ * Key frame requests of downstream, e.g. of a depayloader that lost
+ * packets, are sent to the server from the streaming thread
+ */
+static gboolean
+gst_quiclysrc_event (GstBaseSrc * src, GstEvent * event)
+{
+  GstQuiclysrc *quiclysrc = GST_QUICLYSRC (src);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_UPSTREAM && gst_event_has_name (event, "GstForceKeyUnit")) {
+    if (quiclysrc->control_stream != NULL)
+      g_atomic_int_set (&quiclysrc->key_frame_requested, TRUE);
+    return TRUE;
+  }
+  return GST_BASE_SRC_CLASS (gst_quiclysrc_parent_class)->event (src, event);
+}
+
 /* Clear any pending unlock request, as we succeeded in unlocking */
 static gboolean
 gst_quiclysrc_unlock_stop (GstBaseSrc * src)
@@ -749,134 +1109,345 @@ gst_quiclysrc_unlock_stop (GstBaseSrc * src)
   return TRUE;
 }
 
-static void gst_quiclysrc_reset_memory_allocator(GstQuiclysrc *src)
+/*
+ * Unmap the buffers of the batch and hand them back to their pool
+ */
+static void gst_quiclysrc_release_slots(GstQuiclysrc *src)
 {
-  if (src->mem_list != NULL) {
-    for (int i = 0; i < src->mem_list_size; i++) {
-      if (src->mem_list[i] != NULL) {
-        gst_memory_unmap(src->mem_list[i], src->map_list[i]);
-        gst_memory_unref(src->mem_list[i]);
-        src->mem_list[i] = NULL;
-      }
-      src->vec_list[i]->buffer = NULL;
-      src->vec_list[i]->size = 0;
+  if (src->slots == NULL)
+    return;
+  for (gsize i = 0; i < src->batch_size; i++) {
+    GstQuiclysrcSlot *slot = &src->slots[i];
+    if (slot->buffer != NULL) {
+      gst_buffer_unmap(slot->buffer, &slot->map);
+      gst_buffer_unref(slot->buffer);
+      slot->buffer = NULL;
     }
+    slot->len = 0;
   }
+  src->pushed = 0;
+}
+
+/*
+ * Replace the pool the received packets are copied into. The receive
+ * thread acquires from it with the object lock held
+ */
+static void gst_quiclysrc_set_pool(GstQuiclysrc *src, GstBufferPool *pool)
+{
+  GstBufferPool *old;
+
+  gst_quiclysrc_release_slots(src);
+  GST_OBJECT_LOCK(src);
+  old = src->pool;
+  src->pool = pool;
+  GST_OBJECT_UNLOCK(src);
 
-  if (src->allocator != NULL) {
-    gst_object_unref(src->allocator);
-    src->allocator = NULL;
+  if (old != NULL) {
+    gst_buffer_pool_set_active(old, FALSE);
+    gst_object_unref(old);
   }
 }
 
+/*
+ * Pick up the pool chosen in decide_allocation. The buffers still held
+ * from the previous pool are returned to it
+ */
 static gboolean gst_quiclysrc_negotiate(GstBaseSrc *basesrc)
 {
   GstQuiclysrc *src = GST_QUICLYSRC_CAST(basesrc);
+  GstBufferPool *pool;
   gboolean ret;
 
   ret = GST_BASE_SRC_CLASS(gst_quiclysrc_parent_class)->negotiate(basesrc);
 
-  if (ret) {
-    GstAllocationParams new_params;
-    GstAllocator *new_allocator = NULL;
+  if (ret && (pool = gst_base_src_get_buffer_pool(basesrc)) != NULL) {
+    if (pool != src->pool) {
+      gst_quiclysrc_set_pool(src, pool);
+      GST_INFO_OBJECT(src, "new buffer pool %" GST_PTR_FORMAT, pool);
+    } else {
+      gst_object_unref(pool);
+    }
+  }
 
-    gst_base_src_get_allocator(basesrc, &new_allocator, &new_params);
-    if (new_allocator == NULL)
+  return ret;
+}
 
-    if (src->allocator != new_allocator || memcmp(&src->params, &new_params, sizeof(GstAllocationParams)) != 0) {
-      gst_quiclysrc_reset_memory_allocator(src);
+/*
+ * Pool of quicly_mtu sized buffers, at least one batch of them. It has
+ * no upper limit: jitterbuffers downstream hold on to the buffers for
+ * their latency, and receiving must not stall on them
+ */
+static GstBufferPool *gst_quiclysrc_new_pool(GstQuiclysrc *src, GstCaps *caps, GstAllocator *allocator,
+                                             GstAllocationParams *params)
+{
+  GstBufferPool *pool = gst_buffer_pool_new();
+  GstStructure *config = gst_buffer_pool_get_config(pool);
+
+  gst_buffer_pool_config_set_params(config, caps, src->quicly_mtu, src->batch_size, 0);
+  gst_buffer_pool_config_set_allocator(config, allocator, params);
+  if (!gst_buffer_pool_set_config(pool, config)) {
+    gst_object_unref(pool);
+    return NULL;
+  }
+  return pool;
+}
 
-      src->allocator = new_allocator;
-      src->params = new_params;
+/*
+ * If nothing has been negotiated yet, a pool with the default allocator
+ * is used until then
+ */
+static gboolean gst_quiclysrc_ensure_pool(GstQuiclysrc *src)
+{
+  if (src->pool == NULL) {
+    if ((src->pool = gst_quiclysrc_new_pool(src, NULL, NULL, NULL)) == NULL ||
+        !gst_buffer_pool_set_active(src->pool, TRUE)) {
+      g_printerr("Failed to set up the buffer pool\n");
+      g_clear_object(&src->pool);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
 
-      GST_INFO_OBJECT(src, "new mem allocator\n");
+/* 
+ * Acquire and map buffers for the slots emptied by the last batch
+ */
+static gboolean gst_quiclysrc_ensure_mem(GstQuiclysrc *src)
+{
+  if (!gst_quiclysrc_ensure_pool(src))
+    return FALSE;
+
+  for (gsize i = 0; i < src->batch_size; i++) {
+    GstQuiclysrcSlot *slot = &src->slots[i];
+    if (slot->buffer != NULL)
+      continue;
+    if (gst_buffer_pool_acquire_buffer(src->pool, &slot->buffer, NULL) != GST_FLOW_OK)
+      return FALSE;
+    if (!gst_buffer_map(slot->buffer, &slot->map, GST_MAP_WRITE)) {
+      gst_buffer_unref(slot->buffer);
+      slot->buffer = NULL;
+      return FALSE;
     }
   }
+  return TRUE;
+}
 
-  return ret;
+/* Tag a received buffer with the arrival time of its packet */
+static void add_arrival_meta(GstQuiclysrc *quiclysrc, GstBuffer *buffer)
+{
+  gst_buffer_add_reference_timestamp_meta(buffer, arrival_ts_caps, quiclysrc->arrival_time, GST_CLOCK_TIME_NONE);
 }
 
-static gboolean gst_quiclysrc_free_buffer_list_mem(GstQuiclysrc *src)
+/* Count the time a buffer spent in the element in latency_histogram */
+static void record_latency(GstQuiclysrc *quiclysrc, GstBuffer *buffer, GstClockTime now)
 {
-  if (src->mem_list != NULL) {
-    for (int i = 0; i < src->mem_list_size; i++) {
-      if (src->mem_list[i] != NULL) {
-        gst_memory_unmap(src->mem_list[i], src->map_list[i]);
-        gst_memory_unref(src->mem_list[i]);
-        src->mem_list[i] = NULL;
-      }
-      free(src->map_list[i]);
-      free(src->vec_list[i]);
-    }
-    free(src->map_list);
-    free(src->vec_list);
-    free(src->pushed_list);
+  GstReferenceTimestampMeta *meta = gst_buffer_get_reference_timestamp_meta(buffer, arrival_ts_caps);
+  guint64 latency;
+
+  if (meta == NULL)
+    return;
+  latency = now > meta->timestamp ? (now - meta->timestamp) / GST_USECOND : 0;
+  ++quiclysrc->latency_histogram[latency == 0 ? 0 : MIN(g_bit_storage(latency), GST_QUICLYSRC_LATENCY_BUCKETS - 1)];
+}
+
+/*
+ * Interarrival jitter as in RFC 3550, section 6.4.1 and appendix A.8:
+ * the difference of the transit times of two packets, in units of the
+ * RTP clock, smoothed with a gain of 1/16
+ */
+static void update_jitter(GstQuiclysrc *quiclysrc, const guint8 *rtp, gsize len)
+{
+  guint32 arrival;
+  gint32 transit, d;
+
+  if (len < sizeof(rtp_hdr) || (rtp[0] >> 6) != 2)
+    return;
+
+  /* the clock rate comes with the caps, video if it does not */
+  if (quiclysrc->jitter_caps != quiclysrc->caps) {
+    GstStructure *s;
+    gst_caps_replace(&quiclysrc->jitter_caps, quiclysrc->caps);
+    quiclysrc->clock_rate = 90000;
+    if (quiclysrc->caps != NULL && !gst_caps_is_any(quiclysrc->caps) && !gst_caps_is_empty(quiclysrc->caps) &&
+        (s = gst_caps_get_structure(quiclysrc->caps, 0)) != NULL)
+      gst_structure_get_int(s, "clock-rate", &quiclysrc->clock_rate);
+    if (quiclysrc->clock_rate <= 0)
+      quiclysrc->clock_rate = 90000;
+    quiclysrc->have_transit = FALSE;
   }
 
-   if (src->mem_list != NULL) {
-    free(src->mem_list);
+  arrival = (guint32)gst_util_uint64_scale(quiclysrc->arrival_time, quiclysrc->clock_rate, GST_SECOND);
+  transit = (gint32)(arrival - GST_READ_UINT32_BE(rtp + 4));
+  if (quiclysrc->have_transit) {
+    d = transit - quiclysrc->prev_transit;
+    if (d < 0)
+      d = -d;
+    if ((guint64)d > 2 * (quiclysrc->jitter >> 4))
+      quiclysrc->num_jitter_spikes++;
+    quiclysrc->jitter += d - ((quiclysrc->jitter + 8) >> 4);
+    quiclysrc->max_jitter = MAX(quiclysrc->max_jitter, quiclysrc->jitter);
   }
+  quiclysrc->prev_transit = transit;
+  quiclysrc->have_transit = TRUE;
+}
 
-  return TRUE;
+/* The jitter in ns */
+static guint64 jitter_to_time(GstQuiclysrc *quiclysrc, guint64 jitter)
+{
+  if (quiclysrc->clock_rate <= 0)
+    return 0;
+  return gst_util_uint64_scale(jitter >> 4, GST_SECOND, quiclysrc->clock_rate);
 }
 
-static gboolean gst_quiclysrc_realloc_mem_sizes(GstQuiclysrc *src)
+/*
+ * TRUE if no more packets can be taken: the batch of create is full, or
+ * the queue to create if the receive thread is used
+ */
+static gboolean receive_full(GstQuiclysrc *quiclysrc)
 {
-  if (src->mem_list != NULL)
-    gst_quiclysrc_free_buffer_list_mem(src);
+  GstQuiclysrcRing *ring = &quiclysrc->ring;
 
-  src->map_list = malloc(src->mem_list_size * sizeof(GstMapInfo *));
-  src->vec_list = malloc(src->mem_list_size * sizeof(GInputVector *));
-  src->pushed_list = (gint *) malloc(src->mem_list_size * sizeof(gint));
-  src->mem_list = malloc(src->mem_list_size * sizeof(GstMemory *));
-  for (int i = 0; i < src->mem_list_size; i++) {
-    src->map_list[i] = malloc(sizeof(GstMapInfo));
-    src->vec_list[i] = malloc(sizeof(GInputVector));
-    src->mem_list[i] = NULL;
+  /* the ring has no capacity until the thread runs, i.e. during the handshake */
+  if (quiclysrc->receive_thread)
+    return (guint)(ring->tail - g_atomic_int_get(&ring->head)) == ring->capacity;
+  return quiclysrc->pushed >= quiclysrc->batch_size;
+}
+
+/*
+ * Copy a received packet into the next buffer of the batch, or into a
+ * buffer queued to create if the receive thread is used. Returns FALSE
+ * if there is no room or the packet does not fit
+ */
+static gboolean store_packet(GstQuiclysrc *quiclysrc, const void *data, gsize len)
+{
+  GstQuiclysrcRing *ring = &quiclysrc->ring;
+  GstQuiclysrcSlot *slot;
+  GstBuffer *buffer;
+
+  if (receive_full(quiclysrc))
+    return FALSE;
+
+  if (quiclysrc->receive_thread) {
+    /* called from the receive thread with the object lock held */
+    if (len > quiclysrc->quicly_mtu || !gst_quiclysrc_ensure_pool(quiclysrc) ||
+        gst_buffer_pool_acquire_buffer(quiclysrc->pool, &buffer, NULL) != GST_FLOW_OK)
+      return FALSE;
+    gst_buffer_fill(buffer, 0, data, len);
+    gst_buffer_set_size(buffer, len);
+    add_arrival_meta(quiclysrc, buffer);
+    ring->entries[ring->tail & (ring->capacity - 1)] = buffer;
+    g_atomic_int_set(&ring->tail, ring->tail + 1);
+    return TRUE;
   }
 
+  slot = &quiclysrc->slots[quiclysrc->pushed];
+  if (slot->buffer == NULL || slot->map.size < len)
+    return FALSE;
+  memcpy(slot->map.data, data, len);
+  slot->len = len;
+  add_arrival_meta(quiclysrc, slot->buffer);
+  quiclysrc->pushed++;
   return TRUE;
 }
 
-static gboolean gst_quiclysrc_alloc_mem(GstQuiclysrc *src, GstMemory **pmem, GstMapInfo *map)
+/*
+ * Take out what did not fit into the batch or the receive queue before:
+ * complete packets left on the media stream and the queued packets of
+ * frame streams
+ */
+static void drain_pending(GstQuiclysrc *quiclysrc)
 {
-  GstMemory *mem;
-  mem = gst_allocator_alloc(src->allocator, src->quicly_mtu, &src->params);
+  ptls_iovec_t input;
 
-  if (!gst_memory_map(mem, map, GST_MAP_WRITE)) {
-    gst_memory_unref(mem);
-    memset(map, 0, sizeof(GstMapInfo));
-    return FALSE;
+  if (quiclysrc->dgram == NULL && quiclysrc->stream != NULL) {
+    while ((input = quicly_streambuf_ingress_get(quiclysrc->stream)).len >= 2) {
+      rtp_hdr_ *hdr = (rtp_hdr_*) input.base;
+      /* stop at an incomplete rtp packet */
+      if (hdr->framing > input.len - 2 || !store_packet(quiclysrc, input.base + 2, hdr->framing))
+        break;
+
+      /* update stats */
+      ++quiclysrc->num_packets;
+      quiclysrc->num_bytes += hdr->framing;
+      quicly_streambuf_ingress_shift(quiclysrc->stream, hdr->framing + 2);
+    }
+  }
+  while (!g_queue_is_empty(&quiclysrc->frame_packets) && !receive_full(quiclysrc)) {
+    GBytes *packet = g_queue_pop_head(&quiclysrc->frame_packets);
+    gsize len;
+    const void *data = g_bytes_get_data(packet, &len);
+    store_packet(quiclysrc, data, len);
+    g_bytes_unref(packet);
   }
-  *pmem = mem;
-  return TRUE;
 }
 
-/* 
- * Allocate new memory for buffers
+/*
+ * Receive thread mode: push what the thread received as one list,
+ * waiting for it if the queue is empty. New caps are applied from here,
+ * the streaming thread
  */
-static gboolean gst_quiclysrc_ensure_mem(GstQuiclysrc *src)
+static GstFlowReturn take_received(GstQuiclysrc *quiclysrc, GstBuffer **buf)
 {
-  if (!src->mem_list_allocated) {
-    /* or use a parameter in the function call? */
-    for (int i = 0; i < src->mem_list_size; i++) {
-      if (src->mem_list[i] == NULL) {
-        if (!gst_quiclysrc_alloc_mem(src, &src->mem_list[i], src->map_list[i]))
-          return FALSE;
-        src->vec_list[i]->buffer = src->map_list[i]->data;
-        src->vec_list[i]->size = src->map_list[i]->size;
-      }
+  GstQuiclysrcRing *ring = &quiclysrc->ring;
+  GstBufferList *buf_list;
+  gint64 end_time = g_get_monotonic_time() + RECEIVE_TIMEOUT_US;
+  gboolean timed_out = FALSE;
+  GstClockTime now;
+  gint head, tail;
+
+  for (;;) {
+    if (g_atomic_int_compare_and_exchange(&quiclysrc->caps_pending, TRUE, FALSE))
+      apply_pending_caps(quiclysrc);
+    if (g_atomic_int_get(&quiclysrc->flows_pending)) {
+      push_flows(quiclysrc);
+      end_time = g_get_monotonic_time() + RECEIVE_TIMEOUT_US;
     }
+    head = ring->head;
+    if ((tail = g_atomic_int_get(&ring->tail)) != head)
+      break;
+    if (g_cancellable_is_cancelled(quiclysrc->cancellable))
+      return GST_FLOW_FLUSHING;
+    if (timed_out)
+      g_printerr("Timeout in receive wait\n");
+    if (timed_out || !g_atomic_int_get(&quiclysrc->receive_running)) {
+      GST_DEBUG_OBJECT(quiclysrc, "End of stream in create");
+      return GST_FLOW_EOS;
+    }
+
+    g_mutex_lock(&quiclysrc->ring_lock);
+    if (g_atomic_int_get(&ring->tail) == head && !g_atomic_int_get(&quiclysrc->caps_pending) &&
+        !g_atomic_int_get(&quiclysrc->flows_pending) && !g_cancellable_is_cancelled(quiclysrc->cancellable) &&
+        g_atomic_int_get(&quiclysrc->receive_running))
+      timed_out = !g_cond_wait_until(&quiclysrc->ring_cond, &quiclysrc->ring_lock, end_time);
+    g_mutex_unlock(&quiclysrc->ring_lock);
   }
-  src->mem_list_allocated = TRUE;
-  return TRUE;
+
+  buf_list = gst_buffer_list_new_sized(tail - head);
+  now = g_get_real_time() * GST_USECOND;
+  for (; head != tail; ++head) {
+    record_latency(quiclysrc, ring->entries[head & (ring->capacity - 1)], now);
+    gst_buffer_list_insert(buf_list, -1, ring->entries[head & (ring->capacity - 1)]);
+    ring->entries[head & (ring->capacity - 1)] = NULL;
+  }
+  g_atomic_int_set(&ring->head, head);
+
+  gst_base_src_submit_buffer_list(GST_BASE_SRC_CAST(quiclysrc), buf_list);
+  *buf = NULL;
+  return GST_FLOW_OK;
 }
 
-static GstFlowReturn gst_quiclysrc_create(GstPushSrc *src, GstBuffer **buf)
+static GstFlowReturn receive_media(GstPushSrc *src, GstBuffer **buf)
 {
   GstBaseSrc *base = GST_BASE_SRC_CAST(src);
   GstQuiclysrc *quiclysrc = GST_QUICLYSRC_CAST(src);
 
+  if (g_atomic_int_compare_and_exchange(&quiclysrc->key_frame_requested, TRUE, FALSE))
+    request_key_frame(quiclysrc);
+
+  /* the connection is served by the receive thread */
+  if (quiclysrc->receive_thread)
+    return take_received(quiclysrc, buf);
+
   if (quiclysrc->transport_close) {
     return GST_FLOW_EOS;
   }
@@ -884,7 +1455,6 @@ static GstFlowReturn gst_quiclysrc_create(GstPushSrc *src, GstBuffer **buf)
   if (!gst_quiclysrc_ensure_mem(quiclysrc))
     return GST_FLOW_ERROR;
   
-  gsize written = 0;
   gsize ret;
   GError *err = NULL;
 
@@ -895,46 +1465,26 @@ static GstFlowReturn gst_quiclysrc_create(GstPushSrc *src, GstBuffer **buf)
    * Only happens if the last packet we receive before the list is full contains multiple small frames.
    */
   if (quiclysrc->dgram != NULL) {
-    while ((quicly_dgram_can_get_data(quiclysrc->dgram)) > 0 && (written < quiclysrc->mem_list_size)) {
-      gsize len = quiclysrc->vec_list[written]->size;
-      quicly_dgrambuf_ingress_get(quiclysrc->dgram, quiclysrc->vec_list[written]->buffer, &len);
-      quiclysrc->pushed_list[written] = len;
+    while ((quicly_dgram_can_get_data(quiclysrc->dgram)) > 0 && !receive_full(quiclysrc)) {
+      GstQuiclysrcSlot *slot = &quiclysrc->slots[quiclysrc->pushed];
+      gsize len = slot->map.size;
+      quicly_dgrambuf_ingress_get(quiclysrc->dgram, slot->map.data, &len);
+      slot->len = len;
+      add_arrival_meta(quiclysrc, slot->buffer);
       quiclysrc->pushed++;
-      written++;
 
       /* update stats */
       ++quiclysrc->num_packets;
       quiclysrc->num_bytes += len;
       quicly_dgrambuf_ingress_shift(quiclysrc->dgram, 1);
     }
-  } else if (quiclysrc->stream != NULL) {
-    ptls_iovec_t input;
-    gboolean skip = FALSE;
-    while (((input = quicly_streambuf_ingress_get(quiclysrc->stream)).len != 0) && 
-                                            (written < quiclysrc->mem_list_size) && !skip) {
-      rtp_hdr_ *hdr = (rtp_hdr_*) input.base;
-      if ((hdr->framing <= (input.len - 2)) && (input.len >= 2) &&
-                      quiclysrc->vec_list[written]->size >= hdr->framing) {
-        memcpy(quiclysrc->vec_list[written]->buffer, input.base + 2, hdr->framing);
-        quiclysrc->pushed_list[written] = hdr->framing;
-        quiclysrc->pushed++;
-        written++;
-
-        /* update stats */
-        ++quiclysrc->num_packets;
-        quiclysrc->num_bytes += hdr->framing;
-        quicly_streambuf_ingress_shift(quiclysrc->stream, hdr->framing + 2);
-      } else {
-        /* skip, not a complete rtp package */
-        skip = TRUE;
-      }
-    }
   }
+  drain_pending(quiclysrc);
 
   /* receive packets */
   GIOCondition cond = G_IO_IN;
   GIOCondition out_cond;
-  if (!g_socket_condition_timed_wait(quiclysrc->socket, G_IO_IN, 6000000, quiclysrc->cancellable, &err)) {
+  if (!g_socket_condition_timed_wait(quiclysrc->socket, G_IO_IN, RECEIVE_TIMEOUT_US, quiclysrc->cancellable, &err)) {
     if (g_error_matches(err, G_IO_ERROR, G_IO_ERROR_BUSY) ||
         g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
       goto stopped;
@@ -946,7 +1496,10 @@ static GstFlowReturn gst_quiclysrc_create(GstPushSrc *src, GstBuffer **buf)
     }
   }
   do {
-    if ((ret = receive_packet(quiclysrc, err)) != 0) {
+    GST_OBJECT_LOCK(quiclysrc);
+    ret = receive_packet(quiclysrc, err);
+    GST_OBJECT_UNLOCK(quiclysrc);
+    if (ret != 0) {
       g_printerr("receive_packet failed in fill\n");
       if (err != NULL) {
         g_printerr("Error while receiving: %s\n", err->message);
@@ -954,32 +1507,35 @@ static GstFlowReturn gst_quiclysrc_create(GstPushSrc *src, GstBuffer **buf)
       }
     }
 
+    /* the request pads are served in between, the media may not come for a while */
+    if (g_atomic_int_get(&quiclysrc->flows_pending))
+      push_flows(quiclysrc);
+
     out_cond = g_socket_condition_check(quiclysrc->socket, cond);
     if (!(cond & out_cond) && (quiclysrc->pushed != 0)) {
       break;
     }
 
-  } while ((!quiclysrc->transport_close) && (quiclysrc->pushed < quiclysrc->mem_list_size));
+  } while ((!quiclysrc->transport_close) && (quiclysrc->pushed < quiclysrc->batch_size));
 
   GstBufferList *buf_list;
-  GstBuffer *out_buf = NULL;
+  GstClockTime now;
   
+  /* the filled buffers go downstream and return to the pool once released */
   buf_list = gst_buffer_list_new_sized(quiclysrc->pushed);
-  for (int i = 0; i < quiclysrc->pushed; i++) {
-    out_buf = gst_buffer_new();
-    gst_buffer_append_memory(out_buf, quiclysrc->mem_list[i]);
-    gst_memory_unmap(quiclysrc->mem_list[i], quiclysrc->map_list[i]);
-    quiclysrc->vec_list[i]->buffer = NULL;
-    quiclysrc->vec_list[i]->size = 0;
-    gst_buffer_resize(out_buf, 0, quiclysrc->pushed_list[i]);
-    quiclysrc->pushed_list[i] = 0;
-    gst_buffer_list_insert(buf_list, -1, out_buf);
-    quiclysrc->mem_list[i] = NULL;
+  now = g_get_real_time() * GST_USECOND;
+  for (gsize i = 0; i < quiclysrc->pushed; i++) {
+    GstQuiclysrcSlot *slot = &quiclysrc->slots[i];
+    gst_buffer_unmap(slot->buffer, &slot->map);
+    gst_buffer_resize(slot->buffer, 0, slot->len);
+    record_latency(quiclysrc, slot->buffer, now);
+    gst_buffer_list_insert(buf_list, -1, slot->buffer);
+    slot->buffer = NULL;
+    slot->len = 0;
   }
 
   gst_base_src_submit_buffer_list(base, buf_list);
   quiclysrc->pushed = 0;
-  quiclysrc->mem_list_allocated = FALSE;
   *buf = NULL;
 
   if (quiclysrc->transport_close)
@@ -1007,36 +1563,47 @@ static GstFlowReturn gst_quiclysrc_create(GstPushSrc *src, GstBuffer **buf)
     }
 }
 
+/* The request pads end with the media of the source pad */
+static GstFlowReturn gst_quiclysrc_create(GstPushSrc *src, GstBuffer **buf)
+{
+  GstQuiclysrc *quiclysrc = GST_QUICLYSRC_CAST(src);
+  GstFlowReturn ret = receive_media(src, buf);
+
+  if (ret == GST_FLOW_EOS && quiclysrc->flow_framing)
+    push_flows_eos(quiclysrc);
+  return ret;
+}
+
 /* buffer list version */
 static int on_receive_dgram(quicly_dgram_t *dgram, const void *src, size_t len)
 {
   GstQuiclysrc *quiclysrc = GST_QUICLYSRC (*quicly_get_data(dgram->conn));
 
-  /* calc jitter */
-  GstClockTime now = gst_clock_get_time(gst_system_clock_obtain());
-  if (quiclysrc->prev_arrival_time != 0) {
-    guint64 transit = now - quiclysrc->prev_arrival_time;
-    guint64 tmp = quiclysrc->prev_transit > transit ? 
-                    quiclysrc->prev_transit - transit : 
-                    transit - quiclysrc->prev_transit;
-
-    if (tmp > 2 * quiclysrc->jitter)
-      quiclysrc->num_jitter_spikes++;
-    quiclysrc->jitter = (quiclysrc->num_packets * quiclysrc->jitter + tmp) / (quiclysrc->num_packets + 1);
-    quiclysrc->prev_transit = transit;
+  if (quiclysrc->flow_framing) {
+    guint flow;
+    if (len < GST_QUICLY_FLOW_HEADER_SIZE)
+      return 0;
+    flow = *(const guint8 *)src;
+    src = (const guint8 *)src + GST_QUICLY_FLOW_HEADER_SIZE;
+    len -= GST_QUICLY_FLOW_HEADER_SIZE;
+    if (flow != 0) {
+      receive_flow(quiclysrc, flow, src, len);
+      return 0;
+    }
   }
-  quiclysrc->prev_arrival_time = now;
 
-  if (quiclysrc->pushed >= quiclysrc->mem_list_size) {
-    quicly_dgrambuf_ingress_receive(dgram, src, len);
+  update_jitter(quiclysrc, src, len);
+
+  if (receive_full(quiclysrc)) {
+    /* the receive thread does not buffer beyond its queue, create fell behind */
+    if (quiclysrc->receive_thread)
+      ++quiclysrc->num_ring_dropped;
+    else
+      quicly_dgrambuf_ingress_receive(dgram, src, len);
     return 0;
   }
   
-  if (quiclysrc->connected && (quiclysrc->vec_list[quiclysrc->pushed]->size >= len)) {
-    memcpy(quiclysrc->vec_list[quiclysrc->pushed]->buffer, src, len);
-    quiclysrc->pushed_list[quiclysrc->pushed] = len;
-    quiclysrc->pushed++;
-
+  if (quiclysrc->connected && store_packet(quiclysrc, src, len)) {
     /* stats */
     ++quiclysrc->num_packets;
     quiclysrc->num_bytes += len;
@@ -1049,16 +1616,44 @@ static int on_receive_dgram(quicly_dgram_t *dgram, const void *src, size_t len)
   return 0;
 }
 
+/*
+ * Send what has been written to the control stream. With the receive
+ * thread running, it is sent on the next round of the thread
+ */
+static void flush_control(GstQuiclysrc *quiclysrc)
+{
+  if (g_atomic_int_get(&quiclysrc->receive_running))
+    wake_receive_thread(quiclysrc);
+  else if (send_pending(quiclysrc) != 0)
+    g_printerr("Could not send control message\n");
+}
+
 /* Send ack for caps to server */
 static void ack_caps_receive(GstQuiclysrc *quiclysrc)
 {
-  quicly_stream_t *stream;
-  if (quicly_open_stream(quiclysrc->conn, &stream, 0) == 0) {
-    gchar send[] = "MSG:CAPS;DATA:OK\n";
-    quicly_streambuf_egress_write(stream, send, strlen(send));
-    quicly_streambuf_egress_shutdown(stream);
-    if (send_pending(quiclysrc) == 0)
-      GST_INFO_OBJECT (quiclysrc, "Caps ack send");
+  gchar *caps = gst_caps_to_string(quiclysrc->caps);
+  if (gst_quicly_control_write(quiclysrc->control_stream, GST_QUICLY_CONTROL_CAPS_ACK, caps, strlen(caps)) == 0) {
+    flush_control(quiclysrc);
+    GST_INFO_OBJECT (quiclysrc, "Caps ack send");
+  }
+  g_free(caps);
+}
+
+/* Forward a key frame request of downstream to the server */
+static void request_key_frame(GstQuiclysrc *quiclysrc)
+{
+  int ret;
+
+  /* the receive thread owns the connection while running */
+  if (quiclysrc->receive_thread)
+    GST_OBJECT_LOCK(quiclysrc);
+  ret = gst_quicly_control_write(quiclysrc->control_stream, GST_QUICLY_CONTROL_KEY_FRAME_REQUEST, NULL, 0);
+  if (quiclysrc->receive_thread)
+    GST_OBJECT_UNLOCK(quiclysrc);
+  if (ret == 0) {
+    flush_control(quiclysrc);
+    ++quiclysrc->num_key_frame_requests;
+    GST_DEBUG_OBJECT(quiclysrc, "Key frame request send");
   }
 }
 
@@ -1073,46 +1668,82 @@ static void send_caps_event(GstQuiclysrc *quiclysrc)
   }
 }
 
-static void handle_meta_data_stream(GstQuiclysrc *quiclysrc, quicly_stream_t *stream, ptls_iovec_t *input)
+/*
+ * Receive thread mode: set the caps received by the thread downstream,
+ * then ack them
+ */
+static void apply_pending_caps(GstQuiclysrc *quiclysrc)
 {
-  char str[input->len];
-  memcpy(str, input->base, input->len);
-  GST_DEBUG_OBJECT(quiclysrc, "Received MSG string: %s", str);
-  char delim[] = ":;\n";
-  char *token;
-  char check[] = "DATA";
-  GstStructure *cp;
-  GstCaps *_caps;
-  gboolean found = FALSE;
+  GstCaps *caps;
 
-  token = strtok(str, delim);
+  GST_OBJECT_LOCK(quiclysrc);
+  caps = gst_caps_ref(quiclysrc->caps);
+  GST_OBJECT_UNLOCK(quiclysrc);
 
-  while (token != NULL) {
-    if (found) {
-      if ((cp = gst_structure_from_string(token, NULL)) == NULL) {
-        /* Didn't get the whole caps string or broken. Skip */
-        return;
-      }
-      if (((_caps = gst_caps_new_full(cp, NULL)) != NULL) && GST_IS_CAPS(_caps)) {
-        if (quiclysrc->caps)
-          gst_caps_unref(quiclysrc->caps);
-        quiclysrc->caps = _caps;
-        send_caps_event(quiclysrc);
-        GST_INFO_OBJECT(quiclysrc, "Caps received: %s", gst_caps_to_string(_caps));
-      }
-      break;
+  GST_DEBUG_OBJECT(quiclysrc, "Setting caps downstream.");
+  if (gst_pad_set_caps(GST_BASE_SRC_PAD(quiclysrc), caps)) {
+    GST_OBJECT_LOCK(quiclysrc);
+    /* caps changed again in the meantime, they are acked once set */
+    if (gst_caps_is_equal(caps, quiclysrc->caps))
+      ack_caps_receive(quiclysrc);
+    GST_OBJECT_UNLOCK(quiclysrc);
+  } else {
+    g_printerr("Could not set caps downstream\n");
+  }
+  gst_caps_unref(caps);
+}
+
+static void handle_caps(GstQuiclysrc *quiclysrc, ptls_iovec_t payload)
+{
+  gchar *str = g_strndup((const gchar *)payload.base, payload.len);
+  GstCaps *_caps = gst_caps_from_string(str);
+
+  g_free(str);
+  if (_caps == NULL) {
+    g_printerr("Received invalid caps\n");
+    return;
+  }
+  if (quiclysrc->caps != NULL && gst_caps_is_equal(quiclysrc->caps, _caps)) {
+    /* already running with these caps (e.g. restored from the session file) */
+    gst_caps_unref(_caps);
+    ack_caps_receive(quiclysrc);
+  } else {
+    if (quiclysrc->caps)
+      gst_caps_unref(quiclysrc->caps);
+    quiclysrc->caps = _caps;
+    if (quiclysrc->receive_thread) {
+      /* set and acked from the streaming thread, see take_received */
+      g_atomic_int_set(&quiclysrc->caps_pending, TRUE);
+      signal_received(quiclysrc);
+    } else {
+      send_caps_event(quiclysrc);
     }
-    if (strcmp(token, check) == 0)
-      found = TRUE;
-    token = strtok(NULL, delim);
+    GST_INFO_OBJECT(quiclysrc, "Caps received: %" GST_PTR_FORMAT, _caps);
   }
-  g_print("SKIPPING STUFF\n");
-  quicly_streambuf_ingress_shift(stream, input->len);
+  save_session(quiclysrc);
 }
 
 /*
- * Would be better to differentiate by stream id. e.g. always send caps on stream id 1
- * TODO: Regardless -> split the function up
+ * Messages of the server on the control stream, see gstquiclycontrol.h
+ */
+static void handle_control_stream(GstQuiclysrc *quiclysrc, quicly_stream_t *stream)
+{
+  ptls_iovec_t payload;
+  guint8 type;
+  gsize consumed;
+
+  while ((consumed = gst_quicly_control_parse(quicly_streambuf_ingress_get(stream), &type, &payload)) != 0) {
+    if (type == GST_QUICLY_CONTROL_CAPS)
+      handle_caps(quiclysrc, payload);
+    else
+      GST_DEBUG_OBJECT(quiclysrc, "Ignoring control message of unknown type %u", type);
+    quicly_streambuf_ingress_shift(stream, consumed);
+  }
+}
+
+/*
+ * The control stream is opened by us, every other bidirectional stream
+ * of the server carries media
  **/
 static int on_receive_stream(quicly_stream_t *stream, size_t off, const void *src, size_t len)
 {
@@ -1123,19 +1754,18 @@ static int on_receive_stream(quicly_stream_t *stream, size_t off, const void *sr
   if ((ret = quicly_streambuf_ingress_receive(stream, off, src, len)) != 0)
     return ret;
 
+  if (stream == quiclysrc->control_stream) {
+    handle_control_stream(quiclysrc, stream);
+    return 0;
+  }
+
+  if (quicly_stream_is_unidirectional(stream->stream_id)) {
+    receive_frame_stream(quiclysrc, stream);
+    return 0;
+  }
+
   if ((input = quicly_streambuf_ingress_get(stream)).len != 0) {
-    if (quiclysrc->stream != stream) {
-      char msg[] = "MSG";
-      char head[4] = {input.base[0], input.base[1], input.base[2], '\0'};
-      if (strcmp(head, msg) == 0) {
-        /* Meta data stream */
-        handle_meta_data_stream(quiclysrc, stream, &input);
-        return 0;
-      } else {
-        /* New media data stream */
-        quiclysrc->stream = stream;
-      }
-    }
+    quiclysrc->stream = stream;
 
     rtp_hdr_ *hdr = (rtp_hdr_*) input.base;
     uint8_t version = hdr->ver_p_x_cc >> 6;
@@ -1145,22 +1775,10 @@ static int on_receive_stream(quicly_stream_t *stream, size_t off, const void *sr
       return 0;
     }
 
-     /* calc jitter */
-    GstClockTime now = gst_clock_get_time(gst_system_clock_obtain());
-    if (quiclysrc->prev_arrival_time != 0) {
-      guint64 transit = now - quiclysrc->prev_arrival_time;
-      guint64 tmp = quiclysrc->prev_transit > transit ? 
-                      quiclysrc->prev_transit - transit : 
-                      transit - quiclysrc->prev_transit;
-
-      if (tmp > 2 * quiclysrc->jitter)
-        quiclysrc->num_jitter_spikes++;
-      quiclysrc->jitter = (quiclysrc->num_packets * quiclysrc->jitter + tmp) / (quiclysrc->num_packets + 1);
-      quiclysrc->prev_transit = transit;
-    }
-    quiclysrc->prev_arrival_time = now;
+    if (input.len >= 2)
+      update_jitter(quiclysrc, input.base + 2, input.len - 2);
 
-    if (quiclysrc->pushed >= quiclysrc->mem_list_size) {
+    if (receive_full(quiclysrc)) {
       /* skip, buffer list full */
       return 0;
     }
@@ -1168,10 +1786,7 @@ static int on_receive_stream(quicly_stream_t *stream, size_t off, const void *sr
     /* Check if we can get a complete rtp packet */
     if ((hdr->framing <= (input.len - 2)) && (input.len >= 2)) {
       /* Check if the current buffer has enough space. Should always be true, if we set rtp payloader to 1200bytes */
-      if (quiclysrc->connected && (quiclysrc->vec_list[quiclysrc->pushed]->size >= hdr->framing)) {
-        memcpy(quiclysrc->vec_list[quiclysrc->pushed]->buffer, input.base + 2, hdr->framing);
-        quiclysrc->pushed_list[quiclysrc->pushed] = hdr->framing;
-        quiclysrc->pushed++;
+      if (quiclysrc->connected && store_packet(quiclysrc, input.base + 2, hdr->framing)) {
         /* stats */
         ++quiclysrc->num_packets;
         quiclysrc->num_bytes += hdr->framing;
@@ -1186,6 +1801,35 @@ static int on_receive_stream(quicly_stream_t *stream, size_t off, const void *sr
   return 0;
 }
 
+/*
+ * Streams carrying a single frame are destroyed as soon as they are
+ * complete, so every complete packet is taken out right away and
+ * queued if the buffer list is full, up to FRAME_QUEUE_SIZE packets.
+ * Frames are independent of each other: a frame stream being late or
+ * reset never blocks the others
+ */
+static void receive_frame_stream(GstQuiclysrc *quiclysrc, quicly_stream_t *stream)
+{
+  ptls_iovec_t input;
+  guint16 framing;
+
+  while ((input = quicly_streambuf_ingress_get(stream)).len >= sizeof(framing)) {
+    memcpy(&framing, input.base, sizeof(framing));
+    if (input.len - sizeof(framing) < framing)
+      break;
+    update_jitter(quiclysrc, input.base + sizeof(framing), framing);
+    if (!quiclysrc->connected || !store_packet(quiclysrc, input.base + sizeof(framing), framing)) {
+      if (g_queue_get_length(&quiclysrc->frame_packets) < FRAME_QUEUE_SIZE)
+        g_queue_push_tail(&quiclysrc->frame_packets, g_bytes_new(input.base + sizeof(framing), framing));
+      else
+        ++quiclysrc->num_frame_packets_dropped;
+    }
+    ++quiclysrc->num_packets;
+    quiclysrc->num_bytes += framing;
+    quicly_streambuf_ingress_shift(stream, framing + sizeof(framing));
+  }
+}
+
 static int on_dgram_open(quicly_dgram_open_t *self, quicly_dgram_t *dgram)
 {
   GstQuiclysrc *quiclysrc = GST_QUICLYSRC (*quicly_get_data(dgram->conn));
@@ -1222,6 +1866,8 @@ static void on_closed_by_peer(quicly_closed_by_peer_t *self, quicly_conn_t *conn
 
     if (QUICLY_ERROR_IS_QUIC_TRANSPORT(err)) {
         fprintf(stderr, "transport close: code=%d\n", err);
+    } else if (err == QUICLY_ERROR_FROM_APPLICATION_ERROR_CODE(GST_QUICLY_ERROR_FLOW_FRAMING)) {
+        g_printerr("application close: the request pads of the server do not match\n");
     } else if (QUICLY_ERROR_IS_QUIC_APPLICATION(err)) {
         g_printerr("application close: code=%d\n", err);
     } else if (err == QUICLY_ERROR_RECEIVED_STATELESS_RESET) {
@@ -1240,72 +1886,307 @@ static int on_stop_sending(quicly_stream_t *stream, int err)
 
 static int on_receive_reset(quicly_stream_t *stream, int err)
 {
+    GstQuiclysrc *quiclysrc = GST_QUICLYSRC (*quicly_get_data(stream->conn));
+
     assert(QUICLY_ERROR_IS_QUIC_APPLICATION(err));
+    if (quicly_stream_is_unidirectional(stream->stream_id)) {
+        /* the sink abandoned a frame that missed its deadline; what has been received of it is dropped */
+        ++quiclysrc->num_frames_reset;
+        return 0;
+    }
     g_printerr("received RESET_STREAM\n");
     return 0;
 }
 
 int save_ticket_cb(ptls_save_ticket_t *_self, ptls_t *tls, ptls_iovec_t src)
 {
-    quicly_conn_t *conn = *ptls_get_data_ptr(tls);
+    GstQuiclysrc *quiclysrc = (void *)((char *)_self - offsetof(GstQuiclysrc, save_ticket));
+    int in_use = quiclysrc->hs_properties.client.session_ticket.base != NULL;
+
+    if (quiclysrc->session_file == NULL)
+        return 0;
+
+    free(quiclysrc->session_ticket.base);
+    if ((quiclysrc->session_ticket.base = malloc(src.len)) == NULL) {
+        quiclysrc->session_ticket.len = 0;
+        return PTLS_ERROR_NO_MEMORY;
+    }
+    memcpy(quiclysrc->session_ticket.base, src.base, src.len);
+    quiclysrc->session_ticket.len = src.len;
+    if (in_use)
+        quiclysrc->hs_properties.client.session_ticket = quiclysrc->session_ticket;
+
+    save_session(quiclysrc);
+    return 0;
+}
+
+/* Write the session ticket, the transport parameters of the server and the current caps to session-file */
+static void save_session(GstQuiclysrc *quiclysrc)
+{
     ptls_buffer_t buf;
+    gchar *caps = NULL;
     FILE *fp = NULL;
     int ret;
 
-    if (session_file == NULL)
-        return 0;
+    if (quiclysrc->session_file == NULL || quiclysrc->session_ticket.len == 0 || quiclysrc->conn == NULL)
+        return;
 
     ptls_buffer_init(&buf, "", 0);
 
-    /* build data (session ticket and transport parameters) */
-    ptls_buffer_push_block(&buf, 2, { ptls_buffer_pushv(&buf, src.base, src.len); });
+    /* build data (session ticket, transport parameters and caps) */
+    ptls_buffer_push_block(&buf, 2, { ptls_buffer_pushv(&buf, quiclysrc->session_ticket.base, quiclysrc->session_ticket.len); });
     ptls_buffer_push_block(&buf, 2, {
-        if ((ret = quicly_encode_transport_parameter_list(&buf, 1, quicly_get_peer_transport_parameters(conn), NULL, NULL, 0)) != 0)
+        if ((ret = quicly_encode_transport_parameter_list(&buf, 1, quicly_get_peer_transport_parameters(quiclysrc->conn), NULL,
+                                                          NULL, 0)) != 0)
             goto Exit;
     });
+    if (quiclysrc->caps != NULL && !gst_caps_is_any(quiclysrc->caps))
+        caps = gst_caps_to_string(quiclysrc->caps);
+    ptls_buffer_push_block(&buf, 2, {
+        if (caps != NULL)
+            ptls_buffer_pushv(&buf, caps, strlen(caps));
+    });
 
     /* write file */
-    if ((fp = fopen(session_file, "wb")) == NULL) {
-        fprintf(stderr, "failed to open file:%s:%s\n", session_file, strerror(errno));
-        ret = PTLS_ERROR_LIBRARY;
+    if ((fp = fopen(quiclysrc->session_file, "wb")) == NULL) {
+        g_printerr("failed to open file:%s:%s\n", quiclysrc->session_file, g_strerror(errno));
         goto Exit;
     }
     fwrite(buf.base, 1, buf.off, fp);
 
-    ret = 0;
 Exit:
     if (fp != NULL)
         fclose(fp);
+    g_free(caps);
     ptls_buffer_dispose(&buf);
-    return 0;
 }
 
+/* Load session-file written by save_session. Returns TRUE if a session ticket is available for resumption */
+static gboolean load_session(GstQuiclysrc *quiclysrc)
+{
+    static uint8_t buf[65536];
+    GstCaps *caps = NULL;
+    size_t len;
+    int ret;
+
+    if (quiclysrc->session_file == NULL)
+        return FALSE;
+
+    {
+        FILE *fp;
+        if ((fp = fopen(quiclysrc->session_file, "rb")) == NULL)
+            return FALSE;
+        len = fread(buf, 1, sizeof(buf), fp);
+        if (len == 0 || !feof(fp)) {
+            g_printerr("failed to load ticket from file:%s\n", quiclysrc->session_file);
+            fclose(fp);
+            return FALSE;
+        }
+        fclose(fp);
+    }
+
+    {
+        const uint8_t *src = buf, *end = buf + len;
+        ptls_iovec_t ticket;
+        ptls_decode_open_block(src, end, 2, {
+            ticket = ptls_iovec_init(src, end - src);
+            src = end;
+        });
+        ptls_decode_open_block(src, end, 2, {
+            if ((ret = quicly_decode_transport_parameter_list(&quiclysrc->resumed_transport_params, NULL, NULL, 1, src, end)) != 0)
+                goto Exit;
+            src = end;
+        });
+        /* caps are absent in files written by older versions */
+        if (src != end) {
+            ptls_decode_open_block(src, end, 2, {
+                if (end != src) {
+                    gchar *str = g_strndup((const gchar *)src, end - src);
+                    caps = gst_caps_from_string(str);
+                    g_free(str);
+                }
+                src = end;
+            });
+        }
+
+        free(quiclysrc->session_ticket.base);
+        if ((quiclysrc->session_ticket.base = malloc(ticket.len)) == NULL) {
+            quiclysrc->session_ticket.len = 0;
+            ret = PTLS_ERROR_NO_MEMORY;
+            goto Exit;
+        }
+        memcpy(quiclysrc->session_ticket.base, ticket.base, ticket.len);
+        quiclysrc->session_ticket.len = ticket.len;
+        quiclysrc->hs_properties.client.session_ticket = quiclysrc->session_ticket;
+
+        /* caps set through the property take precedence */
+        if (caps != NULL) {
+            GST_OBJECT_LOCK(quiclysrc);
+            if (quiclysrc->caps == NULL || gst_caps_is_any(quiclysrc->caps)) {
+                if (quiclysrc->caps != NULL)
+                    gst_caps_unref(quiclysrc->caps);
+                quiclysrc->caps = caps;
+                caps = NULL;
+            }
+            GST_OBJECT_UNLOCK(quiclysrc);
+        }
+    }
+    ret = 0;
+
+Exit:
+    if (caps != NULL)
+        gst_caps_unref(caps);
+    if (ret != 0) {
+        g_printerr("failed to decode session file:%s\n", quiclysrc->session_file);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void wake_receive_thread(GstQuiclysrc *quiclysrc)
+{
+  guint64 one = 1;
+  if (quiclysrc->event_fd != -1 && write(quiclysrc->event_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+    g_printerr("Failed to wake up the receive thread: %s\n", g_strerror(errno));
+}
+
+/* Wake up create waiting in take_received */
+static void signal_received(GstQuiclysrc *quiclysrc)
+{
+  g_mutex_lock(&quiclysrc->ring_lock);
+  g_cond_signal(&quiclysrc->ring_cond);
+  g_mutex_unlock(&quiclysrc->ring_lock);
+}
+
+/*
+ * Reads the socket as soon as packets arrive and sends the ACKs when
+ * quicly wants them, no matter how long downstream blocks create. The
+ * packets are handed over through the ring; if create falls behind,
+ * datagrams are dropped and the streams are flow controlled by quicly
+ */
+static gpointer receive_thread_func(gpointer data)
+{
+  GstQuiclysrc *quiclysrc = GST_QUICLYSRC(data);
+  struct pollfd fds[2] = {{g_socket_get_fd(quiclysrc->socket), POLLIN, 0}, {quiclysrc->event_fd, POLLIN, 0}};
+  guint64 counter;
+  gint64 timeout;
+  int ret;
+
+  while (g_atomic_int_get(&quiclysrc->receive_running)) {
+    GST_OBJECT_LOCK(quiclysrc);
+    timeout = quicly_get_first_timeout(quiclysrc->conn) - quiclysrc->ctx.now->cb(quiclysrc->ctx.now);
+    GST_OBJECT_UNLOCK(quiclysrc);
+    if (poll(fds, G_N_ELEMENTS(fds), (int)CLAMP(timeout, 0, RECEIVE_TIMEOUT_US / 1000)) == -1 && errno != EINTR) {
+      g_printerr("poll failed in the receive thread: %s\n", g_strerror(errno));
+      break;
+    }
+    if ((fds[1].revents & POLLIN) && read(quiclysrc->event_fd, &counter, sizeof(counter)) == -1 && errno != EAGAIN)
+      g_printerr("read on the receive thread eventfd failed: %s\n", g_strerror(errno));
+    if (!g_atomic_int_get(&quiclysrc->receive_running))
+      break;
+
+    GST_OBJECT_LOCK(quiclysrc);
+    while (g_socket_condition_check(quiclysrc->socket, G_IO_IN) & G_IO_IN) {
+      if (receive_packet(quiclysrc, NULL) != 0)
+        break;
+    }
+    drain_pending(quiclysrc);
+    ret = send_pending(quiclysrc);
+    GST_OBJECT_UNLOCK(quiclysrc);
+    signal_received(quiclysrc);
+
+    if (ret != 0 || quiclysrc->transport_close) {
+      if (ret != 0)
+        g_printerr("Connection closed while sending\n");
+      break;
+    }
+  }
+
+  g_atomic_int_set(&quiclysrc->receive_running, FALSE);
+  signal_received(quiclysrc);
+  return NULL;
+}
+
+static gboolean start_receive_thread(GstQuiclysrc *quiclysrc)
+{
+  GError *err = NULL;
+
+  quiclysrc->ring.capacity = RECEIVE_RING_SIZE;
+  quiclysrc->ring.entries = g_new0(GstBuffer *, RECEIVE_RING_SIZE);
+  quiclysrc->ring.head = quiclysrc->ring.tail = 0;
+
+  if ((quiclysrc->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+    g_printerr("Failed to set up the receive thread: %s\n", g_strerror(errno));
+    return FALSE;
+  }
+
+  g_atomic_int_set(&quiclysrc->receive_running, TRUE);
+  if ((quiclysrc->receive_thread_handle = g_thread_try_new("quiclysrc-receive", receive_thread_func, quiclysrc,
+                                                           &err)) == NULL) {
+    g_printerr("Failed to start the receive thread: %s\n", err->message);
+    g_clear_error(&err);
+    g_atomic_int_set(&quiclysrc->receive_running, FALSE);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static void stop_receive_thread(GstQuiclysrc *quiclysrc)
+{
+  GstQuiclysrcRing *ring = &quiclysrc->ring;
+
+  if (quiclysrc->receive_thread_handle != NULL) {
+    g_atomic_int_set(&quiclysrc->receive_running, FALSE);
+    wake_receive_thread(quiclysrc);
+    g_thread_join(quiclysrc->receive_thread_handle);
+    quiclysrc->receive_thread_handle = NULL;
+  }
+  if (quiclysrc->event_fd != -1) {
+    close(quiclysrc->event_fd);
+    quiclysrc->event_fd = -1;
+  }
+  if (ring->entries != NULL) {
+    for (; ring->head != ring->tail; ++ring->head)
+      gst_buffer_unref(ring->entries[ring->head & (ring->capacity - 1)]);
+    g_clear_pointer(&ring->entries, g_free);
+  }
+  /* no room until the thread is started again, see receive_full */
+  ring->capacity = 0;
+  ring->head = ring->tail = 0;
+  quiclysrc->caps_pending = FALSE;
+}
+
+/*
+ * Offer our own pool of quicly_mtu sized buffers, using the allocator
+ * downstream asked for. A downstream pool is replaced: its buffers may
+ * be too small for a packet, and its limit would stall receiving
+ */
 static gboolean gst_quiclysrc_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
 {
-  GstQuiclysrc *quiclysrc;
+  GstQuiclysrc *quiclysrc = GST_QUICLYSRC (bsrc);
   GstBufferPool *pool;
-  gboolean update;
-  GstStructure *config;
+  GstAllocator *allocator = NULL;
+  GstAllocationParams params;
   GstCaps *caps = NULL;
 
-  quiclysrc = GST_QUICLYSRC (bsrc);
-
-  if (gst_query_get_n_allocation_pools(query) > 0) {
-    update = TRUE;
+  gst_query_parse_allocation(query, &caps, NULL);
+  if (gst_query_get_n_allocation_params(query) > 0) {
+    gst_query_parse_nth_allocation_param(query, 0, &allocator, &params);
   } else {
-    update = FALSE;
+    gst_allocation_params_init(&params);
+    gst_query_add_allocation_param(query, NULL, &params);
   }
 
-  pool = gst_buffer_pool_new();
-  config = gst_buffer_pool_get_config(pool);
-  gst_query_parse_allocation(query, &caps, NULL);
-  gst_buffer_pool_config_set_params(config, caps, quiclysrc->quicly_mtu, 0, 0);
-  gst_buffer_pool_set_config(pool, config);
+  pool = gst_quiclysrc_new_pool(quiclysrc, caps, allocator, &params);
+  if (allocator != NULL)
+    gst_object_unref(allocator);
+  if (pool == NULL)
+    return FALSE;
 
-  if (update)
-    gst_query_set_nth_allocation_pool(query, 0, pool, quiclysrc->quicly_mtu, 0, 0);
+  if (gst_query_get_n_allocation_pools(query) > 0)
+    gst_query_set_nth_allocation_pool(query, 0, pool, quiclysrc->quicly_mtu, quiclysrc->batch_size, 0);
   else
-    gst_query_add_allocation_pool(query, pool, quiclysrc->quicly_mtu, 0, 0);
+    gst_query_add_allocation_pool(query, pool, quiclysrc->quicly_mtu, quiclysrc->batch_size, 0);
 
   gst_object_unref(pool);
 
@@ -1347,6 +2228,224 @@ static gboolean gst_quiclysrc_set_clock(GstQuiclysrc *quiclysrc, GstClock *clock
   //return GST_ELEMENT_CLASS(gst_quiclysrc_parent_class)->set_clock(ele, clock);
 }
 
+static GstQuiclysrcPad *find_flow(GstQuiclysrc *quiclysrc, guint flow)
+{
+  for (guint i = 0; i < quiclysrc->flows->len; i++) {
+    GstQuiclysrcPad *pad = g_ptr_array_index(quiclysrc->flows, i);
+    if (pad->flow == flow)
+      return pad;
+  }
+  return NULL;
+}
+
+/*
+ * Request pads are only added before the source starts, as the flow ids
+ * are expected from then on. Without a name, the lowest free id is used
+ */
+static GstPad *gst_quiclysrc_request_new_pad(GstElement *element, GstPadTemplate *templ, const gchar *name,
+                                             const GstCaps *caps)
+{
+  GstQuiclysrc *quiclysrc = GST_QUICLYSRC(element);
+  GstQuiclysrcPad *pad;
+  gchar *pad_name;
+  guint flow = 1;
+
+  GST_OBJECT_LOCK(quiclysrc);
+  if (GST_STATE(quiclysrc) > GST_STATE_READY) {
+    GST_OBJECT_UNLOCK(quiclysrc);
+    g_printerr("Request pads can only be added before the source is started\n");
+    return NULL;
+  }
+  if (name != NULL) {
+    if (sscanf(name, "src_%u", &flow) != 1)
+      flow = 0;
+  } else {
+    while (flow < GST_QUICLY_MAX_FLOWS && find_flow(quiclysrc, flow) != NULL)
+      ++flow;
+  }
+  /* flow 0 is the media of the source pad */
+  if (flow == 0 || flow >= GST_QUICLY_MAX_FLOWS || find_flow(quiclysrc, flow) != NULL) {
+    GST_OBJECT_UNLOCK(quiclysrc);
+    g_printerr("Invalid or used request pad %s\n", name != NULL ? name : "src_%u");
+    return NULL;
+  }
+  pad_name = g_strdup_printf("src_%u", flow);
+  pad = g_object_new(GST_TYPE_QUICLYSRC_PAD, "name", pad_name, "direction", GST_PAD_TEMPLATE_DIRECTION(templ),
+                     "template", templ, NULL);
+  g_free(pad_name);
+  pad->flow = flow;
+  if (caps != NULL)
+    pad->caps = gst_caps_copy(caps);
+  g_ptr_array_add(quiclysrc->flows, pad);
+  GST_OBJECT_UNLOCK(quiclysrc);
+
+  gst_pad_set_query_function(GST_PAD(pad), GST_DEBUG_FUNCPTR(gst_quiclysrc_flow_query));
+  gst_element_add_pad(element, GST_PAD(pad));
+  return GST_PAD(pad);
+}
+
+static void gst_quiclysrc_release_pad(GstElement *element, GstPad *pad)
+{
+  GstQuiclysrc *quiclysrc = GST_QUICLYSRC(element);
+
+  GST_OBJECT_LOCK(quiclysrc);
+  g_ptr_array_remove(quiclysrc->flows, pad);
+  GST_OBJECT_UNLOCK(quiclysrc);
+  gst_element_remove_pad(element, pad);
+}
+
+/* The caps of a flow are the ones set on its pad, any if none are */
+static gboolean gst_quiclysrc_flow_query(GstPad *pad, GstObject *parent, GstQuery *query)
+{
+  GstQuiclysrcPad *flow = GST_QUICLYSRC_PAD(pad);
+  GstCaps *filter, *caps, *result;
+
+  if (GST_QUERY_TYPE(query) != GST_QUERY_CAPS)
+    return gst_pad_query_default(pad, parent, query);
+
+  gst_query_parse_caps(query, &filter);
+  GST_OBJECT_LOCK(flow);
+  caps = flow->caps != NULL ? gst_caps_ref(flow->caps) : gst_caps_new_any();
+  GST_OBJECT_UNLOCK(flow);
+  if (filter != NULL) {
+    result = gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref(caps);
+  } else {
+    result = caps;
+  }
+  gst_query_set_caps_result(query, result);
+  gst_caps_unref(result);
+  return TRUE;
+}
+
+/*
+ * Queue a packet of a request pad, to be pushed by the streaming thread.
+ * Called with the object lock held, from the thread receiving
+ */
+static void receive_flow(GstQuiclysrc *quiclysrc, guint flow, const void *data, gsize len)
+{
+  GstQuiclysrcPad *pad = find_flow(quiclysrc, flow);
+  GstBuffer *buffer;
+
+  if (pad == NULL) {
+    GST_LOG_OBJECT(quiclysrc, "Dropping a datagram of flow %u without pad", flow);
+    return;
+  }
+  if (g_queue_get_length(&pad->pending) >= FLOW_QUEUE_SIZE) {
+    ++pad->num_dropped;
+    return;
+  }
+  buffer = gst_buffer_new_allocate(NULL, len, NULL);
+  gst_buffer_fill(buffer, 0, data, len);
+  add_arrival_meta(quiclysrc, buffer);
+  g_queue_push_tail(&pad->pending, buffer);
+  ++pad->num_packets;
+  g_atomic_int_set(&quiclysrc->flows_pending, TRUE);
+}
+
+/* stream-start, caps and a time segment ahead of the first buffer of a request pad */
+static void push_flow_events(GstQuiclysrc *quiclysrc, GstQuiclysrcPad *pad)
+{
+  GstEvent *event;
+  GstCaps *caps;
+  GstSegment segment;
+  gchar *stream_id;
+
+  stream_id = gst_pad_create_stream_id_printf(GST_PAD(pad), GST_ELEMENT(quiclysrc), "%u", pad->flow);
+  event = gst_event_new_stream_start(stream_id);
+  g_free(stream_id);
+  /* grouped with the media of the source pad */
+  {
+    GstEvent *media_start = gst_pad_get_sticky_event(GST_BASE_SRC_PAD(quiclysrc), GST_EVENT_STREAM_START, 0);
+    guint group_id;
+    if (media_start != NULL) {
+      if (gst_event_parse_group_id(media_start, &group_id))
+        gst_event_set_group_id(event, group_id);
+      gst_event_unref(media_start);
+    }
+  }
+  gst_pad_push_event(GST_PAD(pad), event);
+
+  GST_OBJECT_LOCK(pad);
+  caps = pad->caps != NULL ? gst_caps_ref(pad->caps) : NULL;
+  GST_OBJECT_UNLOCK(pad);
+  if (caps != NULL) {
+    if (!gst_pad_push_event(GST_PAD(pad), gst_event_new_caps(caps)))
+      g_printerr("Could not set caps downstream of %s\n", GST_PAD_NAME(pad));
+    gst_caps_unref(caps);
+  }
+
+  gst_segment_init(&segment, GST_FORMAT_TIME);
+  gst_pad_push_event(GST_PAD(pad), gst_event_new_segment(&segment));
+  pad->need_events = FALSE;
+}
+
+/*
+ * Push the packets queued on the request pads, from the streaming
+ * thread. They are timestamped with the running time, like the media
+ */
+static void push_flows(GstQuiclysrc *quiclysrc)
+{
+  GstClockTime pts = GST_CLOCK_TIME_NONE;
+  GstClock *clock;
+  GstFlowReturn ret;
+  GQueue pending;
+  GstBuffer *buffer;
+
+  g_atomic_int_set(&quiclysrc->flows_pending, FALSE);
+  if ((clock = gst_element_get_clock(GST_ELEMENT(quiclysrc))) != NULL) {
+    GstClockTime now = gst_clock_get_time(clock), base_time = gst_element_get_base_time(GST_ELEMENT(quiclysrc));
+    if (now > base_time)
+      pts = now - base_time;
+    gst_object_unref(clock);
+  }
+
+  for (guint i = 0;; i++) {
+    GstQuiclysrcPad *pad;
+
+    GST_OBJECT_LOCK(quiclysrc);
+    if (i >= quiclysrc->flows->len) {
+      GST_OBJECT_UNLOCK(quiclysrc);
+      break;
+    }
+    pad = gst_object_ref(g_ptr_array_index(quiclysrc->flows, i));
+    pending = pad->pending;
+    g_queue_init(&pad->pending);
+    GST_OBJECT_UNLOCK(quiclysrc);
+
+    if (!g_queue_is_empty(&pending) && pad->need_events)
+      push_flow_events(quiclysrc, pad);
+    while ((buffer = g_queue_pop_head(&pending)) != NULL) {
+      GST_BUFFER_PTS(buffer) = pts;
+      if ((ret = gst_pad_push(GST_PAD(pad), buffer)) != GST_FLOW_OK)
+        GST_DEBUG_OBJECT(pad, "Pushing a buffer returned %s", gst_flow_get_name(ret));
+    }
+    gst_object_unref(pad);
+  }
+}
+
+/* End the request pads, after what has been received for them */
+static void push_flows_eos(GstQuiclysrc *quiclysrc)
+{
+  push_flows(quiclysrc);
+  for (guint i = 0;; i++) {
+    GstQuiclysrcPad *pad;
+
+    GST_OBJECT_LOCK(quiclysrc);
+    if (i >= quiclysrc->flows->len) {
+      GST_OBJECT_UNLOCK(quiclysrc);
+      break;
+    }
+    pad = gst_object_ref(g_ptr_array_index(quiclysrc->flows, i));
+    GST_OBJECT_UNLOCK(quiclysrc);
+
+    if (pad->need_events)
+      push_flow_events(quiclysrc, pad);
+    gst_pad_push_event(GST_PAD(pad), gst_event_new_eos());
+    gst_object_unref(pad);
+  }
+}
+
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
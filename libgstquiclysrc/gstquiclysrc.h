@@ -34,8 +34,57 @@ G_BEGIN_DECLS
 #define GST_IS_QUICLYSRC_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_QUICLYSRC))
 #define GST_QUICLYSRC_CAST(obj)   ((GstQuiclysrc *)(obj))
 
+#define GST_TYPE_QUICLYSRC_PAD   (gst_quiclysrc_pad_get_type())
+#define GST_QUICLYSRC_PAD(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_QUICLYSRC_PAD,GstQuiclysrcPad))
+#define GST_IS_QUICLYSRC_PAD(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_QUICLYSRC_PAD))
+
+#define GST_QUICLYSRC_LATENCY_BUCKETS 24
+
 typedef struct _GstQuiclysrc GstQuiclysrc;
 typedef struct _GstQuiclysrcClass GstQuiclysrcClass;
+typedef struct _GstQuiclysrcSlot GstQuiclysrcSlot;
+typedef struct _GstQuiclysrcRing GstQuiclysrcRing;
+typedef struct _GstQuiclysrcPad GstQuiclysrcPad;
+typedef struct _GstQuiclysrcPadClass GstQuiclysrcPadClass;
+
+/* Request pad (src_%u): the datagrams of the flow with the number of the
+ * pad, see gstquiclycontrol.h */
+struct _GstQuiclysrcPad
+{
+  GstPad parent;
+
+  guint flow;
+  GstCaps *caps; /* not exchanged, set by the application */
+  GQueue pending; /* received, pushed by the streaming thread. Protected by the object lock of the element */
+  gboolean need_events; /* stream-start, caps and segment go ahead of the first buffer */
+
+  guint64 num_packets;
+  guint64 num_dropped; /* the streaming thread fell behind */
+};
+
+struct _GstQuiclysrcPadClass
+{
+  GstPadClass parent_class;
+};
+
+/* Buffer of the batch being received, mapped until it is pushed */
+struct _GstQuiclysrcSlot
+{
+  GstBuffer *buffer;
+  GstMapInfo map;
+  gsize len; /* bytes received */
+};
+
+/* Single-producer single-consumer queue handing the buffers received
+ * by the receive thread over to create. head is only written by the
+ * consumer, tail only by the producer */
+struct _GstQuiclysrcRing
+{
+  GstBuffer **entries;
+  guint capacity; /* power of two */
+  gint head;
+  gint tail;
+};
 
 struct _GstQuiclysrc
 {
@@ -66,9 +115,21 @@ struct _GstQuiclysrc
 
   ptls_iovec_t resumption_token;
 
+  /* session resumption (0-RTT) */
+  gchar *session_file;
+  ptls_save_ticket_t save_ticket;
+  ptls_iovec_t session_ticket;
+
   /* quicly receive */
   quicly_dgram_t *dgram;
   quicly_stream_t *stream;
+  quicly_stream_t *control_stream; /* see gstquiclycontrol.h */
+  gint key_frame_requested; /* sent from the streaming thread */
+  guint64 num_key_frame_requests;
+  /* packets of per-frame streams that did not fit into the buffer list */
+  GQueue frame_packets;
+  guint64 num_frame_packets_dropped;
+  guint64 num_frames_reset;
   gchar *recv_buf;
   gsize recv_buf_size;
 
@@ -87,22 +148,44 @@ struct _GstQuiclysrc
   GCancellable *cancellable;
   gboolean made_cancel_fd;
 
-  /* For buffer list output */
-  GstAllocator *allocator;
-  GstAllocationParams params;
-
-  GstMemory **mem_list;
-  GstMapInfo **map_list;
-  GInputVector **vec_list;
-  gint *pushed_list;
-
-  gboolean mem_list_allocated;
-  gsize mem_list_size;
-  GstClockTime prev_arrival_time;
-  GstClockTime prev_transit;
+  /* For buffer list output: the buffers come from pool, see
+   * decide_allocation. Slots that were not filled are kept for the next
+   * batch */
+  GstBufferPool *pool;
+  GstQuiclysrcSlot *slots;
+  gsize batch_size;
+
+  /* receive thread: reads the socket and sends the ACKs while running,
+   * create only takes the received buffers out of the ring */
+  gboolean receive_thread;
+  GThread *receive_thread_handle;
+  gint receive_running;
+  int event_fd;
+  GstQuiclysrcRing ring;
+  GMutex ring_lock; /* only for waiting on ring_cond */
+  GCond ring_cond;
+  gint caps_pending; /* received by the thread, not yet set downstream */
+  guint64 num_ring_dropped;
+
+  /* kernel receive time (SO_TIMESTAMPNS, CLOCK_REALTIME) of the packet
+   * being processed, attached to the buffers as reference timestamp */
+  GstClockTime arrival_time;
+  /* RFC 3550 interarrival jitter, in 1/16 RTP timestamp units */
+  GstCaps *jitter_caps; /* caps the clock rate has been taken from */
+  gint clock_rate;
+  gboolean have_transit;
+  gint32 prev_transit;
   guint64 jitter;
   guint64 max_jitter;
   guint num_jitter_spikes;
+  /* time from arrival until pushed downstream, bucket i counts the
+   * buffers below 2^i us, the last one all others */
+  guint64 latency_histogram[GST_QUICLYSRC_LATENCY_BUCKETS];
+
+  /* request pads: flows received besides the media, fixed while running */
+  GPtrArray *flows;
+  gboolean flow_framing;
+  gint flows_pending; /* packets queued on the request pads */
 };
 
 struct _GstQuiclysrcClass
@@ -111,6 +194,7 @@ struct _GstQuiclysrcClass
 };
 
 GType gst_quiclysrc_get_type (void);
+GType gst_quiclysrc_pad_get_type (void);
 
 G_END_DECLS
 
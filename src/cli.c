@@ -22,6 +22,7 @@
 #include <getopt.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <sys/select.h>
 #include <sys/socket.h>
@@ -59,6 +60,7 @@ static void hexdump(const char *title, const uint8_t *p, size_t l)
 int dgram_counter = 0;
 
 static int save_session_ticket_cb(ptls_save_ticket_t *_self, ptls_t *tls, ptls_iovec_t src);
+static ptls_aead_context_t *get_address_token_encryptor(quicly_conn_t *conn);
 static int on_client_hello_cb(ptls_on_client_hello_t *_self, ptls_t *tls, ptls_on_client_hello_parameters_t *params);
 
 static const char *session_file = NULL;
@@ -70,6 +72,8 @@ static quicly_cid_plaintext_t next_cid;
 static struct {
     ptls_aead_context_t *enc, *dec;
 } address_token_aead;
+static uint8_t address_token_secret[PTLS_MAX_DIGEST_SIZE];
+static const char *cid_key;
 static ptls_save_ticket_t save_session_ticket = {save_session_ticket_cb};
 static ptls_on_client_hello_t on_client_hello = {on_client_hello_cb};
 static int enforce_retry;
@@ -425,7 +429,7 @@ static quicly_closed_by_peer_t closed_by_peer = {&on_closed_by_peer};
 static int on_generate_resumption_token(quicly_generate_resumption_token_t *self, quicly_conn_t *conn, ptls_buffer_t *buf,
                                         quicly_address_token_plaintext_t *token)
 {
-    return quicly_encrypt_address_token(tlsctx.random_bytes, address_token_aead.enc, buf, buf->off, token);
+    return quicly_encrypt_address_token(tlsctx.random_bytes, get_address_token_encryptor(conn), buf, buf->off, token);
 }
 
 static quicly_generate_resumption_token_t generate_resumption_token = {&on_generate_resumption_token};
@@ -718,16 +722,65 @@ static int run_client(struct sockaddr *sa, const char *host)
     }
 }
 
-static quicly_conn_t **conns;
-static size_t num_conns = 0;
+/**
+ * a datagram that arrived at a socket other than the one owned by the thread that the destination CID belongs to
+ */
+struct st_handoff_packet_t {
+    struct st_handoff_packet_t *next;
+    struct sockaddr sa;
+    size_t len;
+    uint8_t bytes[1];
+};
 
-static void on_signal(int signo)
+/**
+ * Each server thread owns one SO_REUSEPORT socket and the connections accepted through that socket. The thread_id of the CIDs
+ * issued by a thread is set to its index, so that packets being routed to a different socket (e.g. after NAT rebinding) can be
+ * handed off to the owning thread. The crypto contexts of the CID encryptor and the address token AEAD are not thread-safe;
+ * therefore each thread uses its own copy of the context, built from the same keys so that every thread can decode any CID.
+ */
+struct st_server_thread_t {
+    pthread_t tid;
+    int fd;
+    quicly_context_t ctx;
+    struct {
+        ptls_aead_context_t *enc, *dec;
+    } address_token_aead;
+    quicly_cid_plaintext_t next_cid;
+    quicly_conn_t **conns;
+    size_t num_conns;
+    struct {
+        pthread_mutex_t mutex;
+        int fds[2];
+        struct st_handoff_packet_t *head, **tail;
+    } handoff;
+};
+
+static struct st_server_thread_t *server_threads;
+static size_t num_server_threads = 1;
+
+static ptls_aead_context_t *get_address_token_encryptor(quicly_conn_t *conn)
 {
     size_t i;
-    for (i = 0; i != num_conns; ++i) {
-        const quicly_cid_plaintext_t *master_id = quicly_get_master_id(conns[i]);
-        fprintf(stderr, "conn:%08" PRIu32 ": ", master_id->master_id);
-        dump_stats(stderr, conns[i]);
+
+    if (server_threads != NULL) {
+        for (i = 0; i != num_server_threads; ++i) {
+            if (quicly_get_context(conn) == &server_threads[i].ctx)
+                return server_threads[i].address_token_aead.enc;
+        }
+    }
+    return address_token_aead.enc;
+}
+
+static void on_signal(int signo)
+{
+    size_t i, j;
+    for (i = 0; i != num_server_threads; ++i) {
+        struct st_server_thread_t *thread = server_threads + i;
+        for (j = 0; j != thread->num_conns; ++j) {
+            const quicly_cid_plaintext_t *master_id = quicly_get_master_id(thread->conns[j]);
+            fprintf(stderr, "conn:%08" PRIu32 ":%" PRIu32 ": ", master_id->master_id, (uint32_t)master_id->thread_id);
+            dump_stats(stderr, thread->conns[j]);
+        }
     }
     if (signo == SIGINT)
         _exit(0);
@@ -872,26 +925,141 @@ static int validate_token(struct sockaddr *remote, ptls_iovec_t client_cid, ptls
     return 1;
 }
 
-static int run_server(struct sockaddr *sa, socklen_t salen)
+static int handoff_packet(struct st_server_thread_t *dest, struct sockaddr *sa, const uint8_t *bytes, size_t len)
 {
-    int fd;
+    struct st_handoff_packet_t *packet;
+
+    if ((packet = malloc(offsetof(struct st_handoff_packet_t, bytes) + len)) == NULL)
+        return PTLS_ERROR_NO_MEMORY;
+    packet->next = NULL;
+    packet->sa = *sa;
+    packet->len = len;
+    memcpy(packet->bytes, bytes, len);
+
+    pthread_mutex_lock(&dest->handoff.mutex);
+    int was_empty = dest->handoff.head == NULL;
+    *dest->handoff.tail = packet;
+    dest->handoff.tail = &packet->next;
+    pthread_mutex_unlock(&dest->handoff.mutex);
+
+    /* wake up the owner */
+    if (was_empty) {
+        while (write(dest->handoff.fds[1], "", 1) == -1 && errno == EINTR)
+            ;
+    }
+    return 0;
+}
 
-    signal(SIGINT, on_signal);
-    signal(SIGHUP, on_signal);
+static struct st_handoff_packet_t *take_handoff_packets(struct st_server_thread_t *thread)
+{
+    struct st_handoff_packet_t *packets;
+    char buf[16];
 
-    if ((fd = socket(sa->sa_family, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
-        perror("socket(2) failed");
-        return 1;
-    }
-    int on = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0) {
-        perror("setsockopt(SO_REUSEADDR) failed");
-        return 1;
-    }
-    if (bind(fd, sa, salen) != 0) {
-        perror("bind(2) failed");
-        return 1;
+    while (read(thread->handoff.fds[0], buf, sizeof(buf)) > 0)
+        ;
+    pthread_mutex_lock(&thread->handoff.mutex);
+    packets = thread->handoff.head;
+    thread->handoff.head = NULL;
+    thread->handoff.tail = &thread->handoff.head;
+    pthread_mutex_unlock(&thread->handoff.mutex);
+
+    return packets;
+}
+
+static void server_handle_datagram(struct st_server_thread_t *thread, struct sockaddr *sa, uint8_t *buf, size_t len)
+{
+    int fd = thread->fd;
+    size_t off = 0;
+
+    while (off != len) {
+        quicly_decoded_packet_t packet;
+        size_t plen = quicly_decode_packet(&thread->ctx, &packet, buf + off, len - off);
+        if (plen == SIZE_MAX)
+            break;
+        if (off == 0 && !packet.cid.dest.might_be_client_generated && packet.cid.dest.plaintext.node_id == 0 &&
+            packet.cid.dest.plaintext.thread_id < num_server_threads &&
+            server_threads + packet.cid.dest.plaintext.thread_id != thread) {
+            /* the CID was issued by another thread; coalesced packets carry the same CID, so the entire datagram is moved */
+            if (handoff_packet(server_threads + packet.cid.dest.plaintext.thread_id, sa, buf, len) != 0)
+                fprintf(stderr, "failed to hand off packet\n");
+            return;
+        }
+        if (QUICLY_PACKET_IS_LONG_HEADER(packet.octets.base[0])) {
+            if (packet.version != QUICLY_PROTOCOL_VERSION) {
+                quicly_datagram_t *rp = quicly_send_version_negotiation(&thread->ctx, sa, packet.cid.src, NULL, packet.cid.dest.encrypted);
+                assert(rp != NULL);
+                if (send_one(fd, rp) == -1)
+                    perror("sendmsg failed");
+                break;
+            }
+            /* there is no way to send response to these v1 packets */
+            if (packet.cid.dest.encrypted.len > QUICLY_MAX_CID_LEN_V1 || packet.cid.src.len > QUICLY_MAX_CID_LEN_V1)
+                break;
+        }
+
+        quicly_conn_t *conn = NULL;
+        size_t i;
+        for (i = 0; i != thread->num_conns; ++i) {
+            if (quicly_is_destination(thread->conns[i], NULL, sa, &packet)) {
+                conn = thread->conns[i];
+                break;
+            }
+        }
+        if (conn != NULL) {
+            /* existing connection */
+            quicly_receive(conn, NULL, sa, &packet);
+        } else if (QUICLY_PACKET_IS_INITIAL(packet.octets.base[0])) {
+            /* long header packet; potentially a new connection */
+            quicly_address_token_plaintext_t *token = NULL, token_buf;
+            if (packet.token.len != 0 &&
+                quicly_decrypt_address_token(thread->address_token_aead.dec, &token_buf, packet.token.base, packet.token.len, 0) == 0 &&
+                validate_token(sa, packet.cid.src, packet.cid.dest.encrypted, &token_buf))
+                token = &token_buf;
+            if (enforce_retry && token == NULL && packet.cid.dest.encrypted.len >= 8) {
+                /* unbound connection; send a retry token unless the client has supplied the correct one, but not too many
+                 */
+                uint8_t new_server_cid[8];
+                memcpy(new_server_cid, packet.cid.dest.encrypted.base, sizeof(new_server_cid));
+                new_server_cid[0] ^= 0xff;
+                quicly_datagram_t *rp = quicly_send_retry(&thread->ctx, thread->address_token_aead.enc, sa, packet.cid.src, NULL,
+                                                          ptls_iovec_init(new_server_cid, sizeof(new_server_cid)),
+                                                          packet.cid.dest.encrypted, ptls_iovec_init(NULL, 0),
+                                                          ptls_iovec_init(NULL, 0));
+                assert(rp != NULL);
+                if (send_one(fd, rp) == -1)
+                    perror("sendmsg failed");
+                break;
+            } else {
+                /* new connection */
+                int ret = quicly_accept(&conn, &thread->ctx, NULL, sa, &packet, token, &thread->next_cid, NULL);
+                if (ret == 0) {
+                    assert(conn != NULL);
+                    ++thread->next_cid.master_id;
+                    thread->conns = realloc(thread->conns, sizeof(*thread->conns) * (thread->num_conns + 1));
+                    assert(thread->conns != NULL);
+                    thread->conns[thread->num_conns++] = conn;
+                } else {
+                    assert(conn == NULL);
+                }
+            }
+        } else if (!QUICLY_PACKET_IS_LONG_HEADER(packet.octets.base[0])) {
+            /* short header packet; potentially a dead connection. No need to check the length of the incoming packet,
+             * because loop is prevented by authenticating the CID (by checking node_id and thread_id). If the peer is also
+             * sending a reset, then the next CID is highly likely to contain a non-authenticating CID, ... */
+            if (packet.cid.dest.plaintext.node_id == 0 && packet.cid.dest.plaintext.thread_id < num_server_threads) {
+                quicly_datagram_t *dgram = quicly_send_stateless_reset(&thread->ctx, sa, NULL, packet.cid.dest.encrypted.base);
+                if (send_one(fd, dgram) == -1)
+                    perror("sendmsg failed");
+            }
+        }
+        off += plen;
     }
+}
+
+static void *run_server_thread(void *_thread)
+{
+    struct st_server_thread_t *thread = _thread;
+    int fd = thread->fd, nfds = (fd > thread->handoff.fds[0] ? fd : thread->handoff.fds[0]) + 1;
 
     while (1) {
         fd_set readfds;
@@ -899,13 +1067,13 @@ static int run_server(struct sockaddr *sa, socklen_t salen)
         do {
             int64_t timeout_at = INT64_MAX;
             size_t i;
-            for (i = 0; i != num_conns; ++i) {
-                int64_t conn_to = quicly_get_first_timeout(conns[i]);
+            for (i = 0; i != thread->num_conns; ++i) {
+                int64_t conn_to = quicly_get_first_timeout(thread->conns[i]);
                 if (conn_to < timeout_at)
                     timeout_at = conn_to;
             }
             if (timeout_at != INT64_MAX) {
-                int64_t delta = timeout_at - ctx.now->cb(ctx.now);
+                int64_t delta = timeout_at - thread->ctx.now->cb(thread->ctx.now);
                 if (delta > 0) {
                     tvbuf.tv_sec = delta / 1000;
                     tvbuf.tv_usec = (delta % 1000) * 1000;
@@ -919,7 +1087,8 @@ static int run_server(struct sockaddr *sa, socklen_t salen)
             }
             FD_ZERO(&readfds);
             FD_SET(fd, &readfds);
-        } while (select(fd + 1, &readfds, NULL, NULL, tv) == -1 && errno == EINTR);
+            FD_SET(thread->handoff.fds[0], &readfds);
+        } while (select(nfds, &readfds, NULL, NULL, tv) == -1 && errno == EINTR);
         if (FD_ISSET(fd, &readfds)) {
             uint8_t buf[4096];
             struct msghdr mess;
@@ -937,99 +1106,96 @@ static int run_server(struct sockaddr *sa, socklen_t salen)
                 ;
             if (verbosity >= 2)
                 hexdump("recvmsg", buf, rret);
-            size_t off = 0;
-            while (off != rret) {
-                quicly_decoded_packet_t packet;
-                size_t plen = quicly_decode_packet(&ctx, &packet, buf + off, rret - off);
-                if (plen == SIZE_MAX)
-                    break;
-                if (QUICLY_PACKET_IS_LONG_HEADER(packet.octets.base[0])) {
-                    if (packet.version != QUICLY_PROTOCOL_VERSION) {
-                        quicly_datagram_t *rp =
-                            quicly_send_version_negotiation(&ctx, &sa, packet.cid.src, NULL, packet.cid.dest.encrypted);
-                        assert(rp != NULL);
-                        if (send_one(fd, rp) == -1)
-                            perror("sendmsg failed");
-                        break;
-                    }
-                    /* there is no way to send response to these v1 packets */
-                    if (packet.cid.dest.encrypted.len > QUICLY_MAX_CID_LEN_V1 || packet.cid.src.len > QUICLY_MAX_CID_LEN_V1)
-                        break;
-                }
-
-                quicly_conn_t *conn = NULL;
-                size_t i;
-                for (i = 0; i != num_conns; ++i) {
-                    if (quicly_is_destination(conns[i], NULL, &sa, &packet)) {
-                        conn = conns[i];
-                        break;
-                    }
-                }
-                if (conn != NULL) {
-                    /* existing connection */
-                    quicly_receive(conn, NULL, &sa, &packet);
-                } else if (QUICLY_PACKET_IS_INITIAL(packet.octets.base[0])) {
-                    /* long header packet; potentially a new connection */
-                    quicly_address_token_plaintext_t *token = NULL, token_buf;
-                    if (packet.token.len != 0 &&
-                        quicly_decrypt_address_token(address_token_aead.dec, &token_buf, packet.token.base, packet.token.len, 0) ==
-                            0 &&
-                        validate_token(&sa, packet.cid.src, packet.cid.dest.encrypted, &token_buf))
-                        token = &token_buf;
-                    if (enforce_retry && token == NULL && packet.cid.dest.encrypted.len >= 8) {
-                        /* unbound connection; send a retry token unless the client has supplied the correct one, but not too many
-                         */
-                        uint8_t new_server_cid[8];
-                        memcpy(new_server_cid, packet.cid.dest.encrypted.base, sizeof(new_server_cid));
-                        new_server_cid[0] ^= 0xff;
-                        quicly_datagram_t *rp = quicly_send_retry(&ctx, address_token_aead.enc, &sa, packet.cid.src, NULL,
-                                                                  ptls_iovec_init(new_server_cid, sizeof(new_server_cid)),
-                                                                  packet.cid.dest.encrypted, ptls_iovec_init(NULL, 0),
-                                                                  ptls_iovec_init(NULL, 0));
-                        assert(rp != NULL);
-                        if (send_one(fd, rp) == -1)
-                            perror("sendmsg failed");
-                        break;
-                    } else {
-                        /* new connection */
-                        int ret = quicly_accept(&conn, &ctx, NULL, &sa, &packet, token, &next_cid, NULL);
-                        if (ret == 0) {
-                            assert(conn != NULL);
-                            ++next_cid.master_id;
-                            conns = realloc(conns, sizeof(*conns) * (num_conns + 1));
-                            assert(conns != NULL);
-                            conns[num_conns++] = conn;
-                        } else {
-                            assert(conn == NULL);
-                        }
-                    }
-                } else if (!QUICLY_PACKET_IS_LONG_HEADER(packet.octets.base[0])) {
-                    /* short header packet; potentially a dead connection. No need to check the length of the incoming packet,
-                     * because loop is prevented by authenticating the CID (by checking node_id and thread_id). If the peer is also
-                     * sending a reset, then the next CID is highly likely to contain a non-authenticating CID, ... */
-                    if (packet.cid.dest.plaintext.node_id == 0 && packet.cid.dest.plaintext.thread_id == 0) {
-                        quicly_datagram_t *dgram = quicly_send_stateless_reset(&ctx, &sa, NULL, packet.cid.dest.encrypted.base);
-                        if (send_one(fd, dgram) == -1)
-                            perror("sendmsg failed");
-                    }
-                }
-                off += plen;
+            server_handle_datagram(thread, &sa, buf, rret);
+        }
+        if (FD_ISSET(thread->handoff.fds[0], &readfds)) {
+            struct st_handoff_packet_t *packet;
+            while ((packet = take_handoff_packets(thread)) != NULL) {
+                do {
+                    struct st_handoff_packet_t *next = packet->next;
+                    server_handle_datagram(thread, &packet->sa, packet->bytes, packet->len);
+                    free(packet);
+                    packet = next;
+                } while (packet != NULL);
             }
         }
         {
             size_t i;
-            for (i = 0; i != num_conns; ++i) {
-                if (quicly_get_first_timeout(conns[i]) <= ctx.now->cb(ctx.now)) {
-                    if (send_pending(fd, conns[i]) != 0) {
-                        quicly_free(conns[i]);
-                        memmove(conns + i, conns + i + 1, (num_conns - i - 1) * sizeof(*conns));
+            for (i = 0; i != thread->num_conns; ++i) {
+                if (quicly_get_first_timeout(thread->conns[i]) <= thread->ctx.now->cb(thread->ctx.now)) {
+                    if (send_pending(fd, thread->conns[i]) != 0) {
+                        quicly_free(thread->conns[i]);
+                        memmove(thread->conns + i, thread->conns + i + 1, (thread->num_conns - i - 1) * sizeof(*thread->conns));
                         --i;
-                        --num_conns;
+                        --thread->num_conns;
                     }
                 }
             }
         }
     }
+
+    return NULL;
+}
+
+static int run_server(struct sockaddr *sa, socklen_t salen)
+{
+    size_t i;
+
+    signal(SIGINT, on_signal);
+    signal(SIGHUP, on_signal);
+
+    if ((server_threads = calloc(num_server_threads, sizeof(*server_threads))) == NULL) {
+        perror("no memory");
+        return 1;
+    }
+    for (i = 0; i != num_server_threads; ++i) {
+        struct st_server_thread_t *thread = server_threads + i;
+        int fd;
+        if ((fd = socket(sa->sa_family, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+            perror("socket(2) failed");
+            return 1;
+        }
+        int on = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0) {
+            perror("setsockopt(SO_REUSEADDR) failed");
+            return 1;
+        }
+        /* the kernel distributes the flows among the sockets by the hash of the 4-tuple */
+        if (num_server_threads > 1 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+            perror("setsockopt(SO_REUSEPORT) failed");
+            return 1;
+        }
+        if (bind(fd, sa, salen) != 0) {
+            perror("bind(2) failed");
+            return 1;
+        }
+        thread->fd = fd;
+        thread->ctx = ctx;
+        thread->ctx.cid_encryptor = quicly_new_default_cid_encryptor(&ptls_openssl_bfecb, &ptls_openssl_aes128ecb, &ptls_openssl_sha256,
+                                                                     ptls_iovec_init(cid_key, strlen(cid_key)));
+        thread->address_token_aead.enc = ptls_aead_new(&ptls_openssl_aes128gcm, &ptls_openssl_sha256, 1, address_token_secret, "");
+        thread->address_token_aead.dec = ptls_aead_new(&ptls_openssl_aes128gcm, &ptls_openssl_sha256, 0, address_token_secret, "");
+        thread->next_cid.thread_id = (uint32_t)i;
+        pthread_mutex_init(&thread->handoff.mutex, NULL);
+        thread->handoff.tail = &thread->handoff.head;
+        if (pipe(thread->handoff.fds) != 0) {
+            perror("pipe(2) failed");
+            return 1;
+        }
+        fcntl(thread->handoff.fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(thread->handoff.fds[1], F_SETFL, O_NONBLOCK);
+    }
+
+    /* the main thread serves the first socket */
+    for (i = 1; i != num_server_threads; ++i) {
+        if (pthread_create(&server_threads[i].tid, NULL, run_server_thread, server_threads + i) != 0) {
+            perror("pthread_create failed");
+            return 1;
+        }
+    }
+    run_server_thread(server_threads);
+
+    return 0;
 }
 
 static void load_session(void)
@@ -1188,9 +1354,13 @@ static void usage(const char *cmd)
            "  -r [initial-pto]          initial PTO (in milliseconds)\n"
            "  -S [num-speculative-ptos] number of speculative PTOs\n"
            "  -s session-file           file to load / store the session ticket\n"
+           "  -t num-threads            number of server threads, each receiving on its own\n"
+           "                            SO_REUSEPORT socket (server-only; default: 1)\n"
            "  -V                        verify peer using the default certificates\n"
            "  -v                        verbose mode (-vv emits packet dumps as well)\n"
            "  -x named-group            named group to be used (default: secp256r1)\n"
+           "  -y cc-algorithm           congestion control algorithm to be used (reno, cubic, bbr\n"
+           "                            or media; default: reno)\n"
            "  -X                        max bidirectional stream count (default: 100)\n"
            "  -h                        print this help\n"
            "\n",
@@ -1199,7 +1369,7 @@ static void usage(const char *cmd)
 
 int main(int argc, char **argv)
 {
-    const char *host, *port, *cid_key = NULL;
+    const char *host, *port;
     struct sockaddr_storage sa;
     socklen_t salen;
     int ch;
@@ -1215,13 +1385,12 @@ int main(int argc, char **argv)
     quicly_amend_ptls_context(ctx.tls);
 
     {
-        uint8_t secret[PTLS_MAX_DIGEST_SIZE];
-        ctx.tls->random_bytes(secret, ptls_openssl_sha256.digest_size);
-        address_token_aead.enc = ptls_aead_new(&ptls_openssl_aes128gcm, &ptls_openssl_sha256, 1, secret, "");
-        address_token_aead.dec = ptls_aead_new(&ptls_openssl_aes128gcm, &ptls_openssl_sha256, 0, secret, "");
+        ctx.tls->random_bytes(address_token_secret, ptls_openssl_sha256.digest_size);
+        address_token_aead.enc = ptls_aead_new(&ptls_openssl_aes128gcm, &ptls_openssl_sha256, 1, address_token_secret, "");
+        address_token_aead.dec = ptls_aead_new(&ptls_openssl_aes128gcm, &ptls_openssl_sha256, 0, address_token_secret, "");
     }
 
-    while ((ch = getopt(argc, argv, "a:C:c:k:K:Ee:i:I:l:M:m:Nnp:P:Rr:S:s:Vvx:X:h")) != -1) {
+    while ((ch = getopt(argc, argv, "a:C:c:k:K:Ee:i:I:l:M:m:Nnp:P:Rr:S:s:t:Vvx:X:y:h")) != -1) {
         switch (ch) {
         case 'a':
             assert(negotiated_protocols.count < sizeof(negotiated_protocols.list) / sizeof(negotiated_protocols.list[0]));
@@ -1318,6 +1487,12 @@ int main(int argc, char **argv)
         case 's':
             session_file = optarg;
             break;
+        case 't':
+            if (sscanf(optarg, "%zu", &num_server_threads) != 1 || num_server_threads == 0 || num_server_threads > 0xffffff) {
+                fprintf(stderr, "invalid number of threads: %s\n", optarg);
+                exit(1);
+            }
+            break;
         case 'V':
             setup_verify_certificate(ctx.tls);
             break;
@@ -1353,6 +1528,17 @@ int main(int argc, char **argv)
                 exit(1);
             }
             break;
+        case 'y': {
+            size_t i;
+            for (i = 0; quicly_cc_all_algorithms[i] != NULL; ++i)
+                if (strcasecmp(optarg, quicly_cc_all_algorithms[i]->name) == 0)
+                    break;
+            if (quicly_cc_all_algorithms[i] == NULL) {
+                fprintf(stderr, "unknown congestion control algorithm: %s\n", optarg);
+                exit(1);
+            }
+            ctx.cc_algorithm = quicly_cc_all_algorithms[i];
+        } break;
         default:
             usage(argv[0]);
             exit(1);
@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2019 Fastly, Janardhan Iyengar
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "quicly/cc.h"
+#include "test.h"
+
+#define MSS QUICLY_MAX_PACKET_SIZE
+#define NUM_RTT_SAMPLES 8
+
+static const quicly_rate_sample_t no_rate_sample = {UINT64_MAX};
+
+static void test_reno(void)
+{
+    quicly_cc_t cc;
+    quicly_rtt_t rtt = {10, 10, 0, 10};
+    uint32_t cwnd;
+
+    quicly_cc_init(&cc, &quicly_cc_reno, 0);
+    ok(cc.cwnd == QUICLY_INITIAL_WINDOW * MSS);
+    ok(cc.ssthresh == UINT32_MAX);
+
+    /* slow start */
+    quicly_cc_on_acked(&cc, &rtt, 10 * MSS, 9, 10 * MSS, 10, 10, &no_rate_sample);
+    ok(cc.cwnd == 20 * MSS);
+
+    /* loss reduces cwnd once per recovery period */
+    quicly_cc_on_lost(&cc, &rtt, MSS, 10, 30, 20);
+    cwnd = cc.cwnd;
+    ok(cwnd == (uint32_t)(20 * MSS * 0.7));
+    ok(cc.ssthresh == cwnd);
+    quicly_cc_on_lost(&cc, &rtt, MSS, 11, 31, 20);
+    ok(cc.cwnd == cwnd);
+
+    /* no increase in recovery */
+    quicly_cc_on_acked(&cc, &rtt, MSS, 20, cwnd, 31, 30, &no_rate_sample);
+    ok(cc.cwnd == cwnd);
+
+    /* congestion avoidance increases cwnd by one MSS per cwnd acked */
+    quicly_cc_on_acked(&cc, &rtt, cwnd, 40, cwnd, 50, 40, &no_rate_sample);
+    ok(cc.cwnd == cwnd + MSS);
+
+    quicly_cc_on_persistent_congestion(&cc, &rtt, 50);
+    ok(cc.cwnd == QUICLY_MIN_CWND * MSS);
+}
+
+static void test_cubic(void)
+{
+    quicly_cc_t cc;
+    quicly_rtt_t rtt = {10, 10, 0, 10};
+    uint64_t pn = 0;
+    int64_t now = 0;
+    uint32_t cwnd, w_max;
+
+    quicly_cc_init(&cc, &quicly_cc_cubic, now);
+    ok(cc.cwnd == QUICLY_INITIAL_WINDOW * MSS);
+
+    /* slow start, without an increase in delay */
+    quicly_cc_on_acked(&cc, &rtt, 10 * MSS, pn, 10 * MSS, pn + 10, now, &no_rate_sample);
+    ok(cc.cwnd == 20 * MSS);
+    pn += 10;
+
+    /* multiplicative decrease */
+    w_max = cc.cwnd;
+    now += 10;
+    quicly_cc_on_lost(&cc, &rtt, MSS, pn, pn + 10, now);
+    cwnd = cc.cwnd;
+    ok(cwnd == (uint32_t)(w_max * 0.7));
+    ok(cc.ssthresh == cwnd);
+    pn += 10;
+
+    /* cwnd grows back to w_max over K seconds, and beyond */
+    while (cc.cwnd < w_max && now < 60000) {
+        now += 10;
+        quicly_cc_on_acked(&cc, &rtt, cc.cwnd, pn, cc.cwnd, pn + 1, now, &no_rate_sample);
+        ++pn;
+    }
+    ok(cc.cwnd >= w_max);
+
+    /* persistent congestion collapses cwnd, slow start resumes */
+    quicly_cc_on_persistent_congestion(&cc, &rtt, now);
+    ok(cc.cwnd == QUICLY_MIN_CWND * MSS);
+    now += 10;
+    quicly_cc_on_acked(&cc, &rtt, MSS, pn, QUICLY_MIN_CWND * MSS, pn + 1, now, &no_rate_sample);
+    ok(cc.cwnd == (QUICLY_MIN_CWND + 1) * MSS);
+}
+
+static void hystart_ack(quicly_cc_t *cc, quicly_rtt_t *rtt, uint32_t bytes, uint64_t pn)
+{
+    quicly_cc_on_acked(cc, rtt, bytes, pn, cc->cwnd, pn + 100, 0, &no_rate_sample);
+}
+
+static void test_hystart(void)
+{
+    quicly_cc_t cc;
+    quicly_rtt_t rtt = {50, 50, 0, 50};
+    uint64_t pn = 0;
+    uint32_t cwnd;
+    size_t i;
+
+    quicly_cc_init(&cc, &quicly_cc_cubic, 0);
+
+    /* first round establishes the baseline RTT */
+    for (i = 0; i != NUM_RTT_SAMPLES; ++i)
+        hystart_ack(&cc, &rtt, MSS, pn++);
+    ok(cc.state.cubic.hystart.css_baseline_min_rtt == UINT32_MAX);
+
+    /* delay increases in the next round; enter conservative slow start */
+    rtt.latest = 70;
+    pn = cc.state.cubic.hystart.window_end;
+    for (i = 0; i != NUM_RTT_SAMPLES; ++i)
+        hystart_ack(&cc, &rtt, MSS, pn++);
+    ok(cc.state.cubic.hystart.css_baseline_min_rtt == 70);
+    ok(cc.ssthresh == UINT32_MAX);
+
+    /* growth slows down in CSS */
+    cwnd = cc.cwnd;
+    hystart_ack(&cc, &rtt, 4 * MSS, pn++);
+    ok(cc.cwnd == cwnd + MSS);
+
+    /* congestion avoidance is entered after spending CSS_ROUNDS in CSS */
+    for (i = 0; i != 5; ++i)
+        hystart_ack(&cc, &rtt, MSS, cc.state.cubic.hystart.window_end);
+    ok(cc.ssthresh == cc.cwnd);
+}
+
+/**
+ * Emulates a path with a fixed bottleneck; all packets sent in a round are acknowledged together at the end of the round. Returns
+ * the number of bytes delivered.
+ */
+static uint32_t bbr_round(quicly_cc_t *cc, quicly_rtt_t *rtt, uint64_t *delivered, int64_t *now, uint32_t path_bdp)
+{
+    uint32_t bytes = cc->cwnd < path_bdp ? cc->cwnd : path_bdp;
+    quicly_rate_sample_t rs = {*delivered, bytes, rtt->latest, rtt->latest};
+
+    *now += rtt->latest;
+    *delivered += bytes;
+    quicly_cc_on_acked(cc, rtt, bytes, 0, bytes, 0, *now, &rs);
+    return bytes;
+}
+
+static void test_bbr(void)
+{
+    quicly_cc_t cc;
+    quicly_rtt_t rtt = {20, 20, 0, 20};
+    uint64_t delivered = 0, bw = 1250000; /* 10Mbps */
+    uint32_t path_bdp = (uint32_t)(bw * 20 / 1000), inflight_hi;
+    int64_t now = 0;
+    size_t i;
+
+    quicly_cc_init(&cc, &quicly_cc_bbr, now);
+    ok(cc.cwnd == QUICLY_INITIAL_WINDOW * MSS);
+    ok(cc.state.bbr.mode == QUICLY_BBR_STATE_STARTUP);
+
+    /* pacing rate is derived from the initial window until a sample is taken */
+    quicly_cc_on_acked(&cc, &rtt, MSS, 0, MSS, 1, now, &no_rate_sample);
+    ok(cc.pacing_rate != 0);
+
+    /* STARTUP ends once the bandwidth stops growing, and the controller settles in PROBE_BW */
+    for (i = 0; i != 20; ++i)
+        bbr_round(&cc, &rtt, &delivered, &now, path_bdp);
+    ok(cc.state.bbr.full_bw_reached);
+    ok(cc.state.bbr.mode == QUICLY_BBR_STATE_PROBE_BW);
+    ok(cc.state.bbr.min_rtt == 20);
+    ok(cc.cwnd >= path_bdp);
+    ok(cc.cwnd <= 2 * path_bdp + 3 * MSS);
+    ok(cc.pacing_rate >= bw * 3 / 4 * 0.99);
+    ok(cc.pacing_rate <= bw * 5 / 4);
+
+    /* excessive loss lowers the upper bound of inflight */
+    quicly_cc_on_lost(&cc, &rtt, path_bdp / 10, 0, 0, now);
+    bbr_round(&cc, &rtt, &delivered, &now, path_bdp);
+    inflight_hi = cc.state.bbr.inflight_hi;
+    ok(inflight_hi != UINT32_MAX);
+    ok(cc.cwnd <= inflight_hi);
+
+    /* PROBE_RTT is entered when min_rtt is not refreshed, and the controller returns to PROBE_BW afterwards */
+    rtt.latest = 25;
+    for (i = 0; i != 250 && cc.state.bbr.mode != QUICLY_BBR_STATE_PROBE_RTT; ++i)
+        bbr_round(&cc, &rtt, &delivered, &now, path_bdp);
+    ok(cc.state.bbr.mode == QUICLY_BBR_STATE_PROBE_RTT);
+    ok(cc.cwnd <= path_bdp);
+    for (i = 0; i != 20 && cc.state.bbr.mode == QUICLY_BBR_STATE_PROBE_RTT; ++i)
+        bbr_round(&cc, &rtt, &delivered, &now, path_bdp);
+    ok(cc.state.bbr.mode == QUICLY_BBR_STATE_PROBE_BW);
+
+    /* persistent congestion restarts the model */
+    quicly_cc_on_persistent_congestion(&cc, &rtt, now);
+    ok(cc.state.bbr.mode == QUICLY_BBR_STATE_STARTUP);
+    ok(cc.cwnd < path_bdp);
+}
+
+static void media_ack(quicly_cc_t *cc, quicly_rtt_t *rtt, uint64_t *pn, int64_t now, uint32_t sample_rtt)
+{
+    uint32_t bytes = 10 * MSS;
+    quicly_rate_sample_t rs = {*pn * MSS, bytes, 10, sample_rtt};
+
+    rtt->latest = sample_rtt;
+    quicly_cc_on_acked(cc, rtt, bytes, *pn + 9, cc->cwnd, *pn + 20, now, &rs);
+    *pn += 10;
+}
+
+static void test_media(void)
+{
+    quicly_cc_t cc;
+    quicly_rtt_t rtt = {20, 20, 0, 20};
+    uint64_t pn = 0, bitrate;
+    int64_t now = 0;
+    uint32_t sample_rtt = 20;
+    size_t i;
+
+    quicly_cc_init(&cc, &quicly_cc_media, now);
+    ok(cc.target_bitrate == QUICLY_MEDIA_CC_START_BITRATE);
+    ok(cc.pacing_rate == QUICLY_MEDIA_CC_START_BITRATE / 8);
+
+    /* stable delay; the target increases, though not beyond what is being delivered */
+    for (i = 0; i != 100; ++i)
+        media_ack(&cc, &rtt, &pn, now += 10, 20);
+    ok(cc.state.media.usage == QUICLY_MEDIA_CC_USAGE_NORMAL);
+    ok(cc.target_bitrate > QUICLY_MEDIA_CC_START_BITRATE);
+    ok(cc.target_bitrate <= cc.state.media.acked_bitrate * 1.5 + 10000);
+    ok(cc.cwnd >= cc.target_bitrate / 8 * 20 / 1000 * 2);
+
+    /* growing delay is detected as overuse, and the target is reduced below the delivery rate */
+    bitrate = cc.target_bitrate;
+    for (i = 0; i != 40 && cc.state.media.usage != QUICLY_MEDIA_CC_USAGE_OVERUSE; ++i)
+        media_ack(&cc, &rtt, &pn, now += 10, sample_rtt += 2);
+    ok(cc.state.media.usage == QUICLY_MEDIA_CC_USAGE_OVERUSE);
+    media_ack(&cc, &rtt, &pn, now += 10, sample_rtt += 2);
+    ok(cc.target_bitrate < bitrate);
+    ok(cc.target_bitrate <= cc.state.media.acked_bitrate * 0.85 + 1);
+
+    /* excessive loss reduces the target */
+    bitrate = cc.target_bitrate;
+    quicly_cc_on_lost(&cc, &rtt, 20 * MSS, pn, pn + 20, now);
+    pn = cc.state.media.loss_round_end;
+    media_ack(&cc, &rtt, &pn, now += 10, sample_rtt);
+    ok(cc.target_bitrate < bitrate);
+
+    /* limits are respected */
+    quicly_cc_set_bitrate_limits(&cc, 2 * QUICLY_MEDIA_CC_START_BITRATE, 0);
+    ok(cc.target_bitrate == 2 * QUICLY_MEDIA_CC_START_BITRATE);
+    quicly_cc_on_persistent_congestion(&cc, &rtt, now);
+    ok(cc.target_bitrate == 2 * QUICLY_MEDIA_CC_START_BITRATE);
+}
+
+static void test_app_limited(void)
+{
+    static const quicly_rate_sample_t app_limited_sample = {0, MSS, 10, 10, 1};
+    quicly_cc_t cc;
+    quicly_rtt_t rtt = {10, 10, 0, 10};
+    uint32_t cwnd;
+    int64_t avoidance_start;
+
+    /* reno does not grow the window while application-limited */
+    quicly_cc_init(&cc, &quicly_cc_reno, 0);
+    cwnd = cc.cwnd;
+    quicly_cc_on_acked(&cc, &rtt, MSS, 0, MSS, 1, 10, &app_limited_sample);
+    ok(cc.cwnd == cwnd);
+    quicly_cc_on_acked(&cc, &rtt, MSS, 1, MSS, 2, 20, &no_rate_sample);
+    ok(cc.cwnd == cwnd + MSS);
+
+    /* neither does cubic, and the application-limited period is excluded from the avoidance epoch */
+    quicly_cc_init(&cc, &quicly_cc_cubic, 0);
+    quicly_cc_on_lost(&cc, &rtt, MSS, 0, 1, 0);
+    quicly_cc_on_acked(&cc, &rtt, MSS, 1, cc.cwnd, 2, 10, &no_rate_sample);
+    cwnd = cc.cwnd;
+    avoidance_start = cc.state.cubic.avoidance_start;
+    quicly_cc_on_acked(&cc, &rtt, MSS, 2, cc.cwnd, 3, 1010, &app_limited_sample);
+    ok(cc.cwnd == cwnd);
+    ok(cc.state.cubic.avoidance_start == avoidance_start + 1000);
+}
+
+static void test_ecn(void)
+{
+    quicly_cc_t cc;
+    quicly_rtt_t rtt = {10, 10, 0, 10};
+    uint32_t cwnd;
+
+    /* classic response; CE is handled like a loss, once per recovery period */
+    quicly_cc_init(&cc, &quicly_cc_reno, 0);
+    cwnd = cc.cwnd;
+    quicly_cc_on_ecn(&cc, &rtt, 0, 10, 1, 9, 20, 10);
+    ok(cc.cwnd == (uint32_t)(cwnd * 0.7));
+    ok(cc.recovery_end == 20);
+    cwnd = cc.cwnd;
+    quicly_cc_on_ecn(&cc, &rtt, 0, 10, 1, 19, 30, 20);
+    ok(cc.cwnd == cwnd);
+
+    /* scalable response; alpha starts at 1 (i.e. halves cwnd), then decays while no marks are observed */
+    quicly_cc_init(&cc, &quicly_cc_reno, 0);
+    cc.cwnd = 100 * MSS;
+    quicly_cc_on_ecn(&cc, &rtt, 1, 10, 1, 0, 10, 10);
+    ok(cc.cwnd == 50 * MSS);
+    ok(cc.ssthresh == 50 * MSS);
+    ok(cc.l4s.alpha < 1);
+    /* only one reduction per round */
+    quicly_cc_on_ecn(&cc, &rtt, 1, 10, 1, 5, 20, 15);
+    ok(cc.cwnd == 50 * MSS);
+    uint64_t pn = 10;
+    int i;
+    for (i = 0; i != 100; ++i) {
+        quicly_cc_on_ecn(&cc, &rtt, 1, 10, 0, pn, pn + 10, 20 + i * 10);
+        pn += 10;
+    }
+    ok(cc.l4s.alpha < 0.01);
+    ok(cc.cwnd == 50 * MSS);
+    /* a single mark now leads to a small reduction */
+    quicly_cc_on_ecn(&cc, &rtt, 1, 10, 1, pn, pn + 10, 2000);
+    ok(cc.cwnd < 50 * MSS);
+    ok(cc.cwnd > 49 * MSS);
+}
+
+void test_cc(void)
+{
+    subtest("reno", test_reno);
+    subtest("cubic", test_cubic);
+    subtest("hystart", test_hystart);
+    subtest("bbr", test_bbr);
+    subtest("media", test_media);
+    subtest("app-limited", test_app_limited);
+    subtest("ecn", test_ecn);
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2017 Fastly, Kazuho Oku
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include "quicly/streambuf.h"
+#include "test.h"
+
+static size_t num_released;
+
+static void on_release(quicly_dgram_listbuf_vec_t *vec)
+{
+    ++num_released;
+}
+
+static int write_tagged(quicly_dgram_t *dgram, uint64_t frame_id, uint8_t priority)
+{
+    quicly_dgram_listbuf_vec_t vec = {INT64_MAX, 1, (void *)"", on_release, NULL, frame_id, priority};
+    return quicly_dgrambuf_egress_write_vec(dgram, &vec);
+}
+
+static uint64_t frame_at(quicly_dgram_t *dgram, size_t index)
+{
+    quicly_dgrambuf_t *dbuf = dgram->data;
+    return dbuf->egress.vecs.entries[index].frame_id;
+}
+
+static void test_untagged(void)
+{
+    quicly_dgram_t dgram = {NULL};
+    size_t i;
+
+    ok(quicly_dgrambuf_create(&dgram, sizeof(quicly_dgrambuf_t)) == 0);
+    for (i = 0; i != 3; ++i)
+        ok(quicly_dgrambuf_egress_write(&dgram, "abc", 3, -1) == 0);
+
+    ok(quicly_dgrambuf_egress_drop(&dgram, 1) == 1);
+    ok(quicly_dgram_num_pending(&dgram) == 2);
+    ok(quicly_dgrambuf_egress_drop(&dgram, 0) == 1);
+    ok(quicly_dgram_num_pending(&dgram) == 1);
+
+    quicly_dgrambuf_destroy(&dgram);
+}
+
+static void test_dependencies(void)
+{
+    quicly_dgram_t dgram = {NULL};
+    quicly_dgrambuf_t *dbuf;
+
+    num_released = 0;
+    ok(quicly_dgrambuf_create(&dgram, sizeof(quicly_dgrambuf_t)) == 0);
+    dbuf = dgram.data;
+
+    /* key frame, two delta frames with a disposable one in between, an untagged datagram and another key frame */
+    write_tagged(&dgram, 1, QUICLY_DGRAM_PRIORITY_KEY);
+    write_tagged(&dgram, 1, QUICLY_DGRAM_PRIORITY_KEY);
+    write_tagged(&dgram, 2, QUICLY_DGRAM_PRIORITY_DISPOSABLE);
+    write_tagged(&dgram, 2, QUICLY_DGRAM_PRIORITY_REFERENCE);
+    write_tagged(&dgram, 3, QUICLY_DGRAM_PRIORITY_DISPOSABLE);
+    write_tagged(&dgram, 4, QUICLY_DGRAM_PRIORITY_REFERENCE);
+    write_tagged(&dgram, 0, QUICLY_DGRAM_PRIORITY_DISPOSABLE);
+    write_tagged(&dgram, 5, QUICLY_DGRAM_PRIORITY_KEY);
+    ok(quicly_dgram_num_pending(&dgram) == 8);
+
+    /* dropping a disposable frame leaves the others intact */
+    ok(quicly_dgrambuf_egress_drop(&dgram, 4) == 1);
+    ok(quicly_dgram_num_pending(&dgram) == 7);
+    ok(!dbuf->drop.until_key);
+
+    /* dropping part of a referenced frame drops the whole frame and the tagged datagrams up to the next key frame */
+    ok(quicly_dgrambuf_egress_drop(&dgram, 2) == 3);
+    ok(num_released == 4);
+    ok(quicly_dgram_num_pending(&dgram) == 4);
+    ok(frame_at(&dgram, 0) == 1);
+    ok(frame_at(&dgram, 1) == 1);
+    ok(frame_at(&dgram, 2) == 0);
+    ok(frame_at(&dgram, 3) == 5);
+    ok(!dbuf->drop.until_key);
+
+    /* the remainder of a dropped frame is discarded upon write */
+    ok(write_tagged(&dgram, 2, QUICLY_DGRAM_PRIORITY_REFERENCE) == 0);
+    ok(dbuf->drop.num_discarded == 1);
+    ok(quicly_dgram_num_pending(&dgram) == 4);
+
+    /* drop the last key frame; delta frames are discarded until a new key frame arrives */
+    ok(quicly_dgrambuf_egress_drop(&dgram, 3) == 1);
+    ok(dbuf->drop.until_key);
+    ok(write_tagged(&dgram, 6, QUICLY_DGRAM_PRIORITY_REFERENCE) == 0);
+    ok(write_tagged(&dgram, 0, QUICLY_DGRAM_PRIORITY_DISPOSABLE) == 0);
+    ok(dbuf->drop.num_discarded == 2);
+    ok(quicly_dgram_num_pending(&dgram) == 4);
+    ok(write_tagged(&dgram, 7, QUICLY_DGRAM_PRIORITY_KEY) == 0);
+    ok(write_tagged(&dgram, 8, QUICLY_DGRAM_PRIORITY_REFERENCE) == 0);
+    ok(!dbuf->drop.until_key);
+    ok(quicly_dgram_num_pending(&dgram) == 6);
+
+    quicly_dgrambuf_destroy(&dgram);
+    ok(num_released == 13);
+}
+
+void test_dgrambuf(void)
+{
+    subtest("untagged", test_untagged);
+    subtest("dependencies", test_dependencies);
+}
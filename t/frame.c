@@ -132,7 +132,7 @@ static void test_ack_encode(void)
     quicly_ranges_add(&ranges, 0x12, 0x14);
 
     /* encode */
-    end = quicly_encode_ack_frame(buf, buf + sizeof(buf), &ranges, 63, 1576235913695);
+    end = quicly_encode_ack_frame(buf, buf + sizeof(buf), &ranges, 63, 1576235913695, NULL);
     ok(end - buf == 5);
     /* decode */
     src = buf + 1;
@@ -147,7 +147,7 @@ static void test_ack_encode(void)
     quicly_ranges_add(&ranges, 0x10, 0x11);
 
     /* encode */
-    end = quicly_encode_ack_frame(buf, buf + sizeof(buf), &ranges, 63, 1576235913695);
+    end = quicly_encode_ack_frame(buf, buf + sizeof(buf), &ranges, 63, 1576235913695, NULL);
     ok(end - buf == 7);
     /* decode */
     src = buf + 1;
@@ -161,6 +161,21 @@ static void test_ack_encode(void)
     ok(decoded.gaps[0] == 1);
     ok(decoded.ack_block_lengths[1] == 1);
 
+    /* encode with ECN counts */
+    static const uint64_t ecn_counts[3] = {10, 0, 300};
+    end = quicly_encode_ack_frame(buf, buf + sizeof(buf), &ranges, 63, 1576235913695, ecn_counts);
+    ok(end != NULL);
+    ok(buf[0] == QUICLY_FRAME_TYPE_ACK_ECN);
+    /* decode */
+    src = buf + 1;
+    ok(quicly_decode_ack_frame(&src, end, &decoded, 1) == 0);
+    ok(src == end);
+    ok(decoded.num_gaps == 1);
+    ok(decoded.largest_acknowledged == 0x13);
+    ok(decoded.ecn_counts[0] == 10);
+    ok(decoded.ecn_counts[1] == 0);
+    ok(decoded.ecn_counts[2] == 300);
+
     quicly_ranges_clear(&ranges);
 }
 
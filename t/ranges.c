@@ -19,6 +19,9 @@
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
  * IN THE SOFTWARE.
  */
+#include <assert.h>
+#include <string.h>
+#include <time.h>
 #include "quicly/ranges.h"
 #include "test.h"
 
@@ -201,8 +204,217 @@ static void test_subtract(void)
     CHECK({100, 117});
 }
 
+static void test_add_bounded(void)
+{
+    quicly_ranges_t ranges;
+    int ret;
+
+    quicly_ranges_init(&ranges);
+
+    ret = quicly_ranges_add_bounded(&ranges, 0, 10, 3);
+    ok(ret == 0);
+    ret = quicly_ranges_add_bounded(&ranges, 20, 30, 3);
+    ok(ret == 0);
+    ret = quicly_ranges_add_bounded(&ranges, 40, 50, 3);
+    ok(ret == 0);
+    CHECK({0, 10}, {20, 30}, {40, 50});
+
+    /* the oldest range is evicted */
+    ret = quicly_ranges_add_bounded(&ranges, 60, 70, 3);
+    ok(ret == 0);
+    CHECK({20, 30}, {40, 50}, {60, 70});
+
+    /* merging does not evict */
+    ret = quicly_ranges_add_bounded(&ranges, 50, 60, 3);
+    ok(ret == 0);
+    CHECK({20, 30}, {40, 70});
+
+    /* adding a range below the lowest one evicts the new range itself */
+    ret = quicly_ranges_add_bounded(&ranges, 80, 90, 3);
+    ok(ret == 0);
+    ret = quicly_ranges_add_bounded(&ranges, 0, 10, 3);
+    ok(ret == 0);
+    CHECK({20, 30}, {40, 70}, {80, 90});
+
+    quicly_ranges_clear(&ranges);
+}
+
+#define BITMAP_SIZE 1024
+
+static int ranges_match_bitmap(quicly_ranges_t *ranges, const uint8_t *bitmap)
+{
+    size_t slot = 0;
+    uint64_t i = 0;
+
+    while (1) {
+        for (; i != BITMAP_SIZE && !bitmap[i]; ++i)
+            ;
+        if (i == BITMAP_SIZE)
+            break;
+        if (slot == ranges->num_ranges || ranges->ranges[slot].start != i)
+            return 0;
+        for (; i != BITMAP_SIZE && bitmap[i]; ++i)
+            ;
+        if (ranges->ranges[slot].end != i)
+            return 0;
+        ++slot;
+    }
+
+    return slot == ranges->num_ranges;
+}
+
+static void test_random(void)
+{
+    quicly_ranges_t ranges;
+    uint8_t bitmap[BITMAP_SIZE];
+    size_t i, j;
+    int all_ok = 1;
+
+    quicly_ranges_init(&ranges);
+    memset(bitmap, 0, sizeof(bitmap));
+
+    for (i = 0; i != 100000; ++i) {
+        uint64_t start = rand() % BITMAP_SIZE, end = start + rand() % 8 + 1;
+        if (end > BITMAP_SIZE)
+            end = BITMAP_SIZE;
+        if (rand() % 3 != 0) {
+            if (quicly_ranges_add(&ranges, start, end) != 0)
+                all_ok = 0;
+            for (j = start; j != end; ++j)
+                bitmap[j] = 1;
+        } else {
+            if (quicly_ranges_subtract(&ranges, start, end) != 0)
+                all_ok = 0;
+            for (j = start; j != end; ++j)
+                bitmap[j] = 0;
+        }
+        if (!ranges_match_bitmap(&ranges, bitmap)) {
+            all_ok = 0;
+            break;
+        }
+    }
+    ok(all_ok);
+
+    quicly_ranges_clear(&ranges);
+}
+
+#define BENCH_MAX_RANGES 1024
+
+/**
+ * the linear-scan implementation of quicly_ranges_add that lib/ranges.c used to employ, retained as a baseline for the benchmark
+ */
+static void linear_add(quicly_range_t *ranges, size_t *num_ranges, uint64_t start, uint64_t end)
+{
+    size_t slot, end_slot;
+
+    if (*num_ranges == 0 || ranges[*num_ranges - 1].end < start) {
+        slot = *num_ranges;
+        goto Insert;
+    }
+    for (slot = *num_ranges - 1;; --slot) {
+        if (ranges[slot].start <= end)
+            break;
+        if (slot == 0)
+            goto Insert;
+    }
+    end_slot = slot;
+    do {
+        if (ranges[slot].end == start) {
+            goto Merge;
+        } else if (ranges[slot].end < start) {
+            if (slot++ == end_slot)
+                goto Insert;
+            goto Merge;
+        }
+    } while (slot-- != 0);
+    slot = 0;
+
+Merge:
+    if (start < ranges[slot].start)
+        ranges[slot].start = start;
+    ranges[slot].end = end < ranges[end_slot].end ? ranges[end_slot].end : end;
+    if (slot != end_slot) {
+        memmove(ranges + slot + 1, ranges + end_slot + 1, sizeof(*ranges) * (*num_ranges - end_slot - 1));
+        *num_ranges -= end_slot - slot;
+    }
+    return;
+
+Insert:
+    assert(*num_ranges < BENCH_MAX_RANGES);
+    memmove(ranges + slot + 1, ranges + slot, sizeof(*ranges) * (*num_ranges - slot));
+    ranges[slot] = (quicly_range_t){start, end};
+    ++*num_ranges;
+}
+
+/**
+ * emulates the ack_queue under heavy loss; every other packet number is received first, then the gaps are filled in random order
+ */
+static void bench_shuffle_gaps(uint64_t *order, size_t num_gaps)
+{
+    size_t i;
+
+    for (i = 0; i != num_gaps; ++i)
+        order[i] = i * 2 + 1;
+    for (i = num_gaps - 1; i != 0; --i) {
+        size_t j = rand() % (i + 1);
+        uint64_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+static void test_benchmark(void)
+{
+    static quicly_range_t linear[BENCH_MAX_RANGES];
+    static uint64_t order[BENCH_MAX_RANGES - 1];
+    size_t num_gaps, round, i, num_linear;
+    int matches = 1;
+
+    for (num_gaps = 16; num_gaps < BENCH_MAX_RANGES; num_gaps *= 4) {
+        quicly_ranges_t ranges;
+        clock_t clocks[2][2] = {{0}}, t;
+        for (round = 0; round != 64; ++round) {
+            num_linear = 0;
+            quicly_ranges_init(&ranges);
+            for (i = 0; i <= num_gaps; ++i) {
+                linear_add(linear, &num_linear, i * 2, i * 2 + 1);
+                quicly_ranges_add(&ranges, i * 2, i * 2 + 1);
+            }
+            /* duplicates landing in the middle of the ack_queue (i.e. pure lookups) */
+            t = clock();
+            for (i = 0; i != 4096; ++i)
+                linear_add(linear, &num_linear, i % num_gaps * 2, i % num_gaps * 2 + 1);
+            clocks[0][0] += clock() - t;
+            t = clock();
+            for (i = 0; i != 4096; ++i)
+                quicly_ranges_add(&ranges, i % num_gaps * 2, i % num_gaps * 2 + 1);
+            clocks[1][0] += clock() - t;
+            /* late arrivals filling the gaps */
+            bench_shuffle_gaps(order, num_gaps);
+            t = clock();
+            for (i = 0; i != num_gaps; ++i)
+                linear_add(linear, &num_linear, order[i], order[i] + 1);
+            clocks[0][1] += clock() - t;
+            t = clock();
+            for (i = 0; i != num_gaps; ++i)
+                quicly_ranges_add(&ranges, order[i], order[i] + 1);
+            clocks[1][1] += clock() - t;
+            if (!(num_linear == ranges.num_ranges && memcmp(linear, ranges.ranges, sizeof(*linear) * num_linear) == 0))
+                matches = 0;
+            quicly_ranges_clear(&ranges);
+        }
+        note("%zu gaps: duplicates: linear %.3f ms, binary search %.3f ms; fill: linear %.3f ms, binary search %.3f ms", num_gaps,
+             clocks[0][0] * 1000.0 / CLOCKS_PER_SEC, clocks[1][0] * 1000.0 / CLOCKS_PER_SEC,
+             clocks[0][1] * 1000.0 / CLOCKS_PER_SEC, clocks[1][1] * 1000.0 / CLOCKS_PER_SEC);
+    }
+    ok(matches);
+}
+
 void test_ranges(void)
 {
     subtest("add", test_add);
     subtest("subtract", test_subtract);
+    subtest("add-bounded", test_add_bounded);
+    subtest("random", test_random);
+    subtest("benchmark", test_benchmark);
 }
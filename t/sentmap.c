@@ -44,7 +44,7 @@ static size_t num_blocks(quicly_sentmap_t *map)
     return n;
 }
 
-void test_sentmap(void)
+static void test_basic(void)
 {
     quicly_sentmap_t map;
     uint64_t at;
@@ -77,7 +77,7 @@ void test_sentmap(void)
         }
     }
     ok(quicly_sentmap_get(&iter)->packet_number == UINT64_MAX);
-    ok(num_blocks(&map) == 150 / 16 + 1);
+    ok(num_blocks(&map) == 200 / 16 + 1);
 
     /* pop acks between 11 <= packet_number <= 40 */
     quicly_sentmap_init_iter(&map, &iter);
@@ -97,7 +97,69 @@ void test_sentmap(void)
         ++cnt;
     }
     ok(cnt == 20);
-    ok(num_blocks(&map) == 30 / 16 + 1 + 1 + 30 / 16 + 1);
+    ok(num_blocks(&map) == 40 / 16 + 1 + 40 / 16 + 1);
+
+    quicly_sentmap_dispose(&map);
+}
+
+static void ack_packet(quicly_sentmap_t *map, uint64_t pn, int64_t now, quicly_rate_sample_t *rs)
+{
+    quicly_sentmap_iter_t iter;
+
+    quicly_sentmap_init_iter(map, &iter);
+    while (quicly_sentmap_get(&iter)->packet_number != pn)
+        quicly_sentmap_skip(&iter);
+    quicly_sentmap_on_delivered(map, &iter, now, rs);
+    quicly_sentmap_update(map, &iter, QUICLY_SENTMAP_EVENT_ACKED, NULL);
+}
+
+static void test_rate_sample(void)
+{
+    quicly_sentmap_t map;
+    quicly_rate_sample_t rs;
+
+    quicly_sentmap_init(&map);
+
+    /* two packets sent back-to-back and acked together */
+    quicly_sentmap_prepare(&map, 1, 0, 0);
+    quicly_sentmap_commit(&map, 100);
+    quicly_sentmap_prepare(&map, 2, 0, 0);
+    quicly_sentmap_commit(&map, 100);
+    quicly_sentmap_init_rate_sample(&rs);
+    ack_packet(&map, 1, 10, &rs);
+    ack_packet(&map, 2, 10, &rs);
+    quicly_sentmap_finalize_rate_sample(&map, &rs);
+    ok(rs.prior_delivered == 0);
+    ok(rs.delivered == 200);
+    ok(rs.interval == 10);
+    ok(rs.rtt == 10);
+    ok(quicly_rate_sample_get_rate(&rs) == 20000);
+    ok(!rs.is_app_limited);
+
+    /* packets sent during an application-limited period are marked, until the period ends */
+    quicly_sentmap_on_app_limited(&map);
+    ok(map.rate.app_limited == 200);
+    quicly_sentmap_prepare(&map, 3, 20, 0);
+    quicly_sentmap_commit(&map, 100);
+    quicly_sentmap_init_rate_sample(&rs);
+    ack_packet(&map, 3, 30, &rs);
+    quicly_sentmap_finalize_rate_sample(&map, &rs);
+    ok(rs.is_app_limited);
+    ok(rs.delivered == 100);
+    ok(map.rate.app_limited == 0);
+
+    quicly_sentmap_prepare(&map, 4, 40, 0);
+    quicly_sentmap_commit(&map, 100);
+    quicly_sentmap_init_rate_sample(&rs);
+    ack_packet(&map, 4, 50, &rs);
+    quicly_sentmap_finalize_rate_sample(&map, &rs);
+    ok(!rs.is_app_limited);
 
     quicly_sentmap_dispose(&map);
 }
+
+void test_sentmap(void)
+{
+    subtest("basic", test_basic);
+    subtest("rate-sample", test_rate_sample);
+}
@@ -394,6 +394,208 @@ static void test_rst_during_loss(void)
 
 static uint16_t test_close_error_code;
 
+static void test_send_rate(void)
+{
+    static char data[32768];
+    quicly_stream_t *client_stream, *server_stream;
+    test_streambuf_t *client_streambuf, *server_streambuf;
+    quicly_datagram_t *packets[32];
+    quicly_decoded_packet_t decoded[32];
+    size_t num_packets, num_decoded, bytes_sent = 0, i, j;
+    int ret;
+
+    ret = quicly_open_stream(client, &client_stream, 0);
+    ok(ret == 0);
+    client_streambuf = client_stream->data;
+    quicly_streambuf_egress_write(client_stream, data, sizeof(data));
+    quicly_streambuf_egress_shutdown(client_stream);
+
+    /* 1.28Mbps (i.e. 160 bytes per millisecond), allowing a burst of 2 packets */
+    quicly_set_send_rate(client, 1280000, 2 * QUICLY_MAX_PACKET_SIZE);
+
+    for (i = 0; i != 100; ++i) {
+        num_packets = sizeof(packets) / sizeof(packets[0]);
+        ret = quicly_send(client, packets, &num_packets);
+        ok(ret == 0);
+        for (j = 0; j != num_packets; ++j)
+            bytes_sent += packets[j]->data.len;
+        num_decoded = decode_packets(decoded, packets, num_packets);
+        for (j = 0; j != num_decoded; ++j)
+            quicly_receive(server, NULL, &fake_address.sa, decoded + j);
+        free_packets(packets, num_packets);
+        /* the initial burst is bounded by the size of the bucket */
+        if (i == 0)
+            ok(bytes_sent <= 3 * QUICLY_MAX_PACKET_SIZE);
+        transmit(server, client);
+        ++quic_now;
+    }
+    ok(bytes_sent >= 100 * 160 - QUICLY_MAX_PACKET_SIZE);
+    ok(bytes_sent <= 100 * 160 + 3 * QUICLY_MAX_PACKET_SIZE);
+
+    /* cwnd is in control once again */
+    quicly_set_send_rate(client, 0, 0);
+    server_stream = quicly_get_stream(server, client_stream->stream_id);
+    assert(server_stream != NULL);
+    server_streambuf = server_stream->data;
+    for (i = 0; i != 100 && !quicly_recvstate_transfer_complete(&server_stream->recvstate); ++i) {
+        transmit(client, server);
+        quic_now += QUICLY_DELAYED_ACK_TIMEOUT;
+        transmit(server, client);
+    }
+    ok(quicly_recvstate_transfer_complete(&server_stream->recvstate));
+    ok(server_streambuf->super.ingress.off == sizeof(data));
+    quicly_streambuf_ingress_shift(server_stream, sizeof(data));
+    quicly_streambuf_egress_shutdown(server_stream);
+
+    transmit(server, client);
+    ok(client_streambuf->is_detached);
+
+    quic_now += QUICLY_DELAYED_ACK_TIMEOUT;
+    transmit(client, server);
+    ok(server_streambuf->is_detached);
+}
+
+static size_t transmit_from(quicly_conn_t *src, quicly_conn_t *dst, quicly_address_t *src_addr, int drop)
+{
+    quicly_datagram_t *packets[32];
+    quicly_decoded_packet_t decoded[32];
+    size_t num_packets, num_decoded, i;
+    int ret;
+
+    num_packets = sizeof(packets) / sizeof(packets[0]);
+    ret = quicly_send(src, packets, &num_packets);
+    ok(ret == 0);
+    if (num_packets != 0) {
+        if (!drop) {
+            num_decoded = decode_packets(decoded, packets, num_packets);
+            for (i = 0; i != num_decoded; ++i)
+                quicly_receive(dst, NULL, &src_addr->sa, decoded + i);
+        }
+        free_packets(packets, num_packets);
+    }
+    return num_packets;
+}
+
+static void test_migration(void)
+{
+    static char data[1024], large[16384];
+    quicly_address_t new_address = fake_address;
+    quicly_stream_t *client_stream, *server_stream;
+    quicly_stats_t orig_stats, stats;
+    uint64_t received, sent;
+    size_t i;
+    int ret;
+
+    /* NAT rebinding; the client appears from a different port */
+    new_address.sin.sin_port = htons(4433);
+
+    ret = quicly_open_stream(client, &client_stream, 0);
+    ok(ret == 0);
+    quicly_streambuf_egress_write(client_stream, data, sizeof(data));
+    quicly_streambuf_egress_shutdown(client_stream);
+
+    /* the server follows the new address, but falls back if the address cannot be validated */
+    ok(transmit_from(client, server, &new_address, 0) != 0);
+    ok(quicly_get_peername(server)->sa_family == AF_INET);
+    ok(((struct sockaddr_in *)quicly_get_peername(server))->sin_port == htons(4433));
+    quicly_get_stats(server, &stats);
+    ok(stats.num_migrations == 1);
+    for (i = 0; i != 20; ++i) {
+        transmit_from(server, client, &fake_address, 1);
+        quic_now += 500;
+    }
+    ok(((struct sockaddr_in *)quicly_get_peername(server))->sin_port == fake_address.sin.sin_port);
+
+    /* the new address is retained once the client responds to PATH_CHALLENGE */
+    for (i = 0; i != 5; ++i) {
+        transmit_from(client, server, &new_address, 0);
+        transmit_from(server, client, &fake_address, 0);
+        quic_now += QUICLY_DELAYED_ACK_TIMEOUT;
+    }
+    quicly_get_stats(server, &stats);
+    ok(stats.num_migrations == 2);
+    for (i = 0; i != 20; ++i) {
+        transmit_from(client, server, &new_address, 0);
+        transmit_from(server, client, &fake_address, 0);
+        quic_now += 500;
+    }
+    ok(((struct sockaddr_in *)quicly_get_peername(server))->sin_port == htons(4433));
+    quicly_get_stats(server, &stats);
+    ok(stats.num_migrations == 2);
+
+    /* move back to the original address */
+    for (i = 0; i != 5; ++i) {
+        transmit(client, server);
+        transmit(server, client);
+        quic_now += QUICLY_DELAYED_ACK_TIMEOUT;
+    }
+    ok(((struct sockaddr_in *)quicly_get_peername(server))->sin_port == fake_address.sin.sin_port);
+
+    /* a probing packet from a new address does not move the connection; let the client ack everything first, so that the packet
+     * carries nothing but PATH_CHALLENGE */
+    new_address = fake_address;
+    new_address.sin.sin_port = htons(4434);
+    quic_now += QUICLY_DELAYED_ACK_TIMEOUT;
+    transmit(client, server);
+    quicly_get_stats(server, &orig_stats);
+    ok(schedule_probe(client) == 0);
+    ok(transmit_from(client, server, &new_address, 0) == 1);
+    quicly_get_stats(server, &stats);
+    ok(stats.num_packets.received == orig_stats.num_packets.received + 1);
+    ok(stats.num_migrations == orig_stats.num_migrations);
+    ok(((struct sockaddr_in *)quicly_get_peername(server))->sin_port == fake_address.sin.sin_port);
+    for (i = 0; i != 5; ++i) {
+        transmit(server, client);
+        transmit(client, server);
+        quic_now += QUICLY_DELAYED_ACK_TIMEOUT;
+    }
+
+    /* IP address change; the server starts over with the initial cwnd and RTT, and does not send more than 3x the bytes received
+     * from the new address until it is validated */
+    new_address = fake_address;
+    new_address.sin.sin_addr.s_addr = htonl(0x7f000002);
+    quicly_get_stats(server, &orig_stats);
+    ret = quicly_open_stream(server, &server_stream, 0);
+    ok(ret == 0);
+    quicly_streambuf_egress_write(server_stream, large, sizeof(large));
+    ret = quicly_open_stream(client, &client_stream, 0);
+    ok(ret == 0);
+    quicly_streambuf_egress_write(client_stream, data, sizeof(data));
+    ok(transmit_from(client, server, &new_address, 0) != 0);
+    ok(((struct sockaddr_in *)quicly_get_peername(server))->sin_addr.s_addr == new_address.sin.sin_addr.s_addr);
+    quicly_get_stats(server, &stats);
+    ok(stats.num_migrations == orig_stats.num_migrations + 1);
+    ok(stats.rtt.minimum == UINT32_MAX);
+    received = stats.num_bytes.received - orig_stats.num_bytes.received;
+    ok(transmit_from(server, client, &fake_address, 1) != 0);
+    ok(transmit_from(server, client, &fake_address, 1) == 0);
+    quicly_get_stats(server, &stats);
+    sent = stats.num_bytes.sent - orig_stats.num_bytes.sent;
+    /* the window is checked before building each packet, therefore the last one might cross the limit */
+    ok(sent <= received * 3 + quic_ctx.max_packet_size);
+    ok(sent < sizeof(large));
+
+    /* the new address does not respond; the server falls back to the validated address along with its cwnd and RTT */
+    for (i = 0; i != 40; ++i) {
+        transmit_from(server, client, &fake_address, 1);
+        if (((struct sockaddr_in *)quicly_get_peername(server))->sin_addr.s_addr == fake_address.sin.sin_addr.s_addr)
+            break;
+        quic_now += 500;
+    }
+    ok(((struct sockaddr_in *)quicly_get_peername(server))->sin_addr.s_addr == fake_address.sin.sin_addr.s_addr);
+    quicly_get_stats(server, &stats);
+    ok(stats.cc.cwnd == orig_stats.cc.cwnd);
+    ok(stats.rtt.minimum == orig_stats.rtt.minimum);
+    ok(stats.rtt.smoothed == orig_stats.rtt.smoothed);
+
+    /* let the connection recover on the original address */
+    for (i = 0; i != 20; ++i) {
+        transmit(client, server);
+        transmit(server, client);
+        quic_now += QUICLY_DELAYED_ACK_TIMEOUT;
+    }
+}
+
 static void test_closeed_by_peer(quicly_closed_by_peer_t *self, quicly_conn_t *conn, int err, uint64_t frame_type,
                                  const char *reason, size_t reason_len)
 {
@@ -534,6 +736,8 @@ void test_simple(void)
     subtest("reset-after-close", test_reset_after_close);
     subtest("tiny-stream-window", tiny_stream_window);
     subtest("rst-during-loss", test_rst_during_loss);
+    subtest("send-rate", test_send_rate);
+    subtest("migration", test_migration);
     subtest("close", test_close);
     subtest("tiny-connection-window", tiny_connection_window);
 }
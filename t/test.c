@@ -309,6 +309,15 @@ int max_data_is_equal(quicly_conn_t *client, quicly_conn_t *server)
     return 1;
 }
 
+/**
+ * Schedules a PATH_CHALLENGE, so that the next packet being sent is a probing one unless there is something else to be sent
+ */
+int schedule_probe(quicly_conn_t *conn)
+{
+    static const uint8_t data[QUICLY_PATH_CHALLENGE_DATA_LEN] = {0};
+    return schedule_path_challenge(conn, 0, data);
+}
+
 static void test_next_packet_number(void)
 {
     /* prefer lower in case the distance in both directions are equal; see https://github.com/quicwg/base-drafts/issues/674 */
@@ -361,6 +370,26 @@ static void test_address_token_codec(void)
     ptls_aead_free(dec);
 }
 
+static void test_transport_parameters_codec(void)
+{
+    quicly_transport_parameters_t input = quic_ctx.transport_params, output;
+    ptls_buffer_t buf;
+
+    /* parameters remembered for 0-RTT include the maximum DATAGRAM frame size */
+    input.max_datagram_frame_size = 1200;
+    ptls_buffer_init(&buf, "", 0);
+
+    ok(quicly_encode_transport_parameter_list(&buf, 1, &input, NULL, NULL, 0) == 0);
+    ok(quicly_decode_transport_parameter_list(&output, NULL, NULL, 1, buf.base, buf.base + buf.off) == 0);
+
+    ok(output.max_data == input.max_data);
+    ok(output.max_stream_data.bidi_local == input.max_stream_data.bidi_local);
+    ok(output.max_streams_bidi == input.max_streams_bidi);
+    ok(output.max_datagram_frame_size == 1200);
+
+    ptls_buffer_dispose(&buf);
+}
+
 int main(int argc, char **argv)
 {
     static ptls_iovec_t cert;
@@ -418,10 +447,13 @@ int main(int argc, char **argv)
 
     subtest("next-packet-number", test_next_packet_number);
     subtest("address-token-codec", test_address_token_codec);
+    subtest("transport-parameters-codec", test_transport_parameters_codec);
     subtest("ranges", test_ranges);
+    subtest("cc", test_cc);
     subtest("frame", test_frame);
     subtest("maxsender", test_maxsender);
     subtest("sentmap", test_sentmap);
+    subtest("dgrambuf", test_dgrambuf);
     // subtest("test-vector", test_vector);
     subtest("simple", test_simple);
     subtest("stream-concurrency", test_stream_concurrency);
@@ -48,8 +48,11 @@ size_t decode_packets(quicly_decoded_packet_t *decoded, quicly_datagram_t **raw,
 int buffer_is(ptls_buffer_t *buf, const char *s);
 size_t transmit(quicly_conn_t *src, quicly_conn_t *dst);
 int max_data_is_equal(quicly_conn_t *client, quicly_conn_t *server);
+int schedule_probe(quicly_conn_t *conn);
 
 void test_ranges(void);
+void test_cc(void);
+void test_dgrambuf(void);
 void test_frame(void);
 void test_maxsender(void);
 void test_sentmap(void);